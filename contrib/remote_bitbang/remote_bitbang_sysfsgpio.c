@@ -291,6 +291,90 @@ static void cleanup_all_fds(void)
 	cleanup_fd(srst_fd, srst_gpio);
 }
 
+/*
+ * Binary (v2) protocol helpers. Counts are 32 bit little endian, bit vectors
+ * are packed LSB first.
+ */
+static int read_u32(unsigned *value)
+{
+	*value = 0;
+	for (int i = 0; i < 4; i++) {
+		int c = getchar();
+		if (c == EOF)
+			return ERROR_FAIL;
+		*value |= (unsigned)c << (8 * i);
+	}
+	return ERROR_OK;
+}
+
+/* One TCK cycle, returns the sampled TDO as 0 or 1 */
+static int clock_bit(int tms, int tdi)
+{
+	sysfsgpio_write(0, tms, tdi);
+	int tdo = sysfsgpio_read() == '1';
+	sysfsgpio_write(1, tms, tdi);
+	return tdo;
+}
+
+static int process_scan(void)
+{
+	int flags = getchar();
+	unsigned num_bits;
+	if (flags == EOF || read_u32(&num_bits) != ERROR_OK)
+		return ERROR_FAIL;
+
+	int tdi_byte = 0, tdo_byte = 0;
+	for (unsigned i = 0; i < num_bits; i++) {
+		if (!(flags & 0x04) && i % 8 == 0) {
+			tdi_byte = getchar();
+			if (tdi_byte == EOF)
+				return ERROR_FAIL;
+		}
+		int tms = (flags & 0x02) && i == num_bits - 1;
+		int tdo = clock_bit(tms, (tdi_byte >> (i % 8)) & 1);
+		tdo_byte |= tdo << (i % 8);
+		if ((flags & 0x01) && (i % 8 == 7 || i == num_bits - 1)) {
+			putchar(tdo_byte);
+			tdo_byte = 0;
+		}
+	}
+	sysfsgpio_write(0, (flags & 0x02) != 0, 0);
+	return ERROR_OK;
+}
+
+static int process_tms(void)
+{
+	unsigned num_bits;
+	if (read_u32(&num_bits) != ERROR_OK)
+		return ERROR_FAIL;
+
+	int tms_byte = 0, tms = 0;
+	for (unsigned i = 0; i < num_bits; i++) {
+		if (i % 8 == 0) {
+			tms_byte = getchar();
+			if (tms_byte == EOF)
+				return ERROR_FAIL;
+		}
+		tms = (tms_byte >> (i % 8)) & 1;
+		clock_bit(tms, 0);
+	}
+	sysfsgpio_write(0, tms, 0);
+	return ERROR_OK;
+}
+
+static int process_clock(void)
+{
+	int tms = getchar();
+	unsigned num_cycles;
+	if (tms == EOF || read_u32(&num_cycles) != ERROR_OK)
+		return ERROR_FAIL;
+
+	for (unsigned i = 0; i < num_cycles; i++)
+		clock_bit(tms, 0);
+	sysfsgpio_write(0, tms, 0);
+	return ERROR_OK;
+}
+
 static void process_remote_protocol(void)
 {
 	int c;
@@ -298,7 +382,19 @@ static void process_remote_protocol(void)
 		c = getchar();
 		if (c == EOF || c == 'Q') /* Quit */
 			break;
-		else if (c == 'b' || c == 'B') /* Blink */
+		else if (c == 'V') { /* Protocol v2 hello */
+			putchar('V');
+			putchar('2');
+		} else if (c == 'S') { /* v2 scan */
+			if (process_scan() != ERROR_OK)
+				break;
+		} else if (c == 'M') { /* v2 TMS sequence */
+			if (process_tms() != ERROR_OK)
+				break;
+		} else if (c == 'C') { /* v2 constant TMS clocks */
+			if (process_clock() != ERROR_OK)
+				break;
+		} else if (c == 'b' || c == 'B') /* Blink */
 			continue;
 		else if (c >= 'r' && c <= 'r' + 3) { /* Reset */
 			char d = c - 'r';
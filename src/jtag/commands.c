@@ -31,19 +31,30 @@
 #endif
 
 #include <jtag/jtag.h>
+#include <jtag/interface.h>
 #include <transport/transport.h>
 #include "commands.h"
 
+/*
+ * The command queue lives in an arena of pages. Pages are kept across
+ * jtag_command_queue_reset() and simply rewound, so once the arena has grown
+ * to the high-water mark of the queue no further malloc/free is done.
+ */
 struct cmd_queue_page {
 	struct cmd_queue_page *next;
 	void *address;
+	size_t size;
 	size_t used;
 };
 
 #define CMD_QUEUE_PAGE_SIZE (1024 * 1024)
 static struct cmd_queue_page *cmd_queue_pages;
+/* page currently allocated from; pages after it are unused in this queue */
+static struct cmd_queue_page *cmd_queue_pages_cur;
 static struct cmd_queue_page *cmd_queue_pages_tail;
 
+static struct cmd_queue_stats cmd_queue_stats;
+
 struct jtag_command *jtag_command_queue;
 static struct jtag_command **next_command_pointer = &jtag_command_queue;
 
@@ -76,8 +87,7 @@ void jtag_queue_command(struct jtag_command *cmd)
 
 void *cmd_queue_alloc(size_t size)
 {
-	struct cmd_queue_page **p_page = &cmd_queue_pages;
-	int offset;
+	size_t offset;
 	uint8_t *t;
 
 	/*
@@ -112,30 +122,65 @@ void *cmd_queue_alloc(size_t size)
 	size = (size + ALIGN_SIZE - 1) & (~(ALIGN_SIZE - 1));
 	/* Done... */
 
-	if (*p_page) {
-		p_page = &cmd_queue_pages_tail;
-		if (CMD_QUEUE_PAGE_SIZE - (*p_page)->used < size)
-			p_page = &((*p_page)->next);
+	struct cmd_queue_page *page = cmd_queue_pages_cur;
+	while (page && page->size - page->used < size) {
+		page = page->next;
+		if (page)
+			page->used = 0;
 	}
 
-	if (!*p_page) {
-		*p_page = malloc(sizeof(struct cmd_queue_page));
-		(*p_page)->used = 0;
-		size_t alloc_size = (size < CMD_QUEUE_PAGE_SIZE) ?
-					CMD_QUEUE_PAGE_SIZE : size;
-		(*p_page)->address = malloc(alloc_size);
-		(*p_page)->next = NULL;
-		cmd_queue_pages_tail = *p_page;
+	if (!page) {
+		/* None of the many callers can back out of a half built command,
+		 * so running out of memory here is fatal. */
+		page = malloc(sizeof(struct cmd_queue_page));
+		if (page) {
+			page->size = (size < CMD_QUEUE_PAGE_SIZE) ?
+						CMD_QUEUE_PAGE_SIZE : size;
+			page->address = malloc(page->size);
+		}
+		if (!page || !page->address) {
+			LOG_ERROR("Out of memory allocating the JTAG command queue");
+			exit(-1);
+		}
+		page->used = 0;
+		page->next = NULL;
+
+		if (cmd_queue_pages_tail)
+			cmd_queue_pages_tail->next = page;
+		else
+			cmd_queue_pages = page;
+		cmd_queue_pages_tail = page;
+
+		cmd_queue_stats.pages++;
+		cmd_queue_stats.bytes_reserved += page->size;
+		cmd_queue_stats.page_mallocs++;
 	}
+	cmd_queue_pages_cur = page;
+
+	offset = page->used;
+	page->used += size;
 
-	offset = (*p_page)->used;
-	(*p_page)->used += size;
+	cmd_queue_stats.allocs++;
+	cmd_queue_stats.bytes_in_use += size;
+	if (cmd_queue_stats.bytes_in_use > cmd_queue_stats.high_water)
+		cmd_queue_stats.high_water = cmd_queue_stats.bytes_in_use;
 
-	t = (*p_page)->address;
+	t = page->address;
 	return t + offset;
 }
 
-static void cmd_queue_free(void)
+/* Rewind the arena, keeping all of its pages for the next queue. */
+static void cmd_queue_rewind(void)
+{
+	cmd_queue_pages_cur = cmd_queue_pages;
+	if (cmd_queue_pages_cur)
+		cmd_queue_pages_cur->used = 0;
+
+	cmd_queue_stats.bytes_in_use = 0;
+	cmd_queue_stats.resets++;
+}
+
+void cmd_queue_free(void)
 {
 	struct cmd_queue_page *page = cmd_queue_pages;
 
@@ -147,17 +192,210 @@ static void cmd_queue_free(void)
 	}
 
 	cmd_queue_pages = NULL;
+	cmd_queue_pages_cur = NULL;
 	cmd_queue_pages_tail = NULL;
+
+	cmd_queue_stats.pages = 0;
+	cmd_queue_stats.bytes_reserved = 0;
+	cmd_queue_stats.bytes_in_use = 0;
+}
+
+void cmd_queue_get_stats(struct cmd_queue_stats *stats)
+{
+	*stats = cmd_queue_stats;
 }
 
 void jtag_command_queue_reset(void)
 {
-	cmd_queue_free();
+	cmd_queue_rewind();
 
 	jtag_command_queue = NULL;
 	next_command_pointer = &jtag_command_queue;
 }
 
+static struct jtag_queue_optimize_stats jtag_queue_optimize_stats;
+
+/* Append the bits of cmd to those of prev, both being JTAG_TMS commands. */
+static void jtag_fold_tms(struct jtag_command *prev, struct jtag_command *cmd)
+{
+	struct tms_command *a = prev->cmd.tms;
+	struct tms_command *b = cmd->cmd.tms;
+	unsigned num_bits = a->num_bits + b->num_bits;
+	uint8_t *bits = cmd_queue_alloc(DIV_ROUND_UP(num_bits, 8));
+
+	memset(bits, 0, DIV_ROUND_UP(num_bits, 8));
+	buf_set_buf(a->bits, 0, bits, 0, a->num_bits);
+	buf_set_buf(b->bits, 0, bits, a->num_bits, b->num_bits);
+
+	a->bits = bits;
+	a->num_bits = num_bits;
+}
+
+/* Does scan only reload the instructions last_ir already put in the IRs?
+ * A scan that captures anything, including only to verify the IR capture
+ * pattern, is kept, since its check callback reads the captured bits. The
+ * Update-IR of a dropped scan is lost too, which the user must accept by
+ * choosing JTAG_QUEUE_OPTIMIZE_IR. */
+static bool jtag_ir_scan_is_redundant(const struct scan_command *last_ir,
+		const struct scan_command *scan)
+{
+	if (last_ir->num_fields != scan->num_fields)
+		return false;
+
+	for (int i = 0; i < scan->num_fields; i++) {
+		const struct scan_field *a = &last_ir->fields[i];
+		const struct scan_field *b = &scan->fields[i];
+
+		if (b->in_value || !a->out_value || !b->out_value)
+			return false;
+		if (a->num_bits != b->num_bits)
+			return false;
+		if (buf_cmp(a->out_value, b->out_value, b->num_bits))
+			return false;
+	}
+
+	return true;
+}
+
+void jtag_command_queue_optimize(enum jtag_queue_optimize mode)
+{
+	struct jtag_queue_optimize_stats *stats = &jtag_queue_optimize_stats;
+	struct jtag_command **link = &jtag_command_queue;
+	struct jtag_command *prev = NULL;
+	struct scan_command *last_ir = NULL;
+	uint64_t removed = stats->commands_removed;
+	uint64_t saved = stats->clocks_saved;
+
+	if (mode == JTAG_QUEUE_OPTIMIZE_OFF)
+		return;
+
+	/* Follow the TAP state the driver will be in before each command */
+	tap_state_t state = tap_get_state();
+	bool state_known = tap_is_state_stable(state);
+
+	stats->queues++;
+
+	while (*link) {
+		struct jtag_command *cmd = *link;
+		bool drop = false;
+
+		switch (cmd->type) {
+			case JTAG_TMS:
+				if (prev && prev->type == JTAG_TMS) {
+					jtag_fold_tms(prev, cmd);
+					stats->tms_folded++;
+					drop = true;
+				}
+				/* raw TMS leaves the TAP in a state we do not track */
+				state_known = false;
+				last_ir = NULL;
+				break;
+			case JTAG_STABLECLOCKS:
+				if (prev && prev->type == JTAG_STABLECLOCKS) {
+					prev->cmd.stableclocks->num_cycles += cmd->cmd.stableclocks->num_cycles;
+					stats->clocks_folded++;
+					drop = true;
+				}
+				break;
+			case JTAG_RUNTEST:
+			{
+				struct runtest_command *rt = cmd->cmd.runtest;
+				if (state_known && state == TAP_IDLE && rt->num_cycles == 0 &&
+						rt->end_state == TAP_IDLE) {
+					stats->moves_dropped++;
+					drop = true;
+				} else if (prev && prev->type == JTAG_RUNTEST &&
+						prev->cmd.runtest->end_state == TAP_IDLE) {
+					/* the first one ends where the second one starts */
+					prev->cmd.runtest->num_cycles += rt->num_cycles;
+					prev->cmd.runtest->end_state = rt->end_state;
+					stats->runtests_folded++;
+					drop = true;
+				}
+				state = rt->end_state;
+				state_known = true;
+				break;
+			}
+			case JTAG_PATHMOVE:
+				if (cmd->cmd.pathmove->num_states == 0) {
+					stats->moves_dropped++;
+					drop = true;
+				} else {
+					state = cmd->cmd.pathmove->path[cmd->cmd.pathmove->num_states - 1];
+					state_known = true;
+				}
+				break;
+			case JTAG_TLR_RESET:
+				state = cmd->cmd.statemove->end_state;
+				state_known = true;
+				last_ir = NULL;
+				break;
+			case JTAG_RESET:
+				if (cmd->cmd.reset->trst == 1) {
+					state = TAP_RESET;
+					state_known = true;
+				}
+				/* SRST may reset TAPs as well */
+				last_ir = NULL;
+				break;
+			case JTAG_SLEEP:
+				break;
+			case JTAG_SCAN:
+			{
+				struct scan_command *scan = cmd->cmd.scan;
+				if (scan->ir_scan) {
+					/* Only when going from Run-Test/Idle back to it, so no
+					 * other state is entered or skipped by dropping it. */
+					if (mode == JTAG_QUEUE_OPTIMIZE_IR && last_ir && state_known &&
+							state == TAP_IDLE && scan->end_state == TAP_IDLE &&
+							jtag_ir_scan_is_redundant(last_ir, scan)) {
+						stats->ir_scans_dropped++;
+						stats->clocks_saved += jtag_scan_size(scan) +
+							tap_get_tms_path_len(TAP_IDLE, TAP_IRSHIFT) +
+							tap_get_tms_path_len(TAP_IRSHIFT, TAP_IDLE) - 1;
+						drop = true;
+					} else {
+						last_ir = scan;
+					}
+				}
+				state = scan->end_state;
+				state_known = true;
+				break;
+			}
+			default:
+				/* leave anything we do not know alone */
+				state_known = false;
+				last_ir = NULL;
+				break;
+		}
+
+		if (drop) {
+			*link = cmd->next;
+			stats->commands_removed++;
+		} else {
+			prev = cmd;
+			link = &cmd->next;
+		}
+	}
+
+	/* the tail may have been removed */
+	next_command_pointer = link;
+
+	if (stats->commands_removed != removed)
+		LOG_DEBUG_IO("queue optimizer removed %" PRIu64 " commands, saved %" PRIu64 " clocks",
+				stats->commands_removed - removed, stats->clocks_saved - saved);
+}
+
+void jtag_queue_optimize_get_stats(struct jtag_queue_optimize_stats *stats)
+{
+	*stats = jtag_queue_optimize_stats;
+}
+
+void jtag_queue_optimize_reset_stats(void)
+{
+	memset(&jtag_queue_optimize_stats, 0, sizeof(jtag_queue_optimize_stats));
+}
+
 /**
  * Copy a struct scan_field for insertion into the queue.
  *
@@ -163,11 +163,62 @@ struct jtag_command {
 /** The current queue of jtag_command_s structures. */
 extern struct jtag_command *jtag_command_queue;
 
+/** Statistics of the arena backing cmd_queue_alloc(). */
+struct cmd_queue_stats {
+	/** number of pages currently held by the arena */
+	unsigned pages;
+	/** total size of those pages */
+	size_t bytes_reserved;
+	/** bytes handed out since the last queue reset */
+	size_t bytes_in_use;
+	/** largest bytes_in_use seen */
+	size_t high_water;
+	/** calls to cmd_queue_alloc() */
+	uint64_t allocs;
+	/** pages that had to be malloc'ed */
+	uint64_t page_mallocs;
+	/** number of queue resets */
+	uint64_t resets;
+};
+
 void *cmd_queue_alloc(size_t size);
+/** Release all memory held by the command queue arena. */
+void cmd_queue_free(void);
+void cmd_queue_get_stats(struct cmd_queue_stats *stats);
 
 void jtag_queue_command(struct jtag_command *cmd);
 void jtag_command_queue_reset(void);
 
+/** Statistics of the queue optimizer, accumulated over all queues. */
+struct jtag_queue_optimize_stats {
+	/** queues that went through the optimizer */
+	uint64_t queues;
+	/** commands removed from the queues */
+	uint64_t commands_removed;
+	/** TMS sequences folded into the preceding one */
+	uint64_t tms_folded;
+	/** stable clock runs folded into the preceding one */
+	uint64_t clocks_folded;
+	/** run-test commands folded into the preceding one */
+	uint64_t runtests_folded;
+	/** state moves dropped because they did not move */
+	uint64_t moves_dropped;
+	/** IR scans dropped because the instruction was already loaded */
+	uint64_t ir_scans_dropped;
+	/** TCK cycles no longer clocked out */
+	uint64_t clocks_saved;
+};
+
+/**
+ * Rewrite jtag_command_queue before it is handed to the driver.
+ *
+ * Scans are never split, merged or reordered, so the fields (and thus
+ * the captured bits) of every remaining scan are untouched.
+ */
+void jtag_command_queue_optimize(enum jtag_queue_optimize mode);
+void jtag_queue_optimize_get_stats(struct jtag_queue_optimize_stats *stats);
+void jtag_queue_optimize_reset_stats(void);
+
 void jtag_scan_field_clone(struct scan_field *dst, const struct scan_field *src);
 enum scan_type jtag_scan_type(const struct scan_command *cmd);
 int jtag_scan_size(const struct scan_command *cmd);
@@ -33,6 +33,7 @@
 #include "jtag.h"
 #include "swd.h"
 #include "interface.h"
+#include "commands.h"
 #include <transport/transport.h>
 #include <helper/jep106.h>
 
@@ -94,6 +95,7 @@ static enum reset_types jtag_reset_config = RESET_NONE;
 tap_state_t cmd_queue_cur_state = TAP_RESET;
 
 static bool jtag_verify_capture_ir = true;
+static enum jtag_queue_optimize jtag_queue_optimize = JTAG_QUEUE_OPTIMIZE_OFF;
 static int jtag_verify = 1;
 
 /* how long the OpenOCD should wait before attempting JTAG communication after reset lines
@@ -951,6 +953,10 @@ int default_interface_jtag_execute_queue(void)
 			return ERROR_OK;
 	}
 
+#if !BUILD_ZY1000
+	jtag_command_queue_optimize(jtag_queue_optimize);
+#endif
+
 	int result = jtag->jtag_ops->execute_queue();
 
 #if !BUILD_ZY1000
@@ -1658,6 +1664,8 @@ int adapter_quit(void)
 			LOG_ERROR("failed: %d", result);
 	}
 
+	cmd_queue_free();
+
 	struct jtag_tap *t = jtag_all_taps();
 	while (t) {
 		struct jtag_tap *n = t->next_tap;
@@ -1887,6 +1895,16 @@ bool jtag_will_verify_capture_ir()
 	return jtag_verify_capture_ir;
 }
 
+void jtag_set_queue_optimize(enum jtag_queue_optimize mode)
+{
+	jtag_queue_optimize = mode;
+}
+
+enum jtag_queue_optimize jtag_get_queue_optimize(void)
+{
+	return jtag_queue_optimize;
+}
+
 int jtag_power_dropout(int *dropout)
 {
 	if (jtag == NULL) {
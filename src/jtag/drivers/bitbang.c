@@ -40,8 +40,6 @@
  */
 static int bitbang_stableclocks(int num_cycles);
 
-static void bitbang_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay_clk);
-
 struct bitbang_interface *bitbang_interface;
 
 /* DANGER!!!! clock absolutely *MUST* be 0 in idle or reset won't work!
@@ -71,20 +69,104 @@ static void bitbang_end_state(tap_state_t state)
 	tap_set_end_state(state);
 }
 
+/* Collects sampled TDO bits and stores them a whole byte at a time. */
+struct bitbang_tdo_writer {
+	uint8_t *tdo;
+	unsigned pos;
+	unsigned num_bits;
+	uint8_t acc;
+};
+
+static inline int bitbang_put_tdo(struct bitbang_tdo_writer *w, bb_value_t value)
+{
+	if (value == BB_ERROR)
+		return ERROR_FAIL;
+
+	w->acc |= (value == BB_HIGH) << (w->pos % 8);
+	w->pos++;
+	if (w->pos % 8 == 0 || w->pos == w->num_bits) {
+		w->tdo[(w->pos - 1) / 8] = w->acc;
+		w->acc = 0;
+	}
+	return ERROR_OK;
+}
+
+/* Fallback for interfaces without shift_bits(). TMS and TDI are loaded a
+ * byte at a time and TDO is stored a byte at a time, so no per bit buffer
+ * helpers are involved; only the write()/read() calls remain per bit. */
+static int bitbang_shift_bits_generic(const uint8_t *tms, const uint8_t *tdi,
+		uint8_t *tdo, unsigned num_bits, bool tms_exit)
+{
+	struct bitbang_tdo_writer w = { .tdo = tdo, .num_bits = num_bits };
+	bool use_sample = tdo && bitbang_interface->buf_size;
+	size_t buffered = 0;
+	int tms_bit = 0;
+
+	for (unsigned byte = 0; byte < DIV_ROUND_UP(num_bits, 8); byte++) {
+		/* read both before tdo (possibly the same buffer as tdi) is written */
+		unsigned tms_byte = tms ? tms[byte] : 0;
+		unsigned tdi_byte = tdi ? tdi[byte] : 0;
+		unsigned bits = MIN(8, num_bits - 8 * byte);
+
+		for (unsigned i = 0; i < bits; i++) {
+			int tdi_bit = tdi_byte & 1;
+			tms_bit = tms_byte & 1;
+			tms_byte >>= 1;
+			tdi_byte >>= 1;
+			if (tms_exit && 8 * byte + i == num_bits - 1)
+				tms_bit = 1;
+
+			if (bitbang_interface->write(0, tms_bit, tdi_bit) != ERROR_OK)
+				return ERROR_FAIL;
+
+			if (tdo) {
+				if (use_sample) {
+					if (bitbang_interface->sample() != ERROR_OK)
+						return ERROR_FAIL;
+					buffered++;
+				} else if (bitbang_put_tdo(&w, bitbang_interface->read()) != ERROR_OK) {
+					return ERROR_FAIL;
+				}
+			}
+
+			if (bitbang_interface->write(1, tms_bit, tdi_bit) != ERROR_OK)
+				return ERROR_FAIL;
+
+			if (use_sample && (buffered == bitbang_interface->buf_size ||
+					8 * byte + i == num_bits - 1)) {
+				for (; buffered; buffered--) {
+					if (bitbang_put_tdo(&w, bitbang_interface->read_sample()) != ERROR_OK)
+						return ERROR_FAIL;
+				}
+			}
+		}
+	}
+
+	if (bitbang_interface->write(CLOCK_IDLE(), tms_bit, 0) != ERROR_OK)
+		return ERROR_FAIL;
+
+	return ERROR_OK;
+}
+
+int bitbang_shift_bits(const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo,
+		unsigned num_bits, bool tms_exit)
+{
+	if (num_bits == 0)
+		return ERROR_OK;
+
+	if (bitbang_interface->shift_bits)
+		return bitbang_interface->shift_bits(tms, tdi, tdo, num_bits, tms_exit);
+
+	return bitbang_shift_bits_generic(tms, tdi, tdo, num_bits, tms_exit);
+}
+
 static int bitbang_state_move(int skip)
 {
-	int i = 0, tms = 0;
 	uint8_t tms_scan = tap_get_tms_path(tap_get_state(), tap_get_end_state());
 	int tms_count = tap_get_tms_path_len(tap_get_state(), tap_get_end_state());
 
-	for (i = skip; i < tms_count; i++) {
-		tms = (tms_scan >> i) & 1;
-		if (bitbang_interface->write(0, tms, 0) != ERROR_OK)
-			return ERROR_FAIL;
-		if (bitbang_interface->write(1, tms, 0) != ERROR_OK)
-			return ERROR_FAIL;
-	}
-	if (bitbang_interface->write(CLOCK_IDLE(), tms, 0) != ERROR_OK)
+	tms_scan >>= skip;
+	if (bitbang_shift_bits(&tms_scan, NULL, NULL, tms_count - skip, false) != ERROR_OK)
 		return ERROR_FAIL;
 
 	tap_set_state(tap_get_end_state());
@@ -102,51 +184,37 @@ static int bitbang_execute_tms(struct jtag_command *cmd)
 
 	LOG_DEBUG_IO("TMS: %d bits", num_bits);
 
-	int tms = 0;
-	for (unsigned i = 0; i < num_bits; i++) {
-		tms = ((bits[i/8] >> (i % 8)) & 1);
-		if (bitbang_interface->write(0, tms, 0) != ERROR_OK)
-			return ERROR_FAIL;
-		if (bitbang_interface->write(1, tms, 0) != ERROR_OK)
-			return ERROR_FAIL;
-	}
-	if (bitbang_interface->write(CLOCK_IDLE(), tms, 0) != ERROR_OK)
-		return ERROR_FAIL;
-
-	return ERROR_OK;
+	return bitbang_shift_bits(bits, NULL, NULL, num_bits, false);
 }
 
 static int bitbang_path_move(struct pathmove_command *cmd)
 {
-	int num_states = cmd->num_states;
-	int state_count;
-	int tms = 0;
-
-	state_count = 0;
-	while (num_states) {
-		if (tap_state_transition(tap_get_state(), false) == cmd->path[state_count])
-			tms = 0;
-		else if (tap_state_transition(tap_get_state(), true) == cmd->path[state_count])
-			tms = 1;
-		else {
+	/* The path is shifted out in chunks of this many states. */
+	uint8_t tms_bits[8];
+	unsigned chunk = 0;
+
+	memset(tms_bits, 0, sizeof(tms_bits));
+
+	for (int state_count = 0; state_count < cmd->num_states; state_count++) {
+		if (tap_state_transition(tap_get_state(), true) == cmd->path[state_count])
+			tms_bits[chunk / 8] |= 1 << (chunk % 8);
+		else if (tap_state_transition(tap_get_state(), false) != cmd->path[state_count]) {
 			LOG_ERROR("BUG: %s -> %s isn't a valid TAP transition",
 				tap_state_name(tap_get_state()),
 				tap_state_name(cmd->path[state_count]));
 			exit(-1);
 		}
 
-		if (bitbang_interface->write(0, tms, 0) != ERROR_OK)
-			return ERROR_FAIL;
-		if (bitbang_interface->write(1, tms, 0) != ERROR_OK)
-			return ERROR_FAIL;
-
 		tap_set_state(cmd->path[state_count]);
-		state_count++;
-		num_states--;
-	}
+		chunk++;
 
-	if (bitbang_interface->write(CLOCK_IDLE(), tms, 0) != ERROR_OK)
-		return ERROR_FAIL;
+		if (chunk == 8 * sizeof(tms_bits) || state_count + 1 == cmd->num_states) {
+			if (bitbang_shift_bits(tms_bits, NULL, NULL, chunk, false) != ERROR_OK)
+				return ERROR_FAIL;
+			memset(tms_bits, 0, sizeof(tms_bits));
+			chunk = 0;
+		}
+	}
 
 	tap_set_end_state(tap_get_state());
 	return ERROR_OK;
@@ -154,8 +222,6 @@ static int bitbang_path_move(struct pathmove_command *cmd)
 
 static int bitbang_runtest(int num_cycles)
 {
-	int i;
-
 	tap_state_t saved_end_state = tap_get_end_state();
 
 	/* only do a state_move when we're not already in IDLE */
@@ -166,13 +232,7 @@ static int bitbang_runtest(int num_cycles)
 	}
 
 	/* execute num_cycles */
-	for (i = 0; i < num_cycles; i++) {
-		if (bitbang_interface->write(0, 0, 0) != ERROR_OK)
-			return ERROR_FAIL;
-		if (bitbang_interface->write(1, 0, 0) != ERROR_OK)
-			return ERROR_FAIL;
-	}
-	if (bitbang_interface->write(CLOCK_IDLE(), 0, 0) != ERROR_OK)
+	if (bitbang_shift_bits(NULL, NULL, NULL, num_cycles, false) != ERROR_OK)
 		return ERROR_FAIL;
 
 	/* finish in end_state */
@@ -186,15 +246,20 @@ static int bitbang_runtest(int num_cycles)
 
 static int bitbang_stableclocks(int num_cycles)
 {
-	int tms = (tap_get_state() == TAP_RESET ? 1 : 0);
-	int i;
+	static const uint8_t ones[32] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	};
+	const uint8_t *tms = (tap_get_state() == TAP_RESET) ? ones : NULL;
 
 	/* send num_cycles clocks onto the cable */
-	for (i = 0; i < num_cycles; i++) {
-		if (bitbang_interface->write(1, tms, 0) != ERROR_OK)
-			return ERROR_FAIL;
-		if (bitbang_interface->write(0, tms, 0) != ERROR_OK)
+	while (num_cycles > 0) {
+		int n = MIN(num_cycles, (int)sizeof(ones) * 8);
+		if (bitbang_shift_bits(tms, NULL, NULL, n, false) != ERROR_OK)
 			return ERROR_FAIL;
+		num_cycles -= n;
 	}
 
 	return ERROR_OK;
@@ -204,7 +269,6 @@ static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 		unsigned scan_size)
 {
 	tap_state_t saved_end_state = tap_get_end_state();
-	unsigned bit_cnt;
 
 	if (!((!ir_scan &&
 			(tap_get_state() == TAP_DRSHIFT)) ||
@@ -219,67 +283,19 @@ static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 		bitbang_end_state(saved_end_state);
 	}
 
-	size_t buffered = 0;
-	for (bit_cnt = 0; bit_cnt < scan_size; bit_cnt++) {
-		int tms = (bit_cnt == scan_size-1) ? 1 : 0;
-		int tdi;
-		int bytec = bit_cnt/8;
-		int bcval = 1 << (bit_cnt % 8);
-
-		/* if we're just reading the scan, but don't care about the output
-		 * default to outputting 'low', this also makes valgrind traces more readable,
-		 * as it removes the dependency on an uninitialised value
-		 */
-		tdi = 0;
-		if ((type != SCAN_IN) && (buffer[bytec] & bcval))
-			tdi = 1;
-
-		if (bitbang_interface->write(0, tms, tdi) != ERROR_OK)
-			return ERROR_FAIL;
-
-		if (type != SCAN_OUT) {
-			if (bitbang_interface->buf_size) {
-				if (bitbang_interface->sample() != ERROR_OK)
-					return ERROR_FAIL;
-				buffered++;
-			} else {
-				switch (bitbang_interface->read()) {
-					case BB_LOW:
-						buffer[bytec] &= ~bcval;
-						break;
-					case BB_HIGH:
-						buffer[bytec] |= bcval;
-						break;
-					default:
-						return ERROR_FAIL;
-				}
-			}
-		}
-
-		if (bitbang_interface->write(1, tms, tdi) != ERROR_OK)
-			return ERROR_FAIL;
-
-		if (type != SCAN_OUT && bitbang_interface->buf_size &&
-				(buffered == bitbang_interface->buf_size ||
-				 bit_cnt == scan_size - 1)) {
-			for (unsigned i = bit_cnt + 1 - buffered; i <= bit_cnt; i++) {
-				switch (bitbang_interface->read_sample()) {
-					case BB_LOW:
-						buffer[i/8] &= ~(1 << (i % 8));
-						break;
-					case BB_HIGH:
-						buffer[i/8] |= 1 << (i % 8);
-						break;
-					default:
-						return ERROR_FAIL;
-				}
-			}
-			buffered = 0;
-		}
-	}
+	/* TMS stays low but for the last bit, which leaves the shift state.
+	 * If we're just reading the scan, but don't care about the output
+	 * default to outputting 'low', this also makes valgrind traces more readable,
+	 * as it removes the dependency on an uninitialised value
+	 */
+	if (bitbang_shift_bits(NULL,
+			type != SCAN_IN ? buffer : NULL,
+			type != SCAN_OUT ? buffer : NULL,
+			scan_size, true) != ERROR_OK)
+		return ERROR_FAIL;
 
 	if (tap_get_state() != tap_get_end_state()) {
-		/* we *KNOW* the above loop transitioned out of
+		/* we *KNOW* the above scan transitioned out of
 		 * the shift state, so we skip the first state
 		 * and move directly to the end state.
 		 */
@@ -386,6 +402,48 @@ int bitbang_execute_queue(void)
 bool swd_mode;
 static int queued_retval;
 
+/* SWD transactions are not clocked out one by one. read_reg() and write_reg()
+ * append each of them to a bit stream, with the turnaround and idle cycles
+ * already in place, and the whole stream is clocked out by
+ * bitbang_swd_run_queue(). The ACK and parity of all queued transactions are
+ * decoded afterwards, in a single pass.
+ *
+ * This relies on the DAP enabling overrun detection: after a WAIT, the
+ * following transactions get a FAULT response instead of being executed,
+ * and still have their data phase, so the transactions from the one answered
+ * with WAIT on can simply be sent again after clearing STICKYORUN. */
+struct bitbang_swd_transfer {
+	uint8_t cmd;
+	/** Write to CTRL/STAT, tracked for CORUNDETECT. */
+	bool ctrl_stat;
+	uint32_t data;
+	uint32_t *dst;
+	uint32_t ap_delay_clk;
+	/** Position of the transaction in the bit stream. */
+	unsigned int offset;
+};
+
+static struct {
+	struct bitbang_swd_transfer *transfers;
+	size_t num_transfers;
+	size_t alloced_transfers;
+	/** The SWDIO value for each bit, where driven by the host. */
+	uint8_t *swdio;
+	/** Set for the bits where the host drives SWDIO. */
+	uint8_t *drive;
+	/** The SWDIO value sampled for each bit. */
+	uint8_t *swdio_in;
+	unsigned int num_bits;
+	unsigned int alloced_bits;
+	/** DPBANKSEL of the last SELECT write queued. */
+	uint8_t dp_bank;
+	/** Overrun detection was enabled in CTRL/STAT. */
+	bool orundetect;
+} swd_queue;
+
+/* How often transactions answered with WAIT are retried */
+#define BITBANG_SWD_WAIT_RETRIES 1000
+
 static int bitbang_swd_init(void)
 {
 	LOG_DEBUG("bitbang_swd_init");
@@ -393,27 +451,293 @@ static int bitbang_swd_init(void)
 	return ERROR_OK;
 }
 
-static void bitbang_exchange(bool rnw, uint8_t buf[], unsigned int offset, unsigned int bit_cnt)
+static int bitbang_swd_reserve_bits(unsigned int num_bits)
 {
-	LOG_DEBUG("bitbang_exchange");
-	int tdi;
+	unsigned int needed = swd_queue.num_bits + num_bits;
 
-	for (unsigned int i = offset; i < bit_cnt + offset; i++) {
-		int bytec = i/8;
-		int bcval = 1 << (i % 8);
-		tdi = !rnw && (buf[bytec] & bcval);
+	if (needed <= swd_queue.alloced_bits)
+		return ERROR_OK;
+
+	unsigned int alloced = MAX(MAX(swd_queue.alloced_bits * 2, needed), 1024u);
+	size_t old_size = DIV_ROUND_UP(swd_queue.alloced_bits, 8);
+	size_t size = DIV_ROUND_UP(alloced, 8);
+	uint8_t **buffers[] = { &swd_queue.swdio, &swd_queue.drive, &swd_queue.swdio_in };
+
+	for (size_t i = 0; i < ARRAY_SIZE(buffers); i++) {
+		uint8_t *buffer = realloc(*buffers[i], size);
+		if (!buffer) {
+			LOG_ERROR("Out of memory for SWD bit stream");
+			return ERROR_FAIL;
+		}
+		memset(buffer + old_size, 0, size - old_size);
+		*buffers[i] = buffer;
+	}
+	swd_queue.alloced_bits = alloced;
+
+	return ERROR_OK;
+}
+
+/* Append num_bits bits of value to the stream. The host drives SWDIO for
+ * these bits if drive is set, else SWDIO is sampled. Longer runs than 32
+ * bits repeat the last bit of value. */
+static void bitbang_swd_put(uint32_t value, unsigned int num_bits, bool drive)
+{
+	while (num_bits) {
+		unsigned int n = MIN(num_bits, 32u);
+
+		buf_set_u32(swd_queue.swdio, swd_queue.num_bits, n, value);
+		buf_set_u32(swd_queue.drive, swd_queue.num_bits, n, drive ? 0xffffffff : 0);
+		swd_queue.num_bits += n;
+		num_bits -= n;
+		value = (value & (1u << (n - 1))) ? 0xffffffff : 0;
+	}
+}
+
+static int bitbang_swd_put_seq(const uint8_t *seq, unsigned int num_bits)
+{
+	int retval = bitbang_swd_reserve_bits(num_bits);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = 0; i < num_bits; i += 32)
+		bitbang_swd_put(buf_get_u32(seq, i, MIN(num_bits - i, 32u)),
+				MIN(num_bits - i, 32u), true);
+
+	return ERROR_OK;
+}
+
+/* A transaction must be followed by another transaction or at least 8 idle cycles to
+ * ensure that data is clocked through the AP. */
+static int bitbang_swd_put_idle(unsigned int num_bits)
+{
+	int retval = bitbang_swd_reserve_bits(num_bits);
+	if (retval != ERROR_OK)
+		return retval;
+
+	bitbang_swd_put(0, num_bits, true);
+	return ERROR_OK;
+}
+
+static int bitbang_swd_encode(struct bitbang_swd_transfer *t)
+{
+	bool is_ap = t->cmd & SWD_CMD_APnDP;
+	int retval = bitbang_swd_reserve_bits(8 + 1 + 3 + 1 + 32 + 1 + (is_ap ? t->ap_delay_clk : 0));
+	if (retval != ERROR_OK)
+		return retval;
+
+	t->offset = swd_queue.num_bits;
+	bitbang_swd_put(t->cmd, 8, true);
+
+	if (t->cmd & SWD_CMD_RnW) {
+		bitbang_swd_put(0, 1 + 3 + 32 + 1 + 1, false);
+	} else {
+		bitbang_swd_put(0, 1 + 3 + 1, false);
+		bitbang_swd_put(t->data, 32, true);
+		bitbang_swd_put(parity_u32(t->data), 1, true);
+	}
 
-		bitbang_interface->write(0, 0, tdi);
+	if (is_ap)
+		bitbang_swd_put(0, t->ap_delay_clk, true);
 
-		if (rnw && buf) {
+	return ERROR_OK;
+}
+
+/* Fallback for interfaces without swd_shift_bits() */
+static int bitbang_swd_shift_bits_generic(const uint8_t *swdio, const uint8_t *drive,
+		uint8_t *swdio_in, unsigned int num_bits)
+{
+	bool driving = false;
+
+	for (unsigned int i = 0; i < num_bits; i++) {
+		unsigned int mask = 1 << (i % 8);
+		bool drive_bit = drive[i / 8] & mask;
+		int swdio_bit = (swdio[i / 8] & mask) != 0;
+
+		if (i == 0 || drive_bit != driving) {
+			bitbang_interface->swdio_drive(drive_bit);
+			driving = drive_bit;
+		}
+
+		if (bitbang_interface->write(0, 0, swdio_bit) != ERROR_OK)
+			return ERROR_FAIL;
+
+		if (!drive_bit) {
 			if (bitbang_interface->swdio_read())
-				buf[bytec] |= bcval;
+				swdio_in[i / 8] |= mask;
 			else
-				buf[bytec] &= ~bcval;
+				swdio_in[i / 8] &= ~mask;
+		}
+
+		if (bitbang_interface->write(1, 0, swdio_bit) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	return ERROR_OK;
+}
+
+/* Clock out the bit stream built so far */
+static int bitbang_swd_shift_stream(void)
+{
+	unsigned int num_bits = swd_queue.num_bits;
+
+	swd_queue.num_bits = 0;
+	if (num_bits == 0)
+		return ERROR_OK;
+
+	LOG_DEBUG_IO("SWD: %u bits, %zu transactions", num_bits, swd_queue.num_transfers);
+
+	if (bitbang_interface->swd_shift_bits)
+		return bitbang_interface->swd_shift_bits(swd_queue.swdio, swd_queue.drive,
+				swd_queue.swdio_in, num_bits);
+
+	return bitbang_swd_shift_bits_generic(swd_queue.swdio, swd_queue.drive,
+			swd_queue.swdio_in, num_bits);
+}
+
+static int bitbang_swd_ack(const struct bitbang_swd_transfer *t)
+{
+	return buf_get_u32(swd_queue.swdio_in, t->offset + 8 + 1, 3);
+}
+
+/* Rebuild the stream to retry the transactions from the first one answered
+ * with WAIT, after clearing the sticky errors. Without overrun detection the
+ * target skips the data phase after a WAIT and may take the data sent as a
+ * new request, so resynchronize with a line reset and DPIDR read first. */
+static int bitbang_swd_requeue(size_t first)
+{
+	struct bitbang_swd_transfer *transfers = swd_queue.transfers;
+	size_t num = swd_queue.num_transfers - first;
+	size_t prefix = swd_queue.orundetect ? 1 : 2;
+	int retval = ERROR_OK;
+
+	memmove(&transfers[prefix], &transfers[first], num * sizeof(*transfers));
+	if (!swd_queue.orundetect) {
+		transfers[0] = (struct bitbang_swd_transfer) {
+			.cmd = swd_cmd(true, false, DP_DPIDR) | SWD_CMD_START | SWD_CMD_PARK,
+		};
+		retval = bitbang_swd_put_seq(swd_seq_line_reset, swd_seq_line_reset_len);
+	}
+	transfers[prefix - 1] = (struct bitbang_swd_transfer) {
+		.cmd = swd_cmd(false, false, DP_ABORT) | SWD_CMD_START | SWD_CMD_PARK,
+		.data = STKCMPCLR | STKERRCLR | WDERRCLR | ORUNERRCLR,
+	};
+	swd_queue.num_transfers = num + prefix;
+
+	for (size_t i = 0; i < swd_queue.num_transfers && retval == ERROR_OK; i++)
+		retval = bitbang_swd_encode(&transfers[i]);
+	if (retval == ERROR_OK)
+		retval = bitbang_swd_put_idle(8);
+
+	return retval;
+}
+
+/* Clock out the queued transactions and decode their responses */
+static int bitbang_swd_flush(void)
+{
+	int retval = ERROR_OK;
+
+	for (unsigned int retry = 0; ; retry++) {
+		retval = bitbang_swd_shift_stream();
+		if (retval != ERROR_OK)
+			break;
+
+		size_t i;
+		int ack = SWD_ACK_OK;
+		for (i = 0; i < swd_queue.num_transfers; i++) {
+			struct bitbang_swd_transfer *t = &swd_queue.transfers[i];
+			bool is_read = t->cmd & SWD_CMD_RnW;
+			uint32_t data = buf_get_u32(swd_queue.swdio_in, t->offset + 8 + 1 + 3, 32);
+
+			ack = bitbang_swd_ack(t);
+			LOG_DEBUG_IO("%s %s %s reg %X = %08" PRIx32,
+				  ack == SWD_ACK_OK ? "OK" : ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK",
+				  t->cmd & SWD_CMD_APnDP ? "AP" : "DP",
+				  is_read ? "read" : "write",
+				  (t->cmd & SWD_CMD_A32) >> 1,
+				  is_read ? data : t->data);
+
+			if (ack != SWD_ACK_OK)
+				break;
+
+			if (is_read) {
+				int parity = buf_get_u32(swd_queue.swdio_in, t->offset + 8 + 1 + 3 + 32, 1);
+				if (parity != parity_u32(data)) {
+					LOG_DEBUG("Wrong parity detected");
+					retval = ERROR_FAIL;
+					break;
+				}
+				if (t->dst)
+					*t->dst = data;
+			} else if (t->ctrl_stat) {
+				swd_queue.orundetect = t->data & CORUNDETECT;
+			}
+		}
+
+		if (retval != ERROR_OK || ack == SWD_ACK_OK)
+			break;
+
+		if (ack != SWD_ACK_WAIT) {
+			if (ack == SWD_ACK_FAULT)
+				LOG_DEBUG("SWD_ACK_FAULT");
+			else
+				LOG_DEBUG("No valid acknowledge: ack=%d", ack);
+			retval = ack;
+			break;
+		}
+
+		LOG_DEBUG("SWD_ACK_WAIT");
+
+		/* An AP access accepted after the WAIT cannot be repeated; this
+		 * only happens without overrun detection */
+		for (size_t j = i + 1; j < swd_queue.num_transfers; j++) {
+			if ((swd_queue.transfers[j].cmd & SWD_CMD_APnDP) &&
+					bitbang_swd_ack(&swd_queue.transfers[j]) == SWD_ACK_OK) {
+				LOG_DEBUG("AP access completed after SWD_ACK_WAIT, cannot retry");
+				retval = ERROR_WAIT;
+				break;
+			}
 		}
+		if (retval != ERROR_OK)
+			break;
 
-		bitbang_interface->write(1, 0, tdi);
+		if (retry == BITBANG_SWD_WAIT_RETRIES) {
+			LOG_DEBUG("Giving up after %d SWD_ACK_WAIT", retry);
+			retval = ERROR_WAIT;
+			break;
+		}
+
+		retval = bitbang_swd_requeue(i);
+		if (retval != ERROR_OK)
+			break;
 	}
+
+	swd_queue.num_transfers = 0;
+	swd_queue.num_bits = 0;
+
+	return retval;
+}
+
+/* Clock out a sequence after whatever is queued */
+static int bitbang_swd_send_seq(const uint8_t *seq, unsigned int num_bits)
+{
+	int retval = ERROR_OK;
+
+	if (swd_queue.num_transfers) {
+		retval = bitbang_swd_flush();
+		if (queued_retval == ERROR_OK)
+			queued_retval = retval;
+	}
+
+	/* The DAP enables overrun detection again after reconnecting */
+	swd_queue.orundetect = false;
+
+	retval = bitbang_swd_put_seq(seq, num_bits);
+	if (retval == ERROR_OK)
+		retval = bitbang_swd_shift_stream();
+
+	swd_queue.num_bits = 0;
+
+	return retval;
 }
 
 int bitbang_swd_switch_seq(enum swd_special_seq seq)
@@ -423,153 +747,90 @@ int bitbang_swd_switch_seq(enum swd_special_seq seq)
 	switch (seq) {
 	case LINE_RESET:
 		LOG_DEBUG("SWD line reset");
-		bitbang_exchange(false, (uint8_t *)swd_seq_line_reset, 0, swd_seq_line_reset_len);
-		break;
+		return bitbang_swd_send_seq(swd_seq_line_reset, swd_seq_line_reset_len);
 	case JTAG_TO_SWD:
 		LOG_DEBUG("JTAG-to-SWD");
-		bitbang_exchange(false, (uint8_t *)swd_seq_jtag_to_swd, 0, swd_seq_jtag_to_swd_len);
-		break;
+		return bitbang_swd_send_seq(swd_seq_jtag_to_swd, swd_seq_jtag_to_swd_len);
 	case SWD_TO_JTAG:
 		LOG_DEBUG("SWD-to-JTAG");
-		bitbang_exchange(false, (uint8_t *)swd_seq_swd_to_jtag, 0, swd_seq_swd_to_jtag_len);
-		break;
+		return bitbang_swd_send_seq(swd_seq_swd_to_jtag, swd_seq_swd_to_jtag_len);
 	default:
 		LOG_ERROR("Sequence %d not supported", seq);
 		return ERROR_FAIL;
 	}
-
-	return ERROR_OK;
 }
 
 void bitbang_switch_to_swd(void)
 {
 	LOG_DEBUG("bitbang_switch_to_swd");
-	bitbang_exchange(false, (uint8_t *)swd_seq_jtag_to_swd, 0, swd_seq_jtag_to_swd_len);
+	bitbang_swd_send_seq(swd_seq_jtag_to_swd, swd_seq_jtag_to_swd_len);
 }
 
-static void swd_clear_sticky_errors(void)
+static void bitbang_swd_queue_cmd(uint8_t cmd, uint32_t *dst, uint32_t data, uint32_t ap_delay_clk)
 {
-	bitbang_swd_write_reg(swd_cmd(false,  false, DP_ABORT),
-		STKCMPCLR | STKERRCLR | WDERRCLR | ORUNERRCLR, 0);
-}
-
-static void bitbang_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay_clk)
-{
-	LOG_DEBUG("bitbang_swd_read_reg");
-	assert(cmd & SWD_CMD_RnW);
-
 	if (queued_retval != ERROR_OK) {
-		LOG_DEBUG("Skip bitbang_swd_read_reg because queued_retval=%d", queued_retval);
+		LOG_DEBUG_IO("Skip SWD transaction because queued_retval=%d", queued_retval);
 		return;
 	}
 
-	for (;;) {
-		uint8_t trn_ack_data_parity_trn[DIV_ROUND_UP(4 + 3 + 32 + 1 + 4, 8)];
-
-		cmd |= SWD_CMD_START | (1 << 7);
-		bitbang_exchange(false, &cmd, 0, 8);
-
-		bitbang_interface->swdio_drive(false);
-		bitbang_exchange(true, trn_ack_data_parity_trn, 0, 1 + 3 + 32 + 1 + 1);
-		bitbang_interface->swdio_drive(true);
-
-		int ack = buf_get_u32(trn_ack_data_parity_trn, 1, 3);
-		uint32_t data = buf_get_u32(trn_ack_data_parity_trn, 1 + 3, 32);
-		int parity = buf_get_u32(trn_ack_data_parity_trn, 1 + 3 + 32, 1);
-
-		LOG_DEBUG("%s %s %s reg %X = %08"PRIx32,
-			  ack == SWD_ACK_OK ? "OK" : ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK",
-			  cmd & SWD_CMD_APnDP ? "AP" : "DP",
-			  cmd & SWD_CMD_RnW ? "read" : "write",
-			  (cmd & SWD_CMD_A32) >> 1,
-			  data);
-
-		switch (ack) {
-		 case SWD_ACK_OK:
-			if (parity != parity_u32(data)) {
-				LOG_DEBUG("Wrong parity detected");
-				queued_retval = ERROR_FAIL;
-				return;
-			}
-			if (value)
-				*value = data;
-			if (cmd & SWD_CMD_APnDP)
-				bitbang_exchange(true, NULL, 0, ap_delay_clk);
-			return;
-		 case SWD_ACK_WAIT:
-			LOG_DEBUG("SWD_ACK_WAIT");
-			swd_clear_sticky_errors();
-			break;
-		 case SWD_ACK_FAULT:
-			LOG_DEBUG("SWD_ACK_FAULT");
-			queued_retval = ack;
-			return;
-		 default:
-			LOG_DEBUG("No valid acknowledge: ack=%d", ack);
-			queued_retval = ack;
+	/* Keep two spare entries for retrying after a WAIT */
+	if (swd_queue.num_transfers + 2 >= swd_queue.alloced_transfers) {
+		size_t alloced = MAX(swd_queue.alloced_transfers * 2, 64u);
+		struct bitbang_swd_transfer *transfers = realloc(swd_queue.transfers,
+				alloced * sizeof(*transfers));
+		if (!transfers) {
+			LOG_ERROR("Out of memory for SWD queue");
+			queued_retval = ERROR_FAIL;
 			return;
 		}
+		swd_queue.transfers = transfers;
+		swd_queue.alloced_transfers = alloced;
 	}
+
+	struct bitbang_swd_transfer *t = &swd_queue.transfers[swd_queue.num_transfers];
+	t->cmd = cmd | SWD_CMD_START | SWD_CMD_PARK;
+	t->data = data;
+	t->dst = dst;
+	t->ap_delay_clk = ap_delay_clk;
+	t->ctrl_stat = false;
+
+	if (!(cmd & (SWD_CMD_APnDP | SWD_CMD_RnW))) {
+		uint8_t reg = (cmd & SWD_CMD_A32) >> 1;
+		if (reg == DP_SELECT)
+			swd_queue.dp_bank = data & DP_SELECT_DPBANK;
+		else if (reg == DP_CTRL_STAT && swd_queue.dp_bank == 0)
+			t->ctrl_stat = true;
+	}
+
+	queued_retval = bitbang_swd_encode(t);
+	if (queued_retval == ERROR_OK)
+		swd_queue.num_transfers++;
+}
+
+static void bitbang_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay_clk)
+{
+	assert(cmd & SWD_CMD_RnW);
+	bitbang_swd_queue_cmd(cmd, value, 0, ap_delay_clk);
 }
 
 static void bitbang_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay_clk)
 {
-	LOG_DEBUG("bitbang_swd_write_reg");
 	assert(!(cmd & SWD_CMD_RnW));
-
-	if (queued_retval != ERROR_OK) {
-		LOG_DEBUG("Skip bitbang_swd_write_reg because queued_retval=%d", queued_retval);
-		return;
-	}
-
-	for (;;) {
-		uint8_t trn_ack_data_parity_trn[DIV_ROUND_UP(4 + 3 + 32 + 1 + 4, 8)];
-		buf_set_u32(trn_ack_data_parity_trn, 1 + 3 + 1, 32, value);
-		buf_set_u32(trn_ack_data_parity_trn, 1 + 3 + 1 + 32, 1, parity_u32(value));
-
-		cmd |= SWD_CMD_START | (1 << 7);
-		bitbang_exchange(false, &cmd, 0, 8);
-
-		bitbang_interface->swdio_drive(false);
-		bitbang_exchange(true, trn_ack_data_parity_trn, 0, 1 + 3 + 1);
-		bitbang_interface->swdio_drive(true);
-		bitbang_exchange(false, trn_ack_data_parity_trn, 1 + 3 + 1, 32 + 1);
-
-		int ack = buf_get_u32(trn_ack_data_parity_trn, 1, 3);
-		LOG_DEBUG("%s %s %s reg %X = %08"PRIx32,
-			  ack == SWD_ACK_OK ? "OK" : ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK",
-			  cmd & SWD_CMD_APnDP ? "AP" : "DP",
-			  cmd & SWD_CMD_RnW ? "read" : "write",
-			  (cmd & SWD_CMD_A32) >> 1,
-			  buf_get_u32(trn_ack_data_parity_trn, 1 + 3 + 1, 32));
-
-		switch (ack) {
-		 case SWD_ACK_OK:
-			if (cmd & SWD_CMD_APnDP)
-				bitbang_exchange(true, NULL, 0, ap_delay_clk);
-			return;
-		 case SWD_ACK_WAIT:
-			LOG_DEBUG("SWD_ACK_WAIT");
-			swd_clear_sticky_errors();
-			break;
-		 case SWD_ACK_FAULT:
-			LOG_DEBUG("SWD_ACK_FAULT");
-			queued_retval = ack;
-			return;
-		 default:
-			LOG_DEBUG("No valid acknowledge: ack=%d", ack);
-			queued_retval = ack;
-			return;
-		}
-	}
+	bitbang_swd_queue_cmd(cmd, NULL, value, ap_delay_clk);
 }
 
 static int bitbang_swd_run_queue(void)
 {
-	LOG_DEBUG("bitbang_swd_run_queue");
-	/* A transaction must be followed by another transaction or at least 8 idle cycles to
-	 * ensure that data is clocked through the AP. */
-	bitbang_exchange(true, NULL, 0, 8);
+	LOG_DEBUG_IO("bitbang_swd_run_queue");
+
+	if (queued_retval == ERROR_OK) {
+		queued_retval = bitbang_swd_put_idle(8);
+		if (queued_retval == ERROR_OK)
+			queued_retval = bitbang_swd_flush();
+	}
+
+	swd_queue.num_transfers = 0;
+	swd_queue.num_bits = 0;
 
 	int retval = queued_retval;
 	queued_retval = ERROR_OK;
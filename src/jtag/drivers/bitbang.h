@@ -51,6 +51,26 @@ struct bitbang_interface {
 
 	/** Set TCK, TMS, and TDI to the given values. */
 	int (*write)(int tck, int tms, int tdi);
+
+	/** Optional: clock out num_bits bits in one go. Bit i is clocked by
+	 * driving TMS and TDI with TCK low, sampling TDO and raising TCK; TCK
+	 * is left low afterwards. A NULL tms or tdi buffer means all zeros, a
+	 * NULL tdo buffer means TDO is not needed. If tms_exit is set, TMS is
+	 * driven high for the last bit whatever tms holds, to leave a shift
+	 * state. tdo may be the same buffer as tdi; bits past num_bits in its
+	 * last byte are cleared. When not set, bitbang_shift_bits() falls back
+	 * to write() and read()/sample(). */
+	int (*shift_bits)(const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo,
+			unsigned num_bits, bool tms_exit);
+
+	/** Optional: clock out num_bits SWD bits in one go. For bit i, SWDIO is
+	 * driven with bit i of swdio if bit i of drive is set, and sampled into
+	 * bit i of swdio_in otherwise. SWDIO is set up while SWCLK is low and
+	 * SWCLK is raised afterwards, as with write(). When not set, the SWD
+	 * queue falls back to write(), swdio_drive() and swdio_read(). */
+	int (*swd_shift_bits)(const uint8_t *swdio, const uint8_t *drive,
+			uint8_t *swdio_in, unsigned num_bits);
+
 	int (*blink)(int on);
 	int (*swdio_read)(void);
 	void (*swdio_drive)(bool on);
@@ -61,6 +81,8 @@ const struct swd_driver bitbang_swd;
 extern bool swd_mode;
 
 int bitbang_execute_queue(void);
+int bitbang_shift_bits(const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo,
+		unsigned num_bits, bool tms_exit);
 
 extern struct bitbang_interface *bitbang_interface;
 void bitbang_switch_to_swd(void);
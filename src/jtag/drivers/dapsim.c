@@ -0,0 +1,1051 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/**
+ * @file
+ * Software model of an ADIv5 debug port, for running the ARM debug stack
+ * without any hardware attached.
+ *
+ * The model consists of an SWJ-DP (usable through both the SWD and the JTAG
+ * transport), a single AHB-AP with TAR auto-increment wrapping at 1 KiB
+ * boundaries, flash and RAM regions, a ROM table and a minimal Cortex-M
+ * debug block (DHCSR, DCRSR, DCRDR, DEMCR, AIRCR, DFSR, FPB and DWT).
+ * The core never executes instructions; resuming it with an enabled FPB
+ * comparator makes it halt at the comparator address, which is enough for
+ * algorithms ending in a breakpoint to complete.
+ *
+ * WAIT and FAULT responses can be injected periodically to exercise the
+ * error paths of the DAP code.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jtag/interface.h>
+#include <jtag/swd.h>
+#include <jtag/commands.h>
+#include <target/arm_adi_v5.h>
+#include <target/cortex_m.h>
+#include <helper/binarybuffer.h>
+
+#define DAPSIM_DPIDR		0x2ba01477
+#define DAPSIM_JTAG_IDCODE	0x4ba00477
+#define DAPSIM_AP_IDR		0x24770011
+#define DAPSIM_CPUID		0x410fc241
+
+/* JTAG-DP instructions, IR length is 4 */
+#define DAPSIM_IR_LEN		4
+#define DAPSIM_IR_ABORT		0x8
+#define DAPSIM_IR_DPACC		0xA
+#define DAPSIM_IR_APACC		0xB
+#define DAPSIM_IR_IDCODE	0xE
+#define DAPSIM_IR_BYPASS	0xF
+
+#define DAPSIM_JTAG_ACK_OK_FAULT	0x2
+#define DAPSIM_JTAG_ACK_WAIT		0x1
+
+/* TAR auto-increment is only guaranteed within a 1 KiB block */
+#define DAPSIM_TAR_WRAP		0x400
+
+#define DAPSIM_PPB_BASE		0xE0000000
+#define DAPSIM_PPB_END		0xE0100000
+#define DAPSIM_SCS_SIZE		0x10000
+#define DAPSIM_ROM_TABLE	0xE00FF000
+#define DAPSIM_ROM_SIZE		0x1000
+
+#define DAPSIM_NUM_CORE_REGS	0x80
+#define DAPSIM_NUM_FP_COMP	6
+
+#define DAPSIM_STICKY_MASK	(SSTICKYORUN | SSTICKYCMP | SSTICKYERR | WDATAERR)
+#define DAPSIM_CTRL_ACK_MASK	(CDBGRSTACK | CDBGPWRUPACK | CSYSPWRUPACK)
+
+struct dapsim_region {
+	const char *name;
+	uint32_t base;
+	uint32_t size;
+	uint8_t *data;
+	uint8_t erased_value;
+};
+
+static struct dapsim_region dapsim_regions[] = {
+	{ .name = "flash", .base = 0x00000000, .size = 256 * 1024, .erased_value = 0xff },
+	{ .name = "ram", .base = 0x20000000, .size = 64 * 1024, .erased_value = 0x00 },
+};
+
+struct dapsim_stats {
+	uint64_t runs;
+	uint64_t dp_reads;
+	uint64_t dp_writes;
+	uint64_t ap_reads;
+	uint64_t ap_writes;
+	uint64_t mem_reads;
+	uint64_t mem_writes;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t waits;
+	uint64_t faults;
+	uint64_t jtag_scans;
+};
+
+static struct dapsim_stats dapsim_stats;
+
+/* Fault injection, a period of 0 disables it */
+static unsigned int dapsim_wait_period;
+static unsigned int dapsim_fault_period;
+static unsigned int dapsim_ap_accesses;
+static unsigned int dapsim_mem_accesses;
+
+/* Debug port and MEM-AP state */
+static uint32_t dapsim_ctrl_stat;
+static uint32_t dapsim_select;
+static uint32_t dapsim_rdbuff;
+static uint32_t dapsim_csw;
+static uint32_t dapsim_tar;
+
+/* JTAG-DP state */
+static unsigned int dapsim_ir = DAPSIM_IR_IDCODE;
+static uint32_t dapsim_jtag_result;
+
+/* Private peripheral bus: the SCS block and the ROM table */
+static uint8_t *dapsim_scs;
+static uint8_t *dapsim_rom;
+
+/* Cortex-M core state */
+static uint32_t dapsim_core_regs[DAPSIM_NUM_CORE_REGS];
+static uint32_t dapsim_dhcsr_ctrl;
+static uint32_t dapsim_dcrdr;
+static uint32_t dapsim_demcr;
+static uint32_t dapsim_dfsr;
+static uint32_t dapsim_aircr;
+static bool dapsim_fp_enabled;
+static bool dapsim_halted;
+static bool dapsim_in_reset;
+static bool dapsim_reset_st;
+static bool dapsim_retire_st;
+
+static int dapsim_queued_retval;
+
+enum dapsim_ack {
+	DAPSIM_OK,
+	DAPSIM_WAIT,
+	DAPSIM_FAULT,
+};
+
+static struct dapsim_region *dapsim_find_region(uint32_t address, unsigned int size)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(dapsim_regions); i++) {
+		struct dapsim_region *region = &dapsim_regions[i];
+		if (region->data && address >= region->base
+				&& address - region->base <= region->size - size)
+			return region;
+	}
+	return NULL;
+}
+
+static uint32_t dapsim_scs_get(uint32_t address)
+{
+	return le_to_h_u32(dapsim_scs + (address - DAPSIM_PPB_BASE));
+}
+
+static void dapsim_scs_set(uint32_t address, uint32_t value)
+{
+	h_u32_to_le(dapsim_scs + (address - DAPSIM_PPB_BASE), value);
+}
+
+static int dapsim_read_u32(uint32_t address, uint32_t *value);
+
+static void dapsim_core_reset(void)
+{
+	uint32_t sp = 0, pc = 0;
+
+	struct dapsim_region *flash = &dapsim_regions[0];
+	dapsim_read_u32(flash->base, &sp);
+	dapsim_read_u32(flash->base + 4, &pc);
+
+	memset(dapsim_core_regs, 0, sizeof(dapsim_core_regs));
+	dapsim_core_regs[13] = sp;
+	dapsim_core_regs[15] = pc & ~1;
+	dapsim_core_regs[16] = 0x01000000;	/* xPSR, Thumb bit */
+	dapsim_core_regs[17] = sp;		/* MSP */
+	dapsim_reset_st = true;
+
+	if ((dapsim_dhcsr_ctrl & C_DEBUGEN) && (dapsim_demcr & VC_CORERESET)) {
+		dapsim_halted = true;
+		dapsim_dfsr |= DFSR_VCATCH;
+	} else {
+		dapsim_halted = false;
+	}
+}
+
+/* Let the "running" core stop at the first enabled FPB breakpoint, if any */
+static void dapsim_core_run(void)
+{
+	dapsim_halted = false;
+	dapsim_retire_st = true;
+
+	if (!dapsim_fp_enabled)
+		return;
+
+	for (unsigned int i = 0; i < DAPSIM_NUM_FP_COMP; i++) {
+		uint32_t comp = dapsim_scs_get(FP_COMP0 + 4 * i);
+		if (!(comp & 1))
+			continue;
+		dapsim_core_regs[15] = (comp & 0x1ffffffc)
+			| ((comp & FPCR_REPLACE_BKPT_HIGH) == FPCR_REPLACE_BKPT_HIGH ? 2 : 0);
+		dapsim_halted = true;
+		dapsim_dfsr |= DFSR_BKPT;
+		return;
+	}
+}
+
+static void dapsim_dhcsr_write(uint32_t value)
+{
+	if ((value & 0xffff0000) != DBGKEY)
+		return;
+
+	dapsim_dhcsr_ctrl = value & (C_DEBUGEN | C_HALT | C_STEP | C_MASKINTS);
+
+	if (!(dapsim_dhcsr_ctrl & C_DEBUGEN)) {
+		if (dapsim_halted)
+			dapsim_core_run();
+		return;
+	}
+
+	if (dapsim_dhcsr_ctrl & C_HALT) {
+		if (!dapsim_halted) {
+			dapsim_halted = true;
+			dapsim_dfsr |= DFSR_HALTED;
+		}
+	} else if (dapsim_halted && !dapsim_in_reset) {
+		if (dapsim_dhcsr_ctrl & C_STEP) {
+			dapsim_core_regs[15] += 2;
+			dapsim_retire_st = true;
+			dapsim_dfsr |= DFSR_HALTED;
+		} else {
+			dapsim_core_run();
+		}
+	}
+}
+
+static uint32_t dapsim_ppb_read(uint32_t address)
+{
+	uint32_t value;
+
+	if (address >= DAPSIM_ROM_TABLE)
+		return le_to_h_u32(dapsim_rom + (address - DAPSIM_ROM_TABLE));
+	if (address - DAPSIM_PPB_BASE >= DAPSIM_SCS_SIZE)
+		return 0;
+
+	switch (address) {
+		case CPUID:
+			return DAPSIM_CPUID;
+		case DCB_DHCSR:
+			value = dapsim_dhcsr_ctrl | S_REGRDY;
+			if (dapsim_halted)
+				value |= S_HALT;
+			if (dapsim_retire_st)
+				value |= S_RETIRE_ST;
+			if (dapsim_reset_st || dapsim_in_reset)
+				value |= S_RESET_ST;
+			dapsim_retire_st = false;
+			dapsim_reset_st = false;
+			return value;
+		case DCB_DCRDR:
+			return dapsim_dcrdr;
+		case DCB_DEMCR:
+			return dapsim_demcr;
+		case NVIC_AIRCR:
+			return 0xfa050000 | (dapsim_aircr & 0x700);
+		case NVIC_DFSR:
+			return dapsim_dfsr;
+		case FP_CTRL:
+			/* NUM_CODE = 6, NUM_LIT = 2 */
+			return 0x260 | (dapsim_fp_enabled ? 1 : 0);
+		case DWT_CTRL:
+			/* NUMCOMP = 4 */
+			return 0x40000000 | (dapsim_scs_get(address) & 0x0fffffff);
+		default:
+			return dapsim_scs_get(address);
+	}
+}
+
+static void dapsim_ppb_write(uint32_t address, uint32_t value)
+{
+	if (address >= DAPSIM_ROM_TABLE || address - DAPSIM_PPB_BASE >= DAPSIM_SCS_SIZE)
+		return;
+
+	switch (address) {
+		case CPUID:
+			break;
+		case DCB_DHCSR:
+			dapsim_dhcsr_write(value);
+			break;
+		case DCB_DCRSR:
+			if ((value & 0x7f) < DAPSIM_NUM_CORE_REGS) {
+				if (value & DCRSR_WnR)
+					dapsim_core_regs[value & 0x7f] = dapsim_dcrdr;
+				else
+					dapsim_dcrdr = dapsim_core_regs[value & 0x7f];
+			}
+			break;
+		case DCB_DCRDR:
+			dapsim_dcrdr = value;
+			break;
+		case DCB_DEMCR:
+			dapsim_demcr = value;
+			break;
+		case NVIC_AIRCR:
+			if ((value & 0xffff0000) != AIRCR_VECTKEY)
+				break;
+			dapsim_aircr = value & 0x700;
+			if (value & (AIRCR_SYSRESETREQ | AIRCR_VECTRESET))
+				dapsim_core_reset();
+			break;
+		case NVIC_DFSR:
+			dapsim_dfsr &= ~value;
+			break;
+		case FP_CTRL:
+			if (value & 2)
+				dapsim_fp_enabled = value & 1;
+			break;
+		default:
+			dapsim_scs_set(address, value);
+			break;
+	}
+}
+
+/* Accesses are naturally aligned, the value is in its byte lane(s) */
+static int dapsim_mem_read(uint32_t address, unsigned int size, uint32_t *value)
+{
+	unsigned int shift = 8 * (address & 3);
+	uint32_t mask = size == 4 ? 0xffffffff : ((1u << (8 * size)) - 1) << shift;
+
+	if (address & (size - 1))
+		return ERROR_FAIL;
+
+	if (address >= DAPSIM_PPB_BASE && address < DAPSIM_PPB_END) {
+		*value = dapsim_ppb_read(address & ~3) & mask;
+		return ERROR_OK;
+	}
+
+	struct dapsim_region *region = dapsim_find_region(address, size);
+	if (!region)
+		return ERROR_FAIL;
+
+	const uint8_t *p = region->data + (address - region->base);
+	uint32_t data = 0;
+	for (unsigned int i = 0; i < size; i++)
+		data |= (uint32_t)p[i] << (8 * i);
+	*value = data << shift;
+
+	return ERROR_OK;
+}
+
+static int dapsim_mem_write(uint32_t address, unsigned int size, uint32_t value)
+{
+	unsigned int shift = 8 * (address & 3);
+
+	if (address & (size - 1))
+		return ERROR_FAIL;
+
+	if (address >= DAPSIM_PPB_BASE && address < DAPSIM_PPB_END) {
+		if (size != 4) {
+			uint32_t mask = ((1u << (8 * size)) - 1) << shift;
+			value = (dapsim_ppb_read(address & ~3) & ~mask) | (value & mask);
+		}
+		dapsim_ppb_write(address & ~3, value);
+		return ERROR_OK;
+	}
+
+	struct dapsim_region *region = dapsim_find_region(address, size);
+	if (!region)
+		return ERROR_FAIL;
+
+	uint8_t *p = region->data + (address - region->base);
+	value >>= shift;
+	for (unsigned int i = 0; i < size; i++)
+		p[i] = value >> (8 * i);
+
+	return ERROR_OK;
+}
+
+static int dapsim_read_u32(uint32_t address, uint32_t *value)
+{
+	return dapsim_mem_read(address, 4, value);
+}
+
+static bool dapsim_inject(unsigned int *count, unsigned int period)
+{
+	(*count)++;
+	return period && (*count % period) == 0;
+}
+
+/* Data access through DRW or BD0-3, with auto-increment for DRW */
+static enum dapsim_ack dapsim_mem_ap_data(uint32_t address, bool increment, bool is_read,
+		uint32_t *value)
+{
+	unsigned int size = 1 << (dapsim_csw & CSW_SIZE_MASK);
+	int retval;
+
+	if (size > 4 || dapsim_inject(&dapsim_mem_accesses, dapsim_fault_period)) {
+		retval = ERROR_FAIL;
+	} else if (is_read) {
+		retval = dapsim_mem_read(address, size, value);
+		dapsim_stats.mem_reads++;
+		dapsim_stats.bytes_read += size;
+	} else {
+		retval = dapsim_mem_write(address, size, *value);
+		dapsim_stats.mem_writes++;
+		dapsim_stats.bytes_written += size;
+	}
+
+	if (retval != ERROR_OK) {
+		LOG_DEBUG_IO("dapsim: bus fault at 0x%8.8" PRIx32, address);
+		dapsim_ctrl_stat |= SSTICKYERR;
+		dapsim_stats.faults++;
+		return DAPSIM_FAULT;
+	}
+
+	if (increment && (dapsim_csw & CSW_ADDRINC_MASK) != CSW_ADDRINC_OFF)
+		dapsim_tar = (dapsim_tar & ~(DAPSIM_TAR_WRAP - 1))
+			| ((dapsim_tar + size) & (DAPSIM_TAR_WRAP - 1));
+
+	return DAPSIM_OK;
+}
+
+static enum dapsim_ack dapsim_ap_access(unsigned int reg, bool is_read, uint32_t *value)
+{
+	unsigned int ap = dapsim_select >> 24;
+	unsigned int address = (dapsim_select & DP_SELECT_APBANK) | reg;
+
+	if (dapsim_inject(&dapsim_ap_accesses, dapsim_wait_period)) {
+		dapsim_stats.waits++;
+		return DAPSIM_WAIT;
+	}
+
+	if (is_read)
+		dapsim_stats.ap_reads++;
+	else
+		dapsim_stats.ap_writes++;
+
+	/* Only AP #0 is implemented, the others read as zero */
+	if (ap != 0) {
+		if (is_read)
+			*value = 0;
+		return DAPSIM_OK;
+	}
+
+	switch (address) {
+		case MEM_AP_REG_CSW:
+			if (is_read) {
+				*value = dapsim_csw | CSW_DEVICE_EN;
+			} else {
+				/* Packed transfers are not implemented */
+				dapsim_csw = *value & ~(CSW_DEVICE_EN | CSW_TRIN_PROG);
+				if ((dapsim_csw & CSW_ADDRINC_MASK) == CSW_ADDRINC_PACKED)
+					dapsim_csw = (dapsim_csw & ~CSW_ADDRINC_MASK) | CSW_ADDRINC_SINGLE;
+			}
+			return DAPSIM_OK;
+		case MEM_AP_REG_TAR:
+			if (is_read)
+				*value = dapsim_tar;
+			else
+				dapsim_tar = *value;
+			return DAPSIM_OK;
+		case MEM_AP_REG_DRW:
+			return dapsim_mem_ap_data(dapsim_tar, true, is_read, value);
+		case MEM_AP_REG_BD0:
+		case MEM_AP_REG_BD1:
+		case MEM_AP_REG_BD2:
+		case MEM_AP_REG_BD3:
+			return dapsim_mem_ap_data((dapsim_tar & ~0xf) | (address & 0xc), false, is_read, value);
+		case MEM_AP_REG_BASE:
+			if (is_read)
+				*value = DAPSIM_ROM_TABLE | 3;
+			return DAPSIM_OK;
+		case AP_REG_IDR:
+			if (is_read)
+				*value = DAPSIM_AP_IDR;
+			return DAPSIM_OK;
+		default:
+			if (is_read)
+				*value = 0;
+			return DAPSIM_OK;
+	}
+}
+
+static uint32_t dapsim_ctrl_stat_read(void)
+{
+	uint32_t value = dapsim_ctrl_stat;
+
+	if (value & CDBGRSTREQ)
+		value |= CDBGRSTACK;
+	if (value & CDBGPWRUPREQ)
+		value |= CDBGPWRUPACK;
+	if (value & CSYSPWRUPREQ)
+		value |= CSYSPWRUPACK;
+
+	return value;
+}
+
+static void dapsim_ctrl_stat_write(uint32_t value)
+{
+	uint32_t sticky = dapsim_ctrl_stat & DAPSIM_STICKY_MASK;
+
+	dapsim_ctrl_stat = (value & ~(DAPSIM_STICKY_MASK | DAPSIM_CTRL_ACK_MASK | READOK)) | sticky;
+}
+
+static void dapsim_abort_write(uint32_t value)
+{
+	if (value & STKCMPCLR)
+		dapsim_ctrl_stat &= ~SSTICKYCMP;
+	if (value & STKERRCLR)
+		dapsim_ctrl_stat &= ~SSTICKYERR;
+	if (value & WDERRCLR)
+		dapsim_ctrl_stat &= ~WDATAERR;
+	if (value & ORUNERRCLR)
+		dapsim_ctrl_stat &= ~SSTICKYORUN;
+}
+
+static uint32_t dapsim_dp_read(unsigned int reg)
+{
+	dapsim_stats.dp_reads++;
+
+	switch (reg) {
+		case DP_DPIDR:
+			return DAPSIM_DPIDR;
+		case DP_CTRL_STAT:
+			/* Only bank 0 is implemented */
+			return (dapsim_select & DP_SELECT_DPBANK) ? 0 : dapsim_ctrl_stat_read();
+		case DP_SELECT:
+			return dapsim_select;
+		default:
+			return 0;
+	}
+}
+
+static void dapsim_dp_write(unsigned int reg, uint32_t value)
+{
+	dapsim_stats.dp_writes++;
+
+	switch (reg) {
+		case DP_CTRL_STAT:
+			if (!(dapsim_select & DP_SELECT_DPBANK))
+				dapsim_ctrl_stat_write(value);
+			break;
+		case DP_SELECT:
+			dapsim_select = value;
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * SWD transport
+ */
+
+static enum dapsim_ack dapsim_swd_transfer(uint8_t cmd, uint32_t *value)
+{
+	unsigned int reg = (cmd & SWD_CMD_A32) >> 1;
+	bool is_read = cmd & SWD_CMD_RnW;
+
+	if (!(cmd & SWD_CMD_APnDP)) {
+		if (is_read) {
+			if (reg == DP_RDBUFF) {
+				dapsim_stats.dp_reads++;
+				*value = dapsim_rdbuff;
+			} else {
+				*value = dapsim_dp_read(reg);
+			}
+		} else if (reg == DP_ABORT) {
+			dapsim_stats.dp_writes++;
+			dapsim_abort_write(*value);
+		} else {
+			dapsim_dp_write(reg, *value);
+		}
+		return DAPSIM_OK;
+	}
+
+	/* AP accesses are not performed while a sticky error is pending */
+	if (dapsim_ctrl_stat & SSTICKYERR)
+		return DAPSIM_FAULT;
+
+	/* AP reads are posted: return the previous result, keep this one in RDBUFF */
+	uint32_t data = *value;
+	enum dapsim_ack ack = dapsim_ap_access(reg, is_read, &data);
+	if (ack == DAPSIM_OK && is_read) {
+		*value = dapsim_rdbuff;
+		dapsim_rdbuff = data;
+	}
+	return ack;
+}
+
+static void dapsim_swd_queue(uint8_t cmd, uint32_t *value)
+{
+	if (dapsim_queued_retval != ERROR_OK) {
+		LOG_DEBUG_IO("Skip dapsim SWD transaction because queued_retval=%d",
+				dapsim_queued_retval);
+		return;
+	}
+
+	/* Like a real adapter, retry transactions answered with WAIT */
+	for (;;) {
+		enum dapsim_ack ack = dapsim_swd_transfer(cmd, value);
+
+		switch (ack) {
+			case DAPSIM_OK:
+				return;
+			case DAPSIM_WAIT:
+				LOG_DEBUG_IO("SWD_ACK_WAIT");
+				break;
+			case DAPSIM_FAULT:
+				LOG_DEBUG_IO("SWD_ACK_FAULT");
+				dapsim_queued_retval = SWD_ACK_FAULT;
+				return;
+		}
+	}
+}
+
+static int dapsim_swd_init(void)
+{
+	return ERROR_OK;
+}
+
+static int dapsim_swd_switch_seq(enum swd_special_seq seq)
+{
+	switch (seq) {
+		case LINE_RESET:
+		case JTAG_TO_SWD:
+		case SWD_TO_JTAG:
+		case SWD_TO_DORMANT:
+		case DORMANT_TO_SWD:
+			LOG_DEBUG("dapsim: switch sequence %d", seq);
+			return ERROR_OK;
+		default:
+			LOG_ERROR("Sequence %d not supported", seq);
+			return ERROR_FAIL;
+	}
+}
+
+static void dapsim_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay_clk)
+{
+	uint32_t data = 0;
+
+	assert(cmd & SWD_CMD_RnW);
+	dapsim_swd_queue(cmd, &data);
+	if (value && dapsim_queued_retval == ERROR_OK)
+		*value = data;
+}
+
+static void dapsim_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay_clk)
+{
+	assert(!(cmd & SWD_CMD_RnW));
+	dapsim_swd_queue(cmd, &value);
+}
+
+static int dapsim_swd_run_queue(void)
+{
+	int retval = dapsim_queued_retval;
+
+	dapsim_stats.runs++;
+	dapsim_queued_retval = ERROR_OK;
+	return retval;
+}
+
+/*
+ * JTAG transport, a single JTAG-DP TAP
+ */
+
+static void dapsim_jtag_dr_scan(uint8_t *buffer, int num_bits)
+{
+	if (dapsim_ir == DAPSIM_IR_IDCODE) {
+		buf_set_u32(buffer, 0, MIN(num_bits, 32), DAPSIM_JTAG_IDCODE);
+		return;
+	}
+
+	if ((dapsim_ir != DAPSIM_IR_DPACC && dapsim_ir != DAPSIM_IR_APACC
+			&& dapsim_ir != DAPSIM_IR_ABORT) || num_bits < 35) {
+		/* BYPASS, or a scan we can't make sense of */
+		buf_set_u32(buffer, 0, 1, 0);
+		return;
+	}
+
+	unsigned int request = buf_get_u32(buffer, 0, 3);
+	uint32_t data = buf_get_u32(buffer, 3, 32);
+	uint32_t captured = dapsim_jtag_result;
+	unsigned int ack = DAPSIM_JTAG_ACK_OK_FAULT;
+	bool is_read = request & 1;
+	unsigned int reg = (request & 6) << 1;
+
+	if (dapsim_ir == DAPSIM_IR_ABORT) {
+		dapsim_stats.dp_writes++;
+	} else if (dapsim_ir == DAPSIM_IR_DPACC) {
+		if (is_read) {
+			/* RDBUFF just collects the result of the previous access */
+			if (reg != DP_RDBUFF)
+				dapsim_jtag_result = dapsim_dp_read(reg);
+		} else {
+			/* Sticky flags are cleared by writing ones to CTRL/STAT */
+			if (reg == DP_CTRL_STAT)
+				dapsim_ctrl_stat &= ~(data & DAPSIM_STICKY_MASK);
+			dapsim_dp_write(reg, data);
+		}
+	} else if (!(dapsim_ctrl_stat & SSTICKYERR)) {
+		/* APACC, discarded while a sticky error is pending */
+		if (dapsim_ap_access(reg, is_read, &data) == DAPSIM_WAIT)
+			ack = DAPSIM_JTAG_ACK_WAIT;
+		else if (is_read)
+			dapsim_jtag_result = data;
+	}
+
+	buf_set_u32(buffer, 0, 3, ack);
+	buf_set_u32(buffer, 3, 32, captured);
+}
+
+static int dapsim_jtag_scan(struct scan_command *cmd)
+{
+	uint8_t *buffer;
+	int num_bits = jtag_build_buffer(cmd, &buffer);
+
+	dapsim_stats.jtag_scans++;
+
+	if (cmd->ir_scan) {
+		dapsim_ir = buf_get_u32(buffer, 0, MIN(num_bits, DAPSIM_IR_LEN));
+		buf_set_u32(buffer, 0, MIN(num_bits, DAPSIM_IR_LEN), 0x1);
+	} else {
+		dapsim_jtag_dr_scan(buffer, num_bits);
+	}
+
+	int retval = jtag_read_buffer(buffer, cmd);
+	free(buffer);
+
+	tap_set_state(cmd->end_state);
+	return retval;
+}
+
+static void dapsim_tap_reset(void)
+{
+	dapsim_ir = DAPSIM_IR_IDCODE;
+	tap_set_state(TAP_RESET);
+}
+
+static int dapsim_execute_queue(void)
+{
+	int retval = ERROR_OK;
+
+	for (struct jtag_command *cmd = jtag_command_queue; cmd; cmd = cmd->next) {
+		switch (cmd->type) {
+			case JTAG_RUNTEST:
+				tap_set_state(cmd->cmd.runtest->end_state);
+				break;
+			case JTAG_STABLECLOCKS:
+				break;
+			case JTAG_TLR_RESET:
+				dapsim_tap_reset();
+				tap_set_state(cmd->cmd.statemove->end_state);
+				break;
+			case JTAG_PATHMOVE:
+				tap_set_state(cmd->cmd.pathmove->path[cmd->cmd.pathmove->num_states - 1]);
+				break;
+			case JTAG_TMS:
+				for (unsigned int i = 0; i < cmd->cmd.tms->num_bits; i++) {
+					bool tms = (cmd->cmd.tms->bits[i / 8] >> (i % 8)) & 1;
+					tap_set_state(tap_state_transition(tap_get_state(), tms));
+					if (tap_get_state() == TAP_RESET)
+						dapsim_ir = DAPSIM_IR_IDCODE;
+				}
+				break;
+			case JTAG_SLEEP:
+				jtag_sleep(cmd->cmd.sleep->us);
+				break;
+			case JTAG_SCAN:
+				if (dapsim_jtag_scan(cmd->cmd.scan) != ERROR_OK)
+					retval = ERROR_JTAG_QUEUE_FAILED;
+				break;
+			default:
+				LOG_ERROR("BUG: unknown JTAG command type encountered");
+				return ERROR_FAIL;
+		}
+	}
+
+	dapsim_stats.runs++;
+	return retval;
+}
+
+/*
+ * Adapter driver
+ */
+
+static int dapsim_quit(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(dapsim_regions); i++) {
+		free(dapsim_regions[i].data);
+		dapsim_regions[i].data = NULL;
+	}
+	free(dapsim_scs);
+	dapsim_scs = NULL;
+	free(dapsim_rom);
+	dapsim_rom = NULL;
+
+	return ERROR_OK;
+}
+
+static int dapsim_init(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(dapsim_regions); i++) {
+		struct dapsim_region *region = &dapsim_regions[i];
+		region->data = malloc(region->size);
+		if (!region->data) {
+			LOG_ERROR("dapsim: can't allocate %" PRIu32 " bytes of %s",
+					region->size, region->name);
+			goto error;
+		}
+		memset(region->data, region->erased_value, region->size);
+	}
+
+	dapsim_scs = calloc(1, DAPSIM_SCS_SIZE);
+	dapsim_rom = calloc(1, DAPSIM_ROM_SIZE);
+	if (!dapsim_scs || !dapsim_rom) {
+		LOG_ERROR("dapsim: can't allocate the system control space");
+		goto error;
+	}
+
+	/* ROM table with SCS, DWT, FPB and ITM entries */
+	static const uint32_t rom_entries[] = { 0xfff0f003, 0xfff02003, 0xfff03003, 0xfff01003, 0 };
+	for (size_t i = 0; i < ARRAY_SIZE(rom_entries); i++)
+		h_u32_to_le(dapsim_rom + 4 * i, rom_entries[i]);
+	static const uint8_t rom_pid[] = { 0xc4, 0xb4, 0x0b, 0x00 };
+	static const uint8_t rom_cid[] = { 0x0d, 0x10, 0x05, 0xb1 };
+	for (size_t i = 0; i < 4; i++) {
+		h_u32_to_le(dapsim_rom + 0xfe0 + 4 * i, rom_pid[i]);
+		h_u32_to_le(dapsim_rom + 0xff0 + 4 * i, rom_cid[i]);
+	}
+	h_u32_to_le(dapsim_rom + 0xfcc, 1);	/* MEMTYPE: system memory present */
+	h_u32_to_le(dapsim_rom + 0xfd0, 0x04);	/* PIDR4 */
+
+	/* Component identification of the SCS */
+	static const uint8_t scs_pid[] = { 0x0c, 0xb0, 0x0b, 0x00 };
+	static const uint8_t scs_cid[] = { 0x0d, 0xe0, 0x05, 0xb1 };
+	for (size_t i = 0; i < 4; i++) {
+		dapsim_scs_set(0xe000efe0 + 4 * i, scs_pid[i]);
+		dapsim_scs_set(0xe000eff0 + 4 * i, scs_cid[i]);
+	}
+	dapsim_scs_set(0xe000efd0, 0x04);
+
+	dapsim_ctrl_stat = 0;
+	dapsim_select = 0;
+	dapsim_queued_retval = ERROR_OK;
+	dapsim_tap_reset();
+	dapsim_core_reset();
+
+	LOG_INFO("dapsim: flash %" PRIu32 " KiB at 0x%8.8" PRIx32 ", ram %" PRIu32 " KiB at 0x%8.8" PRIx32,
+			dapsim_regions[0].size / 1024, dapsim_regions[0].base,
+			dapsim_regions[1].size / 1024, dapsim_regions[1].base);
+
+	return ERROR_OK;
+
+error:
+	dapsim_quit();
+	return ERROR_FAIL;
+}
+
+static int dapsim_reset(int trst, int srst)
+{
+	if (trst)
+		dapsim_tap_reset();
+
+	if (srst) {
+		dapsim_in_reset = true;
+	} else if (dapsim_in_reset) {
+		dapsim_in_reset = false;
+		dapsim_core_reset();
+	}
+
+	return ERROR_OK;
+}
+
+static int dapsim_speed(int speed)
+{
+	return ERROR_OK;
+}
+
+static int dapsim_khz(int khz, int *jtag_speed)
+{
+	*jtag_speed = khz;
+	return ERROR_OK;
+}
+
+static int dapsim_speed_div(int speed, int *khz)
+{
+	*khz = speed;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(dapsim_handle_memory_command)
+{
+	if (CMD_ARGC != 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct dapsim_region *region = NULL;
+	for (size_t i = 0; i < ARRAY_SIZE(dapsim_regions); i++)
+		if (strcmp(CMD_ARGV[0], dapsim_regions[i].name) == 0)
+			region = &dapsim_regions[i];
+	if (!region)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	uint32_t base, size;
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], base);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[2], size);
+
+	if (size == 0 || (base & 3) || (size & 3) || base + (size - 1) < base
+			|| (base < DAPSIM_PPB_END && base + (size - 1) >= DAPSIM_PPB_BASE)) {
+		command_print(CMD, "invalid %s region 0x%8.8" PRIx32 "+0x%" PRIx32,
+				region->name, base, size);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	region->base = base;
+	region->size = size;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(dapsim_handle_inject_command)
+{
+	unsigned int *period;
+
+	if (CMD_ARGC < 1 || CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (strcmp(CMD_ARGV[0], "wait") == 0)
+		period = &dapsim_wait_period;
+	else if (strcmp(CMD_ARGV[0], "fault") == 0)
+		period = &dapsim_fault_period;
+	else
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 2) {
+		unsigned int value;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], value);
+		/* Every access answered with WAIT would never complete */
+		if (period == &dapsim_wait_period && value == 1) {
+			command_print(CMD, "wait period must be 0 or at least 2");
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		*period = value;
+	}
+
+	command_print(CMD, "dapsim %s period %u", CMD_ARGV[0], *period);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(dapsim_handle_stats_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "reset") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		memset(&dapsim_stats, 0, sizeof(dapsim_stats));
+		return ERROR_OK;
+	}
+
+	command_print(CMD, "runs %" PRIu64, dapsim_stats.runs);
+	command_print(CMD, "dp_reads %" PRIu64, dapsim_stats.dp_reads);
+	command_print(CMD, "dp_writes %" PRIu64, dapsim_stats.dp_writes);
+	command_print(CMD, "ap_reads %" PRIu64, dapsim_stats.ap_reads);
+	command_print(CMD, "ap_writes %" PRIu64, dapsim_stats.ap_writes);
+	command_print(CMD, "mem_reads %" PRIu64, dapsim_stats.mem_reads);
+	command_print(CMD, "mem_writes %" PRIu64, dapsim_stats.mem_writes);
+	command_print(CMD, "bytes_read %" PRIu64, dapsim_stats.bytes_read);
+	command_print(CMD, "bytes_written %" PRIu64, dapsim_stats.bytes_written);
+	command_print(CMD, "waits %" PRIu64, dapsim_stats.waits);
+	command_print(CMD, "faults %" PRIu64, dapsim_stats.faults);
+	command_print(CMD, "jtag_scans %" PRIu64, dapsim_stats.jtag_scans);
+
+	return ERROR_OK;
+}
+
+static const struct command_registration dapsim_subcommand_handlers[] = {
+	{
+		.name = "memory",
+		.handler = &dapsim_handle_memory_command,
+		.mode = COMMAND_CONFIG,
+		.help = "set the location and size of a simulated memory region",
+		.usage = "('flash'|'ram') base size",
+	},
+	{
+		.name = "inject",
+		.handler = &dapsim_handle_inject_command,
+		.mode = COMMAND_ANY,
+		.help = "answer every n-th AP access with WAIT, or every n-th "
+			"memory access with a bus fault; 0 disables",
+		.usage = "('wait'|'fault') [period]",
+	},
+	{
+		.name = "stats",
+		.handler = &dapsim_handle_stats_command,
+		.mode = COMMAND_ANY,
+		.help = "show or reset the simulated transaction counters",
+		.usage = "['reset']",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const struct command_registration dapsim_command_handlers[] = {
+	{
+		.name = "dapsim",
+		.mode = COMMAND_ANY,
+		.help = "perform dapsim management",
+		.usage = "",
+		.chain = dapsim_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const struct swd_driver dapsim_swd_driver = {
+	.init = dapsim_swd_init,
+	.switch_seq = dapsim_swd_switch_seq,
+	.read_reg = dapsim_swd_read_reg,
+	.write_reg = dapsim_swd_write_reg,
+	.run = dapsim_swd_run_queue,
+};
+
+static const char * const dapsim_transports[] = { "swd", "jtag", NULL };
+
+static struct jtag_interface dapsim_interface = {
+	.supported = DEBUG_CAP_TMS_SEQ,
+	.execute_queue = dapsim_execute_queue,
+};
+
+struct adapter_driver dapsim_adapter_driver = {
+	.name = "dapsim",
+	.transports = dapsim_transports,
+	.commands = dapsim_command_handlers,
+
+	.init = dapsim_init,
+	.quit = dapsim_quit,
+	.reset = dapsim_reset,
+	.speed = dapsim_speed,
+	.khz = dapsim_khz,
+	.speed_div = dapsim_speed_div,
+
+	.jtag_ops = &dapsim_interface,
+	.swd_ops = &dapsim_swd_driver,
+};
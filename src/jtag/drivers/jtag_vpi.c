@@ -49,6 +49,20 @@
 #define CMD_SCAN_CHAIN_FLIP_TMS	3
 #define CMD_STOP_SIMU		4
 
+/* In variable length mode a packet is the 12 byte header (cmd, length,
+ * nb_bits, each little endian) followed by "length" bytes of buffer_out.
+ * Scan commands are answered by exactly "length" bytes of buffer_in and
+ * nothing else is answered. Packets are streamed without waiting, replies
+ * are collected when the TDO data is needed. */
+#define VPI_HEADER_SIZE		12
+
+/* Flush the outgoing stream once this much has accumulated */
+#define VPI_SEND_BUF_SIZE	(64 * 1024)
+
+/* Never let the server owe us more than this, so that it can not block on
+ * a full socket while we are still writing to it. */
+#define VPI_MAX_PENDING_REPLY	(32 * 1024)
+
 /* jtag_vpi server port and address to connect to */
 static int server_port = SERVER_PORT;
 static char *server_address;
@@ -56,6 +70,9 @@ static char *server_address;
 /* Send CMD_STOP_SIMU to server when OpenOCD exits? */
 static bool stop_sim_on_exit;
 
+/* Use variable length, pipelined packets? */
+static bool variable_length;
+
 static int sockfd;
 static struct sockaddr_in serv_addr;
 
@@ -77,6 +94,32 @@ struct vpi_cmd {
 	};
 };
 
+/* Outgoing packets not yet written to the socket (variable length mode) */
+static uint8_t *send_buf;
+static unsigned send_buf_len;
+
+/* Replies the server still owes us, in the order they will arrive.
+ * A NULL buffer means the data is not needed and is discarded. */
+struct vpi_pending_reply {
+	uint8_t *buf;
+	unsigned length;
+};
+
+static struct vpi_pending_reply *pending_replies;
+static unsigned pending_count;
+static unsigned pending_alloc;
+static unsigned pending_bytes;
+
+/* Scans of the current queue, handed back once their TDO has arrived */
+struct vpi_deferred_scan {
+	struct scan_command *cmd;
+	uint8_t *buf;
+};
+
+static struct vpi_deferred_scan *deferred_scans;
+static unsigned deferred_count;
+static unsigned deferred_alloc;
+
 static char *jtag_vpi_cmd_to_str(int cmd_num)
 {
 	switch (cmd_num) {
@@ -95,9 +138,180 @@ static char *jtag_vpi_cmd_to_str(int cmd_num)
 	}
 }
 
+static int jtag_vpi_write(const void *data, unsigned len)
+{
+	const char *p = data;
+
+	while (len) {
+		int retval = write_socket(sockfd, p, len);
+
+		if (retval < 0) {
+			/* Account for the case when socket write is interrupted. */
+#ifdef _WIN32
+			int wsa_err = WSAGetLastError();
+			if (wsa_err == WSAEINTR)
+				continue;
+#else
+			if (errno == EINTR)
+				continue;
+#endif
+			/* Otherwise this is an error using the socket, most likely fatal
+			   for the connection. B*/
+			log_socket_error("jtag_vpi xmit");
+			/* TODO: Clean way how adapter drivers can report fatal errors
+			   to upper layers of OpenOCD and let it perform an orderly shutdown? */
+			exit(-1);
+		} else if (retval == 0) {
+			/* This means we could not send all data, which is most likely fatal
+			   for the jtag_vpi connection (the underlying TCP connection likely not
+			   usable anymore) */
+			LOG_ERROR("Could not send all data through jtag_vpi connection.");
+			exit(-1);
+		}
+
+		p += retval;
+		len -= retval;
+	}
+
+	/* Otherwise the data has been sent successfully. */
+	return ERROR_OK;
+}
+
+static int jtag_vpi_read(void *data, unsigned len)
+{
+	unsigned bytes_buffered = 0;
+	while (bytes_buffered < len) {
+		int bytes_to_receive = len - bytes_buffered;
+		int retval = read_socket(sockfd, ((char *)data) + bytes_buffered, bytes_to_receive);
+		if (retval < 0) {
+#ifdef _WIN32
+			int wsa_err = WSAGetLastError();
+			if (wsa_err == WSAEINTR) {
+				/* socket read interrupted by WSACancelBlockingCall() */
+				continue;
+			}
+#else
+			if (errno == EINTR) {
+				/* socket read interrupted by a signal */
+				continue;
+			}
+#endif
+			/* Otherwise, this is an error when accessing the socket. */
+			log_socket_error("jtag_vpi recv");
+			exit(-1);
+		} else if (retval == 0) {
+			/* Connection closed by the other side */
+			LOG_ERROR("Connection prematurely closed by jtag_vpi server.");
+			exit(-1);
+		}
+		/* Otherwise, we have successfully received some data */
+		bytes_buffered += retval;
+	}
+
+	return ERROR_OK;
+}
+
+static int jtag_vpi_flush_send_buf(void)
+{
+	int retval = jtag_vpi_write(send_buf, send_buf_len);
+	send_buf_len = 0;
+	return retval;
+}
+
+/* Write out everything queued so far and collect all outstanding replies. */
+static int jtag_vpi_sync(void)
+{
+	uint8_t discard[XFERT_MAX_SIZE];
+	int retval = jtag_vpi_flush_send_buf();
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned i = 0; i < pending_count; i++) {
+		struct vpi_pending_reply *p = &pending_replies[i];
+		retval = jtag_vpi_read(p->buf ? p->buf : discard, p->length);
+		if (retval != ERROR_OK)
+			return retval;
+
+		/* Optional low-level JTAG debug */
+		if (p->buf && LOG_LEVEL_IS(LOG_LVL_DEBUG_IO)) {
+			unsigned nb_bits = p->length * 8;
+			char *char_buf = buf_to_str(p->buf,
+					(nb_bits > DEBUG_JTAG_IOZ) ? DEBUG_JTAG_IOZ : nb_bits,
+					16);
+			LOG_DEBUG_IO("recvd JTAG VPI data: length=%u, buf_in=0x%s%s",
+				p->length, char_buf, (nb_bits > DEBUG_JTAG_IOZ) ? "(...)" : "");
+			free(char_buf);
+		}
+	}
+
+	pending_count = 0;
+	pending_bytes = 0;
+	return ERROR_OK;
+}
+
+/* After an error part of the queue was never sent. Send what is still
+ * buffered and read and drop every reply the server owes us, so that the
+ * next queue starts in step with the stream. */
+static void jtag_vpi_discard_replies(void)
+{
+	uint8_t discard[XFERT_MAX_SIZE];
+
+	if (jtag_vpi_flush_send_buf() == ERROR_OK) {
+		for (unsigned i = 0; i < pending_count; i++)
+			jtag_vpi_read(discard, pending_replies[i].length);
+	}
+
+	pending_count = 0;
+	pending_bytes = 0;
+}
+
+/* Note that the server will answer with length bytes for buf. */
+static int jtag_vpi_expect_reply(uint8_t *buf, unsigned length)
+{
+	if (pending_bytes + length > VPI_MAX_PENDING_REPLY) {
+		int retval = jtag_vpi_sync();
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	if (pending_count == pending_alloc) {
+		unsigned alloc = pending_alloc ? pending_alloc * 2 : 64;
+		struct vpi_pending_reply *p = realloc(pending_replies, alloc * sizeof(*p));
+		if (!p) {
+			LOG_ERROR("jtag_vpi: out of memory");
+			return ERROR_FAIL;
+		}
+		pending_replies = p;
+		pending_alloc = alloc;
+	}
+
+	pending_replies[pending_count].buf = buf;
+	pending_replies[pending_count].length = length;
+	pending_count++;
+	pending_bytes += length;
+	return ERROR_OK;
+}
+
+static int jtag_vpi_queue_packet(struct vpi_cmd *vpi)
+{
+	if (send_buf_len + VPI_HEADER_SIZE + vpi->length > VPI_SEND_BUF_SIZE) {
+		int retval = jtag_vpi_flush_send_buf();
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	uint8_t *p = send_buf + send_buf_len;
+	h_u32_to_le(p, vpi->cmd);
+	h_u32_to_le(p + 4, vpi->length);
+	h_u32_to_le(p + 8, vpi->nb_bits);
+	memcpy(p + VPI_HEADER_SIZE, vpi->buffer_out, vpi->length);
+	send_buf_len += VPI_HEADER_SIZE + vpi->length;
+
+	return ERROR_OK;
+}
+
 static int jtag_vpi_send_cmd(struct vpi_cmd *vpi)
 {
-	int retval;
 
 	/* Optional low-level JTAG debug */
 	if (LOG_LEVEL_IS(LOG_LVL_DEBUG_IO)) {
@@ -129,6 +343,9 @@ static int jtag_vpi_send_cmd(struct vpi_cmd *vpi)
 		}
 	}
 
+	if (variable_length)
+		return jtag_vpi_queue_packet(vpi);
+
 	/* Use little endian when transmitting/receiving jtag_vpi cmds.
 	   The choice of little endian goes against usual networking conventions
 	   but is intentional to remain compatible with most older OpenOCD builds
@@ -137,67 +354,14 @@ static int jtag_vpi_send_cmd(struct vpi_cmd *vpi)
 	h_u32_to_le(vpi->length_buf, vpi->length);
 	h_u32_to_le(vpi->nb_bits_buf, vpi->nb_bits);
 
-retry_write:
-	retval = write_socket(sockfd, vpi, sizeof(struct vpi_cmd));
-
-	if (retval < 0) {
-		/* Account for the case when socket write is interrupted. */
-#ifdef _WIN32
-		int wsa_err = WSAGetLastError();
-		if (wsa_err == WSAEINTR)
-			goto retry_write;
-#else
-		if (errno == EINTR)
-			goto retry_write;
-#endif
-		/* Otherwise this is an error using the socket, most likely fatal
-		   for the connection. B*/
-		log_socket_error("jtag_vpi xmit");
-		/* TODO: Clean way how adapter drivers can report fatal errors
-		   to upper layers of OpenOCD and let it perform an orderly shutdown? */
-		exit(-1);
-	} else if (retval < (int)sizeof(struct vpi_cmd)) {
-		/* This means we could not send all data, which is most likely fatal
-		   for the jtag_vpi connection (the underlying TCP connection likely not
-		   usable anymore) */
-		LOG_ERROR("Could not send all data through jtag_vpi connection.");
-		exit(-1);
-	}
-
-	/* Otherwise the packet has been sent successfully. */
-	return ERROR_OK;
+	return jtag_vpi_write(vpi, sizeof(struct vpi_cmd));
 }
 
 static int jtag_vpi_receive_cmd(struct vpi_cmd *vpi)
 {
-	unsigned bytes_buffered = 0;
-	while (bytes_buffered < sizeof(struct vpi_cmd)) {
-		int bytes_to_receive = sizeof(struct vpi_cmd) - bytes_buffered;
-		int retval = read_socket(sockfd, ((char *)vpi) + bytes_buffered, bytes_to_receive);
-		if (retval < 0) {
-#ifdef _WIN32
-			int wsa_err = WSAGetLastError();
-			if (wsa_err == WSAEINTR) {
-				/* socket read interrupted by WSACancelBlockingCall() */
-				continue;
-			}
-#else
-			if (errno == EINTR) {
-				/* socket read interrupted by a signal */
-				continue;
-			}
-#endif
-			/* Otherwise, this is an error when accessing the socket. */
-			log_socket_error("jtag_vpi recv");
-			exit(-1);
-		} else if (retval == 0) {
-			/* Connection closed by the other side */
-			LOG_ERROR("Connection prematurely closed by jtag_vpi server.");
-			exit(-1);
-		}
-		/* Otherwise, we have successfully received some data */
-		bytes_buffered += retval;
-	}
+	int retval = jtag_vpi_read(vpi, sizeof(struct vpi_cmd));
+	if (retval != ERROR_OK)
+		return retval;
 
 	/* Use little endian when transmitting/receiving jtag_vpi cmds. */
 	vpi->cmd = le_to_h_u32(vpi->cmd_buf);
@@ -318,6 +482,16 @@ static int jtag_vpi_queue_tdi_xfer(uint8_t *bits, int nb_bits, int tap_shift)
 	vpi.length = nb_bytes;
 	vpi.nb_bits = nb_bits;
 
+	/* The reply lands straight in bits once the stream is synced. Note it
+	 * before queuing the packet, so that a packet is never sent without
+	 * its reply being accounted for. */
+	if (variable_length) {
+		int retval = jtag_vpi_expect_reply(bits, nb_bytes);
+		if (retval != ERROR_OK)
+			return retval;
+		return jtag_vpi_send_cmd(&vpi);
+	}
+
 	int retval = jtag_vpi_send_cmd(&vpi);
 	if (retval != ERROR_OK)
 		return retval;
@@ -386,6 +560,26 @@ static int jtag_vpi_clock_tms(int tms)
 	return jtag_vpi_tms_seq(tms ? &tms_1 : &tms_0, 1);
 }
 
+static int jtag_vpi_defer_scan(struct scan_command *cmd, uint8_t *buf)
+{
+	if (deferred_count == deferred_alloc) {
+		unsigned alloc = deferred_alloc ? deferred_alloc * 2 : 64;
+		struct vpi_deferred_scan *d = realloc(deferred_scans, alloc * sizeof(*d));
+		if (!d) {
+			LOG_ERROR("jtag_vpi: out of memory");
+			free(buf);
+			return ERROR_FAIL;
+		}
+		deferred_scans = d;
+		deferred_alloc = alloc;
+	}
+
+	deferred_scans[deferred_count].cmd = cmd;
+	deferred_scans[deferred_count].buf = buf;
+	deferred_count++;
+	return ERROR_OK;
+}
+
 /**
  * jtag_vpi_scan - launches a DR-scan or IR-scan
  * @cmd: the command to launch
@@ -402,25 +596,28 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 
 	scan_bits = jtag_build_buffer(cmd, &buf);
 
-	if (cmd->ir_scan) {
-		retval = jtag_vpi_state_move(TAP_IRSHIFT);
-		if (retval != ERROR_OK)
-			return retval;
-	} else {
-		retval = jtag_vpi_state_move(TAP_DRSHIFT);
+	if (variable_length) {
+		/* TDO is not there yet; hand it back at the end of the queue. From
+		 * here on the deferred list owns buf, which is freed only after
+		 * the replies that point into it have been read. */
+		retval = jtag_vpi_defer_scan(cmd, buf);
 		if (retval != ERROR_OK)
 			return retval;
 	}
 
-	if (cmd->end_state == TAP_DRSHIFT) {
+	if (cmd->ir_scan)
+		retval = jtag_vpi_state_move(TAP_IRSHIFT);
+	else
+		retval = jtag_vpi_state_move(TAP_DRSHIFT);
+	if (retval != ERROR_OK)
+		goto out;
+
+	if (cmd->end_state == TAP_DRSHIFT)
 		retval = jtag_vpi_queue_tdi(buf, scan_bits, NO_TAP_SHIFT);
-		if (retval != ERROR_OK)
-			return retval;
-	} else {
+	else
 		retval = jtag_vpi_queue_tdi(buf, scan_bits, TAP_SHIFT);
-		if (retval != ERROR_OK)
-			return retval;
-	}
+	if (retval != ERROR_OK)
+		goto out;
 
 	if (cmd->end_state != TAP_DRSHIFT) {
 		/*
@@ -429,7 +626,7 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 		 */
 		retval = jtag_vpi_clock_tms(0);
 		if (retval != ERROR_OK)
-			return retval;
+			goto out;
 
 		if (cmd->ir_scan)
 			tap_set_state(TAP_IRPAUSE);
@@ -437,12 +634,13 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 			tap_set_state(TAP_DRPAUSE);
 	}
 
-	retval = jtag_read_buffer(buf, cmd);
-	if (retval != ERROR_OK)
-		return retval;
-
-	if (buf)
+	if (!variable_length) {
+		retval = jtag_read_buffer(buf, cmd);
 		free(buf);
+		buf = NULL;
+		if (retval != ERROR_OK)
+			return retval;
+	}
 
 	if (cmd->end_state != TAP_DRSHIFT) {
 		retval = jtag_vpi_state_move(cmd->end_state);
@@ -451,6 +649,11 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 	}
 
 	return ERROR_OK;
+
+out:
+	if (!variable_length)
+		free(buf);
+	return retval;
 }
 
 static int jtag_vpi_runtest(int cycles, tap_state_t state)
@@ -521,6 +724,8 @@ static int jtag_vpi_execute_queue(void)
 			retval = jtag_vpi_tms(cmd->cmd.tms);
 			break;
 		case JTAG_SLEEP:
+			if (variable_length)
+				retval = jtag_vpi_sync();
 			jtag_sleep(cmd->cmd.sleep->us);
 			break;
 		case JTAG_SCAN:
@@ -534,6 +739,23 @@ static int jtag_vpi_execute_queue(void)
 		}
 	}
 
+	if (variable_length) {
+		if (retval == ERROR_OK)
+			retval = jtag_vpi_sync();
+		else
+			jtag_vpi_discard_replies();
+
+		for (unsigned i = 0; i < deferred_count; i++) {
+			struct vpi_deferred_scan *d = &deferred_scans[i];
+			if (retval == ERROR_OK)
+				retval = jtag_read_buffer(d->buf, d->cmd);
+			free(d->buf);
+		}
+		deferred_count = 0;
+		pending_count = 0;
+		pending_bytes = 0;
+	}
+
 	return retval;
 }
 
@@ -575,6 +797,16 @@ static int jtag_vpi_init(void)
 		setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
 	}
 
+	if (variable_length) {
+		send_buf = malloc(VPI_SEND_BUF_SIZE);
+		if (!send_buf) {
+			close_socket(sockfd);
+			LOG_ERROR("jtag_vpi: out of memory");
+			return ERROR_FAIL;
+		}
+		send_buf_len = 0;
+	}
+
 	LOG_INFO("Connection to %s : %u succeed", server_address, server_port);
 
 	return ERROR_OK;
@@ -587,7 +819,12 @@ static int jtag_vpi_stop_simulation(void)
 	cmd.length = 0;
 	cmd.nb_bits = 0;
 	cmd.cmd = CMD_STOP_SIMU;
-	return jtag_vpi_send_cmd(&cmd);
+	int retval = jtag_vpi_send_cmd(&cmd);
+	if (retval != ERROR_OK)
+		return retval;
+	if (variable_length)
+		return jtag_vpi_flush_send_buf();
+	return ERROR_OK;
 }
 
 static int jtag_vpi_quit(void)
@@ -601,6 +838,14 @@ static int jtag_vpi_quit(void)
 		log_socket_error("jtag_vpi");
 	}
 	free(server_address);
+	free(send_buf);
+	free(pending_replies);
+	free(deferred_scans);
+	send_buf = NULL;
+	pending_replies = NULL;
+	pending_alloc = 0;
+	deferred_scans = NULL;
+	deferred_alloc = 0;
 	return ERROR_OK;
 }
 
@@ -642,6 +887,17 @@ COMMAND_HANDLER(jtag_vpi_stop_sim_on_exit_handler)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(jtag_vpi_variable_length_handler)
+{
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("jtag_vpi_variable_length expects 1 argument (on|off)");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	} else {
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], variable_length);
+	}
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_vpi_command_handlers[] = {
 	{
 		.name = "jtag_vpi_set_port",
@@ -665,6 +921,15 @@ static const struct command_registration jtag_vpi_command_handlers[] = {
 			"before OpenOCD exits (default: off)",
 		.usage = "<on|off>",
 	},
+	{
+		.name = "jtag_vpi_variable_length",
+		.handler = &jtag_vpi_variable_length_handler,
+		.mode = COMMAND_CONFIG,
+		.help = "Configure if commands are streamed as variable length "
+			"packets whose replies are collected once per queue; the "
+			"server must support this (default: off)",
+		.usage = "<on|off>",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -61,6 +61,24 @@
 #define SIO_RESET_PURGE_RX 1
 #define SIO_RESET_PURGE_TX 2
 
+/* Number of command buffers. While the oldest ones are being transferred over USB, the next one
+ * is filled with commands, so long scans keep the device busy without waiting for every buffer. */
+#define MPSSE_BUFFER_COUNT 4
+
+struct mpsse_buffer {
+	struct mpsse_ctx *ctx;
+	uint8_t *write_buffer;
+	unsigned write_count;
+	uint8_t *read_buffer;
+	unsigned read_count;
+	struct bit_copy_queue read_queue;
+	struct libusb_transfer *write_transfer;
+	unsigned write_transferred;
+	unsigned read_transferred;
+	bool write_done;
+	bool in_flight;
+};
+
 struct mpsse_ctx {
 	libusb_context *usb_ctx;
 	libusb_device_handle *usb_dev;
@@ -72,18 +90,26 @@ struct mpsse_ctx {
 	uint16_t index;
 	uint8_t interface;
 	enum ftdi_chip_type type;
-	uint8_t *write_buffer;
+	struct mpsse_buffer buffers[MPSSE_BUFFER_COUNT];
+	struct mpsse_buffer *fill; /* buffer currently being filled with commands */
+	unsigned fill_index;
+	unsigned oldest_index; /* oldest buffer submitted to the device */
+	unsigned in_flight;
 	unsigned write_size;
-	unsigned write_count;
-	uint8_t *read_buffer;
 	unsigned read_size;
-	unsigned read_count;
+	/* A single read transfer collects the IN stream for all in-flight buffers, since one USB
+	 * packet may carry the tail of one buffer's data and the head of the next one's */
+	struct libusb_transfer *read_transfer;
 	uint8_t *read_chunk;
 	unsigned read_chunk_size;
-	struct bit_copy_queue read_queue;
+	bool read_active;
+	bool read_failed;
 	int retval;
 };
 
+static void mpsse_cancel_transfers(struct mpsse_ctx *ctx);
+static int mpsse_submit(struct mpsse_ctx *ctx);
+
 /* Returns true if the string descriptor indexed by str_index in device matches string */
 static bool string_descriptor_equal(libusb_device_handle *device, uint8_t str_index,
 	const char *string)
@@ -326,21 +352,32 @@ struct mpsse_ctx *mpsse_open(const uint16_t *vid, const uint16_t *pid, const cha
 	if (!ctx)
 		return 0;
 
-	bit_copy_queue_init(&ctx->read_queue);
+	for (unsigned i = 0; i < MPSSE_BUFFER_COUNT; i++)
+		bit_copy_queue_init(&ctx->buffers[i].read_queue);
 	ctx->read_chunk_size = 16384;
 	ctx->read_size = 16384;
 	ctx->write_size = 16384;
 	ctx->read_chunk = malloc(ctx->read_chunk_size);
-	ctx->read_buffer = malloc(ctx->read_size);
+	ctx->read_transfer = libusb_alloc_transfer(0);
+	if (!ctx->read_chunk || !ctx->read_transfer)
+		goto error;
 
-	/* Use calloc to make valgrind happy: buffer_write() sets payload
-	 * on bit basis, so some bits can be left uninitialized in write_buffer.
-	 * Although this is perfectly ok with MPSSE, valgrind reports
-	 * Syscall param ioctl(USBDEVFS_SUBMITURB).buffer points to uninitialised byte(s) */
-	ctx->write_buffer = calloc(1, ctx->write_size);
+	for (unsigned i = 0; i < MPSSE_BUFFER_COUNT; i++) {
+		struct mpsse_buffer *buf = &ctx->buffers[i];
+		buf->ctx = ctx;
+		buf->read_buffer = malloc(ctx->read_size);
 
-	if (!ctx->read_chunk || !ctx->read_buffer || !ctx->write_buffer)
-		goto error;
+		/* Use calloc to make valgrind happy: buffer_write() sets payload
+		 * on bit basis, so some bits can be left uninitialized in write_buffer.
+		 * Although this is perfectly ok with MPSSE, valgrind reports
+		 * Syscall param ioctl(USBDEVFS_SUBMITURB).buffer points to uninitialised byte(s) */
+		buf->write_buffer = calloc(1, ctx->write_size);
+		buf->write_transfer = libusb_alloc_transfer(0);
+
+		if (!buf->read_buffer || !buf->write_buffer || !buf->write_transfer)
+			goto error;
+	}
+	ctx->fill = &ctx->buffers[0];
 
 	ctx->interface = channel;
 	ctx->index = channel + 1;
@@ -399,15 +436,24 @@ error:
 
 void mpsse_close(struct mpsse_ctx *ctx)
 {
-	if (ctx->usb_dev)
+	if (ctx->usb_dev) {
+		mpsse_cancel_transfers(ctx);
 		libusb_close(ctx->usb_dev);
+	}
+	for (unsigned i = 0; i < MPSSE_BUFFER_COUNT; i++) {
+		struct mpsse_buffer *buf = &ctx->buffers[i];
+		bit_copy_discard(&buf->read_queue);
+		if (buf->write_transfer)
+			libusb_free_transfer(buf->write_transfer);
+		if (buf->write_buffer)
+			free(buf->write_buffer);
+		if (buf->read_buffer)
+			free(buf->read_buffer);
+	}
+	if (ctx->read_transfer)
+		libusb_free_transfer(ctx->read_transfer);
 	if (ctx->usb_ctx)
 		libusb_exit(ctx->usb_ctx);
-	bit_copy_discard(&ctx->read_queue);
-	if (ctx->write_buffer)
-		free(ctx->write_buffer);
-	if (ctx->read_buffer)
-		free(ctx->read_buffer);
 	if (ctx->read_chunk)
 		free(ctx->read_chunk);
 
@@ -423,10 +469,20 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 {
 	int err;
 	LOG_DEBUG("-");
-	ctx->write_count = 0;
-	ctx->read_count = 0;
+	mpsse_cancel_transfers(ctx);
+	for (unsigned i = 0; i < MPSSE_BUFFER_COUNT; i++) {
+		struct mpsse_buffer *buf = &ctx->buffers[i];
+		buf->write_count = 0;
+		buf->read_count = 0;
+		buf->in_flight = false;
+		bit_copy_discard(&buf->read_queue);
+	}
+	ctx->fill_index = 0;
+	ctx->oldest_index = 0;
+	ctx->in_flight = 0;
+	ctx->fill = &ctx->buffers[0];
+	ctx->read_failed = false;
 	ctx->retval = ERROR_OK;
-	bit_copy_discard(&ctx->read_queue);
 	err = libusb_control_transfer(ctx->usb_dev, FTDI_DEVICE_OUT_REQTYPE, SIO_RESET_REQUEST,
 			SIO_RESET_PURGE_RX, ctx->index, NULL, 0, ctx->usb_write_timeout);
 	if (err < 0) {
@@ -445,28 +501,30 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 static unsigned buffer_write_space(struct mpsse_ctx *ctx)
 {
 	/* Reserve one byte for SEND_IMMEDIATE */
-	return ctx->write_size - ctx->write_count - 1;
+	return ctx->write_size - ctx->fill->write_count - 1;
 }
 
 static unsigned buffer_read_space(struct mpsse_ctx *ctx)
 {
-	return ctx->read_size - ctx->read_count;
+	return ctx->read_size - ctx->fill->read_count;
 }
 
 static void buffer_write_byte(struct mpsse_ctx *ctx, uint8_t data)
 {
 	LOG_DEBUG_IO("%02x", data);
-	assert(ctx->write_count < ctx->write_size);
-	ctx->write_buffer[ctx->write_count++] = data;
+	struct mpsse_buffer *buf = ctx->fill;
+	assert(buf->write_count < ctx->write_size);
+	buf->write_buffer[buf->write_count++] = data;
 }
 
 static unsigned buffer_write(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_offset,
 	unsigned bit_count)
 {
 	LOG_DEBUG_IO("%d bits", bit_count);
-	assert(ctx->write_count + DIV_ROUND_UP(bit_count, 8) <= ctx->write_size);
-	bit_copy(ctx->write_buffer + ctx->write_count, 0, out, out_offset, bit_count);
-	ctx->write_count += DIV_ROUND_UP(bit_count, 8);
+	struct mpsse_buffer *buf = ctx->fill;
+	assert(buf->write_count + DIV_ROUND_UP(bit_count, 8) <= ctx->write_size);
+	bit_copy(buf->write_buffer + buf->write_count, 0, out, out_offset, bit_count);
+	buf->write_count += DIV_ROUND_UP(bit_count, 8);
 	return bit_count;
 }
 
@@ -474,10 +532,11 @@ static unsigned buffer_add_read(struct mpsse_ctx *ctx, uint8_t *in, unsigned in_
 	unsigned bit_count, unsigned offset)
 {
 	LOG_DEBUG_IO("%d bits, offset %d", bit_count, offset);
-	assert(ctx->read_count + DIV_ROUND_UP(bit_count, 8) <= ctx->read_size);
-	bit_copy_queued(&ctx->read_queue, in, in_offset, ctx->read_buffer + ctx->read_count, offset,
+	struct mpsse_buffer *buf = ctx->fill;
+	assert(buf->read_count + DIV_ROUND_UP(bit_count, 8) <= ctx->read_size);
+	bit_copy_queued(&buf->read_queue, in, in_offset, buf->read_buffer + buf->read_count, offset,
 		bit_count);
-	ctx->read_count += DIV_ROUND_UP(bit_count, 8);
+	buf->read_count += DIV_ROUND_UP(bit_count, 8);
 	return bit_count;
 }
 
@@ -513,8 +572,11 @@ void mpsse_clock_data(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_of
 	while (length > 0) {
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) + (length < 8) < (out || (!out && !in) ? 4 : 3)
-				|| (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+				|| (in && buffer_read_space(ctx) < 1)) {
+			ctx->retval = mpsse_submit(ctx);
+			if (ctx->retval != ERROR_OK)
+				return;
+		}
 
 		if (length < 8) {
 			/* Transfer remaining bits in bit mode */
@@ -587,8 +649,11 @@ void mpsse_clock_tms_cs(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_
 
 	while (length > 0) {
 		/* Guarantee buffer space enough for a minimum size transfer */
-		if (buffer_write_space(ctx) < 3 || (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+		if (buffer_write_space(ctx) < 3 || (in && buffer_read_space(ctx) < 1)) {
+			ctx->retval = mpsse_submit(ctx);
+			if (ctx->retval != ERROR_OK)
+				return;
+		}
 
 		/* Byte transfer */
 		unsigned this_bits = length;
@@ -630,8 +695,11 @@ void mpsse_set_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t d
 		return;
 	}
 
-	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+	if (buffer_write_space(ctx) < 3) {
+		ctx->retval = mpsse_submit(ctx);
+		if (ctx->retval != ERROR_OK)
+			return;
+	}
 
 	buffer_write_byte(ctx, 0x80);
 	buffer_write_byte(ctx, data);
@@ -647,8 +715,11 @@ void mpsse_set_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t
 		return;
 	}
 
-	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+	if (buffer_write_space(ctx) < 3) {
+		ctx->retval = mpsse_submit(ctx);
+		if (ctx->retval != ERROR_OK)
+			return;
+	}
 
 	buffer_write_byte(ctx, 0x82);
 	buffer_write_byte(ctx, data);
@@ -664,8 +735,11 @@ void mpsse_read_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t *data)
 		return;
 	}
 
-	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1) {
+		ctx->retval = mpsse_submit(ctx);
+		if (ctx->retval != ERROR_OK)
+			return;
+	}
 
 	buffer_write_byte(ctx, 0x81);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -680,8 +754,11 @@ void mpsse_read_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t *data)
 		return;
 	}
 
-	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1) {
+		ctx->retval = mpsse_submit(ctx);
+		if (ctx->retval != ERROR_OK)
+			return;
+	}
 
 	buffer_write_byte(ctx, 0x83);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -695,8 +772,11 @@ static void single_byte_boolean_helper(struct mpsse_ctx *ctx, bool var, uint8_t
 		return;
 	}
 
-	if (buffer_write_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+	if (buffer_write_space(ctx) < 1) {
+		ctx->retval = mpsse_submit(ctx);
+		if (ctx->retval != ERROR_OK)
+			return;
+	}
 
 	buffer_write_byte(ctx, var ? val_if_true : val_if_false);
 }
@@ -716,8 +796,11 @@ void mpsse_set_divisor(struct mpsse_ctx *ctx, uint16_t divisor)
 		return;
 	}
 
-	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+	if (buffer_write_space(ctx) < 3) {
+		ctx->retval = mpsse_submit(ctx);
+		if (ctx->retval != ERROR_OK)
+			return;
+	}
 
 	buffer_write_byte(ctx, 0x86);
 	buffer_write_byte(ctx, divisor & 0xff);
@@ -777,121 +860,155 @@ int mpsse_set_frequency(struct mpsse_ctx *ctx, int frequency)
 	return frequency;
 }
 
-/* Context needed by the callbacks */
-struct transfer_result {
-	struct mpsse_ctx *ctx;
-	bool done;
-	unsigned transferred;
-};
+/* Returns the oldest in-flight buffer still waiting for read data, or NULL if none */
+static struct mpsse_buffer *read_target(struct mpsse_ctx *ctx)
+{
+	for (unsigned i = 0; i < ctx->in_flight; i++) {
+		struct mpsse_buffer *buf = &ctx->buffers[(ctx->oldest_index + i) % MPSSE_BUFFER_COUNT];
+		if (buf->read_transferred < buf->read_count)
+			return buf;
+	}
+	return NULL;
+}
 
 static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 {
-	struct transfer_result *res = transfer->user_data;
-	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_ctx *ctx = transfer->user_data;
 
 	unsigned packet_size = ctx->max_packet_size;
 
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
 	/* Strip the two status bytes sent at the beginning of each USB packet
-	 * while copying the chunk buffer to the read buffer */
+	 * while handing the payload to the in-flight buffers, oldest first */
 	unsigned num_packets = DIV_ROUND_UP(transfer->actual_length, packet_size);
 	unsigned chunk_remains = transfer->actual_length;
 	for (unsigned i = 0; i < num_packets && chunk_remains > 2; i++) {
 		unsigned this_size = packet_size - 2;
 		if (this_size > chunk_remains - 2)
 			this_size = chunk_remains - 2;
-		if (this_size > ctx->read_count - res->transferred)
-			this_size = ctx->read_count - res->transferred;
-		memcpy(ctx->read_buffer + res->transferred,
-			ctx->read_chunk + packet_size * i + 2,
-			this_size);
-		res->transferred += this_size;
 		chunk_remains -= this_size + 2;
-		if (res->transferred == ctx->read_count) {
-			res->done = true;
-			break;
+
+		const uint8_t *payload = ctx->read_chunk + packet_size * i + 2;
+		while (this_size > 0) {
+			struct mpsse_buffer *buf = read_target(ctx);
+			if (!buf) {
+				LOG_WARNING("ftdi device returned %d unexpected bytes", this_size);
+				break;
+			}
+			unsigned copy_size = buf->read_count - buf->read_transferred;
+			if (copy_size > this_size)
+				copy_size = this_size;
+			memcpy(buf->read_buffer + buf->read_transferred, payload, copy_size);
+			buf->read_transferred += copy_size;
+			payload += copy_size;
+			this_size -= copy_size;
+
+			LOG_DEBUG_IO("raw chunk %d, transferred %d of %d", transfer->actual_length,
+				buf->read_transferred, buf->read_count);
 		}
 	}
 
-	LOG_DEBUG_IO("raw chunk %d, transferred %d of %d", transfer->actual_length, res->transferred,
-		ctx->read_count);
+	if (!read_target(ctx)) {
+		ctx->read_active = false;
+		return;
+	}
 
-	if (!res->done)
-		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
-			res->done = true;
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED && transfer->status != LIBUSB_TRANSFER_TIMED_OUT) {
+		ctx->read_active = false;
+		ctx->read_failed = true;
+		return;
+	}
+
+	if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS) {
+		ctx->read_active = false;
+		ctx->read_failed = true;
+	}
 }
 
 static LIBUSB_CALL void write_cb(struct libusb_transfer *transfer)
 {
-	struct transfer_result *res = transfer->user_data;
-	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_buffer *buf = transfer->user_data;
 
-	res->transferred += transfer->actual_length;
+	buf->write_transferred += transfer->actual_length;
 
-	LOG_DEBUG_IO("transferred %d of %d", res->transferred, ctx->write_count);
+	LOG_DEBUG_IO("transferred %d of %d", buf->write_transferred, buf->write_count);
 
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
-	if (res->transferred == ctx->write_count)
-		res->done = true;
+	/* The remainder of a short write can only be resubmitted if no newer buffer has been queued
+	 * behind it on the endpoint, or the command stream would be reordered */
+	struct mpsse_ctx *ctx = buf->ctx;
+	bool newest = buf == &ctx->buffers[(ctx->oldest_index + ctx->in_flight - 1) % MPSSE_BUFFER_COUNT];
+
+	if (buf->write_transferred == buf->write_count)
+		buf->write_done = true;
+	else if (!newest || (transfer->status != LIBUSB_TRANSFER_COMPLETED
+			&& transfer->status != LIBUSB_TRANSFER_TIMED_OUT))
+		buf->write_done = true;
 	else {
-		transfer->length = ctx->write_count - res->transferred;
-		transfer->buffer = ctx->write_buffer + res->transferred;
+		transfer->length = buf->write_count - buf->write_transferred;
+		transfer->buffer = buf->write_buffer + buf->write_transferred;
 		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
-			res->done = true;
+			buf->write_done = true;
 	}
 }
 
-int mpsse_flush(struct mpsse_ctx *ctx)
+static bool transfers_pending(struct mpsse_ctx *ctx)
 {
-	int retval = ctx->retval;
+	if (ctx->read_active)
+		return true;
+	for (unsigned i = 0; i < MPSSE_BUFFER_COUNT; i++)
+		if (ctx->buffers[i].in_flight && !ctx->buffers[i].write_done)
+			return true;
+	return false;
+}
 
-	if (retval != ERROR_OK) {
-		LOG_DEBUG_IO("Ignoring flush due to previous error");
-		assert(ctx->write_count == 0 && ctx->read_count == 0);
-		ctx->retval = ERROR_OK;
-		return retval;
-	}
+/* Cancel all transfers still owned by libusb and wait for their callbacks */
+static void mpsse_cancel_transfers(struct mpsse_ctx *ctx)
+{
+	if (!transfers_pending(ctx))
+		return;
 
-	LOG_DEBUG_IO("write %d%s, read %d", ctx->write_count, ctx->read_count ? "+1" : "",
-			ctx->read_count);
-	assert(ctx->write_count > 0 || ctx->read_count == 0); /* No read data without write data */
+	for (unsigned i = 0; i < MPSSE_BUFFER_COUNT; i++)
+		if (ctx->buffers[i].in_flight && !ctx->buffers[i].write_done)
+			libusb_cancel_transfer(ctx->buffers[i].write_transfer);
+	if (ctx->read_active)
+		libusb_cancel_transfer(ctx->read_transfer);
 
-	if (ctx->write_count == 0)
-		return retval;
+	while (transfers_pending(ctx)) {
+		struct timeval timeout_usb;
 
-	struct libusb_transfer *read_transfer = 0;
-	struct transfer_result read_result = { .ctx = ctx, .done = true };
-	if (ctx->read_count) {
-		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
-		read_result.done = false;
-		/* delay read transaction to ensure the FTDI chip can support us with data
-		   immediately after processing the MPSSE commands in the write transaction */
-	}
+		timeout_usb.tv_sec = 1;
+		timeout_usb.tv_usec = 0;
 
-	struct transfer_result write_result = { .ctx = ctx, .done = false };
-	struct libusb_transfer *write_transfer = libusb_alloc_transfer(0);
-	libusb_fill_bulk_transfer(write_transfer, ctx->usb_dev, ctx->out_ep, ctx->write_buffer,
-		ctx->write_count, write_cb, &write_result, ctx->usb_write_timeout);
-	retval = libusb_submit_transfer(write_transfer);
-	if (retval != LIBUSB_SUCCESS)
-		goto error_check;
-
-	if (ctx->read_count) {
-		read_transfer = libusb_alloc_transfer(0);
-		libusb_fill_bulk_transfer(read_transfer, ctx->usb_dev, ctx->in_ep, ctx->read_chunk,
-			ctx->read_chunk_size, read_cb, &read_result,
-			ctx->usb_read_timeout);
-		retval = libusb_submit_transfer(read_transfer);
-		if (retval != LIBUSB_SUCCESS)
-			goto error_check;
+		if (libusb_handle_events_timeout_completed(ctx->usb_ctx, &timeout_usb, NULL)
+				!= LIBUSB_SUCCESS)
+			break;
 	}
+}
+
+static bool buffer_complete(struct mpsse_ctx *ctx, struct mpsse_buffer *buf)
+{
+	if (!buf->write_done)
+		return false;
+	if (buf->write_transferred < buf->write_count)
+		return true;
+	return buf->read_transferred == buf->read_count || ctx->read_failed;
+}
+
+/* Wait for the oldest in-flight buffer to complete and hand its read data to the caller */
+static int mpsse_retire(struct mpsse_ctx *ctx)
+{
+	struct mpsse_buffer *buf = &ctx->buffers[ctx->oldest_index];
+	int retval = LIBUSB_SUCCESS;
+
+	assert(ctx->in_flight > 0 && buf->in_flight);
 
 	/* Polling loop, more or less taken from libftdi */
 	int64_t start = timeval_ms();
 	int64_t warn_after = 2000;
-	while (!write_result.done || !read_result.done) {
+	while (!buffer_complete(ctx, buf)) {
 		struct timeval timeout_usb;
 
 		timeout_usb.tv_sec = 1;
@@ -899,21 +1016,9 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 
 		retval = libusb_handle_events_timeout_completed(ctx->usb_ctx, &timeout_usb, NULL);
 		keep_alive();
-		if (retval == LIBUSB_ERROR_NO_DEVICE || retval == LIBUSB_ERROR_INTERRUPTED)
+		if (retval != LIBUSB_SUCCESS)
 			break;
 
-		if (retval != LIBUSB_SUCCESS) {
-			libusb_cancel_transfer(write_transfer);
-			if (read_transfer)
-				libusb_cancel_transfer(read_transfer);
-			while (!write_result.done || !read_result.done) {
-				retval = libusb_handle_events_timeout_completed(ctx->usb_ctx,
-								&timeout_usb, NULL);
-				if (retval != LIBUSB_SUCCESS)
-					break;
-			}
-		}
-
 		int64_t now = timeval_ms();
 		if (now - start > warn_after) {
 			LOG_WARNING("Haven't made progress in mpsse_flush() for %" PRId64
@@ -922,37 +1027,109 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 		}
 	}
 
-error_check:
 	if (retval != LIBUSB_SUCCESS) {
 		LOG_ERROR("libusb_handle_events() failed with %s", libusb_error_name(retval));
 		retval = ERROR_FAIL;
-	} else if (write_result.transferred < ctx->write_count) {
+	} else if (buf->write_transferred < buf->write_count) {
 		LOG_ERROR("ftdi device did not accept all data: %d, tried %d",
-			write_result.transferred,
-			ctx->write_count);
+			buf->write_transferred,
+			buf->write_count);
 		retval = ERROR_FAIL;
-	} else if (read_result.transferred < ctx->read_count) {
+	} else if (buf->read_transferred < buf->read_count) {
 		LOG_ERROR("ftdi device did not return all data: %d, expected %d",
-			read_result.transferred,
-			ctx->read_count);
+			buf->read_transferred,
+			buf->read_count);
 		retval = ERROR_FAIL;
-	} else if (ctx->read_count) {
-		ctx->write_count = 0;
-		ctx->read_count = 0;
-		bit_copy_execute(&ctx->read_queue);
-		retval = ERROR_OK;
 	} else {
-		ctx->write_count = 0;
-		bit_copy_discard(&ctx->read_queue);
+		if (buf->read_count)
+			bit_copy_execute(&buf->read_queue);
+		else
+			bit_copy_discard(&buf->read_queue);
+		buf->write_count = 0;
+		buf->read_count = 0;
+		buf->in_flight = false;
+		ctx->in_flight--;
+		ctx->oldest_index = (ctx->oldest_index + 1) % MPSSE_BUFFER_COUNT;
 		retval = ERROR_OK;
 	}
 
-	libusb_free_transfer(write_transfer);
-	if (read_transfer)
-		libusb_free_transfer(read_transfer);
-
 	if (retval != ERROR_OK)
 		mpsse_purge(ctx);
 
 	return retval;
 }
+
+/* Send the buffer being filled to the device without waiting for it, and continue filling the
+ * next one. Only if that one is still in flight, wait for it to complete first. */
+static int mpsse_submit(struct mpsse_ctx *ctx)
+{
+	struct mpsse_buffer *buf = ctx->fill;
+	int retval;
+
+	LOG_DEBUG_IO("write %d%s, read %d", buf->write_count, buf->read_count ? "+1" : "",
+			buf->read_count);
+	assert(buf->write_count > 0 || buf->read_count == 0); /* No read data without write data */
+
+	if (buf->write_count == 0)
+		return ERROR_OK;
+
+	if (buf->read_count)
+		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
+
+	buf->write_transferred = 0;
+	buf->read_transferred = 0;
+	buf->write_done = false;
+	libusb_fill_bulk_transfer(buf->write_transfer, ctx->usb_dev, ctx->out_ep, buf->write_buffer,
+		buf->write_count, write_cb, buf, ctx->usb_write_timeout);
+	retval = libusb_submit_transfer(buf->write_transfer);
+	if (retval != LIBUSB_SUCCESS)
+		goto error;
+
+	buf->in_flight = true;
+	ctx->in_flight++;
+
+	/* The read transaction is submitted after the write to ensure the FTDI chip can support us
+	 * with data immediately after processing the MPSSE commands in the write transaction. An
+	 * already active read keeps collecting data for this buffer once older ones are satisfied. */
+	if (buf->read_count && !ctx->read_active && !ctx->read_failed) {
+		libusb_fill_bulk_transfer(ctx->read_transfer, ctx->usb_dev, ctx->in_ep, ctx->read_chunk,
+			ctx->read_chunk_size, read_cb, ctx, ctx->usb_read_timeout);
+		retval = libusb_submit_transfer(ctx->read_transfer);
+		if (retval != LIBUSB_SUCCESS)
+			goto error;
+		ctx->read_active = true;
+	}
+
+	ctx->fill_index = (ctx->fill_index + 1) % MPSSE_BUFFER_COUNT;
+	ctx->fill = &ctx->buffers[ctx->fill_index];
+
+	/* The ring is full, the buffer to fill next is the oldest one in flight */
+	if (ctx->fill->in_flight)
+		return mpsse_retire(ctx);
+
+	return ERROR_OK;
+
+error:
+	LOG_ERROR("libusb_submit_transfer() failed with %s", libusb_error_name(retval));
+	mpsse_purge(ctx);
+	return ERROR_FAIL;
+}
+
+int mpsse_flush(struct mpsse_ctx *ctx)
+{
+	int retval = ctx->retval;
+
+	if (retval != ERROR_OK) {
+		LOG_DEBUG_IO("Ignoring flush due to previous error");
+		assert(ctx->fill->write_count == 0 && ctx->fill->read_count == 0 && ctx->in_flight == 0);
+		ctx->retval = ERROR_OK;
+		return retval;
+	}
+
+	retval = mpsse_submit(ctx);
+
+	while (retval == ERROR_OK && ctx->in_flight > 0)
+		retval = mpsse_retire(ctx);
+
+	return retval;
+}
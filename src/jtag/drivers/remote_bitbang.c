@@ -25,17 +25,109 @@
 #include <netdb.h>
 #endif
 #include <jtag/interface.h>
+#include <jtag/commands.h>
+#include <helper/time_support.h>
+#include <transport/transport.h>
 #include "bitbang.h"
 
 /* arbitrary limit on host name length: */
 #define REMOTE_BITBANG_HOST_MAX 255
 
+/* Binary (v2) protocol records. The legacy single character commands stay
+ * valid in v2 mode; these opcodes are chosen not to collide with them. */
+#define REMOTE_BITBANG_V2_HELLO		'V'
+#define REMOTE_BITBANG_V2_SCAN		'S'
+#define REMOTE_BITBANG_V2_TMS		'M'
+#define REMOTE_BITBANG_V2_CLOCK		'C'
+#define REMOTE_BITBANG_V2_SWD_SEQ	'W'
+#define REMOTE_BITBANG_V2_SWD_XFER	'T'
+
+/* flags byte of a scan record */
+#define REMOTE_BITBANG_V2_SCAN_CAPTURE	0x01	/* return TDO bytes */
+#define REMOTE_BITBANG_V2_SCAN_TMS_LAST	0x02	/* raise TMS on the last bit */
+#define REMOTE_BITBANG_V2_SCAN_NO_TDI	0x04	/* no TDI payload, shift zeros */
+
+/* status byte of an SWD transaction reply */
+#define REMOTE_BITBANG_V2_SWD_ACK	0x07	/* ACK as received, LSB first */
+#define REMOTE_BITBANG_V2_SWD_PARITY	0x08	/* parity bit of read data */
+
+/* SWD transactions per record; each record is answered before the next one
+ * is sent, so the server may skip the rest of a record after an error. */
+#define REMOTE_BITBANG_V2_SWD_BATCH	1024
+
+/* How often SWD transactions answered with WAIT are retried */
+#define REMOTE_BITBANG_SWD_WAIT_RETRIES	1000
+
+/* Split scans so that neither side can stall on a full socket buffer while
+ * the other one is still writing. */
+#define REMOTE_BITBANG_V2_CHUNK_BYTES	4096
+#define REMOTE_BITBANG_V2_MAX_PENDING	(4 * REMOTE_BITBANG_V2_CHUNK_BYTES)
+
+/* Bits per round trip when shifting with the legacy protocol */
+#define REMOTE_BITBANG_SHIFT_CHUNK_BITS	4096
+
+/* Default for how long to wait for the server to answer the v2 hello. A
+ * local simulator answers within a few milliseconds. */
+#define REMOTE_BITBANG_V2_HELLO_TIMEOUT_MS	100
+
+enum remote_bitbang_protocol {
+	REMOTE_BITBANG_PROTOCOL_LEGACY,
+	REMOTE_BITBANG_PROTOCOL_V2,
+};
+
+enum remote_bitbang_swd_mode {
+	REMOTE_BITBANG_SWD_PIN,
+	REMOTE_BITBANG_SWD_TRANSACTION,
+};
+
 static char *remote_bitbang_host;
 static char *remote_bitbang_port;
 
 static FILE *remote_bitbang_file;
 static int remote_bitbang_fd;
 
+/* protocol requested by the user, and the one agreed on with the server */
+static enum remote_bitbang_protocol remote_bitbang_protocol_requested;
+static enum remote_bitbang_protocol remote_bitbang_protocol;
+static unsigned int remote_bitbang_hello_timeout_ms = REMOTE_BITBANG_V2_HELLO_TIMEOUT_MS;
+
+static enum remote_bitbang_swd_mode remote_bitbang_swd_mode;
+
+/* TDO bytes the server still owes us, in the order they will arrive */
+struct remote_bitbang_pending_read {
+	uint8_t *buf;
+	unsigned len;
+};
+
+static struct remote_bitbang_pending_read *remote_bitbang_pending;
+static unsigned remote_bitbang_pending_count;
+static unsigned remote_bitbang_pending_size;
+static size_t remote_bitbang_pending_bytes;
+
+/* Scans of the current queue whose buffers are handed back at the end */
+struct remote_bitbang_scan {
+	struct scan_command *cmd;
+	uint8_t *buffer;
+};
+
+static struct remote_bitbang_scan *remote_bitbang_scans;
+static unsigned remote_bitbang_scan_count;
+static unsigned remote_bitbang_scan_size;
+
+/* SWD transaction level (v2 only): the server gets whole DP/AP requests and
+ * answers each of them with its ACK and, for reads, the data. */
+struct remote_bitbang_swd_transfer {
+	uint8_t cmd;
+	uint32_t data;
+	uint32_t *dst;
+	uint8_t reply[5];
+};
+
+static struct remote_bitbang_swd_transfer *remote_bitbang_swd_transfers;
+static unsigned remote_bitbang_swd_count;
+static unsigned remote_bitbang_swd_size;
+static int remote_bitbang_swd_retval;
+
 /* Circular buffer. When start == end, the buffer is empty. */
 static char remote_bitbang_buf[64];
 static unsigned remote_bitbang_start;
@@ -116,6 +208,15 @@ static int remote_bitbang_quit(void)
 
 	free(remote_bitbang_host);
 	free(remote_bitbang_port);
+	free(remote_bitbang_pending);
+	free(remote_bitbang_scans);
+	free(remote_bitbang_swd_transfers);
+	remote_bitbang_pending = NULL;
+	remote_bitbang_pending_size = 0;
+	remote_bitbang_scans = NULL;
+	remote_bitbang_scan_size = 0;
+	remote_bitbang_swd_transfers = NULL;
+	remote_bitbang_swd_size = 0;
 
 	LOG_INFO("remote_bitbang interface quit");
 	return ERROR_OK;
@@ -178,7 +279,13 @@ static bb_value_t remote_bitbang_read_sample(void)
 
 static int remote_bitbang_write(int tck, int tms, int tdi)
 {
-	char c = '0' + ((tck ? 0x4 : 0x0) | (tms ? 0x2 : 0x0) | (tdi ? 0x1 : 0x0));
+	char c;
+
+	/* SWD uses TDI as SWDIO and TCK as SWCLK */
+	if (swd_mode)
+		c = 'd' + ((tck ? 0x2 : 0x0) | (tdi ? 0x1 : 0x0));
+	else
+		c = '0' + ((tck ? 0x4 : 0x0) | (tms ? 0x2 : 0x0) | (tdi ? 0x1 : 0x0));
 	return remote_bitbang_putc(c);
 }
 
@@ -194,14 +301,760 @@ static int remote_bitbang_blink(int on)
 	return remote_bitbang_putc(c);
 }
 
+/* Read exactly len bytes from the server, blocking. */
+static int remote_bitbang_read_exact(uint8_t *buf, unsigned len)
+{
+	socket_block(remote_bitbang_fd);
+	while (len) {
+		ssize_t count = read(remote_bitbang_fd, buf, len);
+		if (count <= 0) {
+			LOG_ERROR("remote_bitbang: read: count=%d, error=%s",
+					(int)count, strerror(errno));
+			return ERROR_FAIL;
+		}
+		buf += count;
+		len -= count;
+	}
+	return ERROR_OK;
+}
+
+/* Legacy protocol: send the characters for a whole chunk of bits at once
+ * and collect the TDO samples of the chunk with a single blocking read. */
+static int remote_bitbang_shift_bits(const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo,
+		unsigned num_bits, bool tms_exit)
+{
+	unsigned max_bits = MIN(num_bits, REMOTE_BITBANG_SHIFT_CHUNK_BITS);
+	int tms_bit = 0;
+	int retval = ERROR_FAIL;
+
+	/* bitbang_scan() drains all samples, so nothing is left in the buffer */
+	assert(remote_bitbang_start == remote_bitbang_end);
+
+	char *cmds = malloc(3 * max_bits + 1);
+	uint8_t *samples = malloc(max_bits + 1);
+	if (!cmds || !samples) {
+		LOG_ERROR("remote_bitbang: out of memory");
+		goto out;
+	}
+
+	for (unsigned offset = 0; offset < num_bits; offset += REMOTE_BITBANG_SHIFT_CHUNK_BITS) {
+		unsigned bits = MIN(num_bits - offset, REMOTE_BITBANG_SHIFT_CHUNK_BITS);
+		unsigned len = 0;
+
+		for (unsigned i = offset; i < offset + bits; i++) {
+			tms_bit = tms ? (tms[i / 8] >> (i % 8)) & 1 : 0;
+			if (tms_exit && i == num_bits - 1)
+				tms_bit = 1;
+			int tdi_bit = tdi ? (tdi[i / 8] >> (i % 8)) & 1 : 0;
+			char c = '0' + ((tms_bit ? 0x2 : 0x0) | (tdi_bit ? 0x1 : 0x0));
+
+			cmds[len++] = c;
+			if (tdo)
+				cmds[len++] = 'R';
+			cmds[len++] = c | 0x4;
+		}
+
+		if (fwrite(cmds, 1, len, remote_bitbang_file) != len) {
+			LOG_ERROR("remote_bitbang: write failed: %s", strerror(errno));
+			goto out;
+		}
+
+		if (!tdo)
+			continue;
+
+		if (EOF == fflush(remote_bitbang_file)) {
+			LOG_ERROR("fflush: %s", strerror(errno));
+			goto out;
+		}
+		if (remote_bitbang_read_exact(samples, bits) != ERROR_OK)
+			goto out;
+
+		/* chunks are whole bytes but for the last one, so the TDI bits of
+		 * this chunk have all been consumed before tdo is written */
+		for (unsigned i = 0; i < bits; i++) {
+			unsigned bit = offset + i;
+			if (bit % 8 == 0)
+				tdo[bit / 8] = 0;
+			switch (char_to_int(samples[i])) {
+				case BB_LOW:
+					break;
+				case BB_HIGH:
+					tdo[bit / 8] |= 1 << (bit % 8);
+					break;
+				default:
+					goto out;
+			}
+		}
+	}
+
+	retval = remote_bitbang_write(0, tms_bit, 0);
+
+out:
+	free(cmds);
+	free(samples);
+	return retval;
+}
+
+static int remote_bitbang_v2_write(const void *data, size_t len)
+{
+	if (len && fwrite(data, 1, len, remote_bitbang_file) != len) {
+		LOG_ERROR("remote_bitbang: write failed: %s", strerror(errno));
+		return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
+
+static int remote_bitbang_v2_header(uint8_t opcode, uint8_t arg, bool has_arg, uint32_t count)
+{
+	uint8_t header[6];
+	unsigned len = 0;
+
+	header[len++] = opcode;
+	if (has_arg)
+		header[len++] = arg;
+	h_u32_to_le(header + len, count);
+	len += 4;
+
+	return remote_bitbang_v2_write(header, len);
+}
+
+/* Flush everything written so far and collect all outstanding TDO data. */
+static int remote_bitbang_v2_drain(void)
+{
+	if (EOF == fflush(remote_bitbang_file)) {
+		LOG_ERROR("fflush: %s", strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	for (unsigned i = 0; i < remote_bitbang_pending_count; i++) {
+		struct remote_bitbang_pending_read *p = &remote_bitbang_pending[i];
+		if (remote_bitbang_read_exact(p->buf, p->len) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	remote_bitbang_pending_count = 0;
+	remote_bitbang_pending_bytes = 0;
+	return ERROR_OK;
+}
+
+static int remote_bitbang_v2_expect(uint8_t *buf, unsigned len)
+{
+	if (remote_bitbang_pending_bytes + len > REMOTE_BITBANG_V2_MAX_PENDING) {
+		if (remote_bitbang_v2_drain() != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	if (remote_bitbang_pending_count == remote_bitbang_pending_size) {
+		unsigned size = remote_bitbang_pending_size ? remote_bitbang_pending_size * 2 : 64;
+		struct remote_bitbang_pending_read *p = realloc(remote_bitbang_pending,
+				size * sizeof(*p));
+		if (p == NULL) {
+			LOG_ERROR("remote_bitbang: out of memory");
+			return ERROR_FAIL;
+		}
+		remote_bitbang_pending = p;
+		remote_bitbang_pending_size = size;
+	}
+
+	remote_bitbang_pending[remote_bitbang_pending_count].buf = buf;
+	remote_bitbang_pending[remote_bitbang_pending_count].len = len;
+	remote_bitbang_pending_count++;
+	remote_bitbang_pending_bytes += len;
+	return ERROR_OK;
+}
+
+/* SWD pin level: the legacy protocol gets characters for each SWCLK edge,
+ * v2 gets whole bit streams as records. */
+static int remote_bitbang_swdio_read(void)
+{
+	if (remote_bitbang_putc('c') != ERROR_OK)
+		return 0;
+	return remote_bitbang_rread() == BB_HIGH;
+}
+
+static void remote_bitbang_swdio_drive(bool is_output)
+{
+	remote_bitbang_putc(is_output ? 'O' : 'o');
+}
+
+static int remote_bitbang_v2_swd_shift_bits(const uint8_t *swdio, const uint8_t *drive,
+		uint8_t *swdio_in, unsigned num_bits)
+{
+	unsigned total_bytes = DIV_ROUND_UP(num_bits, 8);
+
+	for (unsigned offset = 0; offset < total_bytes; offset += REMOTE_BITBANG_V2_CHUNK_BYTES) {
+		unsigned bytes = MIN(total_bytes - offset, REMOTE_BITBANG_V2_CHUNK_BYTES);
+		unsigned bits = MIN(num_bits - 8 * offset, 8 * bytes);
+
+		if (remote_bitbang_v2_expect(swdio_in + offset, bytes) != ERROR_OK)
+			return ERROR_FAIL;
+		if (remote_bitbang_v2_header(REMOTE_BITBANG_V2_SWD_SEQ, 0, false, bits) != ERROR_OK)
+			return ERROR_FAIL;
+		if (remote_bitbang_v2_write(swdio + offset, bytes) != ERROR_OK)
+			return ERROR_FAIL;
+		if (remote_bitbang_v2_write(drive + offset, bytes) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	return remote_bitbang_v2_drain();
+}
+
+static int remote_bitbang_swd_shift_bits(const uint8_t *swdio, const uint8_t *drive,
+		uint8_t *swdio_in, unsigned num_bits)
+{
+	unsigned max_bits = MIN(num_bits, REMOTE_BITBANG_SHIFT_CHUNK_BITS);
+	bool driving = false;
+	int retval = ERROR_FAIL;
+
+	if (remote_bitbang_protocol == REMOTE_BITBANG_PROTOCOL_V2)
+		return remote_bitbang_v2_swd_shift_bits(swdio, drive, swdio_in, num_bits);
+
+	char *cmds = malloc(4 * max_bits + 1);
+	uint8_t *samples = malloc(max_bits + 1);
+	if (!cmds || !samples) {
+		LOG_ERROR("remote_bitbang: out of memory");
+		goto out;
+	}
+
+	for (unsigned offset = 0; offset < num_bits; offset += REMOTE_BITBANG_SHIFT_CHUNK_BITS) {
+		unsigned bits = MIN(num_bits - offset, REMOTE_BITBANG_SHIFT_CHUNK_BITS);
+		unsigned len = 0, num_samples = 0;
+
+		for (unsigned i = offset; i < offset + bits; i++) {
+			bool drive_bit = (drive[i / 8] >> (i % 8)) & 1;
+			int swdio_bit = (swdio[i / 8] >> (i % 8)) & 1;
+
+			if (i == 0 || drive_bit != driving) {
+				cmds[len++] = drive_bit ? 'O' : 'o';
+				driving = drive_bit;
+			}
+			cmds[len++] = 'd' + swdio_bit;
+			if (!drive_bit) {
+				cmds[len++] = 'c';
+				num_samples++;
+			}
+			cmds[len++] = 'f' + swdio_bit;
+		}
+
+		if (fwrite(cmds, 1, len, remote_bitbang_file) != len) {
+			LOG_ERROR("remote_bitbang: write failed: %s", strerror(errno));
+			goto out;
+		}
+
+		if (num_samples == 0)
+			continue;
+
+		if (EOF == fflush(remote_bitbang_file)) {
+			LOG_ERROR("fflush: %s", strerror(errno));
+			goto out;
+		}
+		if (remote_bitbang_read_exact(samples, num_samples) != ERROR_OK)
+			goto out;
+
+		unsigned sample = 0;
+		for (unsigned i = offset; i < offset + bits; i++) {
+			if ((drive[i / 8] >> (i % 8)) & 1)
+				continue;
+			switch (char_to_int(samples[sample++])) {
+				case BB_LOW:
+					swdio_in[i / 8] &= ~(1 << (i % 8));
+					break;
+				case BB_HIGH:
+					swdio_in[i / 8] |= 1 << (i % 8);
+					break;
+				default:
+					goto out;
+			}
+		}
+	}
+
+	retval = ERROR_OK;
+
+out:
+	free(cmds);
+	free(samples);
+	return retval;
+}
+
 static struct bitbang_interface remote_bitbang_bitbang = {
 	.buf_size = sizeof(remote_bitbang_buf) - 1,
 	.sample = &remote_bitbang_sample,
 	.read_sample = &remote_bitbang_read_sample,
 	.write = &remote_bitbang_write,
+	.shift_bits = &remote_bitbang_shift_bits,
+	.swd_shift_bits = &remote_bitbang_swd_shift_bits,
 	.blink = &remote_bitbang_blink,
+	.swdio_read = &remote_bitbang_swdio_read,
+	.swdio_drive = &remote_bitbang_swdio_drive,
 };
 
+/* Send count transfers as one record and wait for all replies. */
+static int remote_bitbang_swd_exchange(struct remote_bitbang_swd_transfer *transfers,
+		unsigned count)
+{
+	if (remote_bitbang_v2_header(REMOTE_BITBANG_V2_SWD_XFER, 0, false, count) != ERROR_OK)
+		return ERROR_FAIL;
+
+	for (unsigned i = 0; i < count; i++) {
+		struct remote_bitbang_swd_transfer *t = &transfers[i];
+		uint8_t request[5] = { t->cmd };
+
+		h_u32_to_le(request + 1, t->data);
+		if (remote_bitbang_v2_write(request, t->cmd & SWD_CMD_RnW ? 1 : 5) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		struct remote_bitbang_swd_transfer *t = &transfers[i];
+		if (remote_bitbang_v2_expect(t->reply, t->cmd & SWD_CMD_RnW ? 5 : 1) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	return remote_bitbang_v2_drain();
+}
+
+/* Run all queued transfers, one record of at most REMOTE_BITBANG_V2_SWD_BATCH
+ * at a time. The server skips the rest of a record after a response other
+ * than OK; after a WAIT, the sticky errors are cleared and the transfers
+ * are sent again from the one that got the WAIT. */
+static int remote_bitbang_swd_flush(void)
+{
+	struct remote_bitbang_swd_transfer *transfers = remote_bitbang_swd_transfers;
+	unsigned retries = 0;
+	unsigned first = 0;
+	int retval = ERROR_OK;
+
+	while (first < remote_bitbang_swd_count && retval == ERROR_OK) {
+		unsigned count = MIN(remote_bitbang_swd_count - first, REMOTE_BITBANG_V2_SWD_BATCH);
+		unsigned i;
+
+		retval = remote_bitbang_swd_exchange(&transfers[first], count);
+		if (retval != ERROR_OK)
+			break;
+
+		for (i = first; i < first + count; i++) {
+			struct remote_bitbang_swd_transfer *t = &transfers[i];
+			int ack = t->reply[0] & REMOTE_BITBANG_V2_SWD_ACK;
+			bool is_read = t->cmd & SWD_CMD_RnW;
+			uint32_t data = is_read ? le_to_h_u32(t->reply + 1) : t->data;
+
+			LOG_DEBUG_IO("%s %s %s reg %X = %08" PRIx32,
+					ack == SWD_ACK_OK ? "OK" : ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK",
+					t->cmd & SWD_CMD_APnDP ? "AP" : "DP",
+					is_read ? "read" : "write",
+					(t->cmd & SWD_CMD_A32) >> 1,
+					data);
+
+			if (ack == SWD_ACK_WAIT && retries++ < REMOTE_BITBANG_SWD_WAIT_RETRIES) {
+				/* the ABORT takes the place of a completed transfer, or of
+				 * the spare entry if there is none */
+				if (i == 0) {
+					memmove(&transfers[1], &transfers[0],
+							remote_bitbang_swd_count * sizeof(*transfers));
+					remote_bitbang_swd_count++;
+				} else {
+					i--;
+				}
+				transfers[i] = (struct remote_bitbang_swd_transfer) {
+					.cmd = swd_cmd(false, false, DP_ABORT) | SWD_CMD_START | SWD_CMD_PARK,
+					.data = STKCMPCLR | STKERRCLR | WDERRCLR | ORUNERRCLR,
+				};
+				break;
+			}
+
+			if (ack != SWD_ACK_OK) {
+				LOG_DEBUG("SWD ack not OK: %d", ack);
+				retval = ack == SWD_ACK_WAIT ? ERROR_WAIT : ERROR_FAIL;
+				break;
+			}
+
+			if (is_read) {
+				bool parity = t->reply[0] & REMOTE_BITBANG_V2_SWD_PARITY;
+				if (parity != parity_u32(data)) {
+					LOG_ERROR("SWD read data parity mismatch");
+					retval = ERROR_FAIL;
+					break;
+				}
+				if (t->dst)
+					*t->dst = data;
+			}
+		}
+		first = i;
+	}
+
+	remote_bitbang_swd_count = 0;
+	return retval;
+}
+
+static void remote_bitbang_swd_queue(uint8_t cmd, uint32_t *dst, uint32_t data)
+{
+	if (remote_bitbang_swd_retval != ERROR_OK)
+		return;
+
+	/* Keep a spare entry for clearing the sticky errors after a WAIT */
+	if (remote_bitbang_swd_count + 1 >= remote_bitbang_swd_size) {
+		unsigned size = remote_bitbang_swd_size ? remote_bitbang_swd_size * 2 : 64;
+		struct remote_bitbang_swd_transfer *t = realloc(remote_bitbang_swd_transfers,
+				size * sizeof(*t));
+		if (t == NULL) {
+			LOG_ERROR("remote_bitbang: out of memory");
+			remote_bitbang_swd_retval = ERROR_FAIL;
+			return;
+		}
+		remote_bitbang_swd_transfers = t;
+		remote_bitbang_swd_size = size;
+	}
+
+	struct remote_bitbang_swd_transfer *t = &remote_bitbang_swd_transfers[remote_bitbang_swd_count++];
+	t->cmd = cmd | SWD_CMD_START | SWD_CMD_PARK;
+	t->data = data;
+	t->dst = dst;
+}
+
+static int remote_bitbang_swd_init(void)
+{
+	return bitbang_swd.init();
+}
+
+static int remote_bitbang_swd_switch_seq(enum swd_special_seq seq)
+{
+	if (remote_bitbang_swd_mode == REMOTE_BITBANG_SWD_TRANSACTION &&
+			remote_bitbang_swd_count && remote_bitbang_swd_retval == ERROR_OK)
+		remote_bitbang_swd_retval = remote_bitbang_swd_flush();
+
+	return bitbang_swd.switch_seq(seq);
+}
+
+static void remote_bitbang_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay_clk)
+{
+	assert(cmd & SWD_CMD_RnW);
+
+	if (remote_bitbang_swd_mode == REMOTE_BITBANG_SWD_TRANSACTION)
+		remote_bitbang_swd_queue(cmd, value, 0);
+	else
+		bitbang_swd.read_reg(cmd, value, ap_delay_clk);
+}
+
+static void remote_bitbang_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay_clk)
+{
+	assert(!(cmd & SWD_CMD_RnW));
+
+	if (remote_bitbang_swd_mode == REMOTE_BITBANG_SWD_TRANSACTION)
+		remote_bitbang_swd_queue(cmd, NULL, value);
+	else
+		bitbang_swd.write_reg(cmd, value, ap_delay_clk);
+}
+
+static int remote_bitbang_swd_run_queue(void)
+{
+	if (remote_bitbang_swd_mode != REMOTE_BITBANG_SWD_TRANSACTION)
+		return bitbang_swd.run();
+
+	if (remote_bitbang_swd_retval == ERROR_OK)
+		remote_bitbang_swd_retval = remote_bitbang_swd_flush();
+	remote_bitbang_swd_count = 0;
+
+	int retval = remote_bitbang_swd_retval;
+	remote_bitbang_swd_retval = ERROR_OK;
+	return retval;
+}
+
+static const struct swd_driver remote_bitbang_swd = {
+	.init = remote_bitbang_swd_init,
+	.switch_seq = remote_bitbang_swd_switch_seq,
+	.read_reg = remote_bitbang_swd_read_reg,
+	.write_reg = remote_bitbang_swd_write_reg,
+	.run = remote_bitbang_swd_run_queue,
+};
+
+/* Send a TMS sequence; TDI is held low. */
+static int remote_bitbang_v2_tms_seq(const uint8_t *bits, unsigned num_bits)
+{
+	if (num_bits == 0)
+		return ERROR_OK;
+	if (remote_bitbang_v2_header(REMOTE_BITBANG_V2_TMS, 0, false, num_bits) != ERROR_OK)
+		return ERROR_FAIL;
+	return remote_bitbang_v2_write(bits, DIV_ROUND_UP(num_bits, 8));
+}
+
+/* Clock num_cycles times with a constant TMS value and TDI low. */
+static int remote_bitbang_v2_clock(int tms, unsigned num_cycles)
+{
+	if (num_cycles == 0)
+		return ERROR_OK;
+	return remote_bitbang_v2_header(REMOTE_BITBANG_V2_CLOCK, tms ? 1 : 0, true, num_cycles);
+}
+
+static int remote_bitbang_v2_state_move(int skip)
+{
+	uint8_t tms_scan = tap_get_tms_path(tap_get_state(), tap_get_end_state());
+	int tms_count = tap_get_tms_path_len(tap_get_state(), tap_get_end_state());
+
+	tms_scan >>= skip;
+	if (remote_bitbang_v2_tms_seq(&tms_scan, tms_count - skip) != ERROR_OK)
+		return ERROR_FAIL;
+
+	tap_set_state(tap_get_end_state());
+	return ERROR_OK;
+}
+
+static int remote_bitbang_v2_path_move(struct pathmove_command *cmd)
+{
+	uint8_t *bits = calloc(DIV_ROUND_UP(cmd->num_states, 8), 1);
+	if (bits == NULL && cmd->num_states) {
+		LOG_ERROR("remote_bitbang: out of memory");
+		return ERROR_FAIL;
+	}
+
+	for (int i = 0; i < cmd->num_states; i++) {
+		if (tap_state_transition(tap_get_state(), true) == cmd->path[i]) {
+			bits[i / 8] |= 1 << (i % 8);
+		} else if (tap_state_transition(tap_get_state(), false) != cmd->path[i]) {
+			LOG_ERROR("BUG: %s -> %s isn't a valid TAP transition",
+				tap_state_name(tap_get_state()),
+				tap_state_name(cmd->path[i]));
+			exit(-1);
+		}
+		tap_set_state(cmd->path[i]);
+	}
+
+	int retval = remote_bitbang_v2_tms_seq(bits, cmd->num_states);
+	free(bits);
+
+	tap_set_end_state(tap_get_state());
+	return retval;
+}
+
+static int remote_bitbang_v2_runtest(int num_cycles, tap_state_t end_state)
+{
+	/* only do a state_move when we're not already in IDLE */
+	if (tap_get_state() != TAP_IDLE) {
+		tap_set_end_state(TAP_IDLE);
+		if (remote_bitbang_v2_state_move(0) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	if (remote_bitbang_v2_clock(0, num_cycles) != ERROR_OK)
+		return ERROR_FAIL;
+
+	/* finish in end_state */
+	tap_set_end_state(end_state);
+	if (tap_get_state() != tap_get_end_state())
+		return remote_bitbang_v2_state_move(0);
+
+	return ERROR_OK;
+}
+
+static int remote_bitbang_v2_scan(struct scan_command *cmd)
+{
+	tap_state_t saved_end_state = cmd->end_state;
+	uint8_t *buffer;
+
+	if (remote_bitbang_scan_count == remote_bitbang_scan_size) {
+		unsigned size = remote_bitbang_scan_size ? remote_bitbang_scan_size * 2 : 64;
+		struct remote_bitbang_scan *s = realloc(remote_bitbang_scans, size * sizeof(*s));
+		if (s == NULL) {
+			LOG_ERROR("remote_bitbang: out of memory");
+			return ERROR_FAIL;
+		}
+		remote_bitbang_scans = s;
+		remote_bitbang_scan_size = size;
+	}
+
+	unsigned scan_size = jtag_build_buffer(cmd, &buffer);
+	enum scan_type type = jtag_scan_type(cmd);
+
+	remote_bitbang_scans[remote_bitbang_scan_count].cmd = cmd;
+	remote_bitbang_scans[remote_bitbang_scan_count].buffer = buffer;
+	remote_bitbang_scan_count++;
+
+	LOG_DEBUG_IO("%s scan %u bits; end in %s",
+			cmd->ir_scan ? "IR" : "DR", scan_size,
+			tap_state_name(cmd->end_state));
+
+	tap_state_t shift_state = cmd->ir_scan ? TAP_IRSHIFT : TAP_DRSHIFT;
+	if (tap_get_state() != shift_state) {
+		tap_set_end_state(shift_state);
+		if (remote_bitbang_v2_state_move(0) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+	tap_set_end_state(saved_end_state);
+
+	unsigned total_bytes = DIV_ROUND_UP(scan_size, 8);
+	for (unsigned offset = 0; offset < total_bytes; offset += REMOTE_BITBANG_V2_CHUNK_BYTES) {
+		unsigned bytes = MIN(total_bytes - offset, REMOTE_BITBANG_V2_CHUNK_BYTES);
+		bool last = offset + bytes == total_bytes;
+		unsigned bits = last ? scan_size - 8 * offset : 8 * bytes;
+		uint8_t flags = 0;
+
+		if (last)
+			flags |= REMOTE_BITBANG_V2_SCAN_TMS_LAST;
+		if (type != SCAN_OUT)
+			flags |= REMOTE_BITBANG_V2_SCAN_CAPTURE;
+		if (type == SCAN_IN)
+			flags |= REMOTE_BITBANG_V2_SCAN_NO_TDI;
+
+		if (type != SCAN_OUT && remote_bitbang_v2_expect(buffer + offset, bytes) != ERROR_OK)
+			return ERROR_FAIL;
+		if (remote_bitbang_v2_header(REMOTE_BITBANG_V2_SCAN, flags, true, bits) != ERROR_OK)
+			return ERROR_FAIL;
+		if (type != SCAN_IN && remote_bitbang_v2_write(buffer + offset, bytes) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	if (tap_get_state() != tap_get_end_state()) {
+		/* the last scanned bit already left the shift state */
+		return remote_bitbang_v2_state_move(1);
+	}
+	return ERROR_OK;
+}
+
+static void remote_bitbang_v2_free_scans(void)
+{
+	for (unsigned i = 0; i < remote_bitbang_scan_count; i++)
+		free(remote_bitbang_scans[i].buffer);
+	remote_bitbang_scan_count = 0;
+}
+
+static int remote_bitbang_v2_execute_queue(void)
+{
+	int retval = ERROR_OK;
+
+	socket_block(remote_bitbang_fd);
+
+	if (remote_bitbang_blink(1) != ERROR_OK)
+		return ERROR_FAIL;
+
+	for (struct jtag_command *cmd = jtag_command_queue; cmd; cmd = cmd->next) {
+		switch (cmd->type) {
+			case JTAG_RUNTEST:
+				LOG_DEBUG_IO("runtest %i cycles, end in %s",
+						cmd->cmd.runtest->num_cycles,
+						tap_state_name(cmd->cmd.runtest->end_state));
+				retval = remote_bitbang_v2_runtest(cmd->cmd.runtest->num_cycles,
+						cmd->cmd.runtest->end_state);
+				break;
+			case JTAG_STABLECLOCKS:
+				retval = remote_bitbang_v2_clock(tap_get_state() == TAP_RESET,
+						cmd->cmd.stableclocks->num_cycles);
+				break;
+			case JTAG_TLR_RESET:
+				LOG_DEBUG_IO("statemove end in %s",
+						tap_state_name(cmd->cmd.statemove->end_state));
+				tap_set_end_state(cmd->cmd.statemove->end_state);
+				retval = remote_bitbang_v2_state_move(0);
+				break;
+			case JTAG_PATHMOVE:
+				retval = remote_bitbang_v2_path_move(cmd->cmd.pathmove);
+				break;
+			case JTAG_SCAN:
+				retval = remote_bitbang_v2_scan(cmd->cmd.scan);
+				break;
+			case JTAG_SLEEP:
+				LOG_DEBUG_IO("sleep %" PRIi32, cmd->cmd.sleep->us);
+				retval = remote_bitbang_v2_drain();
+				jtag_sleep(cmd->cmd.sleep->us);
+				break;
+			case JTAG_TMS:
+				retval = remote_bitbang_v2_tms_seq(cmd->cmd.tms->bits,
+						cmd->cmd.tms->num_bits);
+				break;
+			default:
+				LOG_ERROR("BUG: unknown JTAG command type encountered");
+				exit(-1);
+		}
+		if (retval != ERROR_OK)
+			break;
+	}
+
+	if (retval == ERROR_OK)
+		retval = remote_bitbang_blink(0);
+	if (retval == ERROR_OK)
+		retval = remote_bitbang_v2_drain();
+	if (retval != ERROR_OK) {
+		remote_bitbang_pending_count = 0;
+		remote_bitbang_pending_bytes = 0;
+		remote_bitbang_v2_free_scans();
+		return retval;
+	}
+
+	for (unsigned i = 0; i < remote_bitbang_scan_count; i++) {
+		struct remote_bitbang_scan *s = &remote_bitbang_scans[i];
+		if (jtag_read_buffer(s->buffer, s->cmd) != ERROR_OK)
+			retval = ERROR_JTAG_QUEUE_FAILED;
+	}
+	remote_bitbang_v2_free_scans();
+
+	return retval;
+}
+
+static int remote_bitbang_execute_queue(void)
+{
+	if (remote_bitbang_protocol == REMOTE_BITBANG_PROTOCOL_V2)
+		return remote_bitbang_v2_execute_queue();
+	return bitbang_execute_queue();
+}
+
+/* Offer the binary protocol to the server. A legacy server ignores the hello
+ * and never answers, in which case we keep using the character protocol. */
+static int remote_bitbang_v2_negotiate(void)
+{
+	uint8_t reply[2];
+	unsigned received = 0;
+
+	remote_bitbang_protocol = REMOTE_BITBANG_PROTOCOL_LEGACY;
+
+	if (remote_bitbang_putc(REMOTE_BITBANG_V2_HELLO) != ERROR_OK)
+		return ERROR_FAIL;
+	if (EOF == fflush(remote_bitbang_file)) {
+		LOG_ERROR("fflush: %s", strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	int64_t deadline = timeval_ms() + remote_bitbang_hello_timeout_ms;
+	while (received < sizeof(reply)) {
+		int64_t remaining = deadline - timeval_ms();
+		if (remaining <= 0)
+			break;
+
+		fd_set rfds;
+		struct timeval tv = {
+			.tv_sec = remaining / 1000,
+			.tv_usec = (remaining % 1000) * 1000,
+		};
+		FD_ZERO(&rfds);
+		FD_SET(remote_bitbang_fd, &rfds);
+		int ret = socket_select(remote_bitbang_fd + 1, &rfds, NULL, NULL, &tv);
+		if (ret < 0) {
+			LOG_ERROR("remote_bitbang: select: %s", strerror(errno));
+			return ERROR_FAIL;
+		}
+		if (ret == 0)
+			break;
+
+		ssize_t count = read(remote_bitbang_fd, reply + received, sizeof(reply) - received);
+		if (count <= 0) {
+			LOG_ERROR("remote_bitbang: read: count=%d, error=%s",
+					(int)count, strerror(errno));
+			return ERROR_FAIL;
+		}
+		received += count;
+	}
+
+	if (received == sizeof(reply) && reply[0] == REMOTE_BITBANG_V2_HELLO && reply[1] == '2') {
+		remote_bitbang_protocol = REMOTE_BITBANG_PROTOCOL_V2;
+		LOG_INFO("remote_bitbang: using binary protocol v2");
+	} else if (received == 0) {
+		LOG_WARNING("remote_bitbang: server does not support protocol v2, "
+				"falling back to legacy protocol");
+	} else {
+		LOG_ERROR("remote_bitbang: unexpected answer to protocol v2 hello");
+		return ERROR_FAIL;
+	}
+
+	return ERROR_OK;
+}
+
 static int remote_bitbang_init_tcp(void)
 {
 	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
@@ -295,6 +1148,21 @@ static int remote_bitbang_init(void)
 		return ERROR_FAIL;
 	}
 
+	remote_bitbang_protocol = REMOTE_BITBANG_PROTOCOL_LEGACY;
+	if (remote_bitbang_protocol_requested == REMOTE_BITBANG_PROTOCOL_V2) {
+		if (remote_bitbang_v2_negotiate() != ERROR_OK) {
+			fclose(remote_bitbang_file);
+			return ERROR_FAIL;
+		}
+	}
+
+	if (transport_is_swd() && remote_bitbang_swd_mode == REMOTE_BITBANG_SWD_TRANSACTION &&
+			remote_bitbang_protocol != REMOTE_BITBANG_PROTOCOL_V2) {
+		LOG_ERROR("remote_bitbang: SWD transaction mode needs protocol v2");
+		fclose(remote_bitbang_file);
+		return ERROR_FAIL;
+	}
+
 	LOG_INFO("remote_bitbang driver initialized");
 	return ERROR_OK;
 }
@@ -321,6 +1189,53 @@ COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_host_command)
 	return ERROR_COMMAND_SYNTAX_ERROR;
 }
 
+COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_protocol_command)
+{
+	if (CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC >= 1) {
+		if (strcmp(CMD_ARGV[0], "legacy") == 0)
+			remote_bitbang_protocol_requested = REMOTE_BITBANG_PROTOCOL_LEGACY;
+		else if (strcmp(CMD_ARGV[0], "v2") == 0)
+			remote_bitbang_protocol_requested = REMOTE_BITBANG_PROTOCOL_V2;
+		else
+			return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	if (CMD_ARGC == 2) {
+		if (remote_bitbang_protocol_requested != REMOTE_BITBANG_PROTOCOL_V2)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], remote_bitbang_hello_timeout_ms);
+	}
+
+	if (remote_bitbang_protocol_requested == REMOTE_BITBANG_PROTOCOL_V2)
+		command_print(CMD, "remote_bitbang protocol: v2 (hello timeout %u ms)",
+				remote_bitbang_hello_timeout_ms);
+	else
+		command_print(CMD, "remote_bitbang protocol: legacy");
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_swd_mode_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "pin") == 0)
+			remote_bitbang_swd_mode = REMOTE_BITBANG_SWD_PIN;
+		else if (strcmp(CMD_ARGV[0], "transaction") == 0)
+			remote_bitbang_swd_mode = REMOTE_BITBANG_SWD_TRANSACTION;
+		else
+			return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	command_print(CMD, "remote_bitbang SWD mode: %s",
+			remote_bitbang_swd_mode == REMOTE_BITBANG_SWD_TRANSACTION ? "transaction" : "pin");
+	return ERROR_OK;
+}
+
 static const struct command_registration remote_bitbang_command_handlers[] = {
 	{
 		.name = "remote_bitbang_port",
@@ -338,16 +1253,35 @@ static const struct command_registration remote_bitbang_command_handlers[] = {
 			"  if port is 0 or unset, this is the name of the unix socket to use.",
 		.usage = "host_name",
 	},
+	{
+		.name = "remote_bitbang_protocol",
+		.handler = remote_bitbang_handle_remote_bitbang_protocol_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Select the wire protocol. 'v2' carries whole scans as binary\n"
+			"  records and falls back to 'legacy' if the server does not answer\n"
+			"  within hello_timeout_ms (default 100).",
+		.usage = "['legacy'|'v2' [hello_timeout_ms]]",
+	},
+	{
+		.name = "remote_bitbang_swd_mode",
+		.handler = remote_bitbang_handle_remote_bitbang_swd_mode_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Select how SWD is carried. 'pin' clocks SWDIO and SWCLK,\n"
+			"  'transaction' sends whole DP/AP requests (needs protocol v2).",
+		.usage = "['pin'|'transaction']",
+	},
 	COMMAND_REGISTRATION_DONE,
 };
 
 static struct jtag_interface remote_bitbang_interface = {
-	.execute_queue = &bitbang_execute_queue,
+	.execute_queue = &remote_bitbang_execute_queue,
 };
 
+static const char * const remote_bitbang_transports[] = { "jtag", "swd", NULL };
+
 struct adapter_driver remote_bitbang_adapter_driver = {
 	.name = "remote_bitbang",
-	.transports = jtag_only,
+	.transports = remote_bitbang_transports,
 	.commands = remote_bitbang_command_handlers,
 
 	.init = &remote_bitbang_init,
@@ -355,4 +1289,5 @@ struct adapter_driver remote_bitbang_adapter_driver = {
 	.reset = &remote_bitbang_reset,
 
 	.jtag_ops = &remote_bitbang_interface,
+	.swd_ops = &remote_bitbang_swd,
 };
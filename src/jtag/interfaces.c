@@ -57,6 +57,9 @@ extern struct adapter_driver ftdi_adapter_driver;
 #if BUILD_USB_BLASTER == 1 || BUILD_USB_BLASTER_2 == 1
 extern struct adapter_driver usb_blaster_adapter_driver;
 #endif
+#if BUILD_DAPSIM == 1
+extern struct adapter_driver dapsim_adapter_driver;
+#endif
 #if BUILD_JTAG_VPI == 1
 extern struct adapter_driver jtag_vpi_adapter_driver;
 #endif
@@ -168,6 +171,9 @@ struct adapter_driver *adapter_drivers[] = {
 #if BUILD_USB_BLASTER || BUILD_USB_BLASTER_2 == 1
 		&usb_blaster_adapter_driver,
 #endif
+#if BUILD_DAPSIM == 1
+		&dapsim_adapter_driver,
+#endif
 #if BUILD_JTAG_VPI == 1
 		&jtag_vpi_adapter_driver,
 #endif
@@ -295,6 +295,21 @@ void jtag_set_verify_capture_ir(bool enable);
 /** @returns True if IR scan verification will be performed. */
 bool jtag_will_verify_capture_ir(void);
 
+/** How aggressively the JTAG command queue is rewritten before execution. */
+enum jtag_queue_optimize {
+	/** hand the queue to the driver as built */
+	JTAG_QUEUE_OPTIMIZE_OFF,
+	/** fold TMS sequences, clocks and run-test runs, drop no-op moves */
+	JTAG_QUEUE_OPTIMIZE_ON,
+	/** also drop IR scans that reload the instruction already loaded */
+	JTAG_QUEUE_OPTIMIZE_IR,
+};
+
+/** Select the queue optimizer mode. */
+void jtag_set_queue_optimize(enum jtag_queue_optimize mode);
+/** @returns The current queue optimizer mode. */
+enum jtag_queue_optimize jtag_get_queue_optimize(void);
+
 /** Initialize debug adapter upon startup.  */
 int adapter_init(struct command_context *cmd_ctx);
 
@@ -35,6 +35,7 @@
 #include "minidriver.h"
 #include "interface.h"
 #include "interfaces.h"
+#include "commands.h"
 #include "tcl.h"
 
 #ifdef HAVE_STRINGS_H
@@ -1175,6 +1176,50 @@ COMMAND_HANDLER(handle_verify_ircapture_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_jtag_queue_optimize_command)
+{
+	static const char * const modes[] = {
+		[JTAG_QUEUE_OPTIMIZE_OFF] = "off",
+		[JTAG_QUEUE_OPTIMIZE_ON] = "on",
+		[JTAG_QUEUE_OPTIMIZE_IR] = "ir",
+	};
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned i;
+		for (i = 0; i < ARRAY_SIZE(modes); i++) {
+			if (strcmp(CMD_ARGV[0], modes[i]) == 0)
+				break;
+		}
+		if (i == ARRAY_SIZE(modes)) {
+			if (strcmp(CMD_ARGV[0], "reset_stats") != 0)
+				return ERROR_COMMAND_SYNTAX_ERROR;
+			jtag_queue_optimize_reset_stats();
+		} else {
+			jtag_set_queue_optimize(i);
+			if (i == JTAG_QUEUE_OPTIMIZE_IR && jtag_will_verify() &&
+					jtag_will_verify_capture_ir())
+				LOG_WARNING("IR scans whose capture is verified are never dropped; "
+						"'verify_ircapture disable' to let 'ir' apply to them");
+		}
+	}
+
+	struct jtag_queue_optimize_stats stats;
+	jtag_queue_optimize_get_stats(&stats);
+
+	command_print(CMD, "queue optimizer is %s", modes[jtag_get_queue_optimize()]);
+	command_print(CMD, "queues: %" PRIu64 ", commands removed: %" PRIu64 ", clocks saved: %" PRIu64,
+			stats.queues, stats.commands_removed, stats.clocks_saved);
+	command_print(CMD, "folded: %" PRIu64 " tms, %" PRIu64 " stableclocks, %" PRIu64 " runtest; "
+			"dropped: %" PRIu64 " moves, %" PRIu64 " ir scans",
+			stats.tms_folded, stats.clocks_folded, stats.runtests_folded,
+			stats.moves_dropped, stats.ir_scans_dropped);
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_verify_jtag_command)
 {
 	if (CMD_ARGC > 1)
@@ -1263,6 +1308,23 @@ COMMAND_HANDLER(handle_wait_srst_deassert)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_jtag_queue_stats)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct cmd_queue_stats stats;
+	cmd_queue_get_stats(&stats);
+
+	command_print(CMD, "pages: %u (%zu bytes reserved)", stats.pages, stats.bytes_reserved);
+	command_print(CMD, "in use: %zu bytes, high water: %zu bytes",
+			stats.bytes_in_use, stats.high_water);
+	command_print(CMD, "allocations: %" PRIu64 ", page mallocs: %" PRIu64 ", queue resets: %" PRIu64,
+			stats.allocs, stats.page_mallocs, stats.resets);
+
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_command_handlers[] = {
 
 	{
@@ -1273,6 +1335,13 @@ static const struct command_registration jtag_command_handlers[] = {
 			"to test performance or change in behavior. Default 0ms.",
 		.usage = "[sleep in ms]",
 	},
+	{
+		.name = "jtag_queue_stats",
+		.handler = handle_jtag_queue_stats,
+		.mode = COMMAND_ANY,
+		.help = "Display statistics of the JTAG command queue arena.",
+		.usage = "",
+	},
 	{
 		.name = "jtag_rclk",
 		.handler = handle_jtag_rclk_command,
@@ -1327,6 +1396,19 @@ static const struct command_registration jtag_command_handlers[] = {
 			"verify values captured during Capture-IR.",
 		.usage = "['enable'|'disable']",
 	},
+	{
+		.name = "jtag_queue_optimize",
+		.handler = handle_jtag_queue_optimize_command,
+		.mode = COMMAND_ANY,
+		.help = "Display or set how the JTAG queue is optimized before "
+			"it reaches the driver, and display its statistics.  "
+			"'on' folds adjacent TMS, clock and run-test commands and "
+			"drops no-op moves; 'ir' also drops IR scans that reload "
+			"the instruction already loaded and capture nothing, which "
+			"needs verify_ircapture disabled and is wrong for TAPs that "
+			"act on Update-IR.",
+		.usage = "['off'|'on'|'ir'|'reset_stats']",
+	},
 	{
 		.name = "verify_jtag",
 		.handler = handle_verify_jtag_command,
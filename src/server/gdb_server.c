@@ -95,6 +95,9 @@ struct gdb_connection {
 	bool extended_protocol;
 	/* temporarily used for target description support */
 	struct target_desc_format target_desc;
+	/* set when qSupported offered a target description, whose regnum
+	 * attributes then number the registers */
+	bool target_desc_supported;
 	/* temporarily used for thread list support */
 	char *thread_list;
 };
@@ -116,6 +119,8 @@ static void gdb_log_callback(void *priv, const char *file, unsigned line,
 		const char *function, const char *string);
 
 static void gdb_sig_halted(struct connection *connection);
+static int gdb_expedited_regs(struct connection *connection, struct target *target,
+		char *buf, size_t size);
 
 /* number of gdb connections, mainly to suppress gdb related debugging spam
  * in helper/log.c when no gdb connections are actually active */
@@ -727,9 +732,10 @@ static int gdb_output(struct command_context *context, const char *line)
 static void gdb_signal_reply(struct target *target, struct connection *connection)
 {
 	struct gdb_connection *gdb_connection = connection->priv;
-	char sig_reply[65];
+	char sig_reply[256];
 	char stop_reason[20];
 	char current_thread[25];
+	char expedited[160];
 	int sig_reply_len;
 	int signal_var;
 
@@ -782,8 +788,13 @@ static void gdb_signal_reply(struct target *target, struct connection *connectio
 			snprintf(current_thread, sizeof(current_thread), "thread:%" PRIx64 ";",
 					target->rtos->current_thread);
 
-		sig_reply_len = snprintf(sig_reply, sizeof(sig_reply), "T%2.2x%s%s",
-				signal_var, stop_reason, current_thread);
+		/* the registers of an RTOS thread are not those of the core */
+		expedited[0] = '\0';
+		if (target->rtos == NULL)
+			gdb_expedited_regs(connection, ct, expedited, sizeof(expedited));
+
+		sig_reply_len = snprintf(sig_reply, sizeof(sig_reply), "T%2.2x%s%s%s",
+				signal_var, stop_reason, current_thread, expedited);
 
 		gdb_connection->ctrl_c = 0;
 	}
@@ -954,6 +965,7 @@ static int gdb_new_connection(struct connection *connection)
 	gdb_connection->extended_protocol = false;
 	gdb_connection->target_desc.tdesc = NULL;
 	gdb_connection->target_desc.tdesc_length = 0;
+	gdb_connection->target_desc_supported = false;
 	gdb_connection->thread_list = NULL;
 
 	/* send ACK to GDB for debug request */
@@ -1157,6 +1169,64 @@ static void gdb_target_to_reg(struct target *target,
 	}
 }
 
+/* Registers sent along with stop replies, so that GDB can show where the
+ * target stopped without reading the whole register set first. */
+static const char * const gdb_expedited_reg_names[] = { "pc", "sp", "fp" };
+
+/* Format the expedited registers as "n:value;" pairs, n being the number
+ * GDB knows the register by: its regnum in the target description if one
+ * was offered, otherwise its position in the 'g' packet. Returns the length
+ * of the string in buf. */
+static int gdb_expedited_regs(struct connection *connection, struct target *target,
+		char *buf, size_t size)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	bool tdesc = gdb_connection->target_desc_supported;
+	struct reg **reg_list;
+	int reg_list_size;
+	struct reg *regs[ARRAY_SIZE(gdb_expedited_reg_names)];
+	int numbers[ARRAY_SIZE(gdb_expedited_reg_names)];
+	unsigned num_regs = 0;
+	size_t len = 0;
+
+	buf[0] = '\0';
+	if (target_get_gdb_reg_list_noread(target, &reg_list, &reg_list_size,
+			tdesc ? REG_CLASS_ALL : REG_CLASS_GENERAL) != ERROR_OK)
+		return 0;
+
+	for (unsigned k = 0; k < ARRAY_SIZE(gdb_expedited_reg_names); k++) {
+		for (int i = 0; i < reg_list_size; i++) {
+			if (reg_list[i] && reg_list[i]->exist &&
+					strcmp(reg_list[i]->name, gdb_expedited_reg_names[k]) == 0) {
+				regs[num_regs] = reg_list[i];
+				numbers[num_regs++] = tdesc ? (int)reg_list[i]->number : i;
+				break;
+			}
+		}
+	}
+	free(reg_list);
+
+	register_list_fetch(regs, num_regs);
+
+	for (unsigned k = 0; k < num_regs; k++) {
+		size_t chars = DIV_ROUND_UP(regs[k]->size, 8) * 2;
+
+		if (!regs[k]->valid)
+			continue;
+		/* number, ':', value, ';' and the terminating null */
+		if (len + 8 + 1 + chars + 1 + 1 > size)
+			break;
+
+		len += sprintf(buf + len, "%x:", numbers[k]);
+		gdb_str_to_target(target, buf + len, regs[k]);
+		len += chars;
+		buf[len++] = ';';
+		buf[len] = '\0';
+	}
+
+	return len;
+}
+
 static int gdb_get_registers_packet(struct connection *connection,
 		char const *packet, int packet_size)
 {
@@ -1195,18 +1265,18 @@ static int gdb_get_registers_packet(struct connection *connection,
 
 	reg_packet_p = reg_packet;
 
+	/* read whatever is missing in as few target accesses as possible */
+	retval = register_list_fetch(reg_list, reg_list_size);
+	if (retval != ERROR_OK && gdb_report_register_access_error) {
+		LOG_DEBUG("Couldn't get registers.");
+		free(reg_packet);
+		free(reg_list);
+		return gdb_error(connection, retval);
+	}
+
 	for (i = 0; i < reg_list_size; i++) {
 		if (reg_list[i] == NULL || reg_list[i]->exist == false)
 			continue;
-		if (!reg_list[i]->valid) {
-			retval = reg_list[i]->type->get(reg_list[i]);
-			if (retval != ERROR_OK && gdb_report_register_access_error) {
-				LOG_DEBUG("Couldn't get register %s.", reg_list[i]->name);
-				free(reg_packet);
-				free(reg_list);
-				return gdb_error(connection, retval);
-			}
-		}
 		gdb_str_to_target(target, reg_packet_p, reg_list[i]);
 		reg_packet_p += DIV_ROUND_UP(reg_list[i]->size, 8) * 2;
 	}
@@ -1316,6 +1386,28 @@ static int gdb_get_register_packet(struct connection *connection,
 		return ERROR_SERVER_REMOTE_CLOSED;
 	}
 
+	if (!reg_list[reg_num]->valid && reg_list[reg_num]->type->get_many) {
+		/* GDB usually asks for the other registers of the same feature
+		 * next, read those of the same type along when that type can
+		 * read them in one go */
+		struct reg *reg = reg_list[reg_num];
+		struct reg **group = malloc(reg_list_size * sizeof(*group));
+		unsigned num_group = 0;
+		if (group) {
+			for (int i = 0; i < reg_list_size; i++) {
+				struct reg *r = reg_list[i];
+				if (r == reg || (r && r->exist && !r->valid && r->type == reg->type &&
+						reg->feature && reg->feature->name && r->feature &&
+						r->feature->name &&
+						strcmp(r->feature->name, reg->feature->name) == 0))
+					group[num_group++] = r;
+			}
+			if (reg->type->get_many(group, num_group) != ERROR_OK)
+				LOG_DEBUG("batched read of %u registers failed", num_group);
+			free(group);
+		}
+	}
+
 	if (!reg_list[reg_num]->valid) {
 		retval = reg_list[reg_num]->type->get(reg_list[reg_num]);
 		if (retval != ERROR_OK && gdb_report_register_access_error) {
@@ -2618,6 +2710,7 @@ static int gdb_query_packet(struct connection *connection,
 				LOG_WARNING("Target Descriptions Supported, but disabled");
 			gdb_target_desc_supported = 0;
 		}
+		gdb_connection->target_desc_supported = gdb_target_desc_supported;
 
 		xml_printf(&retval,
 			&buffer,
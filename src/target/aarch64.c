@@ -31,6 +31,7 @@
 #include "arm_semihosting.h"
 #include "jtag/interface.h"
 #include "smp.h"
+#include "tlbcache.h"
 #include <helper/time_support.h>
 
 enum restart_mode {
@@ -314,18 +315,73 @@ static int aarch64_wait_halt_one(struct target *target)
 	return retval;
 }
 
+static unsigned int aarch64_smp_count(struct target *target)
+{
+	struct target_list *head;
+	unsigned int count = 0;
+
+	foreach_smp_target(head, target->head)
+		count++;
+
+	return count;
+}
+
+/*
+ * Read PRSR of all examined PEs in the SMP group with a single DAP run.
+ * The results are stored by position in the group, with @a status set to
+ * ERROR_TARGET_NOT_EXAMINED for the PEs that were skipped.
+ */
+static void aarch64_read_prsr_smp(struct target *target, uint32_t *prsr, int *status)
+{
+	struct adiv5_batch batch;
+	struct target_list *head;
+	unsigned int i = 0;
+
+	adiv5_batch_init(&batch);
+
+	foreach_smp_target(head, target->head) {
+		struct target *curr = head->target;
+		struct armv8_common *armv8 = target_to_armv8(curr);
+
+		status[i] = ERROR_TARGET_NOT_EXAMINED;
+		if (target_was_examined(curr))
+			adiv5_batch_mem_read_u32(&batch, armv8->debug_ap,
+					armv8->debug_base + CPUV8_DBG_PRSR, &prsr[i], &status[i]);
+		i++;
+	}
+
+	adiv5_batch_run(&batch);
+	adiv5_batch_free(&batch);
+}
+
 static int aarch64_prepare_halt_smp(struct target *target, bool exc_target, struct target **p_first)
 {
 	int retval = ERROR_OK;
-	struct target_list *head = target->head;
+	struct target_list *head;
 	struct target *first = NULL;
+	struct adiv5_batch batch;
+	unsigned int count = aarch64_smp_count(target);
+	unsigned int i;
 
 	LOG_DEBUG("target %s exc %i", target_name(target), exc_target);
 
-	while (head != NULL) {
+	uint32_t *gate = calloc(count, sizeof(*gate));
+	uint32_t *dscr = calloc(count, sizeof(*dscr));
+	bool *prepare = calloc(count, sizeof(*prepare));
+	if (!gate || !dscr || !prepare) {
+		LOG_ERROR("Out of memory");
+		retval = ERROR_FAIL;
+		goto out;
+	}
+
+	adiv5_batch_init(&batch);
+
+	/* read the CTI gate and DSCR of all PEs to prepare in one go ... */
+	i = 0;
+	foreach_smp_target(head, target->head) {
 		struct target *curr = head->target;
 		struct armv8_common *armv8 = target_to_armv8(curr);
-		head = head->next;
+		unsigned int n = i++;
 
 		if (exc_target && curr == target)
 			continue;
@@ -336,13 +392,41 @@ static int aarch64_prepare_halt_smp(struct target *target, bool exc_target, stru
 
 		/* HACK: mark this target as prepared for halting */
 		curr->debug_reason = DBG_REASON_DBGRQ;
+		prepare[n] = true;
+
+		arm_cti_batch_read_reg(armv8->cti, &batch, CTI_GATE, &gate[n], NULL);
+		adiv5_batch_mem_read_u32(&batch, armv8->debug_ap,
+				armv8->debug_base + CPUV8_DBG_DSCR, &dscr[n], NULL);
+	}
+	retval = adiv5_batch_run(&batch);
+
+	/* ... then open the gate for channel 0 to let HALT requests pass to
+	 * the CTM, and allow Halting Debug Mode */
+	i = 0;
+	foreach_smp_target(head, target->head) {
+		struct target *curr = head->target;
+		struct armv8_common *armv8 = target_to_armv8(curr);
+		unsigned int n = i++;
 
-		/* open the gate for channel 0 to let HALT requests pass to the CTM */
-		retval = arm_cti_ungate_channel(armv8->cti, 0);
-		if (retval == ERROR_OK)
-			retval = aarch64_set_dscr_bits(curr, DSCR_HDE, DSCR_HDE);
 		if (retval != ERROR_OK)
 			break;
+		if (!prepare[n])
+			continue;
+
+		arm_cti_batch_write_reg(armv8->cti, &batch, CTI_GATE, gate[n] | CTI_CHNL(0), NULL);
+		adiv5_batch_mem_write_u32(&batch, armv8->debug_ap,
+				armv8->debug_base + CPUV8_DBG_DSCR, dscr[n] | DSCR_HDE, NULL);
+	}
+	if (retval == ERROR_OK)
+		retval = adiv5_batch_run(&batch);
+	adiv5_batch_free(&batch);
+
+	i = 0;
+	foreach_smp_target(head, target->head) {
+		struct target *curr = head->target;
+
+		if (retval != ERROR_OK || !prepare[i++])
+			continue;
 
 		LOG_DEBUG("target %s prepared", target_name(curr));
 
@@ -350,6 +434,11 @@ static int aarch64_prepare_halt_smp(struct target *target, bool exc_target, stru
 			first = curr;
 	}
 
+out:
+	free(gate);
+	free(dscr);
+	free(prepare);
+
 	if (p_first) {
 		if (exc_target && first)
 			*p_first = first;
@@ -407,23 +496,36 @@ static int aarch64_halt_smp(struct target *target, bool exc_target)
 	if (retval != ERROR_OK)
 		return retval;
 
+	unsigned int count = aarch64_smp_count(target);
+	uint32_t *prsr = calloc(count, sizeof(*prsr));
+	int *status = calloc(count, sizeof(*status));
+	if (!prsr || !status) {
+		LOG_ERROR("Out of memory");
+		free(prsr);
+		free(status);
+		return ERROR_FAIL;
+	}
+
 	/* wait for all PEs to halt */
 	int64_t then = timeval_ms();
 	for (;;) {
 		bool all_halted = true;
 		struct target_list *head;
 		struct target *curr;
+		unsigned int i = 0;
+
+		aarch64_read_prsr_smp(target, prsr, status);
 
 		foreach_smp_target(head, target->head) {
-			int halted;
+			unsigned int n = i++;
 
 			curr = head->target;
 
 			if (!target_was_examined(curr))
 				continue;
 
-			retval = aarch64_check_state_one(curr, PRSR_HALT, PRSR_HALT, &halted, NULL);
-			if (retval != ERROR_OK || !halted) {
+			retval = status[n];
+			if (retval != ERROR_OK || !(prsr[n] & PRSR_HALT)) {
 				all_halted = false;
 				break;
 			}
@@ -449,6 +551,9 @@ static int aarch64_halt_smp(struct target *target, bool exc_target)
 			break;
 	}
 
+	free(prsr);
+	free(status);
+
 	return retval;
 }
 
@@ -779,14 +884,26 @@ static int aarch64_step_restart_smp(struct target *target)
 		return retval;
 	}
 
+	unsigned int count = aarch64_smp_count(target);
+	uint32_t *prsr = calloc(count, sizeof(*prsr));
+	int *status = calloc(count, sizeof(*status));
+	if (!prsr || !status) {
+		LOG_ERROR("Out of memory");
+		free(prsr);
+		free(status);
+		return ERROR_FAIL;
+	}
+
 	int64_t then = timeval_ms();
 	for (;;) {
 		struct target *curr = target;
 		bool all_resumed = true;
+		unsigned int i = 0;
+
+		aarch64_read_prsr_smp(target, prsr, status);
 
 		foreach_smp_target(head, target->head) {
-			uint32_t prsr;
-			int resumed;
+			unsigned int n = i++;
 
 			curr = head->target;
 
@@ -796,9 +913,8 @@ static int aarch64_step_restart_smp(struct target *target)
 			if (!target_was_examined(curr))
 				continue;
 
-			retval = aarch64_check_state_one(curr,
-					PRSR_SDR, PRSR_SDR, &resumed, &prsr);
-			if (retval != ERROR_OK || (!resumed && (prsr & PRSR_HALT))) {
+			retval = status[n];
+			if (retval != ERROR_OK || (!(prsr[n] & PRSR_SDR) && (prsr[n] & PRSR_HALT))) {
 				all_resumed = false;
 				break;
 			}
@@ -830,6 +946,9 @@ static int aarch64_step_restart_smp(struct target *target)
 			break;
 }
 
+	free(prsr);
+	free(status);
+
 	return retval;
 }
 
@@ -866,15 +985,27 @@ static int aarch64_resume(struct target *target, int current,
 		return retval;
 
 	if (target->smp) {
+		unsigned int count = aarch64_smp_count(target);
+		uint32_t *prsr = calloc(count, sizeof(*prsr));
+		int *status = calloc(count, sizeof(*status));
+		if (!prsr || !status) {
+			LOG_ERROR("Out of memory");
+			free(prsr);
+			free(status);
+			return ERROR_FAIL;
+		}
+
 		int64_t then = timeval_ms();
 		for (;;) {
 			struct target *curr = target;
 			struct target_list *head;
 			bool all_resumed = true;
+			unsigned int i = 0;
+
+			aarch64_read_prsr_smp(target, prsr, status);
 
 			foreach_smp_target(head, target->head) {
-				uint32_t prsr;
-				int resumed;
+				unsigned int n = i++;
 
 				curr = head->target;
 				if (curr == target)
@@ -882,9 +1013,8 @@ static int aarch64_resume(struct target *target, int current,
 				if (!target_was_examined(curr))
 					continue;
 
-				retval = aarch64_check_state_one(curr,
-						PRSR_SDR, PRSR_SDR, &resumed, &prsr);
-				if (retval != ERROR_OK || (!resumed && (prsr & PRSR_HALT))) {
+				retval = status[n];
+				if (retval != ERROR_OK || (!(prsr[n] & PRSR_SDR) && (prsr[n] & PRSR_HALT))) {
 					all_resumed = false;
 					break;
 				}
@@ -916,6 +1046,9 @@ static int aarch64_resume(struct target *target, int current,
 			if (retval != ERROR_OK)
 				break;
 		}
+
+		free(prsr);
+		free(status);
 	}
 
 	if (retval != ERROR_OK)
@@ -2109,18 +2242,52 @@ static int aarch64_read_cpu_memory(struct target *target,
 	return ERROR_OK;
 }
 
+/*
+ * The system bus MEM-AP bypasses the data caches: write back and invalidate
+ * the lines covering the range before it is accessed that way. The MMU is
+ * already off, so the maintenance by VA operates on the physical range.
+ * Nothing needs to be done while the data cache is disabled.
+ */
+static int aarch64_sysap_flush_range(struct target *target,
+	target_addr_t address, uint32_t bytes)
+{
+	struct armv8_common *armv8 = target_to_armv8(target);
+
+	if (!armv8->armv8_mmu.armv8_cache.d_u_cache_enabled)
+		return ERROR_OK;
+
+	return armv8_cache_d_inner_flush_virt(armv8, address, bytes);
+}
+
 static int aarch64_read_phys_memory(struct target *target,
 	target_addr_t address, uint32_t size,
 	uint32_t count, uint8_t *buffer)
 {
+	struct armv8_common *armv8 = target_to_armv8(target);
+	enum arm_memroute_path path;
+	struct duration bench;
 	int retval = ERROR_COMMAND_SYNTAX_ERROR;
 
 	if (count && buffer) {
-		/* read memory through APB-AP */
+		path = arm_memroute_select(&armv8->memroute, address, size * count);
+		duration_start(&bench);
+
 		retval = aarch64_mmu_modify(target, 0);
 		if (retval != ERROR_OK)
 			return retval;
-		retval = aarch64_read_cpu_memory(target, address, size, count, buffer);
+
+		if (path == ARM_MEMROUTE_SYSAP) {
+			/* read memory through the system bus MEM-AP */
+			retval = aarch64_sysap_flush_range(target, address, size * count);
+			if (retval == ERROR_OK)
+				retval = arm_memroute_read(&armv8->memroute, address, size, count, buffer);
+		} else {
+			/* read memory through APB-AP */
+			retval = aarch64_read_cpu_memory(target, address, size, count, buffer);
+		}
+
+		if (retval == ERROR_OK)
+			arm_memroute_account(&armv8->memroute, path, false, size * count, &bench);
 	}
 	return retval;
 }
@@ -2149,14 +2316,34 @@ static int aarch64_write_phys_memory(struct target *target,
 	target_addr_t address, uint32_t size,
 	uint32_t count, const uint8_t *buffer)
 {
+	struct armv8_common *armv8 = target_to_armv8(target);
+	enum arm_memroute_path path;
+	struct duration bench;
 	int retval = ERROR_COMMAND_SYNTAX_ERROR;
 
 	if (count && buffer) {
-		/* write memory through APB-AP */
+		path = arm_memroute_select(&armv8->memroute, address, size * count);
+		duration_start(&bench);
+
 		retval = aarch64_mmu_modify(target, 0);
 		if (retval != ERROR_OK)
 			return retval;
-		return aarch64_write_cpu_memory(target, address, size, count, buffer);
+
+		if (path == ARM_MEMROUTE_SYSAP) {
+			/* write memory through the system bus MEM-AP, then drop
+			 * any stale instructions fetched from the range */
+			retval = aarch64_sysap_flush_range(target, address, size * count);
+			if (retval == ERROR_OK)
+				retval = arm_memroute_write(&armv8->memroute, address, size, count, buffer);
+			if (retval == ERROR_OK && armv8->armv8_mmu.armv8_cache.i_cache_enabled)
+				retval = armv8_cache_i_inner_inval_virt(armv8, address, size * count);
+		} else {
+			/* write memory through APB-AP */
+			retval = aarch64_write_cpu_memory(target, address, size, count, buffer);
+		}
+
+		if (retval == ERROR_OK)
+			arm_memroute_account(&armv8->memroute, path, true, size * count, &bench);
 	}
 
 	return retval;
@@ -2386,6 +2573,9 @@ static int aarch64_init_arch_info(struct target *target,
 	armv8->pre_restore_context = NULL;
 	armv8->armv8_mmu.read_physical_memory = aarch64_read_phys_memory;
 
+	arm_memroute_init(&armv8->memroute);
+	armv8->arm.memroute = &armv8->memroute;
+
 	armv8_init_arch_info(target, armv8);
 	target_register_timer_callback(aarch64_handle_target_request, 1,
 		TARGET_TIMER_TYPE_PERIODIC, target);
@@ -2702,6 +2892,10 @@ static int jim_mcrmrc(Jim_Interp *interp, int argc, Jim_Obj * const *argv)
 		retval = arm->mcr(target, cpnum, op1, op2, CRn, CRm, value);
 		if (retval != ERROR_OK)
 			return JIM_ERR;
+
+		/* SCTLR, TTBRx/TTBCR, DACR, TLB maintenance or CONTEXTIDR */
+		if (cpnum == 15 && (CRn == 1 || CRn == 2 || CRn == 3 || CRn == 8 || CRn == 13))
+			target_tlbcache_invalidate(target);
 	} else {
 		/* NOTE: parameters reordered! */
 		/* ARMV4_5_MRC(cpnum, op1, 0, CRn, CRm, op2) */
@@ -2754,6 +2948,9 @@ static const struct command_registration aarch64_exec_command_handlers[] = {
 	{
 		.chain = smp_command_handlers,
 	},
+	{
+		.chain = arm_memroute_command_handlers,
+	},
 
 
 	COMMAND_REGISTRATION_DONE
@@ -0,0 +1,459 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/**
+ * @file
+ * Persistent cache of the DAP topology.
+ *
+ * Finding an AP of a given type and looking up CoreSight components in the
+ * ROM tables takes many synchronous accesses. The results only depend on
+ * the silicon, so they can be kept in a file and reused at the next start.
+ *
+ * The cache is keyed by a fingerprint of the debug port (JTAG IDCODE,
+ * DPIDR and, for DPv2 over SWD, TARGETID), read once after each connect. Every
+ * entry also records the IDR of the AP it belongs to, which is checked
+ * with a single read before the entry is used. Entries that do not match
+ * are dropped and rediscovered by the normal walk.
+ *
+ * New records are appended to the file. It is only written as a whole when
+ * it does not match the cache in memory, e.g. after a fingerprint change.
+ *
+ * File format, one record per line:
+ *   fingerprint <idcode> <dpidr> <targetid>
+ *   ap <type> <ap_num> <idr>
+ *   component <ap_num> <idr> <dbgbase> <devtype> <index> <address>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include <jtag/jtag.h>
+#include <transport/transport.h>
+#include "arm_adi_v5.h"
+
+enum topology_entry_kind {
+	TOPOLOGY_AP,
+	TOPOLOGY_COMPONENT,
+};
+
+struct topology_entry {
+	enum topology_entry_kind kind;
+	uint8_t ap_num;
+	uint32_t idr;
+	/* TOPOLOGY_AP: AP type searched for; TOPOLOGY_COMPONENT: devtype */
+	uint32_t type;
+	uint32_t dbgbase;
+	int32_t index;
+	uint32_t address;
+};
+
+struct adiv5_topology {
+	char *filename;
+
+	/* fingerprint the entries were recorded with */
+	uint32_t fingerprint[3];
+	bool have_fingerprint;
+
+	/* set once the fingerprint was checked after the last connect */
+	bool checked;
+	bool usable;
+
+	struct topology_entry *entries;
+	unsigned int num_entries;
+
+	/* the file holds exactly the fingerprint and the entries above, so
+	 * new entries can be appended to it */
+	bool file_current;
+
+	/* AP IDR values read in this session, to validate entries */
+	uint32_t ap_idr[DP_APSEL_MAX + 1];
+	bool ap_idr_valid[DP_APSEL_MAX + 1];
+};
+
+static void adiv5_topology_clear(struct adiv5_topology *topology)
+{
+	free(topology->entries);
+	topology->entries = NULL;
+	topology->num_entries = 0;
+	topology->file_current = false;
+}
+
+static bool adiv5_topology_same_key(const struct topology_entry *a, const struct topology_entry *b)
+{
+	if (a->kind != b->kind || a->type != b->type)
+		return false;
+	if (a->kind == TOPOLOGY_AP)
+		return true;
+	return a->ap_num == b->ap_num && a->dbgbase == b->dbgbase && a->index == b->index;
+}
+
+/* Add the entry, or replace the one with the same key. */
+static int adiv5_topology_put(struct adiv5_topology *topology, const struct topology_entry *e,
+		bool *replaced)
+{
+	*replaced = false;
+	for (unsigned int i = 0; i < topology->num_entries; i++) {
+		if (adiv5_topology_same_key(&topology->entries[i], e)) {
+			topology->entries[i] = *e;
+			*replaced = true;
+			return ERROR_OK;
+		}
+	}
+
+	struct topology_entry *entries = realloc(topology->entries,
+			(topology->num_entries + 1) * sizeof(*entries));
+	if (!entries) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	topology->entries = entries;
+	topology->entries[topology->num_entries++] = *e;
+	return ERROR_OK;
+}
+
+static int adiv5_topology_load(struct adiv5_topology *topology)
+{
+	FILE *f = fopen(topology->filename, "r");
+	if (!f) {
+		LOG_DEBUG("DAP topology cache %s not found", topology->filename);
+		return ERROR_OK;
+	}
+
+	/* a later line for the same key supersedes an earlier one, the file is
+	 * compacted at the next write if there were any */
+	bool compact = true;
+	char line[160];
+	while (fgets(line, sizeof(line), f)) {
+		struct topology_entry e = { 0 };
+		unsigned int ap_num;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "fingerprint %" SCNx32 " %" SCNx32 " %" SCNx32,
+					&topology->fingerprint[0], &topology->fingerprint[1],
+					&topology->fingerprint[2]) == 3) {
+			topology->have_fingerprint = true;
+			continue;
+		}
+
+		if (sscanf(line, "ap %" SCNx32 " %u %" SCNx32, &e.type, &ap_num, &e.idr) == 3) {
+			e.kind = TOPOLOGY_AP;
+		} else if (sscanf(line, "component %u %" SCNx32 " %" SCNx32 " %" SCNx32 " %" SCNd32 " %" SCNx32,
+					&ap_num, &e.idr, &e.dbgbase, &e.type, &e.index, &e.address) == 6) {
+			e.kind = TOPOLOGY_COMPONENT;
+		} else {
+			LOG_WARNING("DAP topology cache %s: ignoring malformed line", topology->filename);
+			compact = false;
+			continue;
+		}
+
+		if (ap_num > DP_APSEL_MAX) {
+			compact = false;
+			continue;
+		}
+		e.ap_num = ap_num;
+
+		bool replaced;
+		if (adiv5_topology_put(topology, &e, &replaced) != ERROR_OK) {
+			fclose(f);
+			return ERROR_FAIL;
+		}
+		if (replaced)
+			compact = false;
+	}
+
+	fclose(f);
+
+	if (!topology->have_fingerprint)
+		adiv5_topology_clear(topology);
+	else
+		topology->file_current = compact;
+
+	LOG_DEBUG("DAP topology cache %s: %u entries", topology->filename, topology->num_entries);
+	return ERROR_OK;
+}
+
+static void adiv5_topology_write_entry(FILE *f, const struct topology_entry *e)
+{
+	if (e->kind == TOPOLOGY_AP)
+		fprintf(f, "ap 0x%" PRIx32 " %u 0x%08" PRIx32 "\n", e->type, e->ap_num, e->idr);
+	else
+		fprintf(f, "component %u 0x%08" PRIx32 " 0x%08" PRIx32 " 0x%02" PRIx32 " %" PRId32 " 0x%08" PRIx32 "\n",
+				e->ap_num, e->idr, e->dbgbase, e->type, e->index, e->address);
+}
+
+static void adiv5_topology_save(struct adiv5_topology *topology)
+{
+	FILE *f = fopen(topology->filename, "w");
+	if (!f) {
+		LOG_WARNING("Unable to write DAP topology cache %s", topology->filename);
+		return;
+	}
+
+	fprintf(f, "# OpenOCD DAP topology cache, safe to delete\n");
+	fprintf(f, "fingerprint 0x%08" PRIx32 " 0x%08" PRIx32 " 0x%08" PRIx32 "\n",
+			topology->fingerprint[0], topology->fingerprint[1], topology->fingerprint[2]);
+
+	for (unsigned int i = 0; i < topology->num_entries; i++)
+		adiv5_topology_write_entry(f, &topology->entries[i]);
+
+	topology->file_current = fclose(f) == 0;
+}
+
+static void adiv5_topology_append(struct adiv5_topology *topology, const struct topology_entry *e)
+{
+	FILE *f = fopen(topology->filename, "a");
+	if (!f) {
+		LOG_WARNING("Unable to write DAP topology cache %s", topology->filename);
+		topology->file_current = false;
+		return;
+	}
+
+	adiv5_topology_write_entry(f, e);
+
+	if (fclose(f) != 0)
+		topology->file_current = false;
+}
+
+static int adiv5_topology_read_fingerprint(struct adiv5_dap *dap, uint32_t *fingerprint)
+{
+	uint32_t dpidr = 0, targetid = 0;
+
+	int retval = dap_queue_dp_read(dap, DP_DPIDR, &dpidr);
+	if (retval == ERROR_OK)
+		retval = dap_run(dap);
+	if (retval != ERROR_OK)
+		return retval;
+
+	/* TARGETID only exists from DPv2 on. It sits in DP bank 2, which is
+	 * only selected on SWD: JTAG-DP ignores DPBANKSEL and would return
+	 * CTRL/STAT instead. */
+	if (((dpidr >> 12) & 0xf) >= 2 && transport_is_swd()) {
+		retval = dap_queue_dp_read(dap, DP_TARGETID, &targetid);
+		if (retval == ERROR_OK)
+			retval = dap_run(dap);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	fingerprint[0] = (dap->tap && dap->tap->hasidcode) ? dap->tap->idcode : 0;
+	fingerprint[1] = dpidr;
+	fingerprint[2] = targetid;
+	return ERROR_OK;
+}
+
+/* Check the fingerprint once per connection; drop the entries if it
+ * does not match. Returns false if the cache must not be used. */
+static bool adiv5_topology_check(struct adiv5_dap *dap)
+{
+	struct adiv5_topology *topology = dap->topology;
+
+	if (!topology)
+		return false;
+	if (topology->checked)
+		return topology->usable;
+
+	topology->checked = true;
+	topology->usable = false;
+
+	uint32_t fingerprint[3];
+	if (adiv5_topology_read_fingerprint(dap, fingerprint) != ERROR_OK) {
+		LOG_DEBUG("DAP topology cache disabled, fingerprint read failed");
+		return false;
+	}
+
+	if (topology->have_fingerprint &&
+			memcmp(fingerprint, topology->fingerprint, sizeof(fingerprint)) != 0) {
+		LOG_INFO("%s: DAP topology cache %s does not match this target, rediscovering",
+				adiv5_dap_name(dap), topology->filename);
+		adiv5_topology_clear(topology);
+	}
+
+	memcpy(topology->fingerprint, fingerprint, sizeof(fingerprint));
+	topology->have_fingerprint = true;
+	topology->usable = true;
+	return true;
+}
+
+static int adiv5_topology_ap_idr(struct adiv5_ap *ap, uint32_t *idr)
+{
+	struct adiv5_topology *topology = ap->dap->topology;
+
+	if (!topology->ap_idr_valid[ap->ap_num]) {
+		int retval = dap_queue_ap_read(ap, AP_REG_IDR, &topology->ap_idr[ap->ap_num]);
+		if (retval == ERROR_OK)
+			retval = dap_run(ap->dap);
+		if (retval != ERROR_OK)
+			return retval;
+		topology->ap_idr_valid[ap->ap_num] = true;
+	}
+
+	*idr = topology->ap_idr[ap->ap_num];
+	return ERROR_OK;
+}
+
+/* Add or replace the entry with the same key, and record it in the file:
+ * appended if the file is current, a later line superseding an earlier one
+ * with the same key, or else by writing the whole file once. */
+static void adiv5_topology_add(struct adiv5_topology *topology, const struct topology_entry *e)
+{
+	bool replaced;
+
+	if (adiv5_topology_put(topology, e, &replaced) != ERROR_OK)
+		return;
+
+	if (topology->file_current)
+		adiv5_topology_append(topology, e);
+	else
+		adiv5_topology_save(topology);
+}
+
+int adiv5_topology_find_ap(struct adiv5_dap *dap, enum ap_type type, struct adiv5_ap **ap_out)
+{
+	if (!adiv5_topology_check(dap))
+		return ERROR_FAIL;
+
+	struct adiv5_topology *topology = dap->topology;
+	for (unsigned int i = 0; i < topology->num_entries; i++) {
+		struct topology_entry *e = &topology->entries[i];
+		if (e->kind != TOPOLOGY_AP || e->type != type)
+			continue;
+
+		struct adiv5_ap *ap = dap_ap(dap, e->ap_num);
+		uint32_t idr;
+		if (adiv5_topology_ap_idr(ap, &idr) != ERROR_OK || idr != e->idr)
+			return ERROR_FAIL;
+
+		LOG_DEBUG("Found AP type 0x%x at AP index %d in topology cache", type, e->ap_num);
+		*ap_out = ap;
+		return ERROR_OK;
+	}
+
+	return ERROR_FAIL;
+}
+
+void adiv5_topology_record_ap(struct adiv5_dap *dap, enum ap_type type, struct adiv5_ap *ap)
+{
+	if (!adiv5_topology_check(dap))
+		return;
+
+	struct topology_entry e = {
+		.kind = TOPOLOGY_AP,
+		.ap_num = ap->ap_num,
+		.type = type,
+	};
+	if (adiv5_topology_ap_idr(ap, &e.idr) != ERROR_OK)
+		return;
+
+	adiv5_topology_add(dap->topology, &e);
+}
+
+int adiv5_topology_lookup_component(struct adiv5_ap *ap,
+		uint32_t dbgbase, uint8_t type, int32_t idx, uint32_t *addr)
+{
+	if (!adiv5_topology_check(ap->dap))
+		return ERROR_FAIL;
+
+	struct adiv5_topology *topology = ap->dap->topology;
+	for (unsigned int i = 0; i < topology->num_entries; i++) {
+		struct topology_entry *e = &topology->entries[i];
+		if (e->kind != TOPOLOGY_COMPONENT || e->ap_num != ap->ap_num ||
+				e->dbgbase != dbgbase || e->type != type || e->index != idx)
+			continue;
+
+		uint32_t idr;
+		if (adiv5_topology_ap_idr(ap, &idr) != ERROR_OK || idr != e->idr)
+			return ERROR_FAIL;
+
+		*addr = e->address;
+		return ERROR_OK;
+	}
+
+	return ERROR_FAIL;
+}
+
+void adiv5_topology_record_component(struct adiv5_ap *ap,
+		uint32_t dbgbase, uint8_t type, int32_t idx, uint32_t addr)
+{
+	if (!adiv5_topology_check(ap->dap))
+		return;
+
+	struct topology_entry e = {
+		.kind = TOPOLOGY_COMPONENT,
+		.ap_num = ap->ap_num,
+		.dbgbase = dbgbase,
+		.type = type,
+		.index = idx,
+		.address = addr,
+	};
+	if (adiv5_topology_ap_idr(ap, &e.idr) != ERROR_OK)
+		return;
+
+	adiv5_topology_add(ap->dap->topology, &e);
+}
+
+void adiv5_topology_invalidate(struct adiv5_dap *dap)
+{
+	struct adiv5_topology *topology = dap->topology;
+
+	if (!topology)
+		return;
+
+	topology->checked = false;
+	memset(topology->ap_idr_valid, 0, sizeof(topology->ap_idr_valid));
+}
+
+void adiv5_topology_free(struct adiv5_dap *dap)
+{
+	struct adiv5_topology *topology = dap->topology;
+
+	if (!topology)
+		return;
+
+	adiv5_topology_clear(topology);
+	free(topology->filename);
+	free(topology);
+	dap->topology = NULL;
+}
+
+int adiv5_topology_set_file(struct adiv5_dap *dap, const char *filename)
+{
+	adiv5_topology_free(dap);
+
+	struct adiv5_topology *topology = calloc(1, sizeof(*topology));
+	if (!topology) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	topology->filename = strdup(filename);
+	if (!topology->filename) {
+		free(topology);
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	dap->topology = topology;
+	return adiv5_topology_load(topology);
+}
+
+const char *adiv5_topology_file(struct adiv5_dap *dap)
+{
+	return dap->topology ? dap->topology->filename : NULL;
+}
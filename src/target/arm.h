@@ -227,6 +227,11 @@ struct arm {
 	 * used to make requests to the target.
 	 */
 	struct adiv5_dap *dap;
+
+	/** Routing of physical memory accesses between the core and a
+	 * system bus MEM-AP, or NULL if the core does not support it.
+	 */
+	struct arm_memroute *memroute;
 };
 
 /** Convert target handle to generic ARM target state handle. */
@@ -28,6 +28,7 @@
 #include "target_type.h"
 #include "register.h"
 #include "arm_opcodes.h"
+#include "tlbcache.h"
 
 
 /*
@@ -478,6 +479,7 @@ COMMAND_HANDLER(arm720t_handle_cp15_command)
 				command_print(CMD, "couldn't access cp15 with opcode 0x%8.8" PRIx32 "", opcode);
 				return ERROR_OK;
 			}
+			target_tlbcache_invalidate(target);
 			command_print(CMD, "0x%8.8" PRIx32 ": 0x%8.8" PRIx32 "", opcode, value);
 		}
 	}
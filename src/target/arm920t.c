@@ -26,6 +26,7 @@
 #include "target_type.h"
 #include "register.h"
 #include "arm_opcodes.h"
+#include "tlbcache.h"
 
 /*
  * For information about the ARM920T, see ARM DDI 0151C especially
@@ -1493,6 +1494,7 @@ COMMAND_HANDLER(arm920t_handle_cp15_command)
 				/* REVISIT why lie? "return retval"? */
 				return ERROR_OK;
 			}
+			target_tlbcache_invalidate(target);
 			command_print(CMD, "%i: %8.8" PRIx32,
 				address, value);
 		}
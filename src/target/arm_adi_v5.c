@@ -619,6 +619,128 @@ int mem_ap_write_buf_noincr(struct adiv5_ap *ap,
 
 /*--------------------------------------------------------------------------*/
 
+struct adiv5_batch_op {
+	struct adiv5_dap *dap;
+	int *status;
+};
+
+void adiv5_batch_init(struct adiv5_batch *batch)
+{
+	batch->ops = NULL;
+	batch->num_ops = 0;
+	batch->max_ops = 0;
+	batch->queue_status = ERROR_OK;
+}
+
+void adiv5_batch_free(struct adiv5_batch *batch)
+{
+	free(batch->ops);
+	adiv5_batch_init(batch);
+}
+
+/* Record an access that was just queued (or failed to queue) on @a dap. */
+static int adiv5_batch_add(struct adiv5_batch *batch, struct adiv5_dap *dap,
+		int *status, int retval)
+{
+	if (batch->num_ops == batch->max_ops) {
+		unsigned int max_ops = batch->max_ops ? 2 * batch->max_ops : 16;
+		struct adiv5_batch_op *ops = realloc(batch->ops, max_ops * sizeof(*ops));
+		if (!ops) {
+			LOG_ERROR("Out of memory");
+			retval = ERROR_FAIL;
+		} else {
+			batch->ops = ops;
+			batch->max_ops = max_ops;
+		}
+	}
+
+	if (batch->num_ops < batch->max_ops) {
+		batch->ops[batch->num_ops].dap = dap;
+		batch->ops[batch->num_ops].status = status;
+		batch->num_ops++;
+	}
+
+	if (status)
+		*status = retval;
+	if (retval != ERROR_OK && batch->queue_status == ERROR_OK)
+		batch->queue_status = retval;
+
+	return retval;
+}
+
+int adiv5_batch_dp_read(struct adiv5_batch *batch, struct adiv5_dap *dap,
+		unsigned reg, uint32_t *value, int *status)
+{
+	return adiv5_batch_add(batch, dap, status, dap_queue_dp_read(dap, reg, value));
+}
+
+int adiv5_batch_dp_write(struct adiv5_batch *batch, struct adiv5_dap *dap,
+		unsigned reg, uint32_t value, int *status)
+{
+	return adiv5_batch_add(batch, dap, status, dap_queue_dp_write(dap, reg, value));
+}
+
+int adiv5_batch_ap_read(struct adiv5_batch *batch, struct adiv5_ap *ap,
+		unsigned reg, uint32_t *value, int *status)
+{
+	return adiv5_batch_add(batch, ap->dap, status, dap_queue_ap_read(ap, reg, value));
+}
+
+int adiv5_batch_ap_write(struct adiv5_batch *batch, struct adiv5_ap *ap,
+		unsigned reg, uint32_t value, int *status)
+{
+	return adiv5_batch_add(batch, ap->dap, status, dap_queue_ap_write(ap, reg, value));
+}
+
+int adiv5_batch_mem_read_u32(struct adiv5_batch *batch, struct adiv5_ap *ap,
+		uint32_t address, uint32_t *value, int *status)
+{
+	return adiv5_batch_add(batch, ap->dap, status, mem_ap_read_u32(ap, address, value));
+}
+
+int adiv5_batch_mem_write_u32(struct adiv5_batch *batch, struct adiv5_ap *ap,
+		uint32_t address, uint32_t value, int *status)
+{
+	return adiv5_batch_add(batch, ap->dap, status, mem_ap_write_u32(ap, address, value));
+}
+
+int adiv5_batch_run(struct adiv5_batch *batch)
+{
+	int retval = batch->queue_status;
+
+	/* Flush each DAP once, in the order it was first used. */
+	for (unsigned int i = 0; i < batch->num_ops; i++) {
+		struct adiv5_dap *dap = batch->ops[i].dap;
+		bool seen = false;
+
+		for (unsigned int j = 0; j < i; j++) {
+			if (batch->ops[j].dap == dap) {
+				seen = true;
+				break;
+			}
+		}
+		if (seen)
+			continue;
+
+		int dap_retval = dap_run(dap);
+		if (dap_retval != ERROR_OK && retval == ERROR_OK)
+			retval = dap_retval;
+
+		for (unsigned int j = i; j < batch->num_ops; j++) {
+			struct adiv5_batch_op *op = &batch->ops[j];
+			if (op->dap == dap && op->status && *op->status == ERROR_OK)
+				*op->status = dap_retval;
+		}
+	}
+
+	batch->num_ops = 0;
+	batch->queue_status = ERROR_OK;
+
+	return retval;
+}
+
+/*--------------------------------------------------------------------------*/
+
 
 #define DAP_POWER_DOMAIN_TIMEOUT (10)
 
@@ -653,6 +775,7 @@ int dap_dp_init(struct adiv5_dap *dap)
 	LOG_DEBUG("%s", adiv5_dap_name(dap));
 
 	dap_invalidate_cache(dap);
+	adiv5_topology_invalidate(dap);
 
 	/*
 	 * Early initialize dap->dp_ctrl_stat.
@@ -850,6 +973,9 @@ int dap_find_ap(struct adiv5_dap *dap, enum ap_type type_to_find, struct adiv5_a
 {
 	int ap_num;
 
+	if (adiv5_topology_find_ap(dap, type_to_find, ap_out) == ERROR_OK)
+		return ERROR_OK;
+
 	/* Maximum AP number is 255 since the SELECT register is 8 bits */
 	for (ap_num = 0; ap_num <= DP_APSEL_MAX; ap_num++) {
 
@@ -888,6 +1014,7 @@ int dap_find_ap(struct adiv5_dap *dap, enum ap_type type_to_find, struct adiv5_a
 						ap_num, id_val);
 
 			*ap_out = &dap->ap[ap_num];
+			adiv5_topology_record_ap(dap, type_to_find, *ap_out);
 			return ERROR_OK;
 		}
 	}
@@ -920,7 +1047,7 @@ int dap_get_debugbase(struct adiv5_ap *ap,
 	return ERROR_OK;
 }
 
-int dap_lookup_cs_component(struct adiv5_ap *ap,
+static int dap_walk_cs_component(struct adiv5_ap *ap,
 			uint32_t dbgbase, uint8_t type, uint32_t *addr, int32_t *idx)
 {
 	uint32_t romentry, entry_offset = 0, component_base, devtype;
@@ -946,7 +1073,7 @@ int dap_lookup_cs_component(struct adiv5_ap *ap,
 				return retval;
 			}
 			if (((c_cid1 >> 4) & 0x0f) == 1) {
-				retval = dap_lookup_cs_component(ap, component_base,
+				retval = dap_walk_cs_component(ap, component_base,
 							type, addr, idx);
 				if (retval == ERROR_OK)
 					break;
@@ -976,6 +1103,23 @@ int dap_lookup_cs_component(struct adiv5_ap *ap,
 	return ERROR_OK;
 }
 
+int dap_lookup_cs_component(struct adiv5_ap *ap,
+			uint32_t dbgbase, uint8_t type, uint32_t *addr, int32_t *idx)
+{
+	int32_t index = *idx;
+
+	if (adiv5_topology_lookup_component(ap, dbgbase, type, index, addr) == ERROR_OK) {
+		*idx = 0;
+		return ERROR_OK;
+	}
+
+	int retval = dap_walk_cs_component(ap, dbgbase, type, addr, idx);
+	if (retval == ERROR_OK)
+		adiv5_topology_record_component(ap, dbgbase, type, index, *addr);
+
+	return retval;
+}
+
 static int dap_read_part_id(struct adiv5_ap *ap, uint32_t component_base, uint32_t *cid, uint64_t *pid)
 {
 	assert((component_base & 0xFFF) == 0);
@@ -1883,6 +2027,32 @@ COMMAND_HANDLER(dap_ti_be_32_quirks_command)
 	return 0;
 }
 
+COMMAND_HANDLER(dap_topology_cache_command)
+{
+	struct adiv5_dap *dap = adiv5_get_dap(CMD_DATA);
+
+	switch (CMD_ARGC) {
+	case 0:
+		break;
+	case 1:
+		if (strcmp(CMD_ARGV[0], "off") == 0) {
+			adiv5_topology_free(dap);
+		} else {
+			int retval = adiv5_topology_set_file(dap, CMD_ARGV[0]);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+		break;
+	default:
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	const char *filename = adiv5_topology_file(dap);
+	command_print(CMD, "%s", filename ? filename : "off");
+
+	return ERROR_OK;
+}
+
 const struct command_registration dap_instance_commands[] = {
 	{
 		.name = "info",
@@ -1955,5 +2125,13 @@ const struct command_registration dap_instance_commands[] = {
 		.help = "set/get quirks mode for TI TMS450/TMS570 processors",
 		.usage = "[enable]",
 	},
+	{
+		.name = "topology_cache",
+		.handler = dap_topology_cache_command,
+		.mode = COMMAND_ANY,
+		.help = "set/get the file caching the discovered APs and "
+			"CoreSight components across sessions",
+		.usage = "[filename|'off']",
+	},
 	COMMAND_REGISTRATION_DONE
 };
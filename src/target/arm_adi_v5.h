@@ -294,6 +294,9 @@ struct adiv5_dap {
 	/** Flag saying whether to ignore the syspwrupack flag in DAP. Some devices
 	 *  do not set this bit until later in the bringup sequence */
 	bool ignore_syspwrupack;
+
+	/** Persistent cache of discovered APs and CoreSight components, or NULL */
+	struct adiv5_topology *topology;
 };
 
 /**
@@ -548,6 +551,44 @@ int mem_ap_read_buf_noincr(struct adiv5_ap *ap,
 int mem_ap_write_buf_noincr(struct adiv5_ap *ap,
 		const uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address);
 
+/**
+ * A batch of DP, AP and MEM-AP accesses, possibly spanning several APs and
+ * DAPs, that is sent to the adapter in a single run.
+ *
+ * Accesses are queued as they are added, so the cached SELECT, CSW and TAR
+ * values are shared across the whole batch and only rewritten when they
+ * change. Each access can report its own completion status; the transports
+ * only report errors per run, so a failure marks every access to the same
+ * DAP as failed.
+ */
+struct adiv5_batch {
+	struct adiv5_batch_op *ops;
+	unsigned int num_ops;
+	unsigned int max_ops;
+	/* first error seen while queueing, reported by adiv5_batch_run() */
+	int queue_status;
+};
+
+void adiv5_batch_init(struct adiv5_batch *batch);
+void adiv5_batch_free(struct adiv5_batch *batch);
+
+int adiv5_batch_dp_read(struct adiv5_batch *batch, struct adiv5_dap *dap,
+		unsigned reg, uint32_t *value, int *status);
+int adiv5_batch_dp_write(struct adiv5_batch *batch, struct adiv5_dap *dap,
+		unsigned reg, uint32_t value, int *status);
+int adiv5_batch_ap_read(struct adiv5_batch *batch, struct adiv5_ap *ap,
+		unsigned reg, uint32_t *value, int *status);
+int adiv5_batch_ap_write(struct adiv5_batch *batch, struct adiv5_ap *ap,
+		unsigned reg, uint32_t value, int *status);
+int adiv5_batch_mem_read_u32(struct adiv5_batch *batch, struct adiv5_ap *ap,
+		uint32_t address, uint32_t *value, int *status);
+int adiv5_batch_mem_write_u32(struct adiv5_batch *batch, struct adiv5_ap *ap,
+		uint32_t address, uint32_t value, int *status);
+
+/* Run the batch and report per access completion; the batch can then be
+ * reused for the next set of accesses. */
+int adiv5_batch_run(struct adiv5_batch *batch);
+
 /* Initialisation of the debug system, power domains and registers */
 int dap_dp_init(struct adiv5_dap *dap);
 int mem_ap_init(struct adiv5_ap *ap);
@@ -573,6 +614,18 @@ static inline struct adiv5_ap *dap_ap(struct adiv5_dap *dap, uint8_t ap_num)
 int dap_lookup_cs_component(struct adiv5_ap *ap,
 			uint32_t dbgbase, uint8_t type, uint32_t *addr, int32_t *idx);
 
+/* Persistent DAP topology cache, see adi_v5_topology.c */
+int adiv5_topology_set_file(struct adiv5_dap *dap, const char *filename);
+const char *adiv5_topology_file(struct adiv5_dap *dap);
+int adiv5_topology_find_ap(struct adiv5_dap *dap, enum ap_type type, struct adiv5_ap **ap_out);
+void adiv5_topology_record_ap(struct adiv5_dap *dap, enum ap_type type, struct adiv5_ap *ap);
+int adiv5_topology_lookup_component(struct adiv5_ap *ap,
+		uint32_t dbgbase, uint8_t type, int32_t idx, uint32_t *addr);
+void adiv5_topology_record_component(struct adiv5_ap *ap,
+		uint32_t dbgbase, uint8_t type, int32_t idx, uint32_t addr);
+void adiv5_topology_invalidate(struct adiv5_dap *dap);
+void adiv5_topology_free(struct adiv5_dap *dap);
+
 struct target;
 
 /* Put debug link into SWD mode */
@@ -149,6 +149,18 @@ int arm_cti_read_reg(struct arm_cti *self, unsigned int reg, uint32_t *p_value)
 	return mem_ap_read_atomic_u32(self->ap, self->base + reg, p_value);
 }
 
+int arm_cti_batch_write_reg(struct arm_cti *self, struct adiv5_batch *batch,
+		unsigned int reg, uint32_t value, int *status)
+{
+	return adiv5_batch_mem_write_u32(batch, self->ap, self->base + reg, value, status);
+}
+
+int arm_cti_batch_read_reg(struct arm_cti *self, struct adiv5_batch *batch,
+		unsigned int reg, uint32_t *value, int *status)
+{
+	return adiv5_batch_mem_read_u32(batch, self->ap, self->base + reg, value, status);
+}
+
 int arm_cti_pulse_channel(struct arm_cti *self, uint32_t channel)
 {
 	if (channel > 31)
@@ -144,6 +144,8 @@ int dap_cleanup_all(void)
 		if (dap->ops && dap->ops->quit)
 			dap->ops->quit(dap);
 
+		adiv5_topology_free(dap);
+
 		free(obj->name);
 		free(obj);
 	}
@@ -1017,6 +1017,46 @@ void arm_dpm_report_wfar(struct arm_dpm *dpm, uint32_t addr)
 
 /*----------------------------------------------------------------------*/
 
+/*
+ * Batched instruction execution
+ */
+
+/**
+ * Runs @a opcode once for each word of @a data, with R0 loaded from that
+ * word. Uses the core's queued implementation when it has one, else
+ * executes the words one at a time.
+ */
+int arm_dpm_instr_write_data_r0_array(struct arm_dpm *dpm,
+		uint32_t opcode, const uint32_t *data, unsigned int count)
+{
+	int retval = ERROR_OK;
+
+	if (dpm->instr_write_data_r0_array)
+		return dpm->instr_write_data_r0_array(dpm, opcode, data, count);
+
+	for (unsigned int i = 0; i < count && retval == ERROR_OK; i++)
+		retval = dpm->instr_write_data_r0(dpm, opcode, data[i]);
+
+	return retval;
+}
+
+/** 64-bit variant of arm_dpm_instr_write_data_r0_array(). */
+int arm_dpm_instr_write_data_r0_array_64(struct arm_dpm *dpm,
+		uint32_t opcode, const uint64_t *data, unsigned int count)
+{
+	int retval = ERROR_OK;
+
+	if (dpm->instr_write_data_r0_array_64)
+		return dpm->instr_write_data_r0_array_64(dpm, opcode, data, count);
+
+	for (unsigned int i = 0; i < count && retval == ERROR_OK; i++)
+		retval = dpm->instr_write_data_r0_64(dpm, opcode, data[i]);
+
+	return retval;
+}
+
+/*----------------------------------------------------------------------*/
+
 /*
  * Other debug and support utilities
  */
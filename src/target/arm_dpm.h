@@ -87,6 +87,18 @@ struct arm_dpm {
 	int (*instr_write_data_r0_64)(struct arm_dpm *,
 			uint32_t opcode, uint64_t data);
 
+	/**
+	 * Optional: runs one instruction once for each element of data,
+	 * writing the element to R0 before each execution, as a single
+	 * queued sequence.  Meant for cache maintenance; an implementation
+	 * may repeat part of the sequence if the core reports an overrun.
+	 */
+	int (*instr_write_data_r0_array)(struct arm_dpm *,
+			uint32_t opcode, const uint32_t *data, unsigned int count);
+
+	int (*instr_write_data_r0_array_64)(struct arm_dpm *,
+			uint32_t opcode, const uint64_t *data, unsigned int count);
+
 	/** Optional core-specific operation invoked after CPSR writes. */
 	int (*instr_cpsr_sync)(struct arm_dpm *dpm);
 
@@ -160,6 +172,11 @@ int arm_dpm_write_dirty_registers(struct arm_dpm *, bool bpwp);
 
 void arm_dpm_report_wfar(struct arm_dpm *, uint32_t wfar);
 
+int arm_dpm_instr_write_data_r0_array(struct arm_dpm *dpm,
+		uint32_t opcode, const uint32_t *data, unsigned int count);
+int arm_dpm_instr_write_data_r0_array_64(struct arm_dpm *dpm,
+		uint32_t opcode, const uint64_t *data, unsigned int count);
+
 /* DSCR bits; see ARMv7a arch spec section C10.3.1.
  * Not all v7 bits are valid in v6.
  */
@@ -0,0 +1,299 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/**
+ * @file
+ * Routing of memory accesses of application processors between the core
+ * (instructions fed through the debug APB-AP, slow but coherent with the
+ * caches and able to use the MMU) and a system bus MEM-AP (fast, but
+ * bypassing the caches and the MMU).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include "arm.h"
+#include "arm_adi_v5.h"
+#include "arm_memroute.h"
+#include "target.h"
+
+#define ARM_MEMROUTE_DEFAULT_THRESHOLD	1024
+
+static const char * const arm_memroute_path_names[ARM_MEMROUTE_NUM_PATHS] = {
+	[ARM_MEMROUTE_CPU] = "cpu",
+	[ARM_MEMROUTE_SYSAP] = "sysap",
+};
+
+void arm_memroute_init(struct arm_memroute *route)
+{
+	memset(route, 0, sizeof(*route));
+	route->auto_route = true;
+	route->threshold = ARM_MEMROUTE_DEFAULT_THRESHOLD;
+}
+
+enum arm_memroute_path arm_memroute_select(struct arm_memroute *route,
+		target_addr_t address, uint32_t bytes)
+{
+	if (!route->sys_ap || !route->auto_route || bytes < route->threshold)
+		return ARM_MEMROUTE_CPU;
+
+	/* the MEM-AP functions take 32-bit addresses */
+	if ((uint64_t)address + bytes - 1 > UINT32_MAX)
+		return ARM_MEMROUTE_CPU;
+
+	return ARM_MEMROUTE_SYSAP;
+}
+
+void arm_memroute_account(struct arm_memroute *route, enum arm_memroute_path path,
+		bool write, uint32_t bytes, struct duration *duration)
+{
+	struct arm_memroute_stats *stats = write ? &route->write[path] : &route->read[path];
+
+	if (duration_measure(duration) != ERROR_OK)
+		return;
+
+	stats->requests++;
+	stats->bytes += bytes;
+	stats->seconds += duration_elapsed(duration);
+}
+
+static int arm_memroute_prepare(struct arm_memroute *route)
+{
+	if (route->sys_ap_ready)
+		return ERROR_OK;
+
+	int retval = mem_ap_init(route->sys_ap);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("MEM-AP #%d initialization failed", route->sys_ap->ap_num);
+		return retval;
+	}
+
+	route->sys_ap_ready = true;
+	return ERROR_OK;
+}
+
+int arm_memroute_read(struct arm_memroute *route, target_addr_t address,
+		uint32_t size, uint32_t count, uint8_t *buffer)
+{
+	int retval = arm_memroute_prepare(route);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return mem_ap_read_buf(route->sys_ap, buffer, size, count, address);
+}
+
+int arm_memroute_write(struct arm_memroute *route, target_addr_t address,
+		uint32_t size, uint32_t count, const uint8_t *buffer)
+{
+	int retval = arm_memroute_prepare(route);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return mem_ap_write_buf(route->sys_ap, buffer, size, count, address);
+}
+
+/* true when system bus accesses other than memory transfers, such as
+ * outer cache maintenance, may also go through the system MEM-AP */
+bool arm_memroute_has_sys_ap(struct arm_memroute *route)
+{
+	return route && route->sys_ap && route->auto_route;
+}
+
+/* Write each value in turn to the same 32-bit register, in a single
+ * queued run of the system MEM-AP */
+int arm_memroute_write_reg_u32(struct arm_memroute *route, target_addr_t address,
+		const uint32_t *values, unsigned int count)
+{
+	int retval = arm_memroute_prepare(route);
+
+	for (unsigned int i = 0; i < count && retval == ERROR_OK; i++)
+		retval = mem_ap_write_u32(route->sys_ap, address, values[i]);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return dap_run(route->sys_ap->dap);
+}
+
+static struct arm_memroute *arm_memroute_current(struct command_invocation *cmd)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct arm *arm = target_to_arm(target);
+
+	if (!is_arm(arm) || !arm->memroute) {
+		command_print(CMD, "target %s does not support memory routing", target_name(target));
+		return NULL;
+	}
+
+	return arm->memroute;
+}
+
+COMMAND_HANDLER(handle_arm_memroute_sysap_command)
+{
+	struct arm_memroute *route = arm_memroute_current(CMD);
+	if (!route)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "none") == 0) {
+			route->sys_ap = NULL;
+		} else {
+			struct arm *arm = target_to_arm(get_current_target(CMD_CTX));
+			uint32_t ap_num;
+
+			COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], ap_num);
+			if (ap_num > DP_APSEL_MAX)
+				return ERROR_COMMAND_ARGUMENT_INVALID;
+			if (!arm->dap) {
+				command_print(CMD, "no DAP configured");
+				return ERROR_FAIL;
+			}
+
+			route->sys_ap = dap_ap(arm->dap, ap_num);
+		}
+		route->sys_ap_ready = false;
+	}
+
+	if (route->sys_ap)
+		command_print(CMD, "%d", route->sys_ap->ap_num);
+	else
+		command_print(CMD, "none");
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_arm_memroute_mode_command)
+{
+	struct arm_memroute *route = arm_memroute_current(CMD);
+	if (!route)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "auto") == 0)
+			route->auto_route = true;
+		else if (strcmp(CMD_ARGV[0], "cpu") == 0)
+			route->auto_route = false;
+		else
+			return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	command_print(CMD, "%s", route->auto_route ? "auto" : "cpu");
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_arm_memroute_threshold_command)
+{
+	struct arm_memroute *route = arm_memroute_current(CMD);
+	if (!route)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], route->threshold);
+
+	command_print(CMD, "%" PRIu32, route->threshold);
+
+	return ERROR_OK;
+}
+
+static void arm_memroute_print_stats(struct command_invocation *cmd, const char *dir,
+		const char *path, const struct arm_memroute_stats *stats)
+{
+	double kbps = stats->seconds > 0 ? stats->bytes / 1024.0 / stats->seconds : 0;
+
+	command_print(CMD, "%-5s %-5s %10" PRIu64 " requests %12" PRIu64 " bytes %10.3f s %10.1f KiB/s",
+			dir, path, stats->requests, stats->bytes, stats->seconds, kbps);
+}
+
+COMMAND_HANDLER(handle_arm_memroute_stats_command)
+{
+	struct arm_memroute *route = arm_memroute_current(CMD);
+	if (!route)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "reset") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		memset(route->read, 0, sizeof(route->read));
+		memset(route->write, 0, sizeof(route->write));
+		return ERROR_OK;
+	}
+
+	for (unsigned int i = 0; i < ARM_MEMROUTE_NUM_PATHS; i++)
+		arm_memroute_print_stats(CMD, "read", arm_memroute_path_names[i], &route->read[i]);
+	for (unsigned int i = 0; i < ARM_MEMROUTE_NUM_PATHS; i++)
+		arm_memroute_print_stats(CMD, "write", arm_memroute_path_names[i], &route->write[i]);
+
+	return ERROR_OK;
+}
+
+static const struct command_registration arm_memroute_subcommand_handlers[] = {
+	{
+		.name = "sysap",
+		.handler = handle_arm_memroute_sysap_command,
+		.mode = COMMAND_ANY,
+		.help = "set/get the system bus MEM-AP used for large "
+			"physical memory accesses",
+		.usage = "[ap_num|'none']",
+	},
+	{
+		.name = "mode",
+		.handler = handle_arm_memroute_mode_command,
+		.mode = COMMAND_ANY,
+		.help = "route large physical accesses automatically, or "
+			"always access memory through the core",
+		.usage = "['auto'|'cpu']",
+	},
+	{
+		.name = "threshold",
+		.handler = handle_arm_memroute_threshold_command,
+		.mode = COMMAND_ANY,
+		.help = "set/get the smallest physical access, in bytes, "
+			"routed to the system bus MEM-AP",
+		.usage = "[bytes]",
+	},
+	{
+		.name = "stats",
+		.handler = handle_arm_memroute_stats_command,
+		.mode = COMMAND_EXEC,
+		.help = "display or reset the per path request counts and throughput",
+		.usage = "['reset']",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+const struct command_registration arm_memroute_command_handlers[] = {
+	{
+		.name = "memroute",
+		.mode = COMMAND_ANY,
+		.help = "memory access routing between core and system bus",
+		.usage = "",
+		.chain = arm_memroute_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
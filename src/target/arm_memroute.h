@@ -0,0 +1,74 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_ARM_MEMROUTE_H
+#define OPENOCD_TARGET_ARM_MEMROUTE_H
+
+#include <helper/command.h>
+#include <helper/time_support.h>
+
+struct adiv5_ap;
+
+enum arm_memroute_path {
+	ARM_MEMROUTE_CPU,		/* through the core, via the debug APB-AP */
+	ARM_MEMROUTE_SYSAP,		/* directly on the system bus, via AHB-AP/AXI-AP */
+	ARM_MEMROUTE_NUM_PATHS,
+};
+
+struct arm_memroute_stats {
+	uint64_t requests;
+	uint64_t bytes;
+	double seconds;
+};
+
+/**
+ * Per-core choice between accessing memory through the core and through a
+ * system bus MEM-AP. Large physical accesses use the system MEM-AP when one
+ * is configured; the caller keeps the caches coherent over the accessed
+ * range. Everything else goes through the core.
+ */
+struct arm_memroute {
+	/* system bus MEM-AP, NULL when none is configured */
+	struct adiv5_ap *sys_ap;
+	bool sys_ap_ready;
+
+	/* false to always access memory through the core */
+	bool auto_route;
+
+	/* smallest physical access, in bytes, routed to the system MEM-AP */
+	uint32_t threshold;
+
+	struct arm_memroute_stats read[ARM_MEMROUTE_NUM_PATHS];
+	struct arm_memroute_stats write[ARM_MEMROUTE_NUM_PATHS];
+};
+
+void arm_memroute_init(struct arm_memroute *route);
+enum arm_memroute_path arm_memroute_select(struct arm_memroute *route,
+		target_addr_t address, uint32_t bytes);
+void arm_memroute_account(struct arm_memroute *route, enum arm_memroute_path path,
+		bool write, uint32_t bytes, struct duration *duration);
+
+int arm_memroute_read(struct arm_memroute *route, target_addr_t address,
+		uint32_t size, uint32_t count, uint8_t *buffer);
+int arm_memroute_write(struct arm_memroute *route, target_addr_t address,
+		uint32_t size, uint32_t count, const uint8_t *buffer);
+
+bool arm_memroute_has_sys_ap(struct arm_memroute *route);
+int arm_memroute_write_reg_u32(struct arm_memroute *route, target_addr_t address,
+		const uint32_t *values, unsigned int count);
+
+extern const struct command_registration arm_memroute_command_handlers[];
+
+#endif /* OPENOCD_TARGET_ARM_MEMROUTE_H */
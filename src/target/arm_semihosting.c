@@ -305,7 +305,16 @@ int arm_semihosting(struct target *target, int *retval)
 			semihosting->param = buf_get_u64(arm->core_cache->reg_list[1].value, 0, 64);
 			semihosting->word_size_bytes = 8;
 		} else {
-			/* Read op and param from register r0 and r1 respectively. */
+			/* Read op and param from register r0 and r1 respectively.
+			 * Some cores leave them out of the cache on debug entry. */
+			for (int i = 0; i < 2; i++) {
+				struct reg *reg = &arm->core_cache->reg_list[i];
+				if (!reg->valid) {
+					*retval = reg->type->get(reg);
+					if (*retval != ERROR_OK)
+						return 1;
+				}
+			}
 			semihosting->op = buf_get_u32(arm->core_cache->reg_list[0].value, 0, 32);
 			semihosting->param = buf_get_u32(arm->core_cache->reg_list[1].value, 0, 32);
 			semihosting->word_size_bytes = 4;
@@ -38,6 +38,7 @@
 #include "algorithm.h"
 #include "register.h"
 #include "semihosting_common.h"
+#include "tlbcache.h"
 
 /* offsets into armv4_5 core register cache */
 enum {
@@ -1085,6 +1086,10 @@ static int jim_mcrmrc(Jim_Interp *interp, int argc, Jim_Obj * const *argv)
 		retval = arm->mcr(target, cpnum, op1, op2, CRn, CRm, value);
 		if (retval != ERROR_OK)
 			return JIM_ERR;
+
+		/* SCTLR, TTBRx/TTBCR, DACR, TLB maintenance or CONTEXTIDR */
+		if (cpnum == 15 && (CRn == 1 || CRn == 2 || CRn == 3 || CRn == 8 || CRn == 13))
+			target_tlbcache_invalidate(target);
 	} else {
 		/* NOTE: parameters reordered! */
 		/* ARMV4_5_MRC(cpnum, op1, 0, CRn, CRm, op2) */
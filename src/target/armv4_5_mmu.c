@@ -23,6 +23,7 @@
 #include <helper/log.h>
 #include "target.h"
 #include "armv4_5_mmu.h"
+#include "tlbcache.h"
 
 int armv4_5_mmu_translate_va(struct target *target,
 		struct armv4_5_mmu_common *armv4_5_mmu, uint32_t va, uint32_t *cb, uint32_t *val)
@@ -35,6 +36,12 @@ int armv4_5_mmu_translate_va(struct target *target,
 	if (retval != ERROR_OK)
 		return retval;
 
+	target_addr_t pa;
+	if (target_tlbcache_lookup(target, ttb, va, &pa, cb)) {
+		*val = pa;
+		return ERROR_OK;
+	}
+
 	retval = armv4_5_mmu_read_physical(target, armv4_5_mmu,
 		(ttb & 0xffffc000) | ((va & 0xfff00000) >> 18),
 		4, 1, (uint8_t *)&first_lvl_descriptor);
@@ -58,6 +65,7 @@ int armv4_5_mmu_translate_va(struct target *target,
 		/* section descriptor */
 		*cb = (first_lvl_descriptor & 0xc) >> 2;
 		*val = (first_lvl_descriptor & 0xfff00000) | (va & 0x000fffff);
+		target_tlbcache_insert(target, ttb, va, *val, 0x100000, *cb);
 		return ERROR_OK;
 	}
 
@@ -92,18 +100,21 @@ int armv4_5_mmu_translate_va(struct target *target,
 	if ((second_lvl_descriptor & 0x3) == 1) {
 		/* large page descriptor */
 		*val = (second_lvl_descriptor & 0xffff0000) | (va & 0x0000ffff);
+		target_tlbcache_insert(target, ttb, va, *val, 0x10000, *cb);
 		return ERROR_OK;
 	}
 
 	if ((second_lvl_descriptor & 0x3) == 2) {
 		/* small page descriptor */
 		*val = (second_lvl_descriptor & 0xfffff000) | (va & 0x00000fff);
+		target_tlbcache_insert(target, ttb, va, *val, 0x1000, *cb);
 		return ERROR_OK;
 	}
 
 	if ((second_lvl_descriptor & 0x3) == 3) {
 		/* tiny page descriptor */
 		*val = (second_lvl_descriptor & 0xfffffc00) | (va & 0x000003ff);
+		target_tlbcache_insert(target, ttb, va, *val, 0x400, *cb);
 		return ERROR_OK;
 	}
 
@@ -24,6 +24,7 @@
 #include "armv4_5_mmu.h"
 #include "armv4_5_cache.h"
 #include "arm_dpm.h"
+#include "arm_memroute.h"
 
 enum {
 	ARM_PC  = 15,
@@ -45,6 +46,7 @@ enum {
 struct armv7a_l2x_cache {
 	uint32_t base;
 	uint32_t way;
+	uint32_t way_size;	/* bytes, 0 until read from the controller */
 };
 
 struct armv7a_cachesize {
@@ -122,6 +124,9 @@ struct armv7a_common {
 	/* cache specific to V7 Memory Management Unit compatible with v4_5*/
 	struct armv7a_mmu_common armv7a_mmu;
 
+	/* physical memory access routing, referenced by arm.memroute */
+	struct arm_memroute memroute;
+
 	int (*examine_debug_reason)(struct target *target);
 	int (*post_debug_entry)(struct target *target);
 
@@ -26,6 +26,10 @@
 #include "armv7a_cache.h"
 #include <helper/time_support.h>
 #include "arm_opcodes.h"
+#include "arm_dpm.h"
+
+/* number of cache maintenance operations queued per batch */
+#define ARMV7A_CACHE_BATCH	128
 
 static int armv7a_l1_d_cache_sanity_check(struct target *target)
 {
@@ -65,25 +69,30 @@ static int armv7a_l1_i_cache_sanity_check(struct target *target)
 
 static int armv7a_l1_d_cache_flush_level(struct arm_dpm *dpm, struct armv7a_cachesize *size, int cl)
 {
+	uint32_t batch[ARMV7A_CACHE_BATCH];
+	unsigned int n = 0;
 	int retval = ERROR_OK;
 	int32_t c_way, c_index = size->index;
 
 	LOG_DEBUG("cl %" PRId32, cl);
 	do {
-		keep_alive();
 		c_way = size->way;
 		do {
-			uint32_t value = (c_index << size->index_shift)
+			batch[n++] = (c_index << size->index_shift)
 				| (c_way << size->way_shift) | (cl << 1);
-			/*
-			 * DCCISW - Clean and invalidate data cache
-			 * line by Set/Way.
-			 */
-			retval = dpm->instr_write_data_r0(dpm,
-					ARMV4_5_MCR(15, 0, 0, 7, 14, 2),
-					value);
-			if (retval != ERROR_OK)
-				goto done;
+			if (n == ARMV7A_CACHE_BATCH || (c_index == 0 && c_way == 0)) {
+				keep_alive();
+				/*
+				 * DCCISW - Clean and invalidate data cache
+				 * line by Set/Way.
+				 */
+				retval = arm_dpm_instr_write_data_r0_array(dpm,
+						ARMV4_5_MCR(15, 0, 0, 7, 14, 2),
+						batch, n);
+				if (retval != ERROR_OK)
+					goto done;
+				n = 0;
+			}
 			c_way -= 1;
 		} while (c_way >= 0);
 		c_index -= 1;
@@ -94,7 +103,33 @@ static int armv7a_l1_d_cache_flush_level(struct arm_dpm *dpm, struct armv7a_cach
 	return retval;
 }
 
-static int armv7a_l1_d_cache_clean_inval_all(struct target *target)
+/*
+ * Run a cache maintenance operation by MVA on every line of the range,
+ * queued in batches of ARMV7A_CACHE_BATCH lines.
+ */
+static int armv7a_l1_cache_op_range(struct arm_dpm *dpm, uint32_t opcode,
+		uint32_t va_line, uint32_t va_end, uint32_t linelen)
+{
+	uint32_t batch[ARMV7A_CACHE_BATCH];
+	unsigned int n = 0;
+	int retval;
+
+	while (va_line < va_end) {
+		batch[n++] = va_line;
+		va_line += linelen;
+		if (n == ARMV7A_CACHE_BATCH || va_line >= va_end) {
+			keep_alive();
+			retval = arm_dpm_instr_write_data_r0_array(dpm, opcode, batch, n);
+			if (retval != ERROR_OK)
+				return retval;
+			n = 0;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+int armv7a_l1_d_cache_clean_inval_all(struct target *target)
 {
 	struct armv7a_common *armv7a = target_to_armv7a(target);
 	struct armv7a_cache_common *cache = &(armv7a->armv7a_mmu.armv7a_cache);
@@ -115,7 +150,9 @@ static int armv7a_l1_d_cache_clean_inval_all(struct target *target)
 		if (cache->arch[cl].ctype < CACHE_LEVEL_HAS_D_CACHE)
 			continue;
 
-		armv7a_l1_d_cache_flush_level(dpm, &cache->arch[cl].d_u_size, cl);
+		retval = armv7a_l1_d_cache_flush_level(dpm, &cache->arch[cl].d_u_size, cl);
+		if (retval != ERROR_OK)
+			goto done;
 	}
 
 	retval = dpm->finish(dpm);
@@ -128,13 +165,14 @@ done:
 	return retval;
 }
 
-int armv7a_cache_auto_flush_all_data(struct target *target)
+/*
+ * Set/way operations only reach the caches of the core executing them, so
+ * clean and invalidate the L1 data cache of every halted core of the
+ * cluster.
+ */
+static int armv7a_l1_d_cache_clean_inval_all_cores(struct target *target)
 {
 	int retval = ERROR_FAIL;
-	struct armv7a_common *armv7a = target_to_armv7a(target);
-
-	if (!armv7a->armv7a_mmu.armv7a_cache.auto_cache_enabled)
-		return ERROR_OK;
 
 	if (target->smp) {
 		struct target_list *head;
@@ -150,6 +188,48 @@ int armv7a_cache_auto_flush_all_data(struct target *target)
 	} else
 		retval = armv7a_l1_d_cache_clean_inval_all(target);
 
+	return retval;
+}
+
+/*
+ * Whether flushing the range by set/way is cheaper than flushing it line by
+ * line, comparing the number of lines in the range with the sets and ways of
+ * the data and unified caches up to the level of coherency. Set/way
+ * operations only reach the core that runs them, while the ones by MVA are
+ * broadcast, so SMP targets always flush by MVA.
+ */
+static bool armv7a_l1_d_cache_flush_by_set_way(struct target *target,
+	uint32_t virt, uint32_t size)
+{
+	struct armv7a_common *armv7a = target_to_armv7a(target);
+	struct armv7a_cache_common *cache = &armv7a->armv7a_mmu.armv7a_cache;
+	uint32_t linelen = cache->dminline;
+	uint64_t lines, ops = 0;
+
+	if (target->smp || !linelen)
+		return false;
+
+	lines = ((uint64_t)virt + size - (virt & -linelen) + linelen - 1) / linelen;
+
+	for (int cl = 0; cl < cache->loc; cl++) {
+		if (cache->arch[cl].ctype < CACHE_LEVEL_HAS_D_CACHE)
+			continue;
+		ops += (uint64_t)cache->arch[cl].d_u_size.nsets
+			* cache->arch[cl].d_u_size.associativity;
+	}
+
+	return lines >= ops;
+}
+
+int armv7a_cache_auto_flush_all_data(struct target *target)
+{
+	struct armv7a_common *armv7a = target_to_armv7a(target);
+	int retval;
+
+	if (!armv7a->armv7a_mmu.armv7a_cache.auto_cache_enabled)
+		return ERROR_OK;
+
+	retval = armv7a_l1_d_cache_clean_inval_all_cores(target);
 	if (retval != ERROR_OK)
 		return retval;
 
@@ -166,7 +246,7 @@ int armv7a_l1_d_cache_inval_virt(struct target *target, uint32_t virt,
 	struct armv7a_cache_common *armv7a_cache = &armv7a->armv7a_mmu.armv7a_cache;
 	uint32_t linelen = armv7a_cache->dminline;
 	uint32_t va_line, va_end;
-	int retval, i = 0;
+	int retval;
 
 	retval = armv7a_l1_d_cache_sanity_check(target);
 	if (retval != ERROR_OK)
@@ -199,16 +279,11 @@ int armv7a_l1_d_cache_inval_virt(struct target *target, uint32_t virt,
 			goto done;
 	}
 
-	while (va_line < va_end) {
-		if ((i++ & 0x3f) == 0)
-			keep_alive();
-		/* DCIMVAC - Invalidate data cache line by VA to PoC. */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 6, 1), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* DCIMVAC - Invalidate data cache line by VA to PoC. */
+	retval = armv7a_l1_cache_op_range(dpm, ARMV4_5_MCR(15, 0, 0, 7, 6, 1),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 
 	keep_alive();
 	dpm->finish(dpm);
@@ -230,7 +305,7 @@ int armv7a_l1_d_cache_clean_virt(struct target *target, uint32_t virt,
 	struct armv7a_cache_common *armv7a_cache = &armv7a->armv7a_mmu.armv7a_cache;
 	uint32_t linelen = armv7a_cache->dminline;
 	uint32_t va_line, va_end;
-	int retval, i = 0;
+	int retval;
 
 	retval = armv7a_l1_d_cache_sanity_check(target);
 	if (retval != ERROR_OK)
@@ -243,16 +318,11 @@ int armv7a_l1_d_cache_clean_virt(struct target *target, uint32_t virt,
 	va_line = virt & (-linelen);
 	va_end = virt + size;
 
-	while (va_line < va_end) {
-		if ((i++ & 0x3f) == 0)
-			keep_alive();
-		/* DCCMVAC - Data Cache Clean by MVA to PoC */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 10, 1), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* DCCMVAC - Data Cache Clean by MVA to PoC */
+	retval = armv7a_l1_cache_op_range(dpm, ARMV4_5_MCR(15, 0, 0, 7, 10, 1),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 
 	keep_alive();
 	dpm->finish(dpm);
@@ -274,7 +344,7 @@ int armv7a_l1_d_cache_flush_virt(struct target *target, uint32_t virt,
 	struct armv7a_cache_common *armv7a_cache = &armv7a->armv7a_mmu.armv7a_cache;
 	uint32_t linelen = armv7a_cache->dminline;
 	uint32_t va_line, va_end;
-	int retval, i = 0;
+	int retval;
 
 	retval = armv7a_l1_d_cache_sanity_check(target);
 	if (retval != ERROR_OK)
@@ -287,16 +357,11 @@ int armv7a_l1_d_cache_flush_virt(struct target *target, uint32_t virt,
 	va_line = virt & (-linelen);
 	va_end = virt + size;
 
-	while (va_line < va_end) {
-		if ((i++ & 0x3f) == 0)
-			keep_alive();
-		/* DCCIMVAC */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 14, 1), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* DCCIMVAC */
+	retval = armv7a_l1_cache_op_range(dpm, ARMV4_5_MCR(15, 0, 0, 7, 14, 1),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 
 	keep_alive();
 	dpm->finish(dpm);
@@ -356,7 +421,7 @@ int armv7a_l1_i_cache_inval_virt(struct target *target, uint32_t virt,
 				&armv7a->armv7a_mmu.armv7a_cache;
 	uint32_t linelen = armv7a_cache->iminline;
 	uint32_t va_line, va_end;
-	int retval, i = 0;
+	int retval;
 
 	retval = armv7a_l1_i_cache_sanity_check(target);
 	if (retval != ERROR_OK)
@@ -369,21 +434,16 @@ int armv7a_l1_i_cache_inval_virt(struct target *target, uint32_t virt,
 	va_line = virt & (-linelen);
 	va_end = virt + size;
 
-	while (va_line < va_end) {
-		if ((i++ & 0x3f) == 0)
-			keep_alive();
-		/* ICIMVAU - Invalidate instruction cache by VA to PoU. */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 5, 1), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		/* BPIMVA */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 5, 7), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* ICIMVAU - Invalidate instruction cache by VA to PoU. */
+	retval = armv7a_l1_cache_op_range(dpm, ARMV4_5_MCR(15, 0, 0, 7, 5, 1),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
+	/* BPIMVA */
+	retval = armv7a_l1_cache_op_range(dpm, ARMV4_5_MCR(15, 0, 0, 7, 5, 7),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 	keep_alive();
 	dpm->finish(dpm);
 	return retval;
@@ -396,15 +456,51 @@ done:
 	return retval;
 }
 
+/*
+ * Large ranges are flushed completely by set/way when that takes fewer
+ * operations than walking them line by line.
+ */
 int armv7a_cache_flush_virt(struct target *target, uint32_t virt,
 				uint32_t size)
 {
-	armv7a_l1_d_cache_flush_virt(target, virt, size);
+	if (armv7a_l1_d_cache_flush_by_set_way(target, virt, size))
+		armv7a_l1_d_cache_clean_inval_all_cores(target);
+	else
+		armv7a_l1_d_cache_flush_virt(target, virt, size);
 	armv7a_l2x_cache_flush_virt(target, virt, size);
 
 	return ERROR_OK;
 }
 
+/*
+ * Clean and invalidate the data caches over a physical address range, before
+ * it is accessed through a system bus MEM-AP. The L1 maintenance is done by
+ * MVA, so the caller must have disabled the MMU. Caches that are disabled or
+ * not configured are skipped, any other failure is returned.
+ */
+int armv7a_cache_flush_phys(struct target *target, uint32_t phys,
+				uint32_t size)
+{
+	struct armv7a_common *armv7a = target_to_armv7a(target);
+	struct armv7a_cache_common *cache = &armv7a->armv7a_mmu.armv7a_cache;
+	int retval;
+
+	if (cache->d_u_cache_enabled) {
+		if (armv7a_l1_d_cache_flush_by_set_way(target, phys, size))
+			retval = armv7a_l1_d_cache_clean_inval_all_cores(target);
+		else
+			retval = armv7a_l1_d_cache_flush_virt(target, phys, size);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	if (!cache->outer_cache)
+		return ERROR_OK;
+
+	/* do outer cache flushing after inner caches have been flushed */
+	return armv7a_l2x_cache_flush_phys(target, phys, size);
+}
+
 /*
  * We assume that target core was chosen correctly. It means if same data
  * was handled by two cores, other core will loose the changes. Since it
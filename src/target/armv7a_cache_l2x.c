@@ -28,6 +28,11 @@
 #include "target.h"
 #include "target_type.h"
 
+/* granule over which one address translation is reused */
+#define ARMV7A_L2X_PAGE_SIZE	4096
+/* number of line operations queued per batch */
+#define ARMV7A_L2X_BATCH		128
+
 static int arm7a_l2x_sanity_check(struct target *target)
 {
 	struct armv7a_common *armv7a = target_to_armv7a(target);
@@ -63,72 +68,95 @@ int arm7a_l2x_flush_all_data(struct target *target)
 
 	l2_way_val = (1 << l2x_cache->way) - 1;
 
-	return target_write_phys_u32(target,
+	retval = target_write_phys_u32(target,
 			l2x_cache->base + L2X0_CLEAN_INV_WAY,
 			l2_way_val);
-}
-
-int armv7a_l2x_cache_flush_virt(struct target *target, target_addr_t virt,
-					uint32_t size)
-{
-	struct armv7a_common *armv7a = target_to_armv7a(target);
-	struct armv7a_l2x_cache *l2x_cache = (struct armv7a_l2x_cache *)
-		(armv7a->armv7a_mmu.armv7a_cache.outer_cache);
-	/* FIXME: different controllers have different linelen? */
-	uint32_t i, linelen = 32;
-	int retval;
-
-	retval = arm7a_l2x_sanity_check(target);
-	if (retval)
-		return retval;
+	if (retval != ERROR_OK)
+		goto done;
 
-	for (i = 0; i < size; i += linelen) {
-		target_addr_t pa, offs = virt + i;
+	/* the by-way operation runs in the background, wait until all the
+	 * way bits read back as zero */
+	int64_t then = timeval_ms();
+	for (;;) {
+		uint8_t buf[4];
 
-		/* FIXME: use less verbose virt2phys? */
-		retval = target->type->virt2phys(target, offs, &pa);
-		if (retval != ERROR_OK)
-			goto done;
-
-		retval = target_write_phys_u32(target,
-				l2x_cache->base + L2X0_CLEAN_INV_LINE_PA, pa);
+		retval = target_read_phys_memory(target,
+				l2x_cache->base + L2X0_CLEAN_INV_WAY, 4, 1, buf);
 		if (retval != ERROR_OK)
 			goto done;
+		if (!(target_buffer_get_u32(target, buf) & l2_way_val))
+			return ERROR_OK;
+		if (timeval_ms() > then + 1000) {
+			LOG_ERROR("timeout waiting for l2x clean/invalidate by way");
+			return ERROR_TARGET_TIMEOUT;
+		}
+		keep_alive();
 	}
-	return retval;
 
 done:
-	LOG_ERROR("d-cache invalidate failed");
+	LOG_ERROR("l2x clean/invalidate by way failed");
 
 	return retval;
 }
 
-static int armv7a_l2x_cache_inval_virt(struct target *target, target_addr_t virt,
-					uint32_t size)
+/*
+ * Issue one line maintenance operation for every line of the range, by
+ * writing the physical line addresses to the controller register @a reg.
+ * Virtual ranges are translated once per page rather than once per line.
+ * The writes are queued on the system bus MEM-AP when one is configured,
+ * and go through the core otherwise.
+ */
+static int armv7a_l2x_cache_line_op(struct target *target, uint32_t reg,
+					target_addr_t addr, uint32_t size, bool virt)
 {
 	struct armv7a_common *armv7a = target_to_armv7a(target);
 	struct armv7a_l2x_cache *l2x_cache = (struct armv7a_l2x_cache *)
 		(armv7a->armv7a_mmu.armv7a_cache.outer_cache);
-	/* FIXME: different controllers have different linelen */
-	uint32_t i, linelen = 32;
+	uint32_t linelen = L2X0_CACHE_LINE_SIZE;
+	uint32_t batch[ARMV7A_L2X_BATCH];
+	target_addr_t line, end, page = 0, page_pa = 0;
+	bool translated = false;
+	unsigned int n = 0;
 	int retval;
 
 	retval = arm7a_l2x_sanity_check(target);
 	if (retval)
 		return retval;
 
-	for (i = 0; i < size; i += linelen) {
-		target_addr_t pa, offs = virt + i;
+	line = addr & ~(target_addr_t)(linelen - 1);
+	end = addr + size;
 
-		/* FIXME: use less verbose virt2phys? */
-		retval = target->type->virt2phys(target, offs, &pa);
-		if (retval != ERROR_OK)
-			goto done;
+	while (line < end) {
+		target_addr_t pa = line;
 
-		retval = target_write_phys_u32(target,
-				l2x_cache->base + L2X0_INV_LINE_PA, pa);
-		if (retval != ERROR_OK)
-			goto done;
+		if (virt) {
+			if (!translated || (line & ~(target_addr_t)(ARMV7A_L2X_PAGE_SIZE - 1)) != page) {
+				page = line & ~(target_addr_t)(ARMV7A_L2X_PAGE_SIZE - 1);
+				retval = target->type->virt2phys(target, page, &page_pa);
+				if (retval != ERROR_OK)
+					goto done;
+				translated = true;
+			}
+			pa = page_pa + (line - page);
+		}
+
+		batch[n++] = pa;
+		line += linelen;
+
+		if (n == ARMV7A_L2X_BATCH || line >= end) {
+			keep_alive();
+			if (arm_memroute_has_sys_ap(armv7a->arm.memroute)) {
+				retval = arm_memroute_write_reg_u32(armv7a->arm.memroute,
+						l2x_cache->base + reg, batch, n);
+			} else {
+				for (unsigned int i = 0; i < n && retval == ERROR_OK; i++)
+					retval = target_write_phys_u32(target,
+							l2x_cache->base + reg, batch[i]);
+			}
+			if (retval != ERROR_OK)
+				goto done;
+			n = 0;
+		}
 	}
 	return retval;
 
@@ -138,39 +166,78 @@ done:
 	return retval;
 }
 
-static int armv7a_l2x_cache_clean_virt(struct target *target, target_addr_t virt,
-					unsigned int size)
+/*
+ * Whether the range covers at least as many lines as the controller holds,
+ * so that a flush by way, which walks every line in hardware, replaces one
+ * register write per line. The way size is read from the auxiliary control
+ * register the first time.
+ */
+static bool armv7a_l2x_flush_by_way(struct target *target, target_addr_t addr,
+					uint32_t size)
 {
 	struct armv7a_common *armv7a = target_to_armv7a(target);
 	struct armv7a_l2x_cache *l2x_cache = (struct armv7a_l2x_cache *)
 		(armv7a->armv7a_mmu.armv7a_cache.outer_cache);
-	/* FIXME: different controllers have different linelen */
-	uint32_t i, linelen = 32;
-	int retval;
+	uint32_t linelen = L2X0_CACHE_LINE_SIZE;
+	uint64_t lines;
+
+	if (arm7a_l2x_sanity_check(target) != ERROR_OK)
+		return false;
+
+	if (!l2x_cache->way_size) {
+		uint8_t buf[4];
+		uint32_t aux, encoded;
+
+		if (target_read_phys_memory(target, l2x_cache->base + L2X0_AUX_CTRL,
+				4, 1, buf) != ERROR_OK)
+			return false;
+		aux = target_buffer_get_u32(target, buf);
+		/* 1 = 16 KiB ... 6 = 512 KiB, 0 and 7 are treated as the nearest */
+		encoded = (aux & L2X0_AUX_CTRL_WAY_SIZE_MASK) >> L2X0_AUX_CTRL_WAY_SIZE_SHIFT;
+		if (encoded < 1)
+			encoded = 1;
+		else if (encoded > 6)
+			encoded = 6;
+		l2x_cache->way_size = 8192u << encoded;
+	}
 
-	retval = arm7a_l2x_sanity_check(target);
-	if (retval)
-		return retval;
+	lines = (addr + size - (addr & ~(target_addr_t)(linelen - 1)) + linelen - 1) / linelen;
 
-	for (i = 0; i < size; i += linelen) {
-		target_addr_t pa, offs = virt + i;
+	return lines >= (uint64_t)l2x_cache->way * l2x_cache->way_size / linelen;
+}
 
-		/* FIXME: use less verbose virt2phys? */
-		retval = target->type->virt2phys(target, offs, &pa);
-		if (retval != ERROR_OK)
-			goto done;
+int armv7a_l2x_cache_flush_virt(struct target *target, target_addr_t virt,
+					uint32_t size)
+{
+	if (armv7a_l2x_flush_by_way(target, virt, size))
+		return arm7a_l2x_flush_all_data(target);
 
-		retval = target_write_phys_u32(target,
-				l2x_cache->base + L2X0_CLEAN_LINE_PA, pa);
-		if (retval != ERROR_OK)
-			goto done;
-	}
-	return retval;
+	return armv7a_l2x_cache_line_op(target, L2X0_CLEAN_INV_LINE_PA,
+			virt, size, true);
+}
 
-done:
-	LOG_ERROR("d-cache invalidate failed");
+int armv7a_l2x_cache_flush_phys(struct target *target, uint32_t phys,
+					uint32_t size)
+{
+	if (armv7a_l2x_flush_by_way(target, phys, size))
+		return arm7a_l2x_flush_all_data(target);
 
-	return retval;
+	return armv7a_l2x_cache_line_op(target, L2X0_CLEAN_INV_LINE_PA,
+			phys, size, false);
+}
+
+static int armv7a_l2x_cache_inval_virt(struct target *target, target_addr_t virt,
+					uint32_t size)
+{
+	return armv7a_l2x_cache_line_op(target, L2X0_INV_LINE_PA,
+			virt, size, true);
+}
+
+static int armv7a_l2x_cache_clean_virt(struct target *target, target_addr_t virt,
+					unsigned int size)
+{
+	return armv7a_l2x_cache_line_op(target, L2X0_CLEAN_LINE_PA,
+			virt, size, true);
 }
 
 static int arm7a_handle_l2x_cache_info_command(struct command_invocation *cmd,
@@ -31,6 +31,7 @@
 #include "armv7a_mmu.h"
 #include "arm_opcodes.h"
 #include "cortex_a.h"
+#include "tlbcache.h"
 
 #define SCTLR_BIT_AFE (1 << 29)
 
@@ -43,6 +44,11 @@ int armv7a_mmu_translate_va_pa(struct target *target, uint32_t va,
 	struct arm_dpm *dpm = armv7a->arm.dpm;
 	uint32_t virt = va & ~0xfff, value;
 	uint32_t NOS, NS, INNER, OUTER, SS;
+
+	/* the translation regime, and so the context, follows the core mode */
+	if (target_tlbcache_lookup(target, armv7a->arm.core_mode, va, val, NULL))
+		return ERROR_OK;
+
 	*val = 0xdeadbeef;
 	retval = dpm->prepare(dpm);
 	if (retval != ERROR_OK)
@@ -83,6 +89,10 @@ int armv7a_mmu_translate_va_pa(struct target *target, uint32_t va,
 	} else {
 		*val = (value & ~0xfff)  +  (va & 0xfff);
 	}
+	/* PAR.F set means the translation aborted */
+	if (!(value & 1))
+		target_tlbcache_insert(target, armv7a->arm.core_mode, va, *val,
+				SS ? 0x1000000 : 0x1000, 0);
 	if (meminfo) {
 		LOG_INFO("%" PRIx32 " : %" TARGET_PRIxADDR " %s outer shareable %s secured %s super section",
 			va, *val,
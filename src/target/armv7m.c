@@ -196,6 +196,22 @@ static int armv7m_get_core_reg(struct reg *reg)
 	return retval;
 }
 
+static int armv7m_get_core_regs(struct reg **reg_list, unsigned num_regs)
+{
+	struct arm_reg *armv7m_reg = reg_list[0]->arch_info;
+	struct target *target = armv7m_reg->target;
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+
+	if (target->state != TARGET_HALTED)
+		return ERROR_TARGET_NOT_HALTED;
+
+	/* this reads all invalid registers, not only those of reg_list */
+	if (armv7m->load_core_regs)
+		return armv7m->load_core_regs(target);
+
+	return ERROR_OK;
+}
+
 static int armv7m_set_core_reg(struct reg *reg, uint8_t *buf)
 {
 	struct arm_reg *armv7m_reg = reg->arch_info;
@@ -318,6 +334,30 @@ int armv7m_get_gdb_reg_list(struct target *target, struct reg **reg_list[],
 	return ERROR_OK;
 }
 
+/* Debug entry may leave registers out of the cache, read them for the
+ * callers working on the whole register set */
+static int armv7m_read_all_core_regs(struct target *target)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct reg_cache *cache = armv7m->arm.core_cache;
+
+	if (armv7m->load_core_regs && armv7m->load_core_regs(target) != ERROR_OK)
+		LOG_DEBUG("queued register read failed, reading registers one by one");
+
+	for (unsigned i = 0; i < cache->num_regs; i++) {
+		struct reg *r = &cache->reg_list[i];
+
+		if (!r->exist || r->valid)
+			continue;
+
+		int retval = r->type->get(r);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
+}
+
 /** Runs a Thumb algorithm in the target. */
 int armv7m_run_algorithm(struct target *target,
 	int num_mem_params, struct mem_param *mem_params,
@@ -368,8 +408,11 @@ int armv7m_start_algorithm(struct target *target,
 		return ERROR_TARGET_NOT_HALTED;
 	}
 
-	/* refresh core register cache
-	 * Not needed if core register cache is always consistent with target process state */
+	/* refresh core register cache */
+	retval = armv7m_read_all_core_regs(target);
+	if (retval != ERROR_OK)
+		return retval;
+
 	for (unsigned i = 0; i < armv7m->arm.core_cache->num_regs; i++) {
 
 		armv7m_algorithm_info->context[i] = buf_get_u32(
@@ -522,6 +565,12 @@ int armv7m_wait_algorithm(struct target *target,
 				return ERROR_COMMAND_SYNTAX_ERROR;
 			}
 
+			if (!reg->valid) {
+				retval = reg->type->get(reg);
+				if (retval != ERROR_OK)
+					return retval;
+			}
+
 			buf_set_u32(reg_params[i].value, 0, 32, buf_get_u32(reg->value, 0, 32));
 		}
 	}
@@ -529,7 +578,10 @@ int armv7m_wait_algorithm(struct target *target,
 	for (int i = armv7m->arm.core_cache->num_regs - 1; i >= 0; i--) {
 		uint32_t regvalue;
 		regvalue = buf_get_u32(armv7m->arm.core_cache->reg_list[i].value, 0, 32);
-		if (regvalue != armv7m_algorithm_info->context[i]) {
+		/* a register not read since the algorithm stopped may have been
+		 * changed by it */
+		if (!armv7m->arm.core_cache->reg_list[i].valid ||
+				regvalue != armv7m_algorithm_info->context[i]) {
 			LOG_DEBUG("restoring register %s with value 0x%8.8" PRIx32,
 					armv7m->arm.core_cache->reg_list[i].name,
 				armv7m_algorithm_info->context[i]);
@@ -586,6 +638,7 @@ int armv7m_arch_state(struct target *target)
 static const struct reg_arch_type armv7m_reg_type = {
 	.get = armv7m_get_core_reg,
 	.set = armv7m_set_core_reg,
+	.get_many = armv7m_get_core_regs,
 };
 
 /** Builds cache of architecturally defined registers.  */
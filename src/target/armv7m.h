@@ -161,6 +161,8 @@ struct armv7m_common {
 	/* Direct processor core register read and writes */
 	int (*load_core_reg_u32)(struct target *target, uint32_t num, uint32_t *value);
 	int (*store_core_reg_u32)(struct target *target, uint32_t num, uint32_t value);
+	/* Optional: read all core registers missing from the cache at once */
+	int (*load_core_regs)(struct target *target);
 
 	int (*examine_debug_reason)(struct target *target);
 	int (*post_debug_entry)(struct target *target);
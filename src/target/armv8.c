@@ -40,6 +40,7 @@
 #include "target.h"
 #include "target_type.h"
 #include "semihosting_common.h"
+#include "tlbcache.h"
 
 static const char * const armv8_state_strings[] = {
 	"AArch32", "Thumb", "Jazelle", "ThumbEE", "AArch64",
@@ -945,6 +946,10 @@ int armv8_mmu_translate_va_pa(struct target *target, target_addr_t va,
 		return ERROR_TARGET_NOT_HALTED;
 	}
 
+	/* the translation regime, and so the context, follows the core mode */
+	if (target_tlbcache_lookup(target, arm->core_mode, va, val, NULL))
+		return ERROR_OK;
+
 	retval = dpm->prepare(dpm);
 	if (retval != ERROR_OK)
 		return retval;
@@ -997,6 +1002,7 @@ int armv8_mmu_translate_va_pa(struct target *target, target_addr_t va,
 		retval = ERROR_FAIL;
 	} else {
 		*val = (par & 0xFFFFFFFFF000UL) | (va & 0xFFF);
+		target_tlbcache_insert(target, arm->core_mode, va, *val, 0x1000, 0);
 		if (meminfo) {
 			int SH = (par >> 7) & 3;
 			int NS = (par >> 9) & 1;
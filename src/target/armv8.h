@@ -25,6 +25,7 @@
 #include "armv4_5_cache.h"
 #include "armv8_dpm.h"
 #include "arm_cti.h"
+#include "arm_memroute.h"
 
 enum {
 	ARMV8_R0 = 0,
@@ -214,6 +215,9 @@ struct armv8_common {
 
 	struct armv8_mmu_common armv8_mmu;
 
+	/* physical memory access routing, referenced by arm.memroute */
+	struct arm_memroute memroute;
+
 	struct arm_cti *cti;
 
 	/* last run-control command issued to this target (resume, halt, step) */
@@ -29,6 +29,9 @@
 #define CACHE_LEVEL_HAS_D_CACHE		0x2
 #define CACHE_LEVEL_HAS_I_CACHE		0x1
 
+/* number of cache maintenance operations queued per batch */
+#define ARMV8_CACHE_BATCH	128
+
 static int armv8_d_cache_sanity_check(struct armv8_common *armv8)
 {
 	struct armv8_cache_common *armv8_cache = &armv8->armv8_mmu.armv8_cache;
@@ -52,6 +55,8 @@ static int armv8_i_cache_sanity_check(struct armv8_common *armv8)
 static int armv8_cache_d_inner_flush_level(struct armv8_common *armv8, struct armv8_cachesize *size, int cl)
 {
 	struct arm_dpm *dpm = armv8->arm.dpm;
+	uint64_t batch[ARMV8_CACHE_BATCH];
+	unsigned int n = 0;
 	int retval = ERROR_OK;
 	int32_t c_way, c_index = size->index;
 
@@ -59,16 +64,20 @@ static int armv8_cache_d_inner_flush_level(struct armv8_common *armv8, struct ar
 	do {
 		c_way = size->way;
 		do {
-			uint32_t value = (c_index << size->index_shift)
+			batch[n++] = (c_index << size->index_shift)
 				| (c_way << size->way_shift) | (cl << 1);
-			/*
-			 * DC CISW - Clean and invalidate data cache
-			 * line by Set/Way.
-			 */
-			retval = dpm->instr_write_data_r0(dpm,
-					armv8_opcode(armv8, ARMV8_OPC_DCCISW), value);
-			if (retval != ERROR_OK)
-				goto done;
+			if (n == ARMV8_CACHE_BATCH || (c_index == 0 && c_way == 0)) {
+				keep_alive();
+				/*
+				 * DC CISW - Clean and invalidate data cache
+				 * line by Set/Way.
+				 */
+				retval = arm_dpm_instr_write_data_r0_array_64(dpm,
+						armv8_opcode(armv8, ARMV8_OPC_DCCISW), batch, n);
+				if (retval != ERROR_OK)
+					goto done;
+				n = 0;
+			}
 			c_way -= 1;
 		} while (c_way >= 0);
 		c_index -= 1;
@@ -78,6 +87,32 @@ static int armv8_cache_d_inner_flush_level(struct armv8_common *armv8, struct ar
 	return retval;
 }
 
+/*
+ * Run a cache maintenance operation by VA on every line of the range,
+ * queued in batches of ARMV8_CACHE_BATCH lines.
+ */
+static int armv8_cache_op_range(struct arm_dpm *dpm, uint32_t opcode,
+		target_addr_t va_line, target_addr_t va_end, uint64_t linelen)
+{
+	uint64_t batch[ARMV8_CACHE_BATCH];
+	unsigned int n = 0;
+	int retval;
+
+	while (va_line < va_end) {
+		batch[n++] = va_line;
+		va_line += linelen;
+		if (n == ARMV8_CACHE_BATCH || va_line >= va_end) {
+			keep_alive();
+			retval = arm_dpm_instr_write_data_r0_array_64(dpm, opcode, batch, n);
+			if (retval != ERROR_OK)
+				return retval;
+			n = 0;
+		}
+	}
+
+	return ERROR_OK;
+}
+
 static int armv8_cache_d_inner_clean_inval_all(struct armv8_common *armv8)
 {
 	struct armv8_cache_common *cache = &(armv8->armv8_mmu.armv8_cache);
@@ -98,7 +133,9 @@ static int armv8_cache_d_inner_clean_inval_all(struct armv8_common *armv8)
 		if (cache->arch[cl].ctype < CACHE_LEVEL_HAS_D_CACHE)
 			continue;
 
-		armv8_cache_d_inner_flush_level(armv8, &cache->arch[cl].d_u_size, cl);
+		retval = armv8_cache_d_inner_flush_level(armv8, &cache->arch[cl].d_u_size, cl);
+		if (retval != ERROR_OK)
+			goto done;
 	}
 
 	retval = dpm->finish(dpm);
@@ -111,6 +148,30 @@ done:
 	return retval;
 }
 
+/*
+ * Number of set/way operations that clean and invalidate the data and
+ * unified caches up to the level of coherency.
+ */
+static uint64_t armv8_cache_d_set_way_ops(struct armv8_cache_common *cache)
+{
+	uint64_t ops = 0;
+
+	for (int cl = 0; cl < cache->loc; cl++) {
+		if (cache->arch[cl].ctype < CACHE_LEVEL_HAS_D_CACHE)
+			continue;
+		ops += (uint64_t)cache->arch[cl].d_u_size.nsets
+			* cache->arch[cl].d_u_size.associativity;
+	}
+
+	return ops;
+}
+
+/*
+ * A range covering at least as many lines as there are sets and ways is
+ * flushed completely by set/way instead. Set/way operations only act on
+ * the core that runs them while the by-VA ones are broadcast, so SMP
+ * targets always flush by VA.
+ */
 int armv8_cache_d_inner_flush_virt(struct armv8_common *armv8, target_addr_t va, size_t size)
 {
 	struct arm_dpm *dpm = armv8->arm.dpm;
@@ -123,22 +184,23 @@ int armv8_cache_d_inner_flush_virt(struct armv8_common *armv8, target_addr_t va,
 	if (retval != ERROR_OK)
 		return retval;
 
+	va_line = va & (-linelen);
+	va_end = va + size;
+
+	if (!armv8->arm.target->smp &&
+			(va_end - va_line + linelen - 1) / linelen >= armv8_cache_d_set_way_ops(armv8_cache))
+		return armv8_cache_d_inner_clean_inval_all(armv8);
+
 	retval = dpm->prepare(dpm);
 	if (retval != ERROR_OK)
 		goto done;
 
-	va_line = va & (-linelen);
-	va_end = va + size;
-
-	while (va_line < va_end) {
-		/* DC CIVAC */
-		/* Aarch32: DCCIMVAC: ARMV4_5_MCR(15, 0, 0, 7, 14, 1) */
-		retval = dpm->instr_write_data_r0_64(dpm,
-				armv8_opcode(armv8, ARMV8_OPC_DCCIVAC), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* DC CIVAC */
+	/* Aarch32: DCCIMVAC: ARMV4_5_MCR(15, 0, 0, 7, 14, 1) */
+	retval = armv8_cache_op_range(dpm, armv8_opcode(armv8, ARMV8_OPC_DCCIVAC),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 
 	dpm->finish(dpm);
 	return retval;
@@ -169,14 +231,11 @@ int armv8_cache_i_inner_inval_virt(struct armv8_common *armv8, target_addr_t va,
 	va_line = va & (-linelen);
 	va_end = va + size;
 
-	while (va_line < va_end) {
-		/* IC IVAU - Invalidate instruction cache by VA to PoU. */
-		retval = dpm->instr_write_data_r0_64(dpm,
-				armv8_opcode(armv8, ARMV8_OPC_ICIVAU), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* IC IVAU - Invalidate instruction cache by VA to PoU. */
+	retval = armv8_cache_op_range(dpm, armv8_opcode(armv8, ARMV8_OPC_ICIVAU),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 
 	dpm->finish(dpm);
 	return retval;
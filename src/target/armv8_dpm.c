@@ -339,6 +339,71 @@ static int dpmv8_instr_write_data_r0_64(struct arm_dpm *dpm,
 	return retval;
 }
 
+/*
+ * ARMv8 has no DCC stall mode. The sequence is queued anyway, since the core
+ * normally completes each instruction long before the next debug register
+ * write reaches it. If it did not, EDSCR reports an ITR or DTRRX overrun and
+ * the whole sequence is repeated one instruction at a time, which is
+ * harmless for the cache maintenance operations this is used for.
+ */
+static int dpmv8_instr_write_data_r0_array_64(struct arm_dpm *dpm,
+	uint32_t opcode, const uint64_t *data, unsigned int count)
+{
+	struct armv8_common *armv8 = dpm->arm->arch_info;
+	uint32_t dscr;
+	int retval = ERROR_OK;
+
+	if (dpm->arm->core_state != ARM_STATE_AARCH64)
+		goto slow;
+
+	for (unsigned int i = 0; i < count && retval == ERROR_OK; i++) {
+		retval = dpmv8_write_dcc_64(armv8, data[i]);
+		if (retval == ERROR_OK)
+			retval = mem_ap_write_u32(armv8->debug_ap,
+					armv8->debug_base + CPUV8_DBG_ITR,
+					ARMV8_MRS(SYSTEM_DBG_DBGDTR_EL0, 0));
+		if (retval == ERROR_OK)
+			retval = mem_ap_write_u32(armv8->debug_ap,
+					armv8->debug_base + CPUV8_DBG_ITR, opcode);
+	}
+	if (retval == ERROR_OK)
+		retval = mem_ap_read_atomic_u32(armv8->debug_ap,
+				armv8->debug_base + CPUV8_DBG_DSCR, &dscr);
+	if (retval != ERROR_OK)
+		return retval;
+
+	dpm->dscr = dscr;
+
+	/* an overrun also sets DSCR.ERR, so it must be told apart first */
+	if (!(dscr & (DSCR_ITO | DSCR_RTO))) {
+		if (dscr & DSCR_ERR) {
+			LOG_ERROR("Opcode 0x%08" PRIx32 ", DSCR.ERR=1, DSCR.EL=%i", opcode, dpm->last_el);
+			armv8_dpm_handle_exception(dpm, true);
+			return ERROR_FAIL;
+		}
+		return ERROR_OK;
+	}
+
+	/* DRCR.CSE clears the overrun flags and DSCR.ERR, an exception taken
+	 * by one of the instructions shows up again when it is repeated */
+	LOG_DEBUG("overrun in queued sequence, dscr 0x%08" PRIx32 ", repeating", dscr);
+	retval = mem_ap_write_atomic_u32(armv8->debug_ap,
+			armv8->debug_base + CPUV8_DBG_DRCR, DRCR_CSE);
+	if (retval != ERROR_OK)
+		return retval;
+	dpm->dscr &= ~(DSCR_ITO | DSCR_RTO | DSCR_ERR | DSCR_ITE);
+
+	/* drop data left in the DCC by a discarded instruction */
+	if (dscr & DSCR_DTR_RX_FULL)
+		retval = dpmv8_exec_opcode(dpm, ARMV8_MRS(SYSTEM_DBG_DBGDTR_EL0, 0), &dpm->dscr);
+
+slow:
+	for (unsigned int i = 0; i < count && retval == ERROR_OK; i++)
+		retval = dpmv8_instr_write_data_r0_64(dpm, opcode, data[i]);
+
+	return retval;
+}
+
 static int dpmv8_instr_cpsr_sync(struct arm_dpm *dpm)
 {
 	int retval;
@@ -1439,6 +1504,7 @@ int armv8_dpm_setup(struct arm_dpm *dpm)
 	dpm->instr_write_data_dcc_64 = dpmv8_instr_write_data_dcc_64;
 	dpm->instr_write_data_r0 = dpmv8_instr_write_data_r0;
 	dpm->instr_write_data_r0_64 = dpmv8_instr_write_data_r0_64;
+	dpm->instr_write_data_r0_array_64 = dpmv8_instr_write_data_r0_array_64;
 	dpm->instr_cpsr_sync = dpmv8_instr_cpsr_sync;
 
 	dpm->instr_read_data_dcc = dpmv8_instr_read_data_dcc;
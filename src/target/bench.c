@@ -0,0 +1,639 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/**
+ * @file
+ * The "bench" command group measures the throughput and latency of the
+ * basic debug operations on the current target: memory access, register
+ * access, halt/resume, checksums and flash erase/program/verify.
+ *
+ * Each command returns a list of records, either as a Tcl list of dicts or
+ * as a JSON array of objects, so results can be collected by scripts.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include <helper/time_support.h>
+#include <flash/nor/core.h>
+#include <flash/nor/imp.h>
+#include "bench.h"
+#include "target.h"
+#include "register.h"
+
+enum bench_format {
+	BENCH_FORMAT_TCL,
+	BENCH_FORMAT_JSON,
+};
+
+static enum bench_format bench_format = BENCH_FORMAT_TCL;
+
+struct bench_report {
+	struct command_invocation *cmd;
+	unsigned int records;
+	unsigned int fields;
+};
+
+static void bench_report_start(struct bench_report *report, struct command_invocation *cmd)
+{
+	report->cmd = cmd;
+	report->records = 0;
+	report->fields = 0;
+}
+
+static void bench_record_start(struct bench_report *report)
+{
+	if (bench_format == BENCH_FORMAT_JSON)
+		command_print_sameline(report->cmd, "%s{", report->records ? ",\n " : "[");
+	else
+		command_print_sameline(report->cmd, "{");
+	report->fields = 0;
+}
+
+static void bench_record_end(struct bench_report *report)
+{
+	if (bench_format == BENCH_FORMAT_JSON)
+		command_print_sameline(report->cmd, "}");
+	else
+		command_print(report->cmd, "}");
+	report->records++;
+}
+
+static void bench_report_end(struct bench_report *report)
+{
+	if (bench_format == BENCH_FORMAT_JSON)
+		command_print(report->cmd, "%s]", report->records ? "" : "[");
+}
+
+/* Field values are printed verbatim, they must not need quoting */
+static void bench_field(struct bench_report *report, const char *key, bool is_string,
+		const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	char *value = alloc_vprintf(format, ap);
+	va_end(ap);
+
+	if (!value)
+		return;
+
+	const char *sep = report->fields ? (bench_format == BENCH_FORMAT_JSON ? ", " : " ") : "";
+	if (bench_format == BENCH_FORMAT_JSON)
+		command_print_sameline(report->cmd, is_string ? "%s\"%s\": \"%s\"" : "%s\"%s\": %s",
+				sep, key, value);
+	else
+		command_print_sameline(report->cmd, "%s%s %s", sep, key, value);
+
+	report->fields++;
+	free(value);
+}
+
+static uint64_t bench_elapsed_us(const struct duration *d)
+{
+	return (uint64_t)(duration_elapsed(d) * 1000000.0);
+}
+
+/* Common fields of throughput records */
+static void bench_rate_fields(struct bench_report *report, const struct duration *d,
+		uint64_t bytes)
+{
+	bench_field(report, "bytes", false, "%" PRIu64, bytes);
+	bench_field(report, "time_us", false, "%" PRIu64, bench_elapsed_us(d));
+	bench_field(report, "kib_per_s", false, "%.1f", duration_kbps(d, bytes));
+}
+
+/* Common fields of latency records */
+static void bench_latency_fields(struct bench_report *report, const struct duration *d,
+		unsigned int iterations)
+{
+	bench_field(report, "iterations", false, "%u", iterations);
+	bench_field(report, "time_us", false, "%" PRIu64, bench_elapsed_us(d));
+	bench_field(report, "latency_us", false, "%.1f",
+			duration_elapsed(d) * 1000000.0 / iterations);
+}
+
+static void bench_fill_pattern(uint8_t *buffer, uint32_t size)
+{
+	uint32_t state = 0x12345678;
+
+	for (uint32_t i = 0; i < size; i++) {
+		state = state * 1103515245 + 12345;
+		buffer[i] = state >> 16;
+	}
+}
+
+static struct target *bench_halted_target(struct command_invocation *cmd)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (target->state != TARGET_HALTED) {
+		command_print(CMD, "target %s is not halted", target_name(target));
+		return NULL;
+	}
+	return target;
+}
+
+/* One write and one read run of the memory benchmark, verified against the pattern */
+static int bench_memory_run(struct bench_report *report, struct target *target,
+		target_addr_t address, unsigned int width, uint32_t offset, uint32_t length,
+		unsigned int iterations, const uint8_t *pattern, uint8_t *readback)
+{
+	const char *access = width ? "memory" : "buffer";
+	struct duration bench;
+	int retval;
+
+	duration_start(&bench);
+	for (unsigned int i = 0; i < iterations; i++) {
+		if (width)
+			retval = target_write_memory(target, address + offset, width, length / width,
+					pattern);
+		else
+			retval = target_write_buffer(target, address + offset, length, pattern);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	duration_measure(&bench);
+
+	bench_record_start(report);
+	bench_field(report, "test", true, "memory");
+	bench_field(report, "op", true, "write");
+	bench_field(report, "access", true, "%s", access);
+	bench_field(report, "width", false, "%u", width);
+	bench_field(report, "offset", false, "%" PRIu32, offset);
+	bench_rate_fields(report, &bench, (uint64_t)length * iterations);
+	bench_record_end(report);
+
+	duration_start(&bench);
+	for (unsigned int i = 0; i < iterations; i++) {
+		if (width)
+			retval = target_read_memory(target, address + offset, width, length / width,
+					readback);
+		else
+			retval = target_read_buffer(target, address + offset, length, readback);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	duration_measure(&bench);
+
+	bench_record_start(report);
+	bench_field(report, "test", true, "memory");
+	bench_field(report, "op", true, "read");
+	bench_field(report, "access", true, "%s", access);
+	bench_field(report, "width", false, "%u", width);
+	bench_field(report, "offset", false, "%" PRIu32, offset);
+	bench_rate_fields(report, &bench, (uint64_t)length * iterations);
+	bench_field(report, "verified", false, "%d", memcmp(pattern, readback, length) == 0);
+	bench_record_end(report);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_bench_memory_command)
+{
+	target_addr_t address;
+	uint32_t length;
+	unsigned int iterations = 1;
+
+	if (CMD_ARGC < 2 || CMD_ARGC > 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], length);
+	if (CMD_ARGC == 3)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[2], iterations);
+
+	if ((address & 3) || length < 8 || iterations == 0) {
+		command_print(CMD, "address must be word aligned, length at least 8 bytes");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	length &= ~3;
+
+	struct target *target = bench_halted_target(CMD);
+	if (!target)
+		return ERROR_TARGET_NOT_HALTED;
+
+	uint8_t *backup = malloc(length);
+	uint8_t *pattern = malloc(length);
+	uint8_t *readback = malloc(length);
+	if (!backup || !pattern || !readback) {
+		LOG_ERROR("Out of memory");
+		free(backup);
+		free(pattern);
+		free(readback);
+		return ERROR_FAIL;
+	}
+	bench_fill_pattern(pattern, length);
+
+	/* The benchmark overwrites the memory, put the original contents back afterwards */
+	int retval = target_read_buffer(target, address, length, backup);
+	if (retval != ERROR_OK)
+		goto out;
+
+	struct bench_report report;
+	bench_report_start(&report, CMD);
+
+	/* Aligned accesses of each size, then unaligned buffers in both directions */
+	static const unsigned int widths[] = { 4, 2, 1 };
+	for (size_t i = 0; i < ARRAY_SIZE(widths) && retval == ERROR_OK; i++)
+		retval = bench_memory_run(&report, target, address, widths[i], 0, length,
+				iterations, pattern, readback);
+	for (uint32_t offset = 1; offset < 4 && retval == ERROR_OK; offset++)
+		retval = bench_memory_run(&report, target, address, 0, offset, length - 4,
+				iterations, pattern, readback);
+
+	bench_report_end(&report);
+
+	int restore_retval = target_write_buffer(target, address, length, backup);
+	if (retval == ERROR_OK)
+		retval = restore_retval;
+
+out:
+	free(backup);
+	free(pattern);
+	free(readback);
+	return retval;
+}
+
+COMMAND_HANDLER(handle_bench_register_command)
+{
+	const char *name = "pc";
+	unsigned int iterations = 100;
+
+	if (CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC >= 1)
+		name = CMD_ARGV[0];
+	if (CMD_ARGC == 2)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], iterations);
+	if (iterations == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	struct target *target = bench_halted_target(CMD);
+	if (!target)
+		return ERROR_TARGET_NOT_HALTED;
+
+	struct reg *reg = register_get_by_name(target->reg_cache, name, true);
+	if (!reg || !reg->exist) {
+		command_print(CMD, "register '%s' not found", name);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	if (reg->dirty) {
+		command_print(CMD, "register '%s' has a pending write", name);
+		return ERROR_FAIL;
+	}
+
+	struct duration bench;
+	int retval;
+
+	/* Drop the cached value before each read so it really comes from the target */
+	duration_start(&bench);
+	for (unsigned int i = 0; i < iterations; i++) {
+		reg->valid = false;
+		retval = reg->type->get(reg);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	duration_measure(&bench);
+
+	struct bench_report report;
+	bench_report_start(&report, CMD);
+
+	bench_record_start(&report);
+	bench_field(&report, "test", true, "register");
+	bench_field(&report, "name", true, "%s", reg->name);
+	bench_field(&report, "op", true, "read");
+	bench_latency_fields(&report, &bench, iterations);
+	bench_record_end(&report);
+
+	/* Write the value just read back; targets that only write registers on
+	 * resume account for the cache update only */
+	uint8_t *value = malloc(DIV_ROUND_UP(reg->size, 8));
+	if (!value) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+	memcpy(value, reg->value, DIV_ROUND_UP(reg->size, 8));
+
+	duration_start(&bench);
+	for (unsigned int i = 0; i < iterations; i++) {
+		retval = reg->type->set(reg, value);
+		if (retval != ERROR_OK)
+			break;
+	}
+	duration_measure(&bench);
+	free(value);
+	if (retval != ERROR_OK)
+		return retval;
+
+	bench_record_start(&report);
+	bench_field(&report, "test", true, "register");
+	bench_field(&report, "name", true, "%s", reg->name);
+	bench_field(&report, "op", true, "write");
+	bench_latency_fields(&report, &bench, iterations);
+	bench_record_end(&report);
+
+	bench_report_end(&report);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_bench_halt_resume_command)
+{
+	unsigned int iterations = 10;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], iterations);
+	if (iterations == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	struct target *target = bench_halted_target(CMD);
+	if (!target)
+		return ERROR_TARGET_NOT_HALTED;
+
+	struct duration resume_time = { .elapsed = { 0, 0 } };
+	struct duration halt_time = { .elapsed = { 0, 0 } };
+	struct duration bench;
+	int retval;
+
+	/* Accumulate the time spent in resume and halt separately */
+	for (unsigned int i = 0; i < iterations; i++) {
+		duration_start(&bench);
+		retval = target_resume(target, 1, 0, 1, 0);
+		if (retval != ERROR_OK)
+			return retval;
+		duration_measure(&bench);
+		timeradd(&resume_time.elapsed, &bench.elapsed, &resume_time.elapsed);
+
+		duration_start(&bench);
+		retval = target_halt(target);
+		if (retval == ERROR_OK)
+			retval = target_wait_state(target, TARGET_HALTED, 1000);
+		if (retval != ERROR_OK)
+			return retval;
+		duration_measure(&bench);
+		timeradd(&halt_time.elapsed, &bench.elapsed, &halt_time.elapsed);
+	}
+
+	struct duration round_trip;
+	timeradd(&resume_time.elapsed, &halt_time.elapsed, &round_trip.elapsed);
+
+	struct bench_report report;
+	bench_report_start(&report, CMD);
+
+	static const char * const ops[] = { "resume", "halt", "round_trip" };
+	const struct duration *times[] = { &resume_time, &halt_time, &round_trip };
+	for (size_t i = 0; i < ARRAY_SIZE(ops); i++) {
+		bench_record_start(&report);
+		bench_field(&report, "test", true, "halt_resume");
+		bench_field(&report, "op", true, "%s", ops[i]);
+		bench_latency_fields(&report, times[i], iterations);
+		bench_record_end(&report);
+	}
+
+	bench_report_end(&report);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_bench_checksum_command)
+{
+	target_addr_t address;
+	uint32_t length;
+	unsigned int iterations = 1;
+
+	if (CMD_ARGC < 2 || CMD_ARGC > 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], length);
+	if (CMD_ARGC == 3)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[2], iterations);
+	if (length == 0 || iterations == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	struct target *target = bench_halted_target(CMD);
+	if (!target)
+		return ERROR_TARGET_NOT_HALTED;
+
+	struct duration bench;
+	uint32_t checksum = 0;
+
+	duration_start(&bench);
+	for (unsigned int i = 0; i < iterations; i++) {
+		int retval = target_checksum_memory(target, address, length, &checksum);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	duration_measure(&bench);
+
+	struct bench_report report;
+	bench_report_start(&report, CMD);
+
+	bench_record_start(&report);
+	bench_field(&report, "test", true, "checksum");
+	bench_rate_fields(&report, &bench, (uint64_t)length * iterations);
+	bench_field(&report, "crc", true, "0x%8.8" PRIx32, checksum);
+	bench_record_end(&report);
+
+	bench_report_end(&report);
+
+	return ERROR_OK;
+}
+
+static void bench_flash_record(struct bench_report *report, struct flash_bank *bank,
+		const char *op, const struct duration *d, uint64_t bytes)
+{
+	bench_record_start(report);
+	bench_field(report, "test", true, "flash");
+	bench_field(report, "bank", true, "%s", bank->name);
+	bench_field(report, "op", true, "%s", op);
+	bench_rate_fields(report, d, bytes);
+}
+
+COMMAND_HANDLER(handle_bench_flash_command)
+{
+	struct flash_bank *bank;
+	uint32_t offset, length;
+
+	if (CMD_ARGC != 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	int retval = CALL_COMMAND_HANDLER(flash_command_get_bank, 0, &bank);
+	if (retval != ERROR_OK)
+		return retval;
+
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], offset);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[2], length);
+
+	if (length == 0 || offset >= bank->size || length > bank->size - offset) {
+		command_print(CMD, "range 0x%" PRIx32 "+0x%" PRIx32 " is outside of bank %s",
+				offset, length, bank->name);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	/* Erase whole sectors covering the range */
+	int first = -1, last = -1;
+	uint64_t erase_bytes = 0;
+	for (int i = 0; i < bank->num_sectors; i++) {
+		struct flash_sector *sector = &bank->sectors[i];
+		if (sector->offset + sector->size <= offset || sector->offset >= offset + length)
+			continue;
+		if (first < 0)
+			first = i;
+		last = i;
+		erase_bytes += sector->size;
+	}
+	if (first < 0) {
+		command_print(CMD, "no sectors of bank %s in the given range", bank->name);
+		return ERROR_FAIL;
+	}
+
+	uint8_t *pattern = malloc(length);
+	uint8_t *readback = malloc(length);
+	if (!pattern || !readback) {
+		LOG_ERROR("Out of memory");
+		retval = ERROR_FAIL;
+		goto out;
+	}
+	bench_fill_pattern(pattern, length);
+
+	struct duration erase_time, program_time, verify_time;
+
+	duration_start(&erase_time);
+	retval = flash_driver_erase(bank, first, last);
+	if (retval != ERROR_OK)
+		goto out;
+	duration_measure(&erase_time);
+
+	duration_start(&program_time);
+	retval = flash_driver_write(bank, pattern, offset, length);
+	if (retval != ERROR_OK)
+		goto out;
+	duration_measure(&program_time);
+
+	duration_start(&verify_time);
+	retval = flash_driver_read(bank, readback, offset, length);
+	if (retval != ERROR_OK)
+		goto out;
+	duration_measure(&verify_time);
+
+	struct bench_report report;
+	bench_report_start(&report, CMD);
+
+	bench_flash_record(&report, bank, "erase", &erase_time, erase_bytes);
+	bench_record_end(&report);
+	bench_flash_record(&report, bank, "program", &program_time, length);
+	bench_record_end(&report);
+	bench_flash_record(&report, bank, "verify", &verify_time, length);
+	bench_field(&report, "verified", false, "%d", memcmp(pattern, readback, length) == 0);
+	bench_record_end(&report);
+
+	bench_report_end(&report);
+
+out:
+	free(pattern);
+	free(readback);
+	return retval;
+}
+
+COMMAND_HANDLER(handle_bench_format_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "tcl") == 0)
+			bench_format = BENCH_FORMAT_TCL;
+		else if (strcmp(CMD_ARGV[0], "json") == 0)
+			bench_format = BENCH_FORMAT_JSON;
+		else
+			return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	command_print(CMD, "%s", bench_format == BENCH_FORMAT_JSON ? "json" : "tcl");
+
+	return ERROR_OK;
+}
+
+static const struct command_registration bench_subcommand_handlers[] = {
+	{
+		.name = "memory",
+		.handler = handle_bench_memory_command,
+		.mode = COMMAND_EXEC,
+		.help = "measure memory write/read throughput for each access "
+			"width and for unaligned buffers; the memory contents are "
+			"restored afterwards",
+		.usage = "address length [iterations]",
+	},
+	{
+		.name = "register",
+		.handler = handle_bench_register_command,
+		.mode = COMMAND_EXEC,
+		.help = "measure single register read/write latency",
+		.usage = "[name [iterations]]",
+	},
+	{
+		.name = "halt_resume",
+		.handler = handle_bench_halt_resume_command,
+		.mode = COMMAND_EXEC,
+		.help = "measure resume and halt latency; the target runs briefly",
+		.usage = "[iterations]",
+	},
+	{
+		.name = "checksum",
+		.handler = handle_bench_checksum_command,
+		.mode = COMMAND_EXEC,
+		.help = "measure target memory checksum throughput",
+		.usage = "address length [iterations]",
+	},
+	{
+		.name = "flash",
+		.handler = handle_bench_flash_command,
+		.mode = COMMAND_EXEC,
+		.help = "measure erase, program and verify throughput of a flash "
+			"bank; destroys the contents of the affected sectors",
+		.usage = "bank_id offset length",
+	},
+	{
+		.name = "format",
+		.handler = handle_bench_format_command,
+		.mode = COMMAND_ANY,
+		.help = "select the result format of the bench commands",
+		.usage = "['tcl'|'json']",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const struct command_registration bench_command_handlers[] = {
+	{
+		.name = "bench",
+		.mode = COMMAND_ANY,
+		.help = "debug performance benchmarks",
+		.usage = "",
+		.chain = bench_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+int bench_register_commands(struct command_context *cmd_ctx)
+{
+	return register_commands(cmd_ctx, NULL, bench_command_handlers);
+}
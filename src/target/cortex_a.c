@@ -73,6 +73,8 @@ static int cortex_a_unset_breakpoint(struct target *target,
 	struct breakpoint *breakpoint);
 static int cortex_a_wait_dscr_bits(struct target *target, uint32_t mask,
 	uint32_t value, uint32_t *dscr);
+static int cortex_a_set_dcc_mode(struct target *target, uint32_t mode,
+	uint32_t *dscr);
 static int cortex_a_mmu(struct target *target, int *enabled);
 static int cortex_a_mmu_modify(struct target *target, int enable);
 static int cortex_a_virt2phys(struct target *target,
@@ -466,6 +468,63 @@ static int cortex_a_instr_write_data_r0(struct arm_dpm *dpm,
 	return retval;
 }
 
+/*
+ * Runs the opcode once per word, with R0 loaded from the word. In stall
+ * mode, writes to DTRRX and ITR wait for the core to be ready, so the whole
+ * sequence is queued without polling DSCR in between.
+ */
+static int cortex_a_instr_write_data_r0_array(struct arm_dpm *dpm,
+	uint32_t opcode, const uint32_t *data, unsigned int count)
+{
+	struct cortex_a_common *a = dpm_to_a(dpm);
+	struct armv7a_common *armv7a = &a->armv7a_common;
+	struct target *target = armv7a->arm.target;
+	uint32_t dscr;
+	int retval, final_retval;
+
+	retval = cortex_a_wait_instrcmpl(target, &dscr, true);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = cortex_a_set_dcc_mode(target, DSCR_EXT_DCC_STALL_MODE, &dscr);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = 0; i < count && retval == ERROR_OK; i++) {
+		retval = mem_ap_write_u32(armv7a->debug_ap,
+				armv7a->debug_base + CPUDBG_DTRRX, data[i]);
+		/* DCCRX to R0, "MRC p14, 0, R0, c0, c5, 0" */
+		if (retval == ERROR_OK)
+			retval = mem_ap_write_u32(armv7a->debug_ap,
+					armv7a->debug_base + CPUDBG_ITR,
+					ARMV4_5_MRC(14, 0, 0, 0, 5, 0));
+		if (retval == ERROR_OK)
+			retval = mem_ap_write_u32(armv7a->debug_ap,
+					armv7a->debug_base + CPUDBG_ITR, opcode);
+	}
+	if (retval == ERROR_OK)
+		retval = dap_run(armv7a->debug_ap->dap);
+
+	/* Switch back to non-blocking mode even if the sequence failed */
+	final_retval = cortex_a_wait_instrcmpl(target, &dscr, true);
+	if (final_retval == ERROR_OK)
+		final_retval = cortex_a_set_dcc_mode(target, DSCR_EXT_DCC_NON_BLOCKING, &dscr);
+	if (retval == ERROR_OK)
+		retval = final_retval;
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (dscr & (DSCR_STICKY_ABORT_PRECISE | DSCR_STICKY_ABORT_IMPRECISE
+				| DSCR_STICKY_UNDEFINED)) {
+		LOG_ERROR("abort occurred - dscr = 0x%08" PRIx32, dscr);
+		mem_ap_write_atomic_u32(armv7a->debug_ap,
+				armv7a->debug_base + CPUDBG_DRCR, DRCR_CLEAR_EXCEPTIONS);
+		return ERROR_FAIL;
+	}
+
+	return ERROR_OK;
+}
+
 static int cortex_a_instr_cpsr_sync(struct arm_dpm *dpm)
 {
 	struct target *target = dpm->arm->target;
@@ -607,6 +666,7 @@ static int cortex_a_dpm_setup(struct cortex_a_common *a, uint32_t didr)
 
 	dpm->instr_write_data_dcc = cortex_a_instr_write_data_dcc;
 	dpm->instr_write_data_r0 = cortex_a_instr_write_data_r0;
+	dpm->instr_write_data_r0_array = cortex_a_instr_write_data_r0_array;
 	dpm->instr_cpsr_sync = cortex_a_instr_cpsr_sync;
 
 	dpm->instr_read_data_dcc = cortex_a_instr_read_data_dcc;
@@ -2487,10 +2547,30 @@ out:
  * ap number for every access.
  */
 
+/*
+ * The system bus MEM-AP bypasses the data caches: write back and invalidate
+ * the lines covering the range before it is accessed that way. The L1
+ * maintenance is done by MVA, so the MMU is switched off around it.
+ */
+static int cortex_a_sysap_flush_range(struct target *target,
+	target_addr_t address, uint32_t bytes)
+{
+	int retval;
+
+	cortex_a_prep_memaccess(target, 1);
+	retval = armv7a_cache_flush_phys(target, address, bytes);
+	cortex_a_post_memaccess(target, 1);
+
+	return retval;
+}
+
 static int cortex_a_read_phys_memory(struct target *target,
 	target_addr_t address, uint32_t size,
 	uint32_t count, uint8_t *buffer)
 {
+	struct armv7a_common *armv7a = target_to_armv7a(target);
+	enum arm_memroute_path path;
+	struct duration bench;
 	int retval;
 
 	if (!count || !buffer)
@@ -2499,10 +2579,23 @@ static int cortex_a_read_phys_memory(struct target *target,
 	LOG_DEBUG("Reading memory at real address " TARGET_ADDR_FMT "; size %" PRId32 "; count %" PRId32,
 		address, size, count);
 
-	/* read memory through the CPU */
-	cortex_a_prep_memaccess(target, 1);
-	retval = cortex_a_read_cpu_memory(target, address, size, count, buffer);
-	cortex_a_post_memaccess(target, 1);
+	path = arm_memroute_select(&armv7a->memroute, address, size * count);
+	duration_start(&bench);
+
+	if (path == ARM_MEMROUTE_SYSAP) {
+		/* read memory through the system bus MEM-AP */
+		retval = cortex_a_sysap_flush_range(target, address, size * count);
+		if (retval == ERROR_OK)
+			retval = arm_memroute_read(&armv7a->memroute, address, size, count, buffer);
+	} else {
+		/* read memory through the CPU */
+		cortex_a_prep_memaccess(target, 1);
+		retval = cortex_a_read_cpu_memory(target, address, size, count, buffer);
+		cortex_a_post_memaccess(target, 1);
+	}
+
+	if (retval == ERROR_OK)
+		arm_memroute_account(&armv7a->memroute, path, false, size * count, &bench);
 
 	return retval;
 }
@@ -2527,6 +2620,9 @@ static int cortex_a_write_phys_memory(struct target *target,
 	target_addr_t address, uint32_t size,
 	uint32_t count, const uint8_t *buffer)
 {
+	struct armv7a_common *armv7a = target_to_armv7a(target);
+	enum arm_memroute_path path;
+	struct duration bench;
 	int retval;
 
 	if (!count || !buffer)
@@ -2535,10 +2631,26 @@ static int cortex_a_write_phys_memory(struct target *target,
 	LOG_DEBUG("Writing memory to real address " TARGET_ADDR_FMT "; size %" PRId32 "; count %" PRId32,
 		address, size, count);
 
-	/* write memory through the CPU */
-	cortex_a_prep_memaccess(target, 1);
-	retval = cortex_a_write_cpu_memory(target, address, size, count, buffer);
-	cortex_a_post_memaccess(target, 1);
+	path = arm_memroute_select(&armv7a->memroute, address, size * count);
+	duration_start(&bench);
+
+	if (path == ARM_MEMROUTE_SYSAP) {
+		/* write memory through the system bus MEM-AP, then drop any
+		 * stale instructions fetched from the range */
+		retval = cortex_a_sysap_flush_range(target, address, size * count);
+		if (retval == ERROR_OK)
+			retval = arm_memroute_write(&armv7a->memroute, address, size, count, buffer);
+		if (retval == ERROR_OK && armv7a->armv7a_mmu.armv7a_cache.i_cache_enabled)
+			retval = armv7a_l1_i_cache_inval_all(target);
+	} else {
+		/* write memory through the CPU */
+		cortex_a_prep_memaccess(target, 1);
+		retval = cortex_a_write_cpu_memory(target, address, size, count, buffer);
+		cortex_a_post_memaccess(target, 1);
+	}
+
+	if (retval == ERROR_OK)
+		arm_memroute_account(&armv7a->memroute, path, true, size * count, &bench);
 
 	return retval;
 }
@@ -2863,6 +2975,9 @@ static int cortex_a_init_arch_info(struct target *target,
 
 	armv7a->armv7a_mmu.read_physical_memory = cortex_a_read_phys_memory;
 
+	arm_memroute_init(&armv7a->memroute);
+	armv7a->arm.memroute = &armv7a->memroute;
+
 
 /*	arm7_9->handle_target_request = cortex_a_handle_target_request; */
 
@@ -3095,6 +3210,9 @@ static const struct command_registration cortex_a_exec_command_handlers[] = {
 	{
 		.chain = smp_command_handlers,
 	},
+	{
+		.chain = arm_memroute_command_handlers,
+	},
 
 	COMMAND_REGISTRATION_DONE
 };
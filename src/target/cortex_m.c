@@ -469,9 +469,170 @@ static int cortex_m_examine_exception_reason(struct target *target)
 	return retval;
 }
 
+/* Read the core registers of nums (all of them if nums is NULL) that are
+ * not yet in the cache behind a single DAP run.
+ * Each DCRSR write is followed by a DHCSR read, to check that S_REGRDY was
+ * set before DCRDR is read, and by the DCRDR read. If any transfer was not
+ * ready in time, nothing is stored and the registers are left to the slow
+ * path, which waits for each transfer. */
+static int cortex_m_fast_read_regs(struct target *target, const int *nums,
+		unsigned int num_nums)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct reg_cache *cache = armv7m->arm.core_cache;
+	/* at most 19 core, 1 special, 32 single precision FP and FPSCR reads */
+	uint32_t dcrsr[64], dhcsr[64], values[64];
+	int slot[ARMV7M_LAST_REG];
+	bool wanted[ARMV7M_LAST_REG];
+	int special_slot = -1;
+	unsigned int n = 0;
+	uint32_t dcrdr;
+	int retval;
+
+	assert(cache->num_regs <= ARRAY_SIZE(slot));
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(wanted); i++)
+		wanted[i] = !nums;
+	for (unsigned int i = 0; nums && i < num_nums; i++)
+		wanted[nums[i]] = true;
+
+	for (unsigned int i = 0; i < cache->num_regs; i++) {
+		struct reg *r = &cache->reg_list[i];
+		int num = ((struct arm_reg *)r->arch_info)->num;
+
+		slot[i] = -1;
+		if (r->valid || !wanted[num])
+			continue;
+
+		switch (num) {
+			case ARMV7M_R0 ... ARMV7M_PSP:
+				slot[i] = n;
+				dcrsr[n++] = num;
+				break;
+
+			case ARMV7M_PRIMASK:
+			case ARMV7M_BASEPRI:
+			case ARMV7M_FAULTMASK:
+			case ARMV7M_CONTROL:
+				/* bitfields of one Debug Core register, read it only once */
+				if (special_slot < 0) {
+					special_slot = n;
+					dcrsr[n++] = 20;
+				}
+				slot[i] = special_slot;
+				break;
+
+			case ARMV7M_D0 ... ARMV7M_D15:
+				slot[i] = n;
+				dcrsr[n++] = 0x40 + 2 * (num - ARMV7M_D0);
+				dcrsr[n++] = 0x40 + 2 * (num - ARMV7M_D0) + 1;
+				break;
+
+			case ARMV7M_FPSCR:
+				slot[i] = n;
+				dcrsr[n++] = 0x21;
+				break;
+
+			default:
+				break;
+		}
+		assert(n <= ARRAY_SIZE(dcrsr));
+	}
+
+	if (n == 0)
+		return ERROR_OK;
+
+	/* because the DCB_DCRDR is used for the emulated dcc channel
+	 * we have to save/restore the DCB_DCRDR when used */
+	if (target->dbg_msg_enabled) {
+		retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DCRDR, &dcrdr);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	for (unsigned int k = 0; k < n; k++) {
+		retval = mem_ap_write_u32(armv7m->debug_ap, DCB_DCRSR, dcrsr[k]);
+		if (retval == ERROR_OK)
+			retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DHCSR, &dhcsr[k]);
+		if (retval == ERROR_OK)
+			retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DCRDR, &values[k]);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	retval = dap_run(armv7m->debug_ap->dap);
+
+	if (target->dbg_msg_enabled) {
+		/* restore DCB_DCRDR - this needs to be in a separate
+		 * transaction otherwise the emulated DCC channel breaks */
+		int retval2 = mem_ap_write_atomic_u32(armv7m->debug_ap, DCB_DCRDR, dcrdr);
+		if (retval == ERROR_OK)
+			retval = retval2;
+	}
+
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int k = 0; k < n; k++) {
+		if (!(dhcsr[k] & S_REGRDY)) {
+			LOG_DEBUG("register transfer 0x%" PRIx32 " not ready", dcrsr[k]);
+			return ERROR_TARGET_TIMEOUT;
+		}
+	}
+
+	for (unsigned int i = 0; i < cache->num_regs; i++) {
+		struct reg *r = &cache->reg_list[i];
+		int num = ((struct arm_reg *)r->arch_info)->num;
+		uint32_t value;
+
+		if (slot[i] < 0)
+			continue;
+
+		value = values[slot[i]];
+		switch (num) {
+			case ARMV7M_PRIMASK:
+				value = buf_get_u32((uint8_t *)&value, 0, 1);
+				break;
+			case ARMV7M_BASEPRI:
+				value = buf_get_u32((uint8_t *)&value, 8, 8);
+				break;
+			case ARMV7M_FAULTMASK:
+				value = buf_get_u32((uint8_t *)&value, 16, 1);
+				break;
+			case ARMV7M_CONTROL:
+				value = buf_get_u32((uint8_t *)&value, 24, 2);
+				break;
+			case ARMV7M_D0 ... ARMV7M_D15:
+				buf_set_u32((uint8_t *)r->value + 4, 0, 32, values[slot[i] + 1]);
+				break;
+			default:
+				break;
+		}
+		buf_set_u32(r->value, 0, 32, value);
+		r->valid = true;
+		r->dirty = false;
+	}
+
+	LOG_DEBUG("read %u core registers in one DAP run", n);
+	return ERROR_OK;
+}
+
+static int cortex_m_fast_read_all_regs(struct target *target)
+{
+	return cortex_m_fast_read_regs(target, NULL, 0);
+}
+
+/* The registers read on debug entry: those telling the core mode and those
+ * sent to GDB along with the stop reply. The special registers are fetched
+ * with a single transfer, so they all come along with CONTROL. Everything
+ * else is read when it is first needed. */
+static const int cortex_m_debug_entry_regs[] = {
+	ARMV7M_R13, ARMV7M_PC, ARMV7M_xPSR,
+	ARMV7M_PRIMASK, ARMV7M_BASEPRI, ARMV7M_FAULTMASK, ARMV7M_CONTROL,
+};
+
 static int cortex_m_debug_entry(struct target *target)
 {
-	int i;
 	uint32_t xPSR;
 	int retval;
 	struct cortex_m_common *cortex_m = target_to_cm(target);
@@ -495,13 +656,20 @@ static int cortex_m_debug_entry(struct target *target)
 		return retval;
 
 	/* Examine target state and mode
-	 * First load register accessible through core debug port */
-	int num_regs = arm->core_cache->num_regs;
+	 * Nothing cached from before the halt is still current. Load only the
+	 * registers needed now through the core debug port; the queued path
+	 * gets them at once, anything it left out is read one by one */
+	register_cache_invalidate(arm->core_cache);
+	retval = cortex_m_fast_read_regs(target, cortex_m_debug_entry_regs,
+			ARRAY_SIZE(cortex_m_debug_entry_regs));
+	if (retval != ERROR_OK)
+		LOG_DEBUG("queued register read failed (%d), reading registers one by one", retval);
 
-	for (i = 0; i < num_regs; i++) {
-		r = &armv7m->arm.core_cache->reg_list[i];
+	for (unsigned int i = 0; i < ARRAY_SIZE(cortex_m_debug_entry_regs); i++) {
+		int num = cortex_m_debug_entry_regs[i];
+		r = &arm->core_cache->reg_list[num];
 		if (!r->valid)
-			arm->read_core_reg(target, r, i, ARM_MODE_ANY);
+			arm->read_core_reg(target, r, num, ARM_MODE_ANY);
 	}
 
 	r = arm->cpsr;
@@ -1809,6 +1977,32 @@ void cortex_m_deinit_target(struct target *target)
 	free(cortex_m);
 }
 
+/* Read PC samples from DWT_PCSR; it reads as zero when not implemented */
+static int cortex_m_sample_pc(struct target *target, uint32_t *samples,
+			      uint32_t max_num_samples, uint32_t *num_samples)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	int retval;
+
+	*num_samples = 0;
+
+	if (armv7m->debug_ap) {
+		retval = mem_ap_read_buf_noincr(armv7m->debug_ap, (void *)samples,
+				4, max_num_samples, DWT_PCSR);
+	} else {
+		max_num_samples = 1;
+		retval = target_read_u32(target, DWT_PCSR, &samples[0]);
+	}
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (samples[0] == 0)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	*num_samples = max_num_samples;
+	return ERROR_OK;
+}
+
 int cortex_m_profiling(struct target *target, uint32_t *samples,
 			      uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
 {
@@ -2388,6 +2582,7 @@ static int cortex_m_init_arch_info(struct target *target,
 
 	armv7m->load_core_reg_u32 = cortex_m_load_core_reg_u32;
 	armv7m->store_core_reg_u32 = cortex_m_store_core_reg_u32;
+	armv7m->load_core_regs = cortex_m_fast_read_all_regs;
 
 	target_register_timer_callback(cortex_m_handle_target_request, 1,
 		TARGET_TIMER_TYPE_PERIODIC, target);
@@ -2686,4 +2881,5 @@ struct target_type cortexm_target = {
 	.deinit_target = cortex_m_deinit_target,
 
 	.profiling = cortex_m_profiling,
+	.sample_pc = cortex_m_sample_pc,
 };
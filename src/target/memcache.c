@@ -0,0 +1,515 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/**
+ * @file
+ * Halt-scoped memory read cache.
+ *
+ * While a target is halted its memory only changes when OpenOCD writes to
+ * it, so repeated small reads (GDB unwinding the stack, printing locals)
+ * can be answered from a host side copy. Memory is fetched in lines of a
+ * configurable size, optionally with read-ahead, and only inside regions
+ * the user declared cacheable, so peripheral space is never cached.
+ *
+ * The cache is dropped whenever any target resumes, steps, halts or is
+ * reset, and whenever any target memory is written.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include "memcache.h"
+#include "target.h"
+#include "target_type.h"
+
+#define MEMCACHE_NUM_LINES			64
+#define MEMCACHE_DEFAULT_LINE_SIZE	64
+#define MEMCACHE_MAX_LINE_SIZE		1024
+#define MEMCACHE_DEFAULT_READAHEAD	1
+
+struct memcache_region {
+	target_addr_t address;
+	uint32_t size;
+	struct memcache_region *next;
+};
+
+struct memcache_line {
+	bool valid;
+	target_addr_t address;
+	uint64_t last_use;
+	uint8_t *data;
+};
+
+struct target_memcache {
+	struct memcache_region *regions;
+	uint32_t line_size;
+	unsigned int readahead;
+	uint64_t tick;
+	uint8_t *data;
+	struct memcache_line lines[MEMCACHE_NUM_LINES];
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t fetches;
+	uint64_t bytes_fetched;
+	uint64_t invalidations;
+};
+
+static struct target_memcache *memcache_get(struct target *target)
+{
+	if (target->memcache)
+		return target->memcache;
+
+	struct target_memcache *cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		LOG_ERROR("Out of memory");
+		return NULL;
+	}
+	cache->line_size = MEMCACHE_DEFAULT_LINE_SIZE;
+	cache->readahead = MEMCACHE_DEFAULT_READAHEAD;
+
+	target->memcache = cache;
+	return cache;
+}
+
+static int memcache_alloc_lines(struct target_memcache *cache)
+{
+	if (cache->data)
+		return ERROR_OK;
+
+	cache->data = malloc(MEMCACHE_NUM_LINES * cache->line_size);
+	if (!cache->data) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	for (unsigned int i = 0; i < MEMCACHE_NUM_LINES; i++) {
+		cache->lines[i].valid = false;
+		cache->lines[i].data = cache->data + i * cache->line_size;
+	}
+
+	return ERROR_OK;
+}
+
+static void memcache_invalidate(struct target_memcache *cache)
+{
+	bool any = false;
+
+	for (unsigned int i = 0; i < MEMCACHE_NUM_LINES; i++) {
+		if (cache->lines[i].valid) {
+			cache->lines[i].valid = false;
+			any = true;
+		}
+	}
+
+	if (any)
+		cache->invalidations++;
+}
+
+void target_memcache_invalidate_all(void)
+{
+	for (struct target *target = all_targets; target; target = target->next) {
+		if (target->memcache)
+			memcache_invalidate(target->memcache);
+	}
+}
+
+void target_memcache_free(struct target *target)
+{
+	struct target_memcache *cache = target->memcache;
+	if (!cache)
+		return;
+
+	struct memcache_region *region = cache->regions;
+	while (region) {
+		struct memcache_region *next = region->next;
+		free(region);
+		region = next;
+	}
+
+	free(cache->data);
+	free(cache);
+	target->memcache = NULL;
+}
+
+static struct memcache_region *memcache_find_region(struct target_memcache *cache,
+		target_addr_t address, uint32_t size)
+{
+	for (struct memcache_region *region = cache->regions; region; region = region->next) {
+		if (address >= region->address &&
+				address - region->address + size <= region->size)
+			return region;
+	}
+	return NULL;
+}
+
+bool target_memcache_covers(struct target *target, target_addr_t address, uint32_t size)
+{
+	struct target_memcache *cache = target->memcache;
+
+	if (!cache || !cache->regions || target->state != TARGET_HALTED)
+		return false;
+
+	return memcache_find_region(cache, address, size) != NULL;
+}
+
+static struct memcache_line *memcache_lookup(struct target_memcache *cache, target_addr_t address)
+{
+	for (unsigned int i = 0; i < MEMCACHE_NUM_LINES; i++) {
+		struct memcache_line *line = &cache->lines[i];
+		if (line->valid && line->address == address)
+			return line;
+	}
+	return NULL;
+}
+
+static struct memcache_line *memcache_victim(struct target_memcache *cache)
+{
+	struct memcache_line *victim = &cache->lines[0];
+
+	for (unsigned int i = 0; i < MEMCACHE_NUM_LINES; i++) {
+		struct memcache_line *line = &cache->lines[i];
+		if (!line->valid)
+			return line;
+		if (line->last_use < victim->last_use)
+			victim = line;
+	}
+	return victim;
+}
+
+/* Fetch the run of uncached lines starting at @a address with a single
+ * target access, extended by the read-ahead lines that still fit into the
+ * region and the cache. */
+static int memcache_fill(struct target *target, struct target_memcache *cache,
+		struct memcache_region *region, target_addr_t address, target_addr_t end)
+{
+	target_addr_t region_end = region->address + region->size;
+	unsigned int max_lines = MEMCACHE_NUM_LINES / 2;
+	unsigned int n = 0;
+
+	target_addr_t fetch_end = address;
+	while (n < max_lines && fetch_end < region_end &&
+			(fetch_end < end || n == 0) && !memcache_lookup(cache, fetch_end)) {
+		fetch_end += cache->line_size;
+		n++;
+	}
+	for (unsigned int i = 0; i < cache->readahead && n < max_lines &&
+			fetch_end < region_end && !memcache_lookup(cache, fetch_end); i++) {
+		fetch_end += cache->line_size;
+		n++;
+	}
+
+	uint32_t length = n * cache->line_size;
+	uint8_t *buffer = malloc(length);
+	if (!buffer) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	int retval = target->type->read_buffer(target, address, length, buffer);
+	if (retval != ERROR_OK) {
+		free(buffer);
+		return retval;
+	}
+
+	cache->fetches++;
+	cache->bytes_fetched += length;
+
+	for (unsigned int i = 0; i < n; i++) {
+		struct memcache_line *line = memcache_victim(cache);
+		line->valid = true;
+		line->address = address + i * cache->line_size;
+		line->last_use = ++cache->tick;
+		memcpy(line->data, buffer + i * cache->line_size, cache->line_size);
+	}
+
+	free(buffer);
+	return ERROR_OK;
+}
+
+int target_memcache_read(struct target *target, target_addr_t address, uint32_t size, uint8_t *buffer)
+{
+	struct target_memcache *cache = target->memcache;
+	struct memcache_region *region = memcache_find_region(cache, address, size);
+	assert(region);
+
+	int retval = memcache_alloc_lines(cache);
+	if (retval != ERROR_OK)
+		return retval;
+
+	target_addr_t end = address + size;
+	target_addr_t line_addr = address & ~(target_addr_t)(cache->line_size - 1);
+	bool missed = false;
+
+	while (line_addr < end) {
+		struct memcache_line *line = memcache_lookup(cache, line_addr);
+		if (!line) {
+			missed = true;
+			retval = memcache_fill(target, cache, region, line_addr, end);
+			if (retval != ERROR_OK) {
+				/* The read-ahead may have touched memory that is not
+				 * readable; let the caller see the result of the plain
+				 * request instead. */
+				LOG_DEBUG("memory cache fill at " TARGET_ADDR_FMT " failed, reading uncached",
+						line_addr);
+				cache->misses++;
+				return target->type->read_buffer(target, address, size, buffer);
+			}
+			line = memcache_lookup(cache, line_addr);
+			assert(line);
+		}
+
+		line->last_use = ++cache->tick;
+
+		target_addr_t from = MAX(address, line_addr);
+		target_addr_t to = MIN(end, line_addr + cache->line_size);
+		memcpy(buffer + (from - address), line->data + (from - line_addr), to - from);
+
+		line_addr += cache->line_size;
+	}
+
+	if (missed)
+		cache->misses++;
+	else
+		cache->hits++;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memcache_region_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC != 0 && CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target_memcache *cache = memcache_get(target);
+	if (!cache)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC == 2) {
+		target_addr_t address;
+		uint32_t size;
+		COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], size);
+
+		if (size == 0 || (address | size) & (cache->line_size - 1)) {
+			command_print(CMD, "region must be a non-empty multiple of the line size (%" PRIu32 ")",
+					cache->line_size);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		if (address + size - 1 < address) {
+			command_print(CMD, "region wraps around the address space");
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+
+		struct memcache_region *region = malloc(sizeof(*region));
+		if (!region) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		region->address = address;
+		region->size = size;
+		region->next = cache->regions;
+		cache->regions = region;
+		return ERROR_OK;
+	}
+
+	for (struct memcache_region *region = cache->regions; region; region = region->next)
+		command_print(CMD, TARGET_ADDR_FMT " 0x%8.8" PRIx32, region->address, region->size);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memcache_clear_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target_memcache *cache = target->memcache;
+	if (!cache)
+		return ERROR_OK;
+
+	memcache_invalidate(cache);
+
+	struct memcache_region *region = cache->regions;
+	while (region) {
+		struct memcache_region *next = region->next;
+		free(region);
+		region = next;
+	}
+	cache->regions = NULL;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memcache_line_size_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target_memcache *cache = memcache_get(target);
+	if (!cache)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC == 1) {
+		uint32_t line_size;
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], line_size);
+
+		if (line_size < 4 || line_size > MEMCACHE_MAX_LINE_SIZE || (line_size & (line_size - 1))) {
+			command_print(CMD, "line size must be a power of two between 4 and %d",
+					MEMCACHE_MAX_LINE_SIZE);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		if (cache->regions) {
+			command_print(CMD, "clear the cacheable regions before changing the line size");
+			return ERROR_FAIL;
+		}
+
+		free(cache->data);
+		cache->data = NULL;
+		cache->line_size = line_size;
+	}
+
+	command_print(CMD, "%" PRIu32, cache->line_size);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memcache_readahead_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target_memcache *cache = memcache_get(target);
+	if (!cache)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], cache->readahead);
+
+	command_print(CMD, "%u", cache->readahead);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memcache_stats_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target_memcache *cache = target->memcache;
+	if (!cache)
+		return ERROR_OK;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "reset") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		cache->hits = 0;
+		cache->misses = 0;
+		cache->fetches = 0;
+		cache->bytes_fetched = 0;
+		cache->invalidations = 0;
+		return ERROR_OK;
+	}
+
+	command_print(CMD, "hits %" PRIu64 " misses %" PRIu64 " fetches %" PRIu64
+			" bytes_fetched %" PRIu64 " invalidations %" PRIu64,
+			cache->hits, cache->misses, cache->fetches,
+			cache->bytes_fetched, cache->invalidations);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memcache_invalidate_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (target->memcache)
+		memcache_invalidate(target->memcache);
+
+	return ERROR_OK;
+}
+
+static const struct command_registration memcache_subcommand_handlers[] = {
+	{
+		.name = "region",
+		.handler = handle_memcache_region_command,
+		.mode = COMMAND_ANY,
+		.help = "list the cacheable regions or add one; the cache is "
+			"only active while at least one region is defined",
+		.usage = "[address size]",
+	},
+	{
+		.name = "clear",
+		.handler = handle_memcache_clear_command,
+		.mode = COMMAND_ANY,
+		.help = "remove all cacheable regions, disabling the cache",
+		.usage = "",
+	},
+	{
+		.name = "line_size",
+		.handler = handle_memcache_line_size_command,
+		.mode = COMMAND_ANY,
+		.help = "display or set the cache line size in bytes",
+		.usage = "[bytes]",
+	},
+	{
+		.name = "readahead",
+		.handler = handle_memcache_readahead_command,
+		.mode = COMMAND_ANY,
+		.help = "display or set the number of lines fetched beyond a miss",
+		.usage = "[lines]",
+	},
+	{
+		.name = "stats",
+		.handler = handle_memcache_stats_command,
+		.mode = COMMAND_EXEC,
+		.help = "display or reset the cache statistics",
+		.usage = "['reset']",
+	},
+	{
+		.name = "invalidate",
+		.handler = handle_memcache_invalidate_command,
+		.mode = COMMAND_EXEC,
+		.help = "drop all cached memory contents",
+		.usage = "",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+const struct command_registration memcache_command_handlers[] = {
+	{
+		.name = "memcache",
+		.mode = COMMAND_ANY,
+		.help = "halt-scoped memory read cache",
+		.usage = "",
+		.chain = memcache_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
@@ -0,0 +1,31 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_MEMCACHE_H
+#define OPENOCD_TARGET_MEMCACHE_H
+
+#include <helper/command.h>
+
+struct target;
+struct target_memcache;
+
+extern const struct command_registration memcache_command_handlers[];
+
+bool target_memcache_covers(struct target *target, target_addr_t address, uint32_t size);
+int target_memcache_read(struct target *target, target_addr_t address, uint32_t size, uint8_t *buffer);
+void target_memcache_invalidate_all(void);
+void target_memcache_free(struct target *target);
+
+#endif /* OPENOCD_TARGET_MEMCACHE_H */
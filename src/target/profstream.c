@@ -0,0 +1,736 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/**
+ * @file
+ * Continuous PC sampling profiler.
+ *
+ * Unlike the "profile" command, which samples for a fixed time and then
+ * writes gmon.out, "profstream" samples in the background from a timer
+ * callback for as long as it is running. Samples are accumulated into a
+ * histogram of fixed size buckets that can be read or cleared at any time,
+ * and snapshots of the histogram can be sent periodically to TCP clients or
+ * rewritten into a file.
+ *
+ * Targets that can read the PC without stopping the core (the DWT PCSR on
+ * Cortex-M) are sampled in bursts through their sample_pc() method. Other
+ * targets are halted and resumed for every sample. The time spent sampling
+ * is held below a configurable share of the wall clock time, which leaves
+ * the rest of the adapter bandwidth to the debug session.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/binarybuffer.h>
+#include <helper/log.h>
+#include <helper/time_support.h>
+#include <server/server.h>
+#include "profstream.h"
+#include "target.h"
+#include "target_type.h"
+#include "register.h"
+
+#define PROFSTREAM_DEFAULT_INTERVAL		10
+#define PROFSTREAM_DEFAULT_MAX_BUCKETS	4096
+#define PROFSTREAM_MAX_BUCKETS			(1024 * 1024)
+#define PROFSTREAM_DEFAULT_SHARE		25
+#define PROFSTREAM_DEFAULT_SNAPSHOT		1000
+#define PROFSTREAM_BURST				256
+
+/* PCSR reads as all ones while the core is halted or sleeping */
+#define PROFSTREAM_PC_IDLE				0xffffffff
+
+struct profstream_bucket {
+	uint32_t index;
+	uint64_t count;
+};
+
+struct profstream_client {
+	struct connection *connection;
+	struct profstream_client *next;
+};
+
+struct profstream {
+	struct target *target;
+	bool running;
+	bool use_sample_pc;
+	unsigned int interval;
+
+	/* histogram, an open addressing hash table keyed by bucket index */
+	unsigned int bucket_shift;
+	unsigned int max_buckets;
+	unsigned int num_buckets;
+	unsigned int table_size;
+	struct profstream_bucket *table;
+
+	uint64_t samples;
+	uint64_t idle;
+	uint64_t dropped;
+
+	/* bandwidth limit */
+	unsigned int share;
+	int64_t next_sample;
+	double busy;
+
+	/* snapshot export */
+	unsigned int snapshot_interval;
+	int64_t next_snapshot;
+	uint64_t snapshot_seq;
+	char *port;
+	char *file;
+	struct profstream_client *clients;
+};
+
+static struct profstream profstream = {
+	.interval = PROFSTREAM_DEFAULT_INTERVAL,
+	.bucket_shift = 2,
+	.max_buckets = PROFSTREAM_DEFAULT_MAX_BUCKETS,
+	.share = PROFSTREAM_DEFAULT_SHARE,
+	.snapshot_interval = PROFSTREAM_DEFAULT_SNAPSHOT,
+};
+
+static int profstream_alloc_table(struct profstream *ps)
+{
+	unsigned int size = 1;
+
+	/* keep the table at most half full */
+	while (size < 2 * ps->max_buckets)
+		size <<= 1;
+
+	struct profstream_bucket *table = calloc(size, sizeof(*table));
+	if (!table) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	free(ps->table);
+	ps->table = table;
+	ps->table_size = size;
+	ps->num_buckets = 0;
+	return ERROR_OK;
+}
+
+static void profstream_reset(struct profstream *ps)
+{
+	if (ps->table)
+		memset(ps->table, 0, ps->table_size * sizeof(*ps->table));
+	ps->num_buckets = 0;
+	ps->samples = 0;
+	ps->idle = 0;
+	ps->dropped = 0;
+}
+
+static void profstream_add_sample(struct profstream *ps, uint32_t pc)
+{
+	if (pc == PROFSTREAM_PC_IDLE) {
+		ps->idle++;
+		return;
+	}
+
+	uint32_t index = pc >> ps->bucket_shift;
+	unsigned int mask = ps->table_size - 1;
+	unsigned int slot = (index * 2654435761u) & mask;
+
+	/* count 0 marks a free slot */
+	while (ps->table[slot].count) {
+		if (ps->table[slot].index == index) {
+			ps->table[slot].count++;
+			ps->samples++;
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	if (ps->num_buckets == ps->max_buckets) {
+		ps->dropped++;
+		return;
+	}
+
+	ps->table[slot].index = index;
+	ps->table[slot].count = 1;
+	ps->num_buckets++;
+	ps->samples++;
+}
+
+static int profstream_bucket_compare(const void *a, const void *b)
+{
+	const struct profstream_bucket *x = a, *y = b;
+
+	if (x->index < y->index)
+		return -1;
+	return x->index > y->index;
+}
+
+/* Returns the used buckets sorted by address; the caller frees them */
+static struct profstream_bucket *profstream_sorted(struct profstream *ps)
+{
+	struct profstream_bucket *sorted = malloc((ps->num_buckets + 1) * sizeof(*sorted));
+	unsigned int n = 0;
+
+	if (!sorted) {
+		LOG_ERROR("Out of memory");
+		return NULL;
+	}
+
+	for (unsigned int i = 0; ps->table && i < ps->table_size; i++) {
+		if (ps->table[i].count)
+			sorted[n++] = ps->table[i];
+	}
+	qsort(sorted, n, sizeof(*sorted), profstream_bucket_compare);
+
+	return sorted;
+}
+
+/* Takes one burst of samples. Returns ERROR_OK without sampling while the
+ * target is halted by someone else. */
+static int profstream_sample(struct profstream *ps)
+{
+	struct target *target = ps->target;
+	uint32_t samples[PROFSTREAM_BURST];
+	uint32_t num_samples = 0;
+	int retval;
+
+	if (target->state != TARGET_RUNNING)
+		return ERROR_OK;
+
+	if (ps->use_sample_pc) {
+		retval = target->type->sample_pc(target, samples, PROFSTREAM_BURST, &num_samples);
+		if (retval != ERROR_OK)
+			return retval;
+	} else {
+		struct reg *reg = register_get_by_name(target->reg_cache, "pc", 1);
+		if (!reg) {
+			LOG_ERROR("%s: no pc register", target_name(target));
+			return ERROR_FAIL;
+		}
+
+		retval = target_halt(target);
+		if (retval == ERROR_OK)
+			retval = target_wait_state(target, TARGET_HALTED, 100);
+		if (retval != ERROR_OK)
+			return retval;
+
+		samples[num_samples++] = buf_get_u32(reg->value, 0, 32);
+
+		/* current pc, addr = 0, do not handle breakpoints, not debugging */
+		retval = target_resume(target, 1, 0, 0, 0);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	for (uint32_t i = 0; i < num_samples; i++)
+		profstream_add_sample(ps, samples[i]);
+
+	return ERROR_OK;
+}
+
+static void profstream_write_snapshot(struct profstream *ps)
+{
+	struct profstream_bucket *sorted = profstream_sorted(ps);
+	if (!sorted)
+		return;
+
+	char *snapshot = alloc_printf("profstream %" PRIu64 " target %s bucket_size %u"
+			" samples %" PRIu64 " idle %" PRIu64 " dropped %" PRIu64 "\n",
+			ps->snapshot_seq++, target_name(ps->target), 1u << ps->bucket_shift,
+			ps->samples, ps->idle, ps->dropped);
+	size_t length = snapshot ? strlen(snapshot) : 0;
+	size_t alloc = length + (ps->num_buckets + 1) * 32;
+	char *text = snapshot ? realloc(snapshot, alloc) : NULL;
+	if (!text) {
+		LOG_ERROR("Out of memory");
+		free(snapshot);
+		free(sorted);
+		return;
+	}
+
+	for (unsigned int i = 0; i < ps->num_buckets; i++)
+		length += snprintf(text + length, alloc - length, "0x%08" PRIx32 " %" PRIu64 "\n",
+				sorted[i].index << ps->bucket_shift, sorted[i].count);
+	length += snprintf(text + length, alloc - length, "end\n");
+	free(sorted);
+
+	for (struct profstream_client *c = ps->clients; c; c = c->next)
+		connection_write(c->connection, text, length);
+
+	if (ps->file) {
+		/* replace the file atomically, so readers never see half a snapshot */
+		char *tmp = alloc_printf("%s.tmp", ps->file);
+		FILE *f = tmp ? fopen(tmp, "w") : NULL;
+		if (f) {
+			bool ok = fwrite(text, 1, length, f) == length;
+			if (fclose(f) == 0 && ok)
+				rename(tmp, ps->file);
+		} else {
+			LOG_WARNING("profstream: cannot write %s", ps->file);
+		}
+		free(tmp);
+	}
+
+	free(text);
+}
+
+static int profstream_timer_callback(void *priv);
+
+static int profstream_stop(struct profstream *ps)
+{
+	ps->running = false;
+
+	/* a registration can outlive a stop until the timer loop frees it, so
+	 * make sure none of them is left live */
+	while (target_unregister_timer_callback(profstream_timer_callback, ps) == ERROR_OK)
+		;
+
+	return ERROR_OK;
+}
+
+static int profstream_timer_callback(void *priv)
+{
+	struct profstream *ps = priv;
+	int64_t now = timeval_ms();
+
+	if (!ps->running)
+		return ERROR_OK;
+
+	if (now >= ps->next_sample) {
+		struct duration burst;
+
+		duration_start(&burst);
+		int retval = profstream_sample(ps);
+		duration_measure(&burst);
+
+		if (retval != ERROR_OK) {
+			LOG_ERROR("profstream: sampling %s failed, stopping", target_name(ps->target));
+			profstream_stop(ps);
+			return retval;
+		}
+
+		/* idle long enough that sampling takes at most 'share' percent
+		 * of the time */
+		double busy_ms = duration_elapsed(&burst) * 1000;
+		ps->busy += busy_ms;
+		now = timeval_ms();
+		ps->next_sample = now + (int64_t)(busy_ms * (100 - ps->share) / ps->share);
+	}
+
+	if ((ps->clients || ps->file) && now >= ps->next_snapshot) {
+		profstream_write_snapshot(ps);
+		ps->next_snapshot = now + ps->snapshot_interval;
+	}
+
+	return ERROR_OK;
+}
+
+static int profstream_new_connection(struct connection *connection)
+{
+	struct profstream_client *client = malloc(sizeof(*client));
+	if (!client) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	client->connection = connection;
+	client->next = profstream.clients;
+	profstream.clients = client;
+	return ERROR_OK;
+}
+
+static int profstream_input(struct connection *connection)
+{
+	char buffer[64];
+
+	/* clients only listen; drain and ignore what they send */
+	int bytes_read = connection_read(connection, buffer, sizeof(buffer));
+	if (bytes_read <= 0)
+		return ERROR_SERVER_REMOTE_CLOSED;
+
+	return ERROR_OK;
+}
+
+static int profstream_connection_closed(struct connection *connection)
+{
+	for (struct profstream_client **c = &profstream.clients; *c; c = &(*c)->next) {
+		if ((*c)->connection == connection) {
+			struct profstream_client *client = *c;
+			*c = client->next;
+			free(client);
+			break;
+		}
+	}
+	return ERROR_OK;
+}
+
+static void profstream_close_port(struct profstream *ps)
+{
+	if (!ps->port)
+		return;
+
+	remove_service("profstream", ps->port);
+	free(ps->port);
+	ps->port = NULL;
+}
+
+COMMAND_HANDLER(handle_profstream_start_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct profstream *ps = &profstream;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], ps->interval);
+		if (ps->interval == 0)
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	profstream_stop(ps);
+
+	if (ps->target != target || !ps->table) {
+		int retval = profstream_alloc_table(ps);
+		if (retval != ERROR_OK)
+			return retval;
+		profstream_reset(ps);
+		ps->target = target;
+	}
+
+	ps->use_sample_pc = false;
+	if (target->type->sample_pc) {
+		uint32_t pc, num_samples;
+		ps->use_sample_pc = target->type->sample_pc(target, &pc, 1, &num_samples) == ERROR_OK;
+	}
+	if (!ps->use_sample_pc)
+		LOG_WARNING("%s cannot be sampled while running, halting it for every "
+				"sample; do not use a debugger on it while profiling",
+				target_name(target));
+
+	ps->next_sample = 0;
+	ps->next_snapshot = timeval_ms() + ps->snapshot_interval;
+	ps->busy = 0;
+
+	int retval = target_register_timer_callback(profstream_timer_callback, ps->interval,
+			TARGET_TIMER_TYPE_PERIODIC, ps);
+	if (retval != ERROR_OK)
+		return retval;
+	ps->running = true;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_profstream_stop_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	return profstream_stop(&profstream);
+}
+
+COMMAND_HANDLER(handle_profstream_reset_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	profstream_reset(&profstream);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_profstream_status_command)
+{
+	struct profstream *ps = &profstream;
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	command_print(CMD, "%s target %s method %s samples %" PRIu64 " idle %" PRIu64
+			" dropped %" PRIu64 " buckets %u busy_ms %.0f",
+			ps->running ? "running" : "stopped",
+			ps->target ? target_name(ps->target) : "none",
+			ps->use_sample_pc ? "sample" : "halt",
+			ps->samples, ps->idle, ps->dropped, ps->num_buckets, ps->busy);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_profstream_histogram_command)
+{
+	struct profstream *ps = &profstream;
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct profstream_bucket *sorted = profstream_sorted(ps);
+	if (!sorted)
+		return ERROR_FAIL;
+
+	for (unsigned int i = 0; i < ps->num_buckets; i++)
+		command_print(CMD, "0x%08" PRIx32 " %" PRIu64,
+				sorted[i].index << ps->bucket_shift, sorted[i].count);
+
+	free(sorted);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_profstream_bucket_size_command)
+{
+	struct profstream *ps = &profstream;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		uint32_t size;
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], size);
+		if (size < 2 || (size & (size - 1))) {
+			command_print(CMD, "bucket size must be a power of two of at least 2");
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+
+		unsigned int shift = 0;
+		while ((1u << shift) < size)
+			shift++;
+		if (shift != ps->bucket_shift) {
+			ps->bucket_shift = shift;
+			profstream_reset(ps);
+		}
+	}
+
+	command_print(CMD, "%u", 1u << ps->bucket_shift);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_profstream_max_buckets_command)
+{
+	struct profstream *ps = &profstream;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned int max_buckets;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], max_buckets);
+		if (max_buckets == 0 || max_buckets > PROFSTREAM_MAX_BUCKETS) {
+			command_print(CMD, "number of buckets must be between 1 and %d",
+					PROFSTREAM_MAX_BUCKETS);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		if (max_buckets != ps->max_buckets) {
+			ps->max_buckets = max_buckets;
+			if (ps->table) {
+				int retval = profstream_alloc_table(ps);
+				if (retval != ERROR_OK)
+					return retval;
+			}
+			profstream_reset(ps);
+		}
+	}
+
+	command_print(CMD, "%u", ps->max_buckets);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_profstream_bandwidth_command)
+{
+	struct profstream *ps = &profstream;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned int share;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], share);
+		if (share == 0 || share > 100) {
+			command_print(CMD, "share must be between 1 and 100 percent");
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		ps->share = share;
+	}
+
+	command_print(CMD, "%u%%", ps->share);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_profstream_snapshot_interval_command)
+{
+	struct profstream *ps = &profstream;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], ps->snapshot_interval);
+		if (ps->snapshot_interval == 0)
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	command_print(CMD, "%u", ps->snapshot_interval);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_profstream_port_command)
+{
+	struct profstream *ps = &profstream;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		profstream_close_port(ps);
+		if (strcmp(CMD_ARGV[0], "disabled") != 0) {
+			ps->port = strdup(CMD_ARGV[0]);
+			if (!ps->port) {
+				LOG_ERROR("Out of memory");
+				return ERROR_FAIL;
+			}
+			int retval = add_service("profstream", ps->port, CONNECTION_LIMIT_UNLIMITED,
+					profstream_new_connection, profstream_input,
+					profstream_connection_closed, NULL);
+			if (retval != ERROR_OK) {
+				free(ps->port);
+				ps->port = NULL;
+				return retval;
+			}
+		}
+	}
+
+	command_print(CMD, "%s", ps->port ? ps->port : "disabled");
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_profstream_file_command)
+{
+	struct profstream *ps = &profstream;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		free(ps->file);
+		ps->file = NULL;
+		if (strcmp(CMD_ARGV[0], "disabled") != 0) {
+			ps->file = strdup(CMD_ARGV[0]);
+			if (!ps->file) {
+				LOG_ERROR("Out of memory");
+				return ERROR_FAIL;
+			}
+		}
+	}
+
+	command_print(CMD, "%s", ps->file ? ps->file : "disabled");
+	return ERROR_OK;
+}
+
+static const struct command_registration profstream_subcommand_handlers[] = {
+	{
+		.name = "start",
+		.handler = handle_profstream_start_command,
+		.mode = COMMAND_EXEC,
+		.help = "start sampling the PC of the current target in the "
+			"background, every interval_ms at most",
+		.usage = "[interval_ms]",
+	},
+	{
+		.name = "stop",
+		.handler = handle_profstream_stop_command,
+		.mode = COMMAND_EXEC,
+		.help = "stop sampling, keeping the histogram",
+		.usage = "",
+	},
+	{
+		.name = "reset",
+		.handler = handle_profstream_reset_command,
+		.mode = COMMAND_EXEC,
+		.help = "clear the histogram and the counters",
+		.usage = "",
+	},
+	{
+		.name = "status",
+		.handler = handle_profstream_status_command,
+		.mode = COMMAND_EXEC,
+		.help = "display the profiler state and counters",
+		.usage = "",
+	},
+	{
+		.name = "histogram",
+		.handler = handle_profstream_histogram_command,
+		.mode = COMMAND_EXEC,
+		.help = "list the start address and sample count of every "
+			"non-empty bucket",
+		.usage = "",
+	},
+	{
+		.name = "bucket_size",
+		.handler = handle_profstream_bucket_size_command,
+		.mode = COMMAND_ANY,
+		.help = "display or set the bucket size in bytes; changing it "
+			"clears the histogram",
+		.usage = "[bytes]",
+	},
+	{
+		.name = "max_buckets",
+		.handler = handle_profstream_max_buckets_command,
+		.mode = COMMAND_ANY,
+		.help = "display or set the number of buckets; changing it "
+			"clears the histogram",
+		.usage = "[count]",
+	},
+	{
+		.name = "bandwidth",
+		.handler = handle_profstream_bandwidth_command,
+		.mode = COMMAND_ANY,
+		.help = "display or set the largest share of time spent sampling",
+		.usage = "[percent]",
+	},
+	{
+		.name = "snapshot_interval",
+		.handler = handle_profstream_snapshot_interval_command,
+		.mode = COMMAND_ANY,
+		.help = "display or set the time between histogram snapshots",
+		.usage = "[ms]",
+	},
+	{
+		.name = "port",
+		.handler = handle_profstream_port_command,
+		.mode = COMMAND_EXEC,
+		.help = "display or set the port on which snapshots are sent "
+			"to every connected client",
+		.usage = "[port_num|'disabled']",
+	},
+	{
+		.name = "file",
+		.handler = handle_profstream_file_command,
+		.mode = COMMAND_ANY,
+		.help = "display or set the file rewritten with each snapshot",
+		.usage = "[filename|'disabled']",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const struct command_registration profstream_command_handlers[] = {
+	{
+		.name = "profstream",
+		.mode = COMMAND_ANY,
+		.help = "continuous PC sampling profiler",
+		.usage = "",
+		.chain = profstream_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+int profstream_register_commands(struct command_context *cmd_ctx)
+{
+	return register_commands(cmd_ctx, NULL, profstream_command_handlers);
+}
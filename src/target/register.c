@@ -116,6 +116,67 @@ void register_cache_invalidate(struct reg_cache *cache)
 	}
 }
 
+/**
+ * Reads the registers of @a reg_list that have no valid value. Registers
+ * of a type providing get_many() are read together, with one call per
+ * type; the others, and those get_many() left invalid, are read one by
+ * one. NULL entries and registers that do not exist are skipped.
+ *
+ * @returns ERROR_OK, or the first error encountered.
+ */
+int register_list_fetch(struct reg **reg_list, unsigned num_regs)
+{
+	struct reg **batch = malloc(num_regs * sizeof(*batch));
+	const struct reg_arch_type *batched[16];
+	unsigned num_batched = 0;
+	int retval = ERROR_OK;
+
+	if (!batch) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	for (unsigned i = 0; i < num_regs; i++) {
+		struct reg *reg = reg_list[i];
+
+		if (!reg || !reg->exist || reg->valid || !reg->type->get_many)
+			continue;
+
+		/* each type gets one try, what it left out is read below */
+		bool tried = false;
+		for (unsigned k = 0; k < num_batched; k++)
+			tried |= batched[k] == reg->type;
+		if (tried || num_batched == ARRAY_SIZE(batched))
+			continue;
+		batched[num_batched++] = reg->type;
+
+		/* collect the other invalid registers of the same type */
+		unsigned n = 0;
+		for (unsigned j = i; j < num_regs; j++) {
+			struct reg *r = reg_list[j];
+			if (r && r->exist && !r->valid && r->type == reg->type)
+				batch[n++] = r;
+		}
+
+		if (reg->type->get_many(batch, n) != ERROR_OK)
+			LOG_DEBUG("batched read of %u registers failed", n);
+	}
+	free(batch);
+
+	for (unsigned i = 0; i < num_regs; i++) {
+		struct reg *reg = reg_list[i];
+
+		if (!reg || !reg->exist || reg->valid)
+			continue;
+
+		int reg_retval = reg->type->get(reg);
+		if (retval == ERROR_OK)
+			retval = reg_retval;
+	}
+
+	return retval;
+}
+
 static int register_get_dummy_core_reg(struct reg *reg)
 {
 	return ERROR_OK;
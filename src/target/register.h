@@ -157,6 +157,9 @@ struct reg_cache {
 struct reg_arch_type {
 	int (*get)(struct reg *reg);
 	int (*set)(struct reg *reg, uint8_t *buf);
+	/* Optional: read several registers of this type at once. Registers that
+	 * could not be read are left invalid. */
+	int (*get_many)(struct reg **reg_list, unsigned num_regs);
 };
 
 struct reg *register_get_by_number(struct reg_cache *first,
@@ -166,6 +169,7 @@ struct reg *register_get_by_name(struct reg_cache *first,
 struct reg_cache **register_get_last_cache_p(struct reg_cache **first);
 void register_unlink_cache(struct reg_cache **cache_p, const struct reg_cache *cache);
 void register_cache_invalidate(struct reg_cache *cache);
+int register_list_fetch(struct reg **reg_list, unsigned num_regs);
 
 void register_init_dummy(struct reg *reg);
 
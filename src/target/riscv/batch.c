@@ -5,11 +5,23 @@
 #include "batch.h"
 #include "debug_defines.h"
 #include "riscv.h"
+#include "helper/time_support.h"
 
 #define get_field(reg, mask) (((reg) & (mask)) / ((mask) & ~((mask) << 1)))
 #define set_field(reg, mask, val) (((reg) & ~(mask)) | (((val) * ((mask) & ~((mask) << 1))) & (mask)))
 
+/* DMI op value returned when an earlier operation was still in progress. */
+#define DMI_STATUS_BUSY		3
+
+/* Batch length that bulk transfers start out with, and the longest one that
+ * the pool will try. */
+#define RISCV_BATCH_DEFAULT_SCANS	64
+#define RISCV_BATCH_MAX_SCANS		2048
+/* How long to measure one batch length before comparing it to the last. */
+#define RISCV_BATCH_SAMPLE_MS		100
+
 static void dump_field(int idle, const struct scan_field *field);
+static void batch_account(struct riscv_batch *batch, int64_t ms);
 
 struct riscv_batch *riscv_batch_alloc(struct target *target, size_t scans, size_t idle)
 {
@@ -31,9 +43,100 @@ void riscv_batch_free(struct riscv_batch *batch)
 	free(batch->data_in);
 	free(batch->data_out);
 	free(batch->fields);
+	free(batch->read_keys);
 	free(batch);
 }
 
+static struct riscv_batch_pool *batch_pool(struct target *target)
+{
+	riscv_info_t *r = riscv_info(target);
+	if (!r->batch_pool) {
+		r->batch_pool = calloc(1, sizeof(*r->batch_pool));
+		if (!r->batch_pool)
+			return NULL;
+		r->batch_pool->preferred_scans = RISCV_BATCH_DEFAULT_SCANS;
+	}
+	return r->batch_pool;
+}
+
+struct riscv_batch *riscv_batch_get(struct target *target, size_t scans, size_t idle)
+{
+	struct riscv_batch_pool *pool = batch_pool(target);
+	if (!pool)
+		return riscv_batch_alloc(target, scans, idle);
+
+	/* Use the smallest free batch that is large enough, or replace the
+	 * largest one if none is. */
+	struct riscv_batch *batch = NULL;
+	unsigned index = 0;
+	for (unsigned i = 0; i < pool->free_count; i++) {
+		struct riscv_batch *b = pool->free[i];
+		bool fits = b->allocated_scans >= scans + 4;
+		if (!batch ||
+				(fits && (batch->allocated_scans < scans + 4 ||
+						  b->allocated_scans < batch->allocated_scans)) ||
+				(!fits && b->allocated_scans > batch->allocated_scans)) {
+			batch = b;
+			index = i;
+		}
+	}
+
+	if (batch) {
+		pool->free[index] = pool->free[--pool->free_count];
+		if (batch->allocated_scans >= scans + 4) {
+			pool->reuses++;
+			riscv_batch_reset(batch);
+			batch->idle_count = idle;
+			return batch;
+		}
+		riscv_batch_free(batch);
+	}
+
+	pool->allocations++;
+	return riscv_batch_alloc(target, scans, idle);
+}
+
+void riscv_batch_put(struct riscv_batch *batch)
+{
+	struct riscv_batch_pool *pool = riscv_info(batch->target)->batch_pool;
+	if (!pool || pool->free_count == RISCV_BATCH_POOL_FREE) {
+		riscv_batch_free(batch);
+		return;
+	}
+	pool->free[pool->free_count++] = batch;
+}
+
+size_t riscv_batch_preferred_scans(struct target *target)
+{
+	struct riscv_batch_pool *pool = batch_pool(target);
+	return pool ? pool->preferred_scans : RISCV_BATCH_DEFAULT_SCANS;
+}
+
+void riscv_batch_pool_reset_stats(struct riscv_batch_pool *pool)
+{
+	pool->runs = 0;
+	pool->scans = 0;
+	pool->busy_runs = 0;
+	pool->allocations = 0;
+	pool->reuses = 0;
+}
+
+void riscv_batch_pool_free(struct riscv_batch_pool *pool)
+{
+	if (!pool)
+		return;
+	for (unsigned i = 0; i < pool->free_count; i++)
+		riscv_batch_free(pool->free[i]);
+	free(pool);
+}
+
+void riscv_batch_reset(struct riscv_batch *batch)
+{
+	batch->used_scans = 0;
+	batch->read_keys_used = 0;
+	batch->last_scan = RISCV_SCAN_TYPE_INVALID;
+}
+
 bool riscv_batch_full(struct riscv_batch *batch)
 {
 	return batch->used_scans > (batch->allocated_scans - 4);
@@ -56,10 +159,12 @@ int riscv_batch_run(struct riscv_batch *batch)
 			jtag_add_runtest(batch->idle_count, TAP_IDLE);
 	}
 
+	int64_t start = timeval_ms();
 	if (jtag_execute_queue() != ERROR_OK) {
 		LOG_ERROR("Unable to execute JTAG queue");
 		return ERROR_FAIL;
 	}
+	batch_account(batch, timeval_ms() - start);
 
 	for (size_t i = 0; i < batch->used_scans; ++i)
 		dump_field(batch->idle_count, batch->fields + i);
@@ -92,11 +197,9 @@ size_t riscv_batch_add_dmi_read(struct riscv_batch *batch, unsigned address)
 	batch->last_scan = RISCV_SCAN_TYPE_READ;
 	batch->used_scans++;
 
-	/* FIXME We get the read response back on the next scan.  For now I'm
-	 * just sticking a NOP in there, but this should be coalesced away. */
-	riscv_batch_add_nop(batch);
-
-	batch->read_keys[batch->read_keys_used] = batch->used_scans - 1;
+	/* The read response comes back on whatever scan follows, which is at
+	 * worst the NOP that riscv_batch_run() appends. */
+	batch->read_keys[batch->read_keys_used] = batch->used_scans;
 	return batch->read_keys_used++;
 }
 
@@ -129,6 +232,55 @@ void riscv_batch_add_nop(struct riscv_batch *batch)
 	batch->used_scans++;
 }
 
+/* Update the pool statistics after a batch ran, and use full batches of the
+ * preferred length to find the length beyond which the adapter gets no
+ * faster: keep doubling it while that still gains 10%, and step back when it
+ * made things slower. */
+static void batch_account(struct riscv_batch *batch, int64_t ms)
+{
+	struct riscv_batch_pool *pool = riscv_info(batch->target)->batch_pool;
+	if (!pool)
+		return;
+
+	bool busy = false;
+	for (size_t i = 0; i < batch->used_scans && !busy; i++) {
+		uint64_t in = buf_get_u64(batch->fields[i].in_value, 0,
+				batch->fields[i].num_bits);
+		busy = get_field(in, DTM_DMI_OP) == DMI_STATUS_BUSY;
+	}
+
+	pool->runs++;
+	pool->scans += batch->used_scans;
+	if (busy)
+		pool->busy_runs++;
+
+	if (busy || pool->converged || batch->used_scans < pool->preferred_scans)
+		return;
+
+	pool->sample_scans += batch->used_scans;
+	pool->sample_ms += ms;
+	if (pool->sample_ms < RISCV_BATCH_SAMPLE_MS)
+		return;
+
+	uint64_t rate = pool->sample_scans * 1000 / pool->sample_ms;
+	pool->sample_scans = 0;
+	pool->sample_ms = 0;
+
+	if (rate * 10 > pool->preferred_rate * 11 &&
+			pool->preferred_scans < RISCV_BATCH_MAX_SCANS) {
+		pool->preferred_rate = rate;
+		pool->preferred_scans *= 2;
+	} else {
+		if (rate < pool->preferred_rate)
+			pool->preferred_scans /= 2;
+		else
+			pool->preferred_rate = rate;
+		pool->converged = true;
+	}
+	LOG_DEBUG("%" PRIu64 " scans/s; preferred batch length is now %zu%s",
+			rate, pool->preferred_scans, pool->converged ? "" : " (tuning)");
+}
+
 void dump_field(int idle, const struct scan_field *field)
 {
 	static const char * const op_string[] = {"-", "r", "w", "?"};
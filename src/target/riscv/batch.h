@@ -44,6 +44,9 @@ struct riscv_batch {
 struct riscv_batch *riscv_batch_alloc(struct target *target, size_t scans, size_t idle);
 void riscv_batch_free(struct riscv_batch *batch);
 
+/* Empties the batch so that it can be filled and run again. */
+void riscv_batch_reset(struct riscv_batch *batch);
+
 /* Checks to see if this batch is full. */
 bool riscv_batch_full(struct riscv_batch *batch);
 
@@ -61,4 +64,44 @@ uint64_t riscv_batch_get_dmi_read(struct riscv_batch *batch, size_t key);
 /* Scans in a NOP. */
 void riscv_batch_add_nop(struct riscv_batch *batch);
 
+#define RISCV_BATCH_POOL_FREE	4
+
+/* Each target keeps a few batches around so that they don't have to be
+ * allocated for every operation, and learns which batch length gives the
+ * most scans per second on the adapter in use. */
+struct riscv_batch_pool {
+	struct riscv_batch *free[RISCV_BATCH_POOL_FREE];
+	unsigned free_count;
+
+	/* Number of scans that bulk transfers should put in one batch. */
+	size_t preferred_scans;
+	/* Throughput of preferred_scans, in scans per second, as measured in
+	 * the last sample. Zero until the first sample is complete. */
+	uint64_t preferred_rate;
+	bool converged;
+
+	/* Current sample, taken from batches of at least the preferred length. */
+	uint64_t sample_scans;
+	int64_t sample_ms;
+
+	/* Statistics. */
+	uint64_t runs;
+	uint64_t scans;
+	uint64_t busy_runs;
+	uint64_t allocations;
+	uint64_t reuses;
+};
+
+/* Takes a batch that can hold at least "scans" scans from the target's pool,
+ * or allocates one, and empties it. Return it with riscv_batch_put(). */
+struct riscv_batch *riscv_batch_get(struct target *target, size_t scans, size_t idle);
+void riscv_batch_put(struct riscv_batch *batch);
+
+/* Returns the number of scans that bulk transfers on this target should
+ * put in one batch. */
+size_t riscv_batch_preferred_scans(struct target *target);
+
+void riscv_batch_pool_reset_stats(struct riscv_batch_pool *pool);
+void riscv_batch_pool_free(struct riscv_batch_pool *pool);
+
 #endif
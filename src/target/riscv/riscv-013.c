@@ -38,6 +38,8 @@ static void riscv013_clear_abstract_error(struct target *target);
 static int riscv013_get_register(struct target *target,
 		riscv_reg_t *value, int hid, int rid);
 static int riscv013_set_register(struct target *target, int hartid, int regid, uint64_t value);
+static int riscv013_read_registers(struct target *target, riscv_reg_t *values,
+		int hartid, enum gdb_regno first, unsigned count);
 static int riscv013_select_current_hart(struct target *target);
 static int riscv013_halt_current_hart(struct target *target);
 static int riscv013_resume_current_hart(struct target *target);
@@ -71,6 +73,14 @@ void write_memory_sba_simple(struct target *target, target_addr_t addr, uint32_t
 void read_memory_sba_simple(struct target *target, target_addr_t addr,
 		uint32_t *rd_buf, uint32_t read_size, uint32_t sbcs);
 static int	riscv013_test_compliance(struct target *target);
+static int riscv013_poll_targets(struct target **targets, unsigned count,
+		bool *halted);
+static int riscv013_halt_targets(struct target **targets, unsigned count);
+static int riscv013_resume_targets(struct target **targets, unsigned count);
+static int riscv013_get_delays(struct target *target,
+		struct riscv_delay_state *delays);
+static int riscv013_set_delays(struct target *target,
+		const unsigned int *delays);
 
 /**
  * Since almost everything can be accomplish by scanning the dbus register, all
@@ -152,6 +162,8 @@ typedef struct {
 	struct list_head target_list;
 	/* The currently selected hartid on this DM. */
 	int current_hartid;
+	/* The DM implements the hart array mask (dmcontrol.hasel). */
+	bool hasel_supported;
 } dm013_info_t;
 
 typedef struct {
@@ -159,6 +171,28 @@ typedef struct {
 	struct target *target;
 } target_list_t;
 
+/* State of the controller that tunes one of the busy delays.
+ *
+ * A busy response means the delay is too short, so it grows as it always
+ * has. Busy responses often come in bursts, though, after which the delay
+ * is larger than it needs to be. So after every probe_interval operations
+ * without a busy response the delay is halved towards floor, the smallest
+ * delay not yet seen to be too short. A probe that turns out busy restores
+ * the previous delay and makes probing less frequent. Once the delay has
+ * reached floor it has converged; floor then slowly decays so that a floor
+ * learned during a burst does not stick forever. */
+struct delay_tuner {
+	unsigned int floor;
+	unsigned int successes;
+	unsigned int probe_interval;
+	/* Set while the delay is being probed downward from probe_from. */
+	bool probing;
+	unsigned int probe_from;
+};
+
+#define DELAY_PROBE_INTERVAL_MIN	64
+#define DELAY_PROBE_INTERVAL_MAX	8192
+
 typedef struct {
 	/* Number of address bits in the dbus register. */
 	unsigned abits;
@@ -194,10 +228,23 @@ typedef struct {
 	 * go low. */
 	unsigned int ac_busy_delay;
 
+	/* Like ac_busy_delay, but for abstract commands that also execute the
+	 * program buffer. */
+	unsigned int progbuf_busy_delay;
+
+	/* Whether the last abstract command started executes the program buffer,
+	 * which decides the delay that follows a scan that starts a command. */
+	bool last_command_postexec;
+
+	/* Controllers for dmi_busy_delay, ac_busy_delay and progbuf_busy_delay. */
+	struct delay_tuner tuner[RISCV_DELAY_CLASSES];
+
 	bool abstract_read_csr_supported;
 	bool abstract_write_csr_supported;
 	bool abstract_read_fpr_supported;
 	bool abstract_write_fpr_supported;
+	/* Whether abstract register accesses can post-increment regno. */
+	bool abstract_postincrement_supported;
 
 	/* When a function returns some error due to a failure indicated by the
 	 * target in cmderr, the caller can look here to see what that error was.
@@ -428,13 +475,87 @@ static uint32_t dtmcontrol_scan(struct target *target, uint32_t out)
 	return in;
 }
 
+static unsigned int *delay_value(riscv013_info_t *info,
+		enum riscv_delay_class class)
+{
+	switch (class) {
+		case RISCV_DELAY_DMI:
+			return &info->dmi_busy_delay;
+		case RISCV_DELAY_ABSTRACT:
+			return &info->ac_busy_delay;
+		default:
+			return &info->progbuf_busy_delay;
+	}
+}
+
+static void delay_busy(riscv013_info_t *info, enum riscv_delay_class class)
+{
+	struct delay_tuner *tuner = &info->tuner[class];
+	unsigned int *delay = delay_value(info, class);
+
+	tuner->floor = *delay + 1;
+	tuner->successes = 0;
+	if (tuner->probing) {
+		/* The probe went too far. Go back to the delay that worked. */
+		*delay = tuner->probe_from;
+		tuner->probing = false;
+		if (tuner->probe_interval < DELAY_PROBE_INTERVAL_MAX)
+			tuner->probe_interval *= 2;
+	} else {
+		*delay += *delay / 10 + 1;
+	}
+}
+
+static void delay_success(riscv013_info_t *info, enum riscv_delay_class class)
+{
+	struct delay_tuner *tuner = &info->tuner[class];
+	unsigned int *delay = delay_value(info, class);
+
+	if (++tuner->successes < tuner->probe_interval)
+		return;
+	tuner->successes = 0;
+	tuner->probing = false;
+
+	if (*delay <= tuner->floor) {
+		tuner->floor /= 2;
+		return;
+	}
+
+	tuner->probing = true;
+	tuner->probe_from = *delay;
+	*delay = tuner->floor + (*delay - tuner->floor) / 2;
+	LOG_DEBUG("probing %s delay %d -> %d",
+			class == RISCV_DELAY_DMI ? "dmi" :
+			class == RISCV_DELAY_ABSTRACT ? "abstract" : "progbuf",
+			tuner->probe_from, *delay);
+}
+
+static void reset_delays(riscv013_info_t *info, const unsigned int *delays)
+{
+	for (unsigned c = 0; c < RISCV_DELAY_CLASSES; c++) {
+		*delay_value(info, c) = delays ? delays[c] : 0;
+		memset(&info->tuner[c], 0, sizeof(info->tuner[c]));
+		info->tuner[c].probe_interval = DELAY_PROBE_INTERVAL_MIN;
+	}
+}
+
+/* Number of run-test/idle cycles to feed the target after a scan that starts
+ * an abstract command. */
+static unsigned int exec_delay(riscv013_info_t *info)
+{
+	if (info->last_command_postexec)
+		return info->dmi_busy_delay + info->progbuf_busy_delay;
+	return info->dmi_busy_delay + info->ac_busy_delay;
+}
+
 static void increase_dmi_busy_delay(struct target *target)
 {
 	riscv013_info_t *info = get_info(target);
-	info->dmi_busy_delay += info->dmi_busy_delay / 10 + 1;
-	LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d",
+	delay_busy(info, RISCV_DELAY_DMI);
+	LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d, "
+			"progbuf_busy_delay=%d",
 			info->dtmcs_idle, info->dmi_busy_delay,
-			info->ac_busy_delay);
+			info->ac_busy_delay, info->progbuf_busy_delay);
 
 	dtmcontrol_scan(target, DTM_DTMCS_DMIRESET);
 }
@@ -461,10 +582,8 @@ static dmi_status_t dmi_scan(struct target *target, uint32_t *address_in,
 
 	if (r->reset_delays_wait >= 0) {
 		r->reset_delays_wait--;
-		if (r->reset_delays_wait < 0) {
-			info->dmi_busy_delay = 0;
-			info->ac_busy_delay = 0;
-		}
+		if (r->reset_delays_wait < 0)
+			reset_delays(info, NULL);
 	}
 
 	memset(in, 0, num_bytes);
@@ -478,9 +597,7 @@ static dmi_status_t dmi_scan(struct target *target, uint32_t *address_in,
 	/* Assume dbus is already selected. */
 	jtag_add_dr_scan(target->tap, 1, &field, TAP_IDLE);
 
-	int idle_count = info->dmi_busy_delay;
-	if (exec)
-		idle_count += info->ac_busy_delay;
+	int idle_count = exec ? exec_delay(info) : info->dmi_busy_delay;
 
 	if (idle_count)
 		jtag_add_runtest(idle_count, TAP_IDLE);
@@ -512,6 +629,7 @@ static int dmi_op_timeout(struct target *target, uint32_t *data_in,
 
 	dmi_status_t status;
 	uint32_t address_in;
+	bool busy = false;
 
 	if (dmi_busy_encountered)
 		*dmi_busy_encountered = false;
@@ -540,6 +658,7 @@ static int dmi_op_timeout(struct target *target, uint32_t *data_in,
 				exec);
 		if (status == DMI_STATUS_BUSY) {
 			increase_dmi_busy_delay(target);
+			busy = true;
 			if (dmi_busy_encountered)
 				*dmi_busy_encountered = true;
 		} else if (status == DMI_STATUS_SUCCESS) {
@@ -565,6 +684,7 @@ static int dmi_op_timeout(struct target *target, uint32_t *data_in,
 				false);
 		if (status == DMI_STATUS_BUSY) {
 			increase_dmi_busy_delay(target);
+			busy = true;
 		} else if (status == DMI_STATUS_SUCCESS) {
 			break;
 		} else {
@@ -587,6 +707,9 @@ static int dmi_op_timeout(struct target *target, uint32_t *data_in,
 		return ERROR_FAIL;
 	}
 
+	if (!busy)
+		delay_success(get_info(target), RISCV_DELAY_DMI);
+
 	return ERROR_OK;
 }
 
@@ -649,13 +772,14 @@ int dmstatus_read(struct target *target, uint32_t *dmstatus,
 			riscv_command_timeout_sec);
 }
 
-static void increase_ac_busy_delay(struct target *target)
+static void increase_progbuf_busy_delay(struct target *target)
 {
 	riscv013_info_t *info = get_info(target);
-	info->ac_busy_delay += info->ac_busy_delay / 10 + 1;
-	LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d",
+	delay_busy(info, RISCV_DELAY_PROGBUF);
+	LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d, "
+			"progbuf_busy_delay=%d",
 			info->dtmcs_idle, info->dmi_busy_delay,
-			info->ac_busy_delay);
+			info->ac_busy_delay, info->progbuf_busy_delay);
 }
 
 uint32_t abstract_register_size(unsigned width)
@@ -733,10 +857,25 @@ static int execute_abstract_command(struct target *target, uint32_t command)
 		}
 	}
 
+	bool postexec = get_field(command, DMI_COMMAND_CMDTYPE) == 0 &&
+		get_field(command, AC_ACCESS_REGISTER_POSTEXEC);
+	enum riscv_delay_class class = postexec ? RISCV_DELAY_PROGBUF :
+		RISCV_DELAY_ABSTRACT;
+	info->last_command_postexec = postexec;
+
 	dmi_write_exec(target, DMI_COMMAND, command);
 
+	/* If the command is still busy after the delay that followed it, the
+	 * delay was too short. */
 	uint32_t abstractcs = 0;
-	wait_for_idle(target, &abstractcs);
+	bool busy = false;
+	if (dmi_read(target, &abstractcs, DMI_ABSTRACTCS) != ERROR_OK) {
+		wait_for_idle(target, &abstractcs);
+	} else if (get_field(abstractcs, DMI_ABSTRACTCS_BUSY)) {
+		busy = true;
+		delay_busy(info, class);
+		wait_for_idle(target, &abstractcs);
+	}
 
 	info->cmderr = get_field(abstractcs, DMI_ABSTRACTCS_CMDERR);
 	if (info->cmderr != 0) {
@@ -747,6 +886,9 @@ static int execute_abstract_command(struct target *target, uint32_t command)
 		return ERROR_FAIL;
 	}
 
+	if (!busy)
+		delay_success(info, class);
+
 	return ERROR_OK;
 }
 
@@ -1395,10 +1537,15 @@ static int examine(struct target *target)
 	}
 
 	dmi_write(target, DMI_DMCONTROL, DMI_DMCONTROL_HARTSELLO |
-			DMI_DMCONTROL_HARTSELHI | DMI_DMCONTROL_DMACTIVE);
+			DMI_DMCONTROL_HARTSELHI | DMI_DMCONTROL_DMACTIVE |
+			DMI_DMCONTROL_HASEL);
 	uint32_t dmcontrol;
 	if (dmi_read(target, &dmcontrol, DMI_DMCONTROL) != ERROR_OK)
 		return ERROR_FAIL;
+	dm->hasel_supported = get_field(dmcontrol, DMI_DMCONTROL_HASEL);
+	dmi_write(target, DMI_DMCONTROL, DMI_DMCONTROL_DMACTIVE);
+	dm->current_hartid = 0;
+	LOG_DEBUG("hasel_supported=%d", dm->hasel_supported);
 
 	if (!get_field(dmcontrol, DMI_DMCONTROL_DMACTIVE)) {
 		LOG_ERROR("Debug Module did not become active. dmcontrol=0x%x",
@@ -1587,6 +1734,25 @@ int riscv013_authdata_write(struct target *target, uint32_t value)
 	return ERROR_OK;
 }
 
+static int riscv013_get_delays(struct target *target,
+		struct riscv_delay_state *delays)
+{
+	RISCV013_INFO(info);
+	for (unsigned c = 0; c < RISCV_DELAY_CLASSES; c++) {
+		delays[c].value = *delay_value(info, c);
+		delays[c].converged = delays[c].value <= info->tuner[c].floor;
+	}
+	return ERROR_OK;
+}
+
+static int riscv013_set_delays(struct target *target,
+		const unsigned int *delays)
+{
+	RISCV013_INFO(info);
+	reset_delays(info, delays);
+	return ERROR_OK;
+}
+
 static int init_target(struct command_context *cmd_ctx,
 		struct target *target)
 {
@@ -1595,6 +1761,7 @@ static int init_target(struct command_context *cmd_ctx,
 
 	generic_info->get_register = &riscv013_get_register;
 	generic_info->set_register = &riscv013_set_register;
+	generic_info->read_registers = &riscv013_read_registers;
 	generic_info->select_current_hart = &riscv013_select_current_hart;
 	generic_info->is_halted = &riscv013_is_halted;
 	generic_info->halt_current_hart = &riscv013_halt_current_hart;
@@ -1617,6 +1784,11 @@ static int init_target(struct command_context *cmd_ctx,
 	generic_info->dmi_write = &dmi_write;
 	generic_info->test_sba_config_reg = &riscv013_test_sba_config_reg;
 	generic_info->test_compliance = &riscv013_test_compliance;
+	generic_info->get_delays = &riscv013_get_delays;
+	generic_info->set_delays = &riscv013_set_delays;
+	generic_info->poll_targets = &riscv013_poll_targets;
+	generic_info->halt_targets = &riscv013_halt_targets;
+	generic_info->resume_targets = &riscv013_resume_targets;
 	generic_info->version_specific = calloc(1, sizeof(riscv013_info_t));
 	if (!generic_info->version_specific)
 		return ERROR_FAIL;
@@ -1624,10 +1796,9 @@ static int init_target(struct command_context *cmd_ctx,
 
 	info->progbufsize = -1;
 
-	info->dmi_busy_delay = 0;
+	reset_delays(info, generic_info->preset_delays);
 	info->bus_master_read_delay = 0;
 	info->bus_master_write_delay = 0;
-	info->ac_busy_delay = 0;
 
 	/* Assume all these abstract commands are supported until we learn
 	 * otherwise.
@@ -1638,6 +1809,7 @@ static int init_target(struct command_context *cmd_ctx,
 	info->abstract_write_csr_supported = true;
 	info->abstract_read_fpr_supported = true;
 	info->abstract_write_fpr_supported = true;
+	info->abstract_postincrement_supported = true;
 
 	return ERROR_OK;
 }
@@ -1835,37 +2007,6 @@ static void log_memory_access(target_addr_t address, uint64_t value,
 	LOG_DEBUG(fmt, value);
 }
 
-/* Read the relevant sbdata regs depending on size, and put the results into
- * buffer. */
-static int read_memory_bus_word(struct target *target, target_addr_t address,
-		uint32_t size, uint8_t *buffer)
-{
-	uint32_t value;
-	if (size > 12) {
-		if (dmi_read(target, &value, DMI_SBDATA3) != ERROR_OK)
-			return ERROR_FAIL;
-		write_to_buf(buffer + 12, value, 4);
-		log_memory_access(address + 12, value, 4, true);
-	}
-	if (size > 8) {
-		if (dmi_read(target, &value, DMI_SBDATA2) != ERROR_OK)
-			return ERROR_FAIL;
-		write_to_buf(buffer + 8, value, 4);
-		log_memory_access(address + 8, value, 4, true);
-	}
-	if (size > 4) {
-		if (dmi_read(target, &value, DMI_SBDATA1) != ERROR_OK)
-			return ERROR_FAIL;
-		write_to_buf(buffer + 4, value, 4);
-		log_memory_access(address + 4, value, 4, true);
-	}
-	if (dmi_read(target, &value, DMI_SBDATA0) != ERROR_OK)
-		return ERROR_FAIL;
-	write_to_buf(buffer, value, MIN(size, 4));
-	log_memory_access(address, value, MIN(size, 4), true);
-	return ERROR_OK;
-}
-
 static uint32_t sb_sbaccess(unsigned size_bytes)
 {
 	switch (size_bytes) {
@@ -1902,24 +2043,6 @@ static target_addr_t sb_read_address(struct target *target)
 	return address;
 }
 
-static int sb_write_address(struct target *target, target_addr_t address)
-{
-	RISCV013_INFO(info);
-	unsigned sbasize = get_field(info->sbcs, DMI_SBCS_SBASIZE);
-	/* There currently is no support for >64-bit addresses in OpenOCD. */
-	if (sbasize > 96)
-		dmi_write(target, DMI_SBADDRESS3, 0);
-	if (sbasize > 64)
-		dmi_write(target, DMI_SBADDRESS2, 0);
-	if (sbasize > 32)
-#if BUILD_TARGET64
-		dmi_write(target, DMI_SBADDRESS1, address >> 32);
-#else
-		dmi_write(target, DMI_SBADDRESS1, 0);
-#endif
-	return dmi_write(target, DMI_SBADDRESS0, address);
-}
-
 static int read_sbcs_nonbusy(struct target *target, uint32_t *sbcs)
 {
 	time_t start = time(NULL);
@@ -2014,83 +2137,190 @@ static int read_memory_bus_v0(struct target *target, target_addr_t address,
 	return ERROR_OK;
 }
 
+static int batch_run(const struct target *target, struct riscv_batch *batch)
+{
+	RISCV013_INFO(info);
+	RISCV_INFO(r);
+	if (r->reset_delays_wait >= 0) {
+		r->reset_delays_wait -= batch->used_scans;
+		if (r->reset_delays_wait <= 0) {
+			batch->idle_count = 0;
+			reset_delays(info, NULL);
+		}
+	}
+	return riscv_batch_run(batch);
+}
+
+static bool sb_access_supported(riscv013_info_t *info, unsigned size_bytes)
+{
+	switch (size_bytes) {
+		case 1:
+			return get_field(info->sbcs, DMI_SBCS_SBACCESS8);
+		case 2:
+			return get_field(info->sbcs, DMI_SBCS_SBACCESS16);
+		case 4:
+			return get_field(info->sbcs, DMI_SBCS_SBACCESS32);
+		case 8:
+			return get_field(info->sbcs, DMI_SBCS_SBACCESS64);
+		case 16:
+			return get_field(info->sbcs, DMI_SBCS_SBACCESS128);
+	}
+	return false;
+}
+
+static void sb_batch_write_address(struct target *target,
+		struct riscv_batch *batch, target_addr_t address)
+{
+	RISCV013_INFO(info);
+	unsigned sbasize = get_field(info->sbcs, DMI_SBCS_SBASIZE);
+	/* There currently is no support for >64-bit addresses in OpenOCD. */
+	if (sbasize > 96)
+		riscv_batch_add_dmi_write(batch, DMI_SBADDRESS3, 0);
+	if (sbasize > 64)
+		riscv_batch_add_dmi_write(batch, DMI_SBADDRESS2, 0);
+	if (sbasize > 32)
+#if BUILD_TARGET64
+		riscv_batch_add_dmi_write(batch, DMI_SBADDRESS1, address >> 32);
+#else
+		riscv_batch_add_dmi_write(batch, DMI_SBADDRESS1, 0);
+#endif
+	riscv_batch_add_dmi_write(batch, DMI_SBADDRESS0, address);
+}
+
+/* Wait for the bus to go idle after a batch of bus accesses and check how
+ * they went. Returns ERROR_OK if the whole batch succeeded, or
+ * ERROR_TARGET_RESOURCE_NOT_AVAILABLE if it has to be repeated because the
+ * DMI or the bus was busy, in which case the relevant delay has already been
+ * increased. */
+static int sb_check_batch(struct target *target, bool dmi_busy,
+		unsigned int *bus_delay)
+{
+	uint32_t sbcs;
+	bool busy_encountered;
+
+	if (dmi_op(target, &sbcs, &busy_encountered, DMI_OP_READ, DMI_SBCS, 0,
+				false) != ERROR_OK)
+		return ERROR_FAIL;
+	if (get_field(sbcs, DMI_SBCS_SBBUSY) &&
+			read_sbcs_nonbusy(target, &sbcs) != ERROR_OK)
+		return ERROR_FAIL;
+
+	if (get_field(sbcs, DMI_SBCS_SBERROR)) {
+		/* Some error indicating the bus access failed, but not because of
+		 * something we did wrong. */
+		LOG_DEBUG("System Bus access failed, sbcs=0x%x", sbcs);
+		dmi_write(target, DMI_SBCS, DMI_SBCS_SBERROR);
+		return ERROR_FAIL;
+	}
+
+	if (get_field(sbcs, DMI_SBCS_SBBUSYERROR)) {
+		/* We accessed the bus while it was busy. Slow down and try again. */
+		dmi_write(target, DMI_SBCS, DMI_SBCS_SBBUSYERROR);
+		*bus_delay += *bus_delay / 10 + 1;
+		LOG_DEBUG("sbbusyerror, bus delay is now %d", *bus_delay);
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+
+	if (dmi_busy || busy_encountered)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	return ERROR_OK;
+}
+
 /**
- * Read the requested memory using the system bus interface.
+ * Read memory through the System Bus in batches of many accesses. Reads are
+ * started by writing the address and then by each read of sbdata0, so the
+ * whole block streams through one chain of autoincremented accesses. Errors
+ * are only checked after each batch; if the DMI or the bus was busy during a
+ * batch, its data is discarded and the chain is restarted at the first word
+ * of that batch.
  */
 static int read_memory_bus_v1(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, uint8_t *buffer)
 {
 	RISCV013_INFO(info);
-	target_addr_t next_address = address;
-	target_addr_t end_address = address + count * size;
-
-	while (next_address < end_address) {
-		uint32_t sbcs = set_field(0, DMI_SBCS_SBREADONADDR, 1);
-		sbcs |= sb_sbaccess(size);
-		sbcs = set_field(sbcs, DMI_SBCS_SBAUTOINCREMENT, 1);
-		sbcs = set_field(sbcs, DMI_SBCS_SBREADONDATA, count > 1);
-		dmi_write(target, DMI_SBCS, sbcs);
+	unsigned regs = DIV_ROUND_UP(size, 4);
+	size_t scans = riscv_batch_preferred_scans(target);
+	uint32_t words_per_batch = scans / regs;
+	struct riscv_batch *batch = riscv_batch_get(target, scans + 8, 0);
+	int result = ERROR_OK;
 
-		/* This address write will trigger the first read. */
-		sb_write_address(target, next_address);
+	uint32_t sbcs = sb_sbaccess(size);
+	sbcs = set_field(sbcs, DMI_SBCS_SBAUTOINCREMENT, 1);
+	sbcs = set_field(sbcs, DMI_SBCS_SBREADONADDR, 1);
 
-		if (info->bus_master_read_delay) {
-			jtag_add_runtest(info->bus_master_read_delay, TAP_IDLE);
-			if (jtag_execute_queue() != ERROR_OK) {
-				LOG_ERROR("Failed to scan idle sequence");
-				return ERROR_FAIL;
-			}
+	uint32_t next = 0;
+	bool setup_needed = true;
+	while (next < count) {
+		uint32_t end = MIN(count, next + words_per_batch);
+		LOG_DEBUG("reading words %d..%d from 0x%" TARGET_PRIxADDR, next,
+				end - 1, address);
+
+		riscv_batch_reset(batch);
+		batch->idle_count = info->dmi_busy_delay + info->bus_master_read_delay;
+
+		if (setup_needed) {
+			riscv_batch_add_dmi_write(batch, DMI_SBCS,
+					set_field(sbcs, DMI_SBCS_SBREADONDATA, next + 1 < count));
+			/* This address write will trigger the first read. */
+			sb_batch_write_address(target, batch, address + next * size);
+			setup_needed = false;
 		}
 
-		for (uint32_t i = (next_address - address) / size; i < count - 1; i++) {
-			read_memory_bus_word(target, address + i * size, size,
-					buffer + i * size);
+		size_t first_key = batch->read_keys_used;
+		for (uint32_t i = next; i < end; i++) {
+			/* Don't start a read past the end of the block. */
+			if (i + 1 == count && count > 1)
+				riscv_batch_add_dmi_write(batch, DMI_SBCS,
+						set_field(sbcs, DMI_SBCS_SBREADONDATA, 0));
+			/* sbdata0 goes last, because reading it starts the next read. */
+			for (unsigned r = regs; r-- > 0; )
+				riscv_batch_add_dmi_read(batch, DMI_SBDATA0 + r);
 		}
 
-		sbcs = set_field(sbcs, DMI_SBCS_SBREADONDATA, 0);
-		dmi_write(target, DMI_SBCS, sbcs);
-
-		read_memory_bus_word(target, address + (count - 1) * size, size,
-				buffer + (count - 1) * size);
+		select_dmi(target);
+		result = batch_run(target, batch);
+		if (result != ERROR_OK)
+			break;
 
-		if (read_sbcs_nonbusy(target, &sbcs) != ERROR_OK)
-			return ERROR_FAIL;
+		bool dmi_busy = false;
+		for (size_t key = first_key; key < batch->read_keys_used; key++) {
+			dmi_status_t status = get_field(riscv_batch_get_dmi_read(batch, key),
+					DTM_DMI_OP);
+			if (status == DMI_STATUS_BUSY) {
+				dmi_busy = true;
+			} else if (status != DMI_STATUS_SUCCESS) {
+				LOG_ERROR("System Bus read failed with DMI status %d", status);
+				result = ERROR_FAIL;
+			}
+		}
+		if (result != ERROR_OK)
+			break;
 
-		if (get_field(sbcs, DMI_SBCS_SBBUSYERROR)) {
-			/* We read while the target was busy. Slow down and try again. */
-			dmi_write(target, DMI_SBCS, DMI_SBCS_SBBUSYERROR);
-			next_address = sb_read_address(target);
-			info->bus_master_read_delay += info->bus_master_read_delay / 10 + 1;
+		result = sb_check_batch(target, dmi_busy, &info->bus_master_read_delay);
+		if (result == ERROR_TARGET_RESOURCE_NOT_AVAILABLE) {
+			setup_needed = true;
+			result = ERROR_OK;
 			continue;
 		}
+		if (result != ERROR_OK)
+			break;
 
-		unsigned error = get_field(sbcs, DMI_SBCS_SBERROR);
-		if (error == 0) {
-			next_address = end_address;
-		} else {
-			/* Some error indicating the bus access failed, but not because of
-			 * something we did wrong. */
-			dmi_write(target, DMI_SBCS, DMI_SBCS_SBERROR);
-			return ERROR_FAIL;
+		size_t key = first_key;
+		for (uint32_t i = next; i < end; i++) {
+			for (unsigned r = regs; r-- > 0; ) {
+				uint32_t value = get_field(riscv_batch_get_dmi_read(batch, key++),
+						DTM_DMI_DATA);
+				unsigned bytes = MIN(size, 4);
+				write_to_buf(buffer + i * size + 4 * r, value, bytes);
+				log_memory_access(address + i * size + 4 * r, value, bytes, true);
+			}
 		}
+		next = end;
 	}
 
-	return ERROR_OK;
-}
-
-static int batch_run(const struct target *target, struct riscv_batch *batch)
-{
-	RISCV013_INFO(info);
-	RISCV_INFO(r);
-	if (r->reset_delays_wait >= 0) {
-		r->reset_delays_wait -= batch->used_scans;
-		if (r->reset_delays_wait <= 0) {
-			batch->idle_count = 0;
-			info->dmi_busy_delay = 0;
-			info->ac_busy_delay = 0;
-		}
-	}
-	return riscv_batch_run(batch);
+	riscv_batch_put(batch);
+	return result;
 }
 
 /**
@@ -2152,8 +2382,9 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 		LOG_DEBUG("creating burst to read from 0x%" PRIx64
 				" up to 0x%" PRIx64, read_addr, fin_addr);
 		assert(read_addr >= address && read_addr < fin_addr);
-		struct riscv_batch *batch = riscv_batch_alloc(target, 32,
-				info->dmi_busy_delay + info->ac_busy_delay);
+		struct riscv_batch *batch = riscv_batch_get(target,
+				riscv_batch_preferred_scans(target),
+				info->dmi_busy_delay + info->progbuf_busy_delay);
 
 		size_t reads = 0;
 		for (riscv_addr_t addr = read_addr; addr < fin_addr; addr += size) {
@@ -2182,12 +2413,13 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 		switch (info->cmderr) {
 			case CMDERR_NONE:
 				LOG_DEBUG("successful (partial?) memory read");
+				delay_success(info, RISCV_DELAY_PROGBUF);
 				next_read_addr = read_addr + reads * size;
 				break;
 			case CMDERR_BUSY:
 				LOG_DEBUG("memory read resulted in busy response");
 
-				increase_ac_busy_delay(target);
+				increase_progbuf_busy_delay(target);
 				riscv013_clear_abstract_error(target);
 
 				dmi_write(target, DMI_ABSTRACTAUTO, 0);
@@ -2197,7 +2429,7 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 				 * attempted to read when we discovered that the target was
 				 * busy. */
 				if (dmi_read(target, &dmi_data0, DMI_DATA0) != ERROR_OK) {
-					riscv_batch_free(batch);
+					riscv_batch_put(batch);
 					goto error;
 				}
 
@@ -2205,7 +2437,7 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 				result = register_read_direct(target, &next_read_addr,
 						GDB_REGNO_S0);
 				if (result != ERROR_OK) {
-					riscv_batch_free(batch);
+					riscv_batch_put(batch);
 					goto error;
 				}
 				write_to_buf(buffer + next_read_addr - 2 * size - address, dmi_data0, size);
@@ -2226,7 +2458,7 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 			default:
 				LOG_DEBUG("error when reading memory, abstractcs=0x%08lx", (long)abstractcs);
 				riscv013_clear_abstract_error(target);
-				riscv_batch_free(batch);
+				riscv_batch_put(batch);
 				result = ERROR_FAIL;
 				goto error;
 		}
@@ -2254,7 +2486,7 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 				 * caller to reread the entire block. */
 				LOG_WARNING("Batch memory read encountered DMI error %d. "
 						"Falling back on slower reads.", status);
-				riscv_batch_free(batch);
+				riscv_batch_put(batch);
 				result = ERROR_FAIL;
 				goto error;
 			}
@@ -2268,7 +2500,7 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 
 		read_addr = next_read_addr;
 
-		riscv_batch_free(batch);
+		riscv_batch_put(batch);
 	}
 
 	dmi_write(target, DMI_ABSTRACTAUTO, 0);
@@ -2388,11 +2620,7 @@ static int read_memory(struct target *target, target_addr_t address,
 	if (info->progbufsize >= 2 && !riscv_prefer_sba)
 		return read_memory_progbuf(target, address, size, count, buffer);
 
-	if ((get_field(info->sbcs, DMI_SBCS_SBACCESS8) && size == 1) ||
-			(get_field(info->sbcs, DMI_SBCS_SBACCESS16) && size == 2) ||
-			(get_field(info->sbcs, DMI_SBCS_SBACCESS32) && size == 4) ||
-			(get_field(info->sbcs, DMI_SBCS_SBACCESS64) && size == 8) ||
-			(get_field(info->sbcs, DMI_SBCS_SBACCESS128) && size == 16)) {
+	if (sb_access_supported(info, size)) {
 		if (get_field(info->sbcs, DMI_SBCS_SBVERSION) == 0)
 			return read_memory_bus_v0(target, address, size, count, buffer);
 		else if (get_field(info->sbcs, DMI_SBCS_SBVERSION) == 1)
@@ -2494,82 +2722,73 @@ static int write_memory_bus_v0(struct target *target, target_addr_t address,
 	return ERROR_OK;
 }
 
+/**
+ * Write memory through the System Bus in batches of many accesses, each
+ * started by a write to sbdata0. Like read_memory_bus_v1(), errors are only
+ * checked after each batch, and a batch that ran into a busy DMI or bus is
+ * written again from its first word.
+ */
 static int write_memory_bus_v1(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, const uint8_t *buffer)
 {
 	RISCV013_INFO(info);
+	unsigned regs = DIV_ROUND_UP(size, 4);
+	size_t scans = riscv_batch_preferred_scans(target);
+	uint32_t words_per_batch = scans / regs;
+	struct riscv_batch *batch = riscv_batch_get(target, scans + 8, 0);
+	int result = ERROR_OK;
+
 	uint32_t sbcs = sb_sbaccess(size);
 	sbcs = set_field(sbcs, DMI_SBCS_SBAUTOINCREMENT, 1);
-	dmi_write(target, DMI_SBCS, sbcs);
 
-	target_addr_t next_address = address;
-	target_addr_t end_address = address + count * size;
-
-	sb_write_address(target, next_address);
-	while (next_address < end_address) {
-		for (uint32_t i = (next_address - address) / size; i < count; i++) {
-			const uint8_t *p = buffer + i * size;
-			if (size > 12)
-				dmi_write(target, DMI_SBDATA3,
-						((uint32_t) p[12]) |
-						(((uint32_t) p[13]) << 8) |
-						(((uint32_t) p[14]) << 16) |
-						(((uint32_t) p[15]) << 24));
-			if (size > 8)
-				dmi_write(target, DMI_SBDATA2,
-						((uint32_t) p[8]) |
-						(((uint32_t) p[9]) << 8) |
-						(((uint32_t) p[10]) << 16) |
-						(((uint32_t) p[11]) << 24));
-			if (size > 4)
-				dmi_write(target, DMI_SBDATA1,
-						((uint32_t) p[4]) |
-						(((uint32_t) p[5]) << 8) |
-						(((uint32_t) p[6]) << 16) |
-						(((uint32_t) p[7]) << 24));
-			uint32_t value = p[0];
-			if (size > 2) {
-				value |= ((uint32_t) p[2]) << 16;
-				value |= ((uint32_t) p[3]) << 24;
-			}
-			if (size > 1)
-				value |= ((uint32_t) p[1]) << 8;
-			dmi_write(target, DMI_SBDATA0, value);
-
-			log_memory_access(address + i * size, value, size, false);
+	uint32_t next = 0;
+	bool setup_needed = true;
+	while (next < count) {
+		uint32_t end = MIN(count, next + words_per_batch);
+		LOG_DEBUG("writing words %d..%d to 0x%" TARGET_PRIxADDR, next,
+				end - 1, address);
+
+		riscv_batch_reset(batch);
+		batch->idle_count = info->dmi_busy_delay + info->bus_master_write_delay;
+
+		if (setup_needed) {
+			riscv_batch_add_dmi_write(batch, DMI_SBCS, sbcs);
+			sb_batch_write_address(target, batch, address + next * size);
+			setup_needed = false;
+		}
 
-			if (info->bus_master_write_delay) {
-				jtag_add_runtest(info->bus_master_write_delay, TAP_IDLE);
-				if (jtag_execute_queue() != ERROR_OK) {
-					LOG_ERROR("Failed to scan idle sequence");
-					return ERROR_FAIL;
-				}
+		for (uint32_t i = next; i < end; i++) {
+			/* sbdata0 goes last, because writing it starts the access. */
+			for (unsigned r = regs; r-- > 0; ) {
+				unsigned bytes = MIN(size, 4);
+				uint32_t value = buf_get_u32(buffer + i * size + 4 * r, 0,
+						8 * bytes);
+				riscv_batch_add_dmi_write(batch, DMI_SBDATA0 + r, value);
+				log_memory_access(address + i * size + 4 * r, value, bytes, false);
 			}
 		}
 
-		if (read_sbcs_nonbusy(target, &sbcs) != ERROR_OK)
-			return ERROR_FAIL;
+		select_dmi(target);
+		result = batch_run(target, batch);
+		if (result != ERROR_OK)
+			break;
 
-		if (get_field(sbcs, DMI_SBCS_SBBUSYERROR)) {
-			/* We wrote while the target was busy. Slow down and try again. */
-			dmi_write(target, DMI_SBCS, DMI_SBCS_SBBUSYERROR);
-			next_address = sb_read_address(target);
-			info->bus_master_write_delay += info->bus_master_write_delay / 10 + 1;
+		/* Writes have no status of their own in the batch, but DMI busy is
+		 * sticky, so sb_check_batch() sees it when it reads sbcs. */
+		result = sb_check_batch(target, false, &info->bus_master_write_delay);
+		if (result == ERROR_TARGET_RESOURCE_NOT_AVAILABLE) {
+			setup_needed = true;
+			result = ERROR_OK;
 			continue;
 		}
+		if (result != ERROR_OK)
+			break;
 
-		unsigned error = get_field(sbcs, DMI_SBCS_SBERROR);
-		if (error == 0) {
-			next_address = end_address;
-		} else {
-			/* Some error indicating the bus access failed, but not because of
-			 * something we did wrong. */
-			dmi_write(target, DMI_SBCS, DMI_SBCS_SBERROR);
-			return ERROR_FAIL;
-		}
+		next = end;
 	}
 
-	return ERROR_OK;
+	riscv_batch_put(batch);
+	return result;
 }
 
 static int write_memory_progbuf(struct target *target, target_addr_t address,
@@ -2627,10 +2846,10 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 		LOG_DEBUG("transferring burst starting at address 0x%016" PRIx64,
 				cur_addr);
 
-		struct riscv_batch *batch = riscv_batch_alloc(
+		struct riscv_batch *batch = riscv_batch_get(
 				target,
-				32,
-				info->dmi_busy_delay + info->ac_busy_delay);
+				riscv_batch_preferred_scans(target),
+				info->dmi_busy_delay + info->progbuf_busy_delay);
 
 		/* To write another word, we put it in S1 and execute the program. */
 		unsigned start = (cur_addr - address) / size;
@@ -2655,7 +2874,7 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 					break;
 				default:
 					LOG_ERROR("unsupported access size: %d", size);
-					riscv_batch_free(batch);
+					riscv_batch_put(batch);
 					result = ERROR_FAIL;
 					goto error;
 			}
@@ -2667,7 +2886,7 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 				result = register_write_direct(target, GDB_REGNO_S0,
 						address + offset);
 				if (result != ERROR_OK) {
-					riscv_batch_free(batch);
+					riscv_batch_put(batch);
 					goto error;
 				}
 
@@ -2683,7 +2902,7 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 						AC_ACCESS_REGISTER_WRITE);
 				result = execute_abstract_command(target, command);
 				if (result != ERROR_OK) {
-					riscv_batch_free(batch);
+					riscv_batch_put(batch);
 					goto error;
 				}
 
@@ -2700,7 +2919,7 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 		}
 
 		result = batch_run(target, batch);
-		riscv_batch_free(batch);
+		riscv_batch_put(batch);
 		if (result != ERROR_OK)
 			goto error;
 
@@ -2719,13 +2938,14 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 		info->cmderr = get_field(abstractcs, DMI_ABSTRACTCS_CMDERR);
 		if (info->cmderr == CMDERR_NONE && !dmi_busy_encountered) {
 			LOG_DEBUG("successful (partial?) memory write");
+			delay_success(info, RISCV_DELAY_PROGBUF);
 		} else if (info->cmderr == CMDERR_BUSY || dmi_busy_encountered) {
 			if (info->cmderr == CMDERR_BUSY)
 				LOG_DEBUG("Memory write resulted in abstract command busy response.");
 			else if (dmi_busy_encountered)
 				LOG_DEBUG("Memory write resulted in DMI busy response.");
 			riscv013_clear_abstract_error(target);
-			increase_ac_busy_delay(target);
+			increase_progbuf_busy_delay(target);
 
 			dmi_write(target, DMI_ABSTRACTAUTO, 0);
 			result = register_read_direct(target, &cur_addr, GDB_REGNO_S0);
@@ -2761,11 +2981,7 @@ static int write_memory(struct target *target, target_addr_t address,
 	if (info->progbufsize >= 2 && !riscv_prefer_sba)
 		return write_memory_progbuf(target, address, size, count, buffer);
 
-	if ((get_field(info->sbcs, DMI_SBCS_SBACCESS8) && size == 1) ||
-			(get_field(info->sbcs, DMI_SBCS_SBACCESS16) && size == 2) ||
-			(get_field(info->sbcs, DMI_SBCS_SBACCESS32) && size == 4) ||
-			(get_field(info->sbcs, DMI_SBCS_SBACCESS64) && size == 8) ||
-			(get_field(info->sbcs, DMI_SBCS_SBACCESS128) && size == 16)) {
+	if (sb_access_supported(info, size)) {
 		if (get_field(info->sbcs, DMI_SBCS_SBVERSION) == 0)
 			return write_memory_bus_v0(target, address, size, count, buffer);
 		else if (get_field(info->sbcs, DMI_SBCS_SBVERSION) == 1)
@@ -2830,6 +3046,132 @@ static int riscv013_get_register(struct target *target,
 	return result;
 }
 
+/*
+ * Read count consecutive GPRs or FPRs with a single abstract command that
+ * post-increments its register number. abstractauto makes every read of
+ * data0 execute the command again, so the registers stream through data0
+ * and the whole transfer is one batch. Errors are only checked at the end.
+ */
+static int riscv013_read_registers(struct target *target, riscv_reg_t *values,
+		int hartid, enum gdb_regno first, unsigned count)
+{
+	RISCV013_INFO(info);
+
+	bool fpr = first >= GDB_REGNO_FPR0 && first <= GDB_REGNO_FPR31;
+	enum gdb_regno last = first + count - 1;
+	if (count == 0)
+		return ERROR_OK;
+	if (fpr ? last > GDB_REGNO_FPR31 : last > GDB_REGNO_XPR31)
+		return ERROR_FAIL;
+	if (!info->abstract_postincrement_supported ||
+			(fpr && !info->abstract_read_fpr_supported))
+		return ERROR_FAIL;
+
+	LOG_DEBUG("reading %s..%s on hart %d", gdb_regno_name(first),
+			gdb_regno_name(last), hartid);
+
+	if (riscv_set_current_hartid(target, hartid) != ERROR_OK)
+		return ERROR_FAIL;
+
+	unsigned size = register_size(target, first);
+	unsigned regs = size / 32;
+	uint32_t command = access_register_command(target, first, size,
+			AC_ACCESS_REGISTER_TRANSFER | AC_ACCESS_REGISTER_AARPOSTINCREMENT);
+	struct riscv_batch *batch = riscv_batch_get(target, count * regs + 4, 0);
+	int result = ERROR_FAIL;
+
+	time_t start = time(NULL);
+	while (time(NULL) - start <= riscv_command_timeout_sec) {
+		info->last_command_postexec = false;
+		riscv_batch_reset(batch);
+		batch->idle_count = exec_delay(info);
+
+		if (count > 1)
+			riscv_batch_add_dmi_write(batch, DMI_ABSTRACTAUTO,
+					1 << DMI_ABSTRACTAUTO_AUTOEXECDATA_OFFSET);
+		riscv_batch_add_dmi_write(batch, DMI_COMMAND, command);
+		size_t first_key = batch->read_keys_used;
+		for (unsigned i = 0; i < count; i++) {
+			/* Don't run the command again after the last register. */
+			if (count > 1 && i + 1 == count)
+				riscv_batch_add_dmi_write(batch, DMI_ABSTRACTAUTO, 0);
+			/* data0 goes last, because reading it starts the next access. */
+			if (regs > 1)
+				riscv_batch_add_dmi_read(batch, DMI_DATA1);
+			riscv_batch_add_dmi_read(batch, DMI_DATA0);
+		}
+		size_t abstractcs_key = riscv_batch_add_dmi_read(batch, DMI_ABSTRACTCS);
+
+		select_dmi(target);
+		if (batch_run(target, batch) != ERROR_OK)
+			break;
+
+		bool dmi_busy = false;
+		for (size_t key = first_key; key <= abstractcs_key; key++) {
+			dmi_status_t status = get_field(riscv_batch_get_dmi_read(batch, key),
+					DTM_DMI_OP);
+			if (status == DMI_STATUS_BUSY)
+				dmi_busy = true;
+		}
+		uint32_t abstractcs = get_field(riscv_batch_get_dmi_read(batch,
+					abstractcs_key), DTM_DMI_DATA);
+
+		if (dmi_busy) {
+			/* Some of the scans were dropped, including possibly the one
+			 * that turns autoexec off again. */
+			increase_dmi_busy_delay(target);
+			dmi_write(target, DMI_ABSTRACTAUTO, 0);
+			if (wait_for_idle(target, &abstractcs) != ERROR_OK)
+				break;
+		} else if (get_field(abstractcs, DMI_ABSTRACTCS_BUSY) &&
+				wait_for_idle(target, &abstractcs) != ERROR_OK) {
+			break;
+		}
+
+		info->cmderr = get_field(abstractcs, DMI_ABSTRACTCS_CMDERR);
+		if (info->cmderr != 0) {
+			LOG_DEBUG("reading %s..%s failed; abstractcs=0x%x",
+					gdb_regno_name(first), gdb_regno_name(last), abstractcs);
+			dmi_write(target, DMI_ABSTRACTCS, set_field(0, DMI_ABSTRACTCS_CMDERR,
+						info->cmderr));
+			dmi_write(target, DMI_ABSTRACTAUTO, 0);
+		}
+
+		if (info->cmderr == CMDERR_BUSY) {
+			/* A data register was accessed while a command was running. */
+			delay_busy(info, RISCV_DELAY_ABSTRACT);
+			continue;
+		}
+		if (info->cmderr != 0) {
+			if (info->cmderr == CMDERR_NOT_SUPPORTED && !fpr) {
+				/* All GPRs can be read with abstract commands, so it's the
+				 * post-increment that isn't supported. */
+				info->abstract_postincrement_supported = false;
+				LOG_INFO("Disabling bulk register reads with abstract commands.");
+			}
+			break;
+		}
+		if (dmi_busy)
+			continue;
+
+		delay_success(info, RISCV_DELAY_ABSTRACT);
+		size_t key = first_key;
+		for (unsigned i = 0; i < count; i++) {
+			values[i] = 0;
+			if (regs > 1)
+				values[i] = get_field(riscv_batch_get_dmi_read(batch, key++),
+						DTM_DMI_DATA) << 32;
+			values[i] |= get_field(riscv_batch_get_dmi_read(batch, key++),
+					DTM_DMI_DATA);
+		}
+		result = ERROR_OK;
+		break;
+	}
+
+	riscv_batch_put(batch);
+	return result;
+}
+
 static int riscv013_set_register(struct target *target, int hid, int rid, uint64_t value)
 {
 	LOG_DEBUG("writing 0x%" PRIx64 " to register %s on hart %d", value,
@@ -2916,6 +3258,233 @@ static int riscv013_halt_current_hart(struct target *target)
 	return ERROR_OK;
 }
 
+/**
+ * Select each of the given harts of one DM in turn and read its dmstatus,
+ * all in a single batch. control is ORed into every dmcontrol write. When it
+ * includes hasel, hamask is written to the first hart array window, and
+ * count should be 1.
+ *
+ * The batch is repeated for as long as the DMI reports busy. Busy is sticky,
+ * so a successful final read means every access in the batch took effect.
+ */
+static int dm_select_and_read_dmstatus(struct target *target,
+		const int *hartids, unsigned count, uint32_t control, uint32_t hamask,
+		uint32_t *dmstatus)
+{
+	RISCV013_INFO(info);
+	dm013_info_t *dm = get_dm(target);
+	time_t start = time(NULL);
+
+	while (1) {
+		struct riscv_batch *batch = riscv_batch_get(target, 3 * count + 2,
+				info->dmi_busy_delay);
+		size_t keys[count];
+
+		if (control & DMI_DMCONTROL_HASEL) {
+			riscv_batch_add_dmi_write(batch, DMI_HAWINDOWSEL, 0);
+			riscv_batch_add_dmi_write(batch, DMI_HAWINDOW, hamask);
+		}
+		for (unsigned i = 0; i < count; i++) {
+			riscv_batch_add_dmi_write(batch, DMI_DMCONTROL,
+					set_hartsel(DMI_DMCONTROL_DMACTIVE | control, hartids[i]));
+			keys[i] = riscv_batch_add_dmi_read(batch, DMI_DMSTATUS);
+		}
+
+		select_dmi(target);
+		int result = batch_run(target, batch);
+		bool busy = false;
+		for (unsigned i = 0; result == ERROR_OK && i < count; i++) {
+			uint64_t dmi_out = riscv_batch_get_dmi_read(batch, keys[i]);
+			dmi_status_t status = get_field(dmi_out, DTM_DMI_OP);
+			if (status == DMI_STATUS_BUSY) {
+				busy = true;
+			} else if (status != DMI_STATUS_SUCCESS) {
+				LOG_ERROR("failed read of dmstatus for hart %d, status=%d",
+						hartids[i], status);
+				result = ERROR_FAIL;
+			}
+			dmstatus[i] = get_field(dmi_out, DTM_DMI_DATA);
+		}
+		riscv_batch_put(batch);
+
+		if (result == ERROR_OK && !busy) {
+			dm->current_hartid = hartids[count - 1];
+			return ERROR_OK;
+		}
+		dm->current_hartid = -1;
+		if (result != ERROR_OK)
+			return result;
+
+		increase_dmi_busy_delay(target);
+		if (time(NULL) - start > riscv_command_timeout_sec) {
+			LOG_ERROR("DMI stayed busy for %d seconds. You could increase the "
+					"timeout with riscv set_command_timeout_sec.",
+					riscv_command_timeout_sec);
+			return ERROR_FAIL;
+		}
+	}
+}
+
+/**
+ * Send a halt or resume request to several harts of one DM and wait until
+ * all of them acknowledge it in dmstatus. If the DM implements the hart array
+ * mask all harts are selected together, so each step is a single dmcontrol
+ * write and dmstatus read no matter how many harts there are.
+ */
+static int dm_group_request(struct target *target, const int *hartids,
+		unsigned count, uint32_t request, uint32_t ack)
+{
+	dm013_info_t *dm = get_dm(target);
+	const char *what = request == DMI_DMCONTROL_HALTREQ ? "halt" : "resume";
+
+	bool use_hasel = dm->hasel_supported && count > 1;
+	uint32_t hamask = 0;
+	for (unsigned i = 0; i < count; i++) {
+		if (hartids[i] >= 32)
+			use_hasel = false;
+		else
+			hamask |= 1U << hartids[i];
+	}
+	uint32_t control = use_hasel ? DMI_DMCONTROL_HASEL : 0;
+	unsigned selections = use_hasel ? 1 : count;
+
+	int pending[selections];
+	uint32_t dmstatus[selections];
+	memcpy(pending, hartids, sizeof(pending));
+	unsigned left = selections;
+
+	/* A halt request has to stay set until the hart halts, but a resume
+	 * request must only be made once. */
+	uint32_t command = request;
+	time_t start = time(NULL);
+	while (left > 0) {
+		LOG_DEBUG("%s: %d hart(s) pending, first %d", what, left, pending[0]);
+		if (dm_select_and_read_dmstatus(target, pending, left,
+					control | command, hamask, dmstatus) != ERROR_OK)
+			return ERROR_FAIL;
+		command &= DMI_DMCONTROL_HALTREQ;
+
+		unsigned still = 0;
+		for (unsigned i = 0; i < left; i++) {
+			if (get_field(dmstatus[i], ack))
+				continue;
+			pending[still] = pending[i];
+			dmstatus[still] = dmstatus[i];
+			still++;
+		}
+		left = still;
+
+		if (left > 0 && time(NULL) - start > riscv_command_timeout_sec) {
+			LOG_ERROR("unable to %s hart %d (dmstatus=0x%08x)", what,
+					pending[0], dmstatus[0]);
+			return ERROR_FAIL;
+		}
+	}
+
+	if (request == DMI_DMCONTROL_HALTREQ) {
+		memcpy(pending, hartids, sizeof(pending));
+		if (dm_select_and_read_dmstatus(target, pending, selections, control,
+					hamask, dmstatus) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	if (use_hasel) {
+		if (dmi_write(target, DMI_DMCONTROL,
+					set_hartsel(DMI_DMCONTROL_DMACTIVE, hartids[0])) != ERROR_OK)
+			return ERROR_FAIL;
+		dm->current_hartid = hartids[0];
+	}
+
+	return ERROR_OK;
+}
+
+/* Collect the targets that share a DM with targets[first] and have not been
+ * handled yet, together with their current hart ids. */
+static unsigned dm_group(struct target **targets, unsigned count,
+		unsigned first, bool *done, unsigned *group, int *hartids)
+{
+	dm013_info_t *dm = get_dm(targets[first]);
+	unsigned n = 0;
+
+	for (unsigned i = first; i < count; i++) {
+		if (done[i] || get_dm(targets[i]) != dm)
+			continue;
+		done[i] = true;
+		group[n] = i;
+		hartids[n] = riscv_current_hartid(targets[i]);
+		n++;
+	}
+	return n;
+}
+
+static int riscv013_poll_targets(struct target **targets, unsigned count,
+		bool *halted)
+{
+	bool done[count];
+	unsigned group[count];
+	int hartids[count];
+	uint32_t dmstatus[count];
+
+	memset(done, 0, sizeof(done));
+	for (unsigned first = 0; first < count; first++) {
+		if (done[first])
+			continue;
+		unsigned n = dm_group(targets, count, first, done, group, hartids);
+		if (dm_select_and_read_dmstatus(targets[first], hartids, n, 0, 0,
+					dmstatus) != ERROR_OK)
+			return ERROR_FAIL;
+
+		for (unsigned i = 0; i < n; i++) {
+			struct target *t = targets[group[i]];
+			if (get_field(dmstatus[i], DMI_DMSTATUS_ANYHAVERESET)) {
+				/* Let the single hart path report and acknowledge the
+				 * reset. */
+				if (riscv_set_current_hartid(t, hartids[i]) != ERROR_OK)
+					return ERROR_FAIL;
+				halted[group[i]] = riscv_is_halted(t);
+				continue;
+			}
+			if (get_field(dmstatus[i], DMI_DMSTATUS_ANYUNAVAIL))
+				LOG_ERROR("Hart %d is unavailable.", hartids[i]);
+			if (get_field(dmstatus[i], DMI_DMSTATUS_ANYNONEXISTENT))
+				LOG_ERROR("Hart %d doesn't exist.", hartids[i]);
+			halted[group[i]] = get_field(dmstatus[i], DMI_DMSTATUS_ALLHALTED);
+		}
+	}
+	return ERROR_OK;
+}
+
+static int riscv013_request_targets(struct target **targets, unsigned count,
+		uint32_t request, uint32_t ack)
+{
+	bool done[count];
+	unsigned group[count];
+	int hartids[count];
+	int result = ERROR_OK;
+
+	memset(done, 0, sizeof(done));
+	for (unsigned first = 0; first < count; first++) {
+		if (done[first])
+			continue;
+		unsigned n = dm_group(targets, count, first, done, group, hartids);
+		if (dm_group_request(targets[first], hartids, n, request, ack) != ERROR_OK)
+			result = ERROR_FAIL;
+	}
+	return result;
+}
+
+static int riscv013_halt_targets(struct target **targets, unsigned count)
+{
+	return riscv013_request_targets(targets, count, DMI_DMCONTROL_HALTREQ,
+			DMI_DMSTATUS_ALLHALTED);
+}
+
+static int riscv013_resume_targets(struct target **targets, unsigned count)
+{
+	return riscv013_request_targets(targets, count, DMI_DMCONTROL_RESUMEREQ,
+			DMI_DMSTATUS_ALLRESUMEACK);
+}
+
 static int riscv013_resume_current_hart(struct target *target)
 {
 	return riscv013_step_or_resume_current_hart(target, false);
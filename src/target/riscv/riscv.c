@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -15,6 +16,7 @@
 #include "target/breakpoints.h"
 #include "helper/time_support.h"
 #include "riscv.h"
+#include "batch.h"
 #include "gdb_regs.h"
 #include "rtos/rtos.h"
 
@@ -295,6 +297,7 @@ static void riscv_deinit_target(struct target *target)
 		tt->deinit_target(target);
 		riscv_info_t *info = (riscv_info_t *) target->arch_info;
 		free(info->reg_names);
+		riscv_batch_pool_free(info->batch_pool);
 		free(info);
 	}
 
@@ -871,6 +874,13 @@ static int old_or_new_riscv_resume(
 ){
 	LOG_DEBUG("handle_breakpoints=%d", handle_breakpoints);
 	if (target->smp) {
+		bool all_new = true;
+		for (struct target_list *list = target->head; list; list = list->next)
+			if (riscv_info(list->target)->is_halted == NULL)
+				all_new = false;
+		if (all_new)
+			return riscv_openocd_resume_smp(target, current, address);
+
 		struct target_list *targets = target->head;
 		int result = ERROR_OK;
 		while (targets) {
@@ -926,6 +936,55 @@ static int riscv_write_memory(struct target *target, target_addr_t address,
 	return tt->write_memory(target, address, size, count, buffer);
 }
 
+static void riscv_cache_register_range(struct target *target,
+		int first, int last)
+{
+	RISCV_INFO(r);
+	struct reg *reg_list = target->reg_cache->reg_list;
+
+	/* Don't read again what's already cached. */
+	while (first <= last && reg_list[first].valid)
+		first++;
+	while (last >= first && reg_list[last].valid)
+		last--;
+	if (first > last)
+		return;
+
+	unsigned count = last - first + 1;
+	riscv_reg_t values[count];
+	if (r->read_registers(target, values, riscv_current_hartid(target), first,
+				count) != ERROR_OK)
+		return;
+
+	for (unsigned i = 0; i < count; i++) {
+		struct reg *reg = &reg_list[first + i];
+		if (reg->valid)
+			continue;
+		buf_set_u64(reg->value, 0, reg->size, values[i]);
+		reg->valid = true;
+	}
+}
+
+/* Fill the register cache of a halted hart with its GPRs, and optionally its
+ * FPRs, using bulk reads where the debug spec implementation supports them.
+ * Whatever can't be read that way is left for register_get() to read one
+ * register at a time. CSRs are not read here: register_get() treats them as
+ * changing at any time and never caches them, and the PC comes from dpc,
+ * which is too far from the GPRs to share their post-incrementing command. */
+static void riscv_cache_registers(struct target *target, bool fprs)
+{
+	RISCV_INFO(r);
+	int hartid = riscv_current_hartid(target);
+
+	if (!r->read_registers || !target->reg_cache)
+		return;
+
+	riscv_cache_register_range(target, GDB_REGNO_ZERO, GDB_REGNO_XPR31);
+	if (fprs && (riscv_supports_extension(target, hartid, 'F') ||
+				riscv_supports_extension(target, hartid, 'D')))
+		riscv_cache_register_range(target, GDB_REGNO_FPR0, GDB_REGNO_FPR31);
+}
+
 static int riscv_get_gdb_reg_list_internal(struct target *target,
 		struct reg **reg_list[], int *reg_list_size,
 		enum target_register_class reg_class, bool read)
@@ -958,6 +1017,9 @@ static int riscv_get_gdb_reg_list_internal(struct target *target,
 	if (!*reg_list)
 		return ERROR_FAIL;
 
+	if (read && target->state == TARGET_HALTED)
+		riscv_cache_registers(target, reg_class == REG_CLASS_ALL);
+
 	for (int i = 0; i < *reg_list_size; i++) {
 		assert(!target->reg_cache->reg_list[i].valid ||
 				target->reg_cache->reg_list[i].size > 0);
@@ -1187,6 +1249,95 @@ int set_debug_reason(struct target *target, int hartid)
 	return ERROR_OK;
 }
 
+/* Returns the info whose *_targets operations can handle all of targets at
+ * once, or NULL if they don't all share one implementation of them. */
+static riscv_info_t *riscv_group_info(struct target **targets, unsigned count)
+{
+	riscv_info_t *r = riscv_info(targets[0]);
+	if (!r->poll_targets)
+		return NULL;
+	for (unsigned i = 1; i < count; i++)
+		if (riscv_info(targets[i])->poll_targets != r->poll_targets)
+			return NULL;
+	return r;
+}
+
+static int riscv_poll_targets(struct target **targets, unsigned count,
+		bool *halted)
+{
+	if (count == 0)
+		return ERROR_OK;
+
+	riscv_info_t *group = riscv_group_info(targets, count);
+	if (group)
+		return group->poll_targets(targets, count, halted);
+
+	for (unsigned i = 0; i < count; i++) {
+		struct target *t = targets[i];
+		if (riscv_set_current_hartid(t, riscv_current_hartid(t)) != ERROR_OK)
+			return ERROR_FAIL;
+		halted[i] = riscv_is_halted(t);
+	}
+	return ERROR_OK;
+}
+
+static int riscv_halt_targets(struct target **targets, unsigned count)
+{
+	if (count == 0)
+		return ERROR_OK;
+
+	riscv_info_t *group = riscv_group_info(targets, count);
+	if (!group) {
+		int result = ERROR_OK;
+		for (unsigned i = 0; i < count; i++)
+			if (riscv_halt_all_harts(targets[i]) != ERROR_OK)
+				result = ERROR_FAIL;
+		return result;
+	}
+
+	int result = group->halt_targets(targets, count);
+	for (unsigned i = 0; i < count; i++)
+		riscv_invalidate_register_cache(targets[i]);
+	return result;
+}
+
+static int riscv_resume_targets(struct target **targets, unsigned count)
+{
+	if (count == 0)
+		return ERROR_OK;
+
+	riscv_info_t *group = riscv_group_info(targets, count);
+	if (!group) {
+		int result = ERROR_OK;
+		for (unsigned i = 0; i < count; i++)
+			if (riscv_resume_all_harts(targets[i]) != ERROR_OK)
+				result = ERROR_FAIL;
+		return result;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		struct target *t = targets[i];
+		riscv_info_t *r = riscv_info(t);
+		if (riscv_set_current_hartid(t, r->current_hartid) != ERROR_OK)
+			return ERROR_FAIL;
+		if (r->on_resume(t) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	int result = group->resume_targets(targets, count);
+	for (unsigned i = 0; i < count; i++)
+		riscv_invalidate_register_cache(targets[i]);
+	return result;
+}
+
+static unsigned riscv_smp_count(struct target *target)
+{
+	unsigned count = 0;
+	for (struct target_list *list = target->head; list; list = list->next)
+		count++;
+	return count;
+}
+
 /*** OpenOCD Interface ***/
 int riscv_openocd_poll(struct target *target)
 {
@@ -1223,45 +1374,54 @@ int riscv_openocd_poll(struct target *target)
 			riscv_halt_one_hart(target, i);
 
 	} else if (target->smp) {
-		bool halt_discovered = false;
-		bool newly_halted[128] = {0};
+		/* Poll, and if necessary halt, the whole group together. */
+		unsigned count = riscv_smp_count(target);
+		struct target *targets[count];
+		bool halted[count];
+		bool newly_halted[count];
 		unsigned i = 0;
 		for (struct target_list *list = target->head; list != NULL;
 				list = list->next, i++) {
-			struct target *t = list->target;
+			targets[i] = list->target;
+			newly_halted[i] = false;
+		}
+
+		if (riscv_poll_targets(targets, count, halted) != ERROR_OK)
+			return ERROR_FAIL;
+
+		bool halt_discovered = false;
+		for (i = 0; i < count; i++) {
+			struct target *t = targets[i];
 			riscv_info_t *r = riscv_info(t);
-			assert(i < DIM(newly_halted));
-			enum riscv_poll_hart out = riscv_poll_hart(t, r->current_hartid);
-			switch (out) {
-				case RPH_NO_CHANGE:
-					break;
-				case RPH_DISCOVERED_RUNNING:
-					t->state = TARGET_RUNNING;
-					break;
-				case RPH_DISCOVERED_HALTED:
-					halt_discovered = true;
-					newly_halted[i] = true;
-					t->state = TARGET_HALTED;
-					if (set_debug_reason(t, r->current_hartid) != ERROR_OK)
-						return ERROR_FAIL;
-					break;
-				case RPH_ERROR:
+			LOG_DEBUG("hart %d halted=%d, target->state=%d",
+					r->current_hartid, halted[i], t->state);
+			if (t->state != TARGET_HALTED && halted[i]) {
+				r->on_halt(t);
+				halt_discovered = true;
+				newly_halted[i] = true;
+				t->state = TARGET_HALTED;
+				if (set_debug_reason(t, r->current_hartid) != ERROR_OK)
 					return ERROR_FAIL;
+			} else if (t->state != TARGET_RUNNING && !halted[i]) {
+				t->state = TARGET_RUNNING;
 			}
 		}
 
 		if (halt_discovered) {
 			LOG_DEBUG("Halt other targets in this SMP group.");
-			i = 0;
-			for (struct target_list *list = target->head; list != NULL;
-					list = list->next, i++) {
-				struct target *t = list->target;
-				riscv_info_t *r = riscv_info(t);
+			struct target *running[count];
+			unsigned running_count = 0;
+			for (i = 0; i < count; i++)
+				if (targets[i]->state != TARGET_HALTED)
+					running[running_count++] = targets[i];
+			if (riscv_halt_targets(running, running_count) != ERROR_OK)
+				return ERROR_FAIL;
+
+			for (i = 0; i < count; i++) {
+				struct target *t = targets[i];
 				if (t->state != TARGET_HALTED) {
-					if (riscv_halt_one_hart(t, r->current_hartid) != ERROR_OK)
-						return ERROR_FAIL;
 					t->state = TARGET_HALTED;
-					if (set_debug_reason(t, r->current_hartid) != ERROR_OK)
+					if (set_debug_reason(t, riscv_current_hartid(t)) != ERROR_OK)
 						return ERROR_FAIL;
 					newly_halted[i] = true;
 				}
@@ -1269,12 +1429,11 @@ int riscv_openocd_poll(struct target *target)
 
 			/* Now that we have all our ducks in a row, tell the higher layers
 			 * what just happened. */
-			i = 0;
-			for (struct target_list *list = target->head; list != NULL;
-					list = list->next, i++) {
-				struct target *t = list->target;
-				if (newly_halted[i])
-					target_call_event_callbacks(t, TARGET_EVENT_HALTED);
+			for (i = 0; i < count; i++) {
+				if (newly_halted[i]) {
+					riscv_cache_registers(targets[i], false);
+					target_call_event_callbacks(targets[i], TARGET_EVENT_HALTED);
+				}
 			}
 		}
 		return ERROR_OK;
@@ -1309,6 +1468,7 @@ int riscv_openocd_poll(struct target *target)
 			return retval;
 	}
 
+	riscv_cache_registers(target, false);
 	target_call_event_callbacks(target, TARGET_EVENT_HALTED);
 	return ERROR_OK;
 }
@@ -1322,16 +1482,12 @@ int riscv_openocd_halt(struct target *target)
 
 	if (target->smp) {
 		LOG_DEBUG("Halt other targets in this SMP group.");
-		struct target_list *targets = target->head;
-		result = ERROR_OK;
-		while (targets) {
-			struct target *t = targets->target;
-			targets = targets->next;
-			if (t->state != TARGET_HALTED) {
-				if (riscv_halt_all_harts(t) != ERROR_OK)
-					result = ERROR_FAIL;
-			}
-		}
+		struct target *targets[riscv_smp_count(target)];
+		unsigned count = 0;
+		for (struct target_list *list = target->head; list; list = list->next)
+			if (list->target->state != TARGET_HALTED)
+				targets[count++] = list->target;
+		result = riscv_halt_targets(targets, count);
 	} else {
 		result = riscv_halt_all_harts(target);
 	}
@@ -1347,16 +1503,15 @@ int riscv_openocd_halt(struct target *target)
 
 	target->state = TARGET_HALTED;
 	target->debug_reason = DBG_REASON_DBGRQ;
+	riscv_cache_registers(target, false);
 	target_call_event_callbacks(target, TARGET_EVENT_HALTED);
 	return result;
 }
 
-int riscv_openocd_resume(
-		struct target *target,
-		int current,
-		target_addr_t address,
-		int handle_breakpoints,
-		int debug_execution)
+/* Get target ready to be resumed: set the PC, and step off a watchpoint
+ * that caused the last halt. */
+static int riscv_prepare_resume(struct target *target, int current,
+		target_addr_t address)
 {
 	LOG_DEBUG("debug_reason=%d", target->debug_reason);
 
@@ -1401,18 +1556,63 @@ int riscv_openocd_resume(
 			return result;
 	}
 
-	int out = riscv_resume_all_harts(target);
+	return ERROR_OK;
+}
+
+static void riscv_resumed(struct target *target)
+{
+	register_cache_invalidate(target->reg_cache);
+	target->state = TARGET_RUNNING;
+	target_call_event_callbacks(target, TARGET_EVENT_RESUMED);
+}
+
+int riscv_openocd_resume(
+		struct target *target,
+		int current,
+		target_addr_t address,
+		int handle_breakpoints,
+		int debug_execution)
+{
+	int out = riscv_prepare_resume(target, current, address);
+	if (out != ERROR_OK)
+		return out;
+
+	out = riscv_resume_all_harts(target);
 	if (out != ERROR_OK) {
 		LOG_ERROR("unable to resume all harts");
 		return out;
 	}
 
-	register_cache_invalidate(target->reg_cache);
-	target->state = TARGET_RUNNING;
-	target_call_event_callbacks(target, TARGET_EVENT_RESUMED);
+	riscv_resumed(target);
 	return out;
 }
 
+/* Resume all the targets of an SMP group together. */
+int riscv_openocd_resume_smp(struct target *target, int current,
+		target_addr_t address)
+{
+	struct target *targets[riscv_smp_count(target)];
+	unsigned count = 0;
+	for (struct target_list *list = target->head; list; list = list->next) {
+		struct target *t = list->target;
+		if (t->state != TARGET_HALTED)
+			continue;
+		if (riscv_prepare_resume(t, current, address) != ERROR_OK)
+			return ERROR_FAIL;
+		targets[count++] = t;
+	}
+
+	int out = riscv_resume_targets(targets, count);
+	if (out != ERROR_OK) {
+		LOG_ERROR("unable to resume all harts");
+		return out;
+	}
+
+	for (unsigned i = 0; i < count; i++)
+		riscv_resumed(targets[i]);
+	return ERROR_OK;
+}
+
 int riscv_openocd_step(
 		struct target *target,
 		int current,
@@ -1435,6 +1635,7 @@ int riscv_openocd_step(
 	target_call_event_callbacks(target, TARGET_EVENT_RESUMED);
 	target->state = TARGET_HALTED;
 	target->debug_reason = DBG_REASON_SINGLESTEP;
+	riscv_cache_registers(target, false);
 	target_call_event_callbacks(target, TARGET_EVENT_HALTED);
 	return out;
 }
@@ -1754,6 +1955,126 @@ COMMAND_HANDLER(riscv_reset_delays)
 	return ERROR_OK;
 }
 
+static const char * const riscv_delay_names[RISCV_DELAY_CLASSES] = {
+	"dmi", "abstract", "progbuf"
+};
+
+COMMAND_HANDLER(riscv_delays)
+{
+	if (CMD_ARGC != 0) {
+		LOG_ERROR("Command takes no parameters");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+	if (!r->get_delays) {
+		LOG_ERROR("get_delays is not implemented for this target.");
+		return ERROR_FAIL;
+	}
+
+	struct riscv_delay_state delays[RISCV_DELAY_CLASSES];
+	int result = r->get_delays(target, delays);
+	if (result != ERROR_OK)
+		return result;
+
+	for (unsigned c = 0; c < RISCV_DELAY_CLASSES; c++)
+		command_print(CMD, "%-8s %u%s", riscv_delay_names[c], delays[c].value,
+				delays[c].converged ? "" : " (tuning)");
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_delays)
+{
+	if (CMD_ARGC != RISCV_DELAY_CLASSES) {
+		LOG_ERROR("Command takes exactly %d arguments", RISCV_DELAY_CLASSES);
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+	if (!r) {
+		LOG_ERROR("Target has not been initialized");
+		return ERROR_FAIL;
+	}
+
+	for (unsigned c = 0; c < RISCV_DELAY_CLASSES; c++)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[c], r->preset_delays[c]);
+
+	if (r->set_delays && r->version_specific)
+		return r->set_delays(target, r->preset_delays);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_save_delays)
+{
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 argument");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+	if (!r->get_delays) {
+		LOG_ERROR("get_delays is not implemented for this target.");
+		return ERROR_FAIL;
+	}
+
+	struct riscv_delay_state delays[RISCV_DELAY_CLASSES];
+	int result = r->get_delays(target, delays);
+	if (result != ERROR_OK)
+		return result;
+
+	FILE *f = fopen(CMD_ARGV[0], "w");
+	if (!f) {
+		LOG_ERROR("Can't open %s: %s", CMD_ARGV[0], strerror(errno));
+		return ERROR_FAIL;
+	}
+	fprintf(f, "# Run-Test/Idle delays learned for %s\n", target_name(target));
+	fprintf(f, "%s riscv set_delays %u %u %u\n", target_name(target),
+			delays[RISCV_DELAY_DMI].value, delays[RISCV_DELAY_ABSTRACT].value,
+			delays[RISCV_DELAY_PROGBUF].value);
+	if (fclose(f) != 0) {
+		LOG_ERROR("Can't write %s: %s", CMD_ARGV[0], strerror(errno));
+		return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_batch_stats)
+{
+	if (CMD_ARGC > 1) {
+		LOG_ERROR("Command takes at most one parameter");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+	struct riscv_batch_pool *pool = r->batch_pool;
+	if (!pool) {
+		command_print(CMD, "no batches have been run");
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "reset") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		riscv_batch_pool_reset_stats(pool);
+		return ERROR_OK;
+	}
+
+	uint64_t runs = pool->runs ? pool->runs : 1;
+	command_print(CMD, "batches %" PRIu64 " scans %" PRIu64 " (%.1f per batch)",
+			pool->runs, pool->scans, (double) pool->scans / runs);
+	command_print(CMD, "busy retries %" PRIu64 " (%.3f per batch)",
+			pool->busy_runs, (double) pool->busy_runs / runs);
+	command_print(CMD, "allocated %" PRIu64 " reused %" PRIu64,
+			pool->allocations, pool->reuses);
+	command_print(CMD, "preferred length %zu%s", pool->preferred_scans,
+			pool->converged ? "" : " (tuning)");
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(riscv_set_ir)
 {
 	if (CMD_ARGC != 2) {
@@ -1877,6 +2198,39 @@ static const struct command_registration riscv_exec_command_handlers[] = {
 			"command resets those learned values after `wait` scans. It's only "
 			"useful for testing OpenOCD itself."
 	},
+	{
+		.name = "delays",
+		.handler = riscv_delays,
+		.mode = COMMAND_EXEC,
+		.usage = "riscv delays",
+		.help = "Display the Run-Test/Idle delays currently used after DMI "
+			"accesses, abstract commands and program buffer executions."
+	},
+	{
+		.name = "set_delays",
+		.handler = riscv_set_delays,
+		.mode = COMMAND_ANY,
+		.usage = "riscv set_delays dmi abstract progbuf",
+		.help = "Set the Run-Test/Idle delays to start from, e.g. as learned "
+			"in an earlier session. They are still tuned from there."
+	},
+	{
+		.name = "save_delays",
+		.handler = riscv_save_delays,
+		.mode = COMMAND_EXEC,
+		.usage = "riscv save_delays filename",
+		.help = "Write the current Run-Test/Idle delays to a file as a "
+			"set_delays command that can be sourced in a later session."
+	},
+	{
+		.name = "batch_stats",
+		.handler = riscv_batch_stats,
+		.mode = COMMAND_EXEC,
+		.usage = "riscv batch_stats ['reset']",
+		.help = "Display or reset statistics about the batches of DMI scans "
+			"used for bulk transfers, and the batch length learned for the "
+			"adapter."
+	},
 	{
 		.name = "set_ir",
 		.handler = riscv_set_ir,
@@ -2,6 +2,7 @@
 #define RISCV_H
 
 struct riscv_program;
+struct riscv_batch_pool;
 
 #include <stdint.h>
 #include "opcodes.h"
@@ -35,6 +36,21 @@ enum riscv_halt_reason {
 	RISCV_HALT_ERROR
 };
 
+/* Classes of debug operation that each need their own number of
+ * run-test/idle cycles before the target is ready for the next scan. */
+enum riscv_delay_class {
+	RISCV_DELAY_DMI,
+	RISCV_DELAY_ABSTRACT,
+	RISCV_DELAY_PROGBUF,
+	RISCV_DELAY_CLASSES
+};
+
+struct riscv_delay_state {
+	unsigned int value;
+	/* True when the value is the smallest one not known to be too short. */
+	bool converged;
+};
+
 typedef struct {
 	struct target *target;
 	unsigned custom_number;
@@ -100,6 +116,13 @@ typedef struct {
 	 * delays, causing them to be relearned. Used for testing. */
 	int reset_delays_wait;
 
+	/* Delays to start from when the target is examined, so that a session
+	 * can reuse what an earlier one learned. Set with `riscv set_delays`. */
+	unsigned int preset_delays[RISCV_DELAY_CLASSES];
+
+	/* Batches kept for reuse, allocated on first use. */
+	struct riscv_batch_pool *batch_pool;
+
 	/* Helper functions that target the various RISC-V debug spec
 	 * implementations. */
 	int (*get_register)(struct target *target,
@@ -134,6 +157,22 @@ typedef struct {
 			uint32_t num_words, target_addr_t illegal_address, bool run_sbbusyerror_test);
 
 	int (*test_compliance)(struct target *target);
+
+	int (*get_delays)(struct target *target, struct riscv_delay_state *delays);
+	int (*set_delays)(struct target *target, const unsigned int *delays);
+
+	/* Optional. Poll, halt or resume the current hart of every one of the
+	 * given targets, which all use this same implementation, with a few
+	 * batched DMI round trips instead of several per hart. */
+	int (*poll_targets)(struct target **targets, unsigned count, bool *halted);
+	int (*halt_targets)(struct target **targets, unsigned count);
+	int (*resume_targets)(struct target **targets, unsigned count);
+
+	/* Optional. Read count consecutive GPRs or FPRs, starting at first, in
+	 * one go. Returns ERROR_FAIL if any of them couldn't be read this way, in
+	 * which case the caller should read them one at a time. */
+	int (*read_registers)(struct target *target, riscv_reg_t *values,
+			int hartid, enum gdb_regno first, unsigned count);
 } riscv_info_t;
 
 /* Wall-clock timeout for a command/access. Settable via RISC-V Target commands.*/
@@ -171,6 +210,12 @@ int riscv_openocd_resume(
 	int debug_execution
 );
 
+int riscv_openocd_resume_smp(
+	struct target *target,
+	int current,
+	target_addr_t address
+);
+
 int riscv_openocd_step(
 	struct target *target,
 	int current,
@@ -51,6 +51,10 @@
 #include "breakpoints.h"
 #include "register.h"
 #include "trace.h"
+#include "bench.h"
+#include "profstream.h"
+#include "memcache.h"
+#include "tlbcache.h"
 #include "image.h"
 #include "rtos/rtos.h"
 #include "transport/transport.h"
@@ -623,6 +627,9 @@ int target_resume(struct target *target, int current, target_addr_t address,
 
 	target_call_event_callbacks(target, TARGET_EVENT_RESUME_START);
 
+	target_memcache_invalidate_all();
+	target_tlbcache_invalidate_all();
+
 	/* note that resume *must* be asynchronous. The CPU can halt before
 	 * we poll. The CPU can even halt at the current PC as a result of
 	 * a software breakpoint being inserted by (a bug?) the application.
@@ -651,6 +658,9 @@ static int target_process_reset(struct command_invocation *cmd, enum target_rese
 	for (target = all_targets; target; target = target->next)
 		target_call_reset_callbacks(target, reset_mode);
 
+	target_memcache_invalidate_all();
+	target_tlbcache_invalidate_all();
+
 	/* disable polling during reset to make reset event scripts
 	 * more predictable, i.e. dr/irscan & pathmove in events will
 	 * not have JTAG operations injected into the middle of a sequence.
@@ -1121,6 +1131,7 @@ int target_write_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	target_memcache_invalidate_all();
 	return target->type->write_memory(target, address, size, count, buffer);
 }
 
@@ -1135,6 +1146,7 @@ int target_write_phys_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_phys_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	target_memcache_invalidate_all();
 	return target->type->write_phys_memory(target, address, size, count, buffer);
 }
 
@@ -1249,6 +1261,9 @@ bool target_supports_gdb_connection(struct target *target)
 int target_step(struct target *target,
 		int current, target_addr_t address, int handle_breakpoints)
 {
+	target_memcache_invalidate_all();
+	target_tlbcache_invalidate_all();
+
 	return target->type->step(target, current, address, handle_breakpoints);
 }
 
@@ -1587,7 +1602,7 @@ int target_unregister_timer_callback(int (*callback)(void *priv), void *priv)
 
 	for (struct target_timer_callback *c = target_timer_callbacks;
 	     c; c = c->next) {
-		if ((c->callback == callback) && (c->priv == priv)) {
+		if ((c->callback == callback) && (c->priv == priv) && !c->removed) {
 			c->removed = true;
 			return ERROR_OK;
 		}
@@ -1610,6 +1625,21 @@ int target_call_event_callbacks(struct target *target, enum target_event event)
 			Jim_Nvp_value2name_simple(nvp_target_event, event)->name,
 			target_name(target));
 
+	switch (event) {
+	case TARGET_EVENT_HALTED:
+	case TARGET_EVENT_RESUMED:
+	case TARGET_EVENT_DEBUG_HALTED:
+	case TARGET_EVENT_DEBUG_RESUMED:
+	case TARGET_EVENT_RESET_ASSERT:
+	case TARGET_EVENT_RESET_END:
+		/* memory and page tables may have changed behind our back */
+		target_memcache_invalidate_all();
+		target_tlbcache_invalidate_all();
+		break;
+	default:
+		break;
+	}
+
 	target_handle_event(target, event);
 
 	while (callback) {
@@ -2042,6 +2072,9 @@ static void target_destroy(struct target *target)
 		target->smp = 0;
 	}
 
+	target_memcache_free(target);
+	target_tlbcache_free(target);
+
 	free(target->gdb_port_override);
 	free(target->type);
 	free(target->trace_info);
@@ -2183,6 +2216,8 @@ int target_write_buffer(struct target *target, target_addr_t address, uint32_t s
 		return ERROR_FAIL;
 	}
 
+	target_memcache_invalidate_all();
+
 	return target->type->write_buffer(target, address, size, buffer);
 }
 
@@ -2245,6 +2280,9 @@ int target_read_buffer(struct target *target, target_addr_t address, uint32_t si
 		return ERROR_FAIL;
 	}
 
+	if (target_memcache_covers(target, address, size))
+		return target_memcache_read(target, address, size, buffer);
+
 	return target->type->read_buffer(target, address, size, buffer);
 }
 
@@ -5302,6 +5340,12 @@ static const struct command_registration target_instance_command_handlers[] = {
 			"from target memory",
 		.usage = "arrayname bitwidth address count",
 	},
+	{
+		.chain = memcache_command_handlers,
+	},
+	{
+		.chain = tlbcache_command_handlers,
+	},
 	{
 		.name = "eventlist",
 		.handler = handle_target_event_list,
@@ -5496,6 +5540,9 @@ static int target_create(Jim_GetOptInfo *goi)
 
 	target->gdb_port_override = NULL;
 
+	target->memcache = NULL;
+	target->tlbcache = NULL;
+
 	/* Do the rest as "configure" options */
 	goi->isconfigure = 1;
 	e = target_configure(goi, target);
@@ -6409,6 +6456,14 @@ static int target_register_user_commands(struct command_context *cmd_ctx)
 	if (retval != ERROR_OK)
 		return retval;
 
+	retval = bench_register_commands(cmd_ctx);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = profstream_register_commands(cmd_ctx);
+	if (retval != ERROR_OK)
+		return retval;
+
 
 	return register_commands(cmd_ctx, NULL, target_exec_command_handlers);
 }
@@ -212,6 +212,12 @@ struct target {
 
 	/* The semihosting information, extracted from the target. */
 	struct semihosting *semihosting;
+
+	/* Memory read cache, valid while the target is halted; NULL until configured */
+	struct target_memcache *memcache;
+
+	/* Cached virtual to physical address translations; NULL until first used */
+	struct target_tlbcache *tlbcache;
 };
 
 struct target_list {
@@ -292,6 +292,13 @@ struct target_type {
 	int (*profiling)(struct target *target, uint32_t *samples,
 			uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds);
 
+	/* read PC samples without stopping the target, for background
+	 * profiling; returns ERROR_TARGET_RESOURCE_NOT_AVAILABLE when the
+	 * target cannot be sampled that way
+	 */
+	int (*sample_pc)(struct target *target, uint32_t *samples,
+			uint32_t max_num_samples, uint32_t *num_samples);
+
 	/* Return the number of address bits this target supports. This will
 	 * typically be 32 for 32-bit targets, and 64 for 64-bit targets. If not
 	 * implemented, it's assumed to be 32. */
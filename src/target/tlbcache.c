@@ -0,0 +1,261 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/**
+ * @file
+ * Host side cache of virtual to physical address translations.
+ *
+ * Translating an address costs a page table walk in target memory or a
+ * sequence of debug instructions, and accesses to virtual memory usually
+ * come in runs within the same few pages. Translations are remembered per
+ * page, tagged with a context value chosen by the architecture code (the
+ * translation table base, or the translation regime of the current mode)
+ * so that entries of different address spaces never alias.
+ *
+ * Like a hardware TLB, the cache is not kept coherent with the page tables
+ * in target memory. It is flushed whenever any target resumes, steps,
+ * halts or is reset, when the debugger writes a register that controls
+ * translation, and on request.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include "tlbcache.h"
+#include "target.h"
+
+#define TLBCACHE_NUM_ENTRIES	32
+
+struct tlbcache_entry {
+	bool valid;
+	uint64_t context;
+	target_addr_t va;
+	target_addr_t pa;
+	target_addr_t mask;
+	uint32_t attr;
+	uint64_t last_use;
+};
+
+struct target_tlbcache {
+	bool enabled;
+	uint64_t tick;
+	struct tlbcache_entry entries[TLBCACHE_NUM_ENTRIES];
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t flushes;
+};
+
+static struct target_tlbcache *tlbcache_get(struct target *target)
+{
+	if (target->tlbcache)
+		return target->tlbcache;
+
+	struct target_tlbcache *cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		LOG_ERROR("Out of memory");
+		return NULL;
+	}
+	cache->enabled = true;
+
+	target->tlbcache = cache;
+	return cache;
+}
+
+void target_tlbcache_invalidate(struct target *target)
+{
+	struct target_tlbcache *cache = target->tlbcache;
+	bool any = false;
+
+	if (!cache)
+		return;
+
+	for (unsigned int i = 0; i < TLBCACHE_NUM_ENTRIES; i++) {
+		if (cache->entries[i].valid) {
+			cache->entries[i].valid = false;
+			any = true;
+		}
+	}
+
+	if (any)
+		cache->flushes++;
+}
+
+void target_tlbcache_invalidate_all(void)
+{
+	for (struct target *target = all_targets; target; target = target->next)
+		target_tlbcache_invalidate(target);
+}
+
+void target_tlbcache_free(struct target *target)
+{
+	free(target->tlbcache);
+	target->tlbcache = NULL;
+}
+
+bool target_tlbcache_lookup(struct target *target, uint64_t context,
+		target_addr_t va, target_addr_t *pa, uint32_t *attr)
+{
+	struct target_tlbcache *cache = target->tlbcache;
+
+	if (!cache || !cache->enabled)
+		return false;
+
+	for (unsigned int i = 0; i < TLBCACHE_NUM_ENTRIES; i++) {
+		struct tlbcache_entry *entry = &cache->entries[i];
+
+		if (entry->valid && entry->context == context &&
+				(va & ~entry->mask) == entry->va) {
+			entry->last_use = ++cache->tick;
+			*pa = entry->pa | (va & entry->mask);
+			if (attr)
+				*attr = entry->attr;
+			cache->hits++;
+			return true;
+		}
+	}
+
+	cache->misses++;
+	return false;
+}
+
+void target_tlbcache_insert(struct target *target, uint64_t context,
+		target_addr_t va, target_addr_t pa, uint32_t page_size, uint32_t attr)
+{
+	struct target_tlbcache *cache = tlbcache_get(target);
+
+	if (!cache || !cache->enabled)
+		return;
+
+	assert(page_size && !(page_size & (page_size - 1)));
+
+	struct tlbcache_entry *victim = &cache->entries[0];
+	for (unsigned int i = 0; i < TLBCACHE_NUM_ENTRIES; i++) {
+		struct tlbcache_entry *entry = &cache->entries[i];
+		if (!entry->valid) {
+			victim = entry;
+			break;
+		}
+		if (entry->last_use < victim->last_use)
+			victim = entry;
+	}
+
+	victim->valid = true;
+	victim->context = context;
+	victim->mask = page_size - 1;
+	victim->va = va & ~victim->mask;
+	victim->pa = pa & ~victim->mask;
+	victim->attr = attr;
+	victim->last_use = ++cache->tick;
+}
+
+COMMAND_HANDLER(handle_tlbcache_enable_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target_tlbcache *cache = tlbcache_get(target);
+	if (!cache)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC == 1) {
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], cache->enabled);
+		if (!cache->enabled)
+			target_tlbcache_invalidate(target);
+	}
+
+	command_print(CMD, "address translation cache %s",
+			cache->enabled ? "enabled" : "disabled");
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_tlbcache_stats_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target_tlbcache *cache = target->tlbcache;
+	if (!cache)
+		return ERROR_OK;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "reset") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		cache->hits = 0;
+		cache->misses = 0;
+		cache->flushes = 0;
+		return ERROR_OK;
+	}
+
+	command_print(CMD, "hits %" PRIu64 " misses %" PRIu64 " flushes %" PRIu64,
+			cache->hits, cache->misses, cache->flushes);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_tlbcache_flush_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	target_tlbcache_invalidate(target);
+
+	return ERROR_OK;
+}
+
+static const struct command_registration tlbcache_subcommand_handlers[] = {
+	{
+		.name = "enable",
+		.handler = handle_tlbcache_enable_command,
+		.mode = COMMAND_ANY,
+		.help = "display or set whether address translations are cached",
+		.usage = "['on'|'off']",
+	},
+	{
+		.name = "stats",
+		.handler = handle_tlbcache_stats_command,
+		.mode = COMMAND_EXEC,
+		.help = "display or reset the cache statistics",
+		.usage = "['reset']",
+	},
+	{
+		.name = "flush",
+		.handler = handle_tlbcache_flush_command,
+		.mode = COMMAND_EXEC,
+		.help = "drop all cached address translations",
+		.usage = "",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+const struct command_registration tlbcache_command_handlers[] = {
+	{
+		.name = "tlbcache",
+		.mode = COMMAND_ANY,
+		.help = "host side cache of address translations",
+		.usage = "",
+		.chain = tlbcache_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
@@ -0,0 +1,34 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_TLBCACHE_H
+#define OPENOCD_TARGET_TLBCACHE_H
+
+#include <helper/command.h>
+
+struct target;
+struct target_tlbcache;
+
+extern const struct command_registration tlbcache_command_handlers[];
+
+bool target_tlbcache_lookup(struct target *target, uint64_t context,
+		target_addr_t va, target_addr_t *pa, uint32_t *attr);
+void target_tlbcache_insert(struct target *target, uint64_t context,
+		target_addr_t va, target_addr_t pa, uint32_t page_size, uint32_t attr);
+void target_tlbcache_invalidate(struct target *target);
+void target_tlbcache_invalidate_all(void);
+void target_tlbcache_free(struct target *target);
+
+#endif /* OPENOCD_TARGET_TLBCACHE_H */
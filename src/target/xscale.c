@@ -37,6 +37,7 @@
 #include "image.h"
 #include "arm_opcodes.h"
 #include "armv4_5.h"
+#include "tlbcache.h"
 
 /*
  * Important XScale documents available as of October 2009 include:
@@ -3565,6 +3566,8 @@ COMMAND_HANDLER(xscale_handle_cp15)
 
 		/* execute cpwait to ensure outstanding operations complete */
 		xscale_send_u32(target, 0x53);
+
+		target_tlbcache_invalidate(target);
 	} else
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
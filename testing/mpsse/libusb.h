@@ -0,0 +1,164 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/* Minimal stand-in for <libusb.h>, declaring only what mpsse.c uses. The functions are
+ * implemented by libusb_mock.c, which emulates a single FT2232H in MPSSE mode. */
+
+#ifndef OPENOCD_TESTING_MPSSE_LIBUSB_H
+#define OPENOCD_TESTING_MPSSE_LIBUSB_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#define LIBUSB_CALL
+
+#define LIBUSB_REQUEST_TYPE_VENDOR (0x02 << 5)
+#define LIBUSB_RECIPIENT_DEVICE 0x00
+
+enum libusb_error {
+	LIBUSB_SUCCESS = 0,
+	LIBUSB_ERROR_IO = -1,
+	LIBUSB_ERROR_INVALID_PARAM = -2,
+	LIBUSB_ERROR_ACCESS = -3,
+	LIBUSB_ERROR_NO_DEVICE = -4,
+	LIBUSB_ERROR_NOT_FOUND = -5,
+	LIBUSB_ERROR_BUSY = -6,
+	LIBUSB_ERROR_TIMEOUT = -7,
+	LIBUSB_ERROR_OVERFLOW = -8,
+	LIBUSB_ERROR_PIPE = -9,
+	LIBUSB_ERROR_INTERRUPTED = -10,
+	LIBUSB_ERROR_NO_MEM = -11,
+	LIBUSB_ERROR_NOT_SUPPORTED = -12,
+	LIBUSB_ERROR_OTHER = -99,
+};
+
+enum libusb_transfer_status {
+	LIBUSB_TRANSFER_COMPLETED,
+	LIBUSB_TRANSFER_ERROR,
+	LIBUSB_TRANSFER_TIMED_OUT,
+	LIBUSB_TRANSFER_CANCELLED,
+	LIBUSB_TRANSFER_STALL,
+	LIBUSB_TRANSFER_NO_DEVICE,
+	LIBUSB_TRANSFER_OVERFLOW,
+};
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+
+struct libusb_transfer;
+typedef void (*libusb_transfer_cb_fn)(struct libusb_transfer *transfer);
+
+struct libusb_transfer {
+	libusb_device_handle *dev_handle;
+	uint8_t flags;
+	unsigned char endpoint;
+	unsigned char type;
+	unsigned int timeout;
+	enum libusb_transfer_status status;
+	int length;
+	int actual_length;
+	libusb_transfer_cb_fn callback;
+	void *user_data;
+	unsigned char *buffer;
+	int num_iso_packets;
+};
+
+struct libusb_device_descriptor {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint16_t bcdUSB;
+	uint8_t bDeviceClass;
+	uint8_t bDeviceSubClass;
+	uint8_t bDeviceProtocol;
+	uint8_t bMaxPacketSize0;
+	uint16_t idVendor;
+	uint16_t idProduct;
+	uint16_t bcdDevice;
+	uint8_t iManufacturer;
+	uint8_t iProduct;
+	uint8_t iSerialNumber;
+	uint8_t bNumConfigurations;
+};
+
+struct libusb_endpoint_descriptor {
+	uint8_t bEndpointAddress;
+	uint16_t wMaxPacketSize;
+};
+
+struct libusb_interface_descriptor {
+	uint8_t bNumEndpoints;
+	const struct libusb_endpoint_descriptor *endpoint;
+};
+
+struct libusb_interface {
+	const struct libusb_interface_descriptor *altsetting;
+	int num_altsetting;
+};
+
+struct libusb_config_descriptor {
+	uint8_t bNumInterfaces;
+	uint8_t bConfigurationValue;
+	const struct libusb_interface *interface;
+};
+
+static inline void libusb_fill_bulk_transfer(struct libusb_transfer *transfer,
+	libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *buffer,
+	int length, libusb_transfer_cb_fn callback, void *user_data, unsigned int timeout)
+{
+	transfer->dev_handle = dev_handle;
+	transfer->endpoint = endpoint;
+	transfer->timeout = timeout;
+	transfer->buffer = buffer;
+	transfer->length = length;
+	transfer->user_data = user_data;
+	transfer->callback = callback;
+}
+
+int libusb_init(libusb_context **ctx);
+void libusb_exit(libusb_context *ctx);
+const char *libusb_error_name(int errcode);
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list);
+void libusb_free_device_list(libusb_device **list, int unref_devices);
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc);
+int libusb_get_config_descriptor(libusb_device *dev, uint8_t config_index,
+	struct libusb_config_descriptor **config);
+void libusb_free_config_descriptor(struct libusb_config_descriptor *config);
+libusb_device *libusb_get_device(libusb_device_handle *dev_handle);
+uint8_t libusb_get_bus_number(libusb_device *dev);
+int libusb_get_port_numbers(libusb_device *dev, uint8_t *port_numbers, int port_numbers_len);
+
+int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle);
+void libusb_close(libusb_device_handle *dev_handle);
+int libusb_get_configuration(libusb_device_handle *dev, int *config);
+int libusb_set_configuration(libusb_device_handle *dev, int configuration);
+int libusb_claim_interface(libusb_device_handle *dev, int interface_number);
+int libusb_detach_kernel_driver(libusb_device_handle *dev, int interface_number);
+int libusb_get_string_descriptor_ascii(libusb_device_handle *dev, uint8_t desc_index,
+	unsigned char *data, int length);
+int libusb_control_transfer(libusb_device_handle *dev_handle, uint8_t request_type,
+	uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data,
+	uint16_t wLength, unsigned int timeout);
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets);
+void libusb_free_transfer(struct libusb_transfer *transfer);
+int libusb_submit_transfer(struct libusb_transfer *transfer);
+int libusb_cancel_transfer(struct libusb_transfer *transfer);
+int libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv,
+	int *completed);
+
+#endif /* OPENOCD_TESTING_MPSSE_LIBUSB_H */
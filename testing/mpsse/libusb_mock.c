@@ -0,0 +1,491 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/* Emulates one FT2232H in MPSSE mode behind the libusb API. Submitted transfers are completed
+ * from libusb_handle_events_timeout_completed(), one per call: cancelled transfers first, then
+ * writes in submission order, then the read transfer once the device has data for it.
+ * Also provides the few helper functions mpsse.c and binarybuffer.c need, so the test does not
+ * link the rest of OpenOCD. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper/log.h"
+#include "helper/time_support.h"
+#include "libusb.h"
+#include "libusb_mock.h"
+
+int debug_level = LOG_LVL_WARNING;
+
+void log_printf_lf(enum log_levels level, const char *file, unsigned line,
+	const char *function, const char *format, ...)
+{
+	va_list ap;
+
+	if (level > debug_level)
+		return;
+	fprintf(stderr, "%s:%u %s(): ", file, line, function);
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+void keep_alive(void)
+{
+}
+
+int64_t timeval_ms(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+#define MAX_PENDING 16
+
+struct mock_state mock;
+
+struct libusb_context {
+	int unused;
+};
+
+struct libusb_device {
+	int unused;
+};
+
+struct libusb_device_handle {
+	libusb_device *dev;
+};
+
+static libusb_context usb_ctx;
+static libusb_device usb_dev;
+static libusb_device_handle usb_handle = { .dev = &usb_dev };
+
+static const struct libusb_endpoint_descriptor endpoints[] = {
+	{ .bEndpointAddress = 0x81, .wMaxPacketSize = MOCK_PACKET_SIZE },
+	{ .bEndpointAddress = 0x02, .wMaxPacketSize = MOCK_PACKET_SIZE },
+};
+
+static const struct libusb_interface_descriptor altsetting = {
+	.bNumEndpoints = 2,
+	.endpoint = endpoints,
+};
+
+static const struct libusb_interface interfaces[] = {
+	{ .altsetting = &altsetting, .num_altsetting = 1 },
+	{ .altsetting = &altsetting, .num_altsetting = 1 },
+};
+
+static struct libusb_config_descriptor config = {
+	.bNumInterfaces = 2,
+	.bConfigurationValue = 1,
+	.interface = interfaces,
+};
+
+static struct {
+	struct libusb_transfer *transfer;
+	bool cancelled;
+} pending[MAX_PENDING];
+static unsigned num_pending;
+
+/* Data the device has produced for the host, not yet returned by a read transfer */
+static uint8_t *in_data;
+static size_t in_head;
+static size_t in_len;
+static size_t in_cap;
+
+/* Offset in mock.out of the first command not executed yet */
+static size_t parse_pos;
+static uint8_t next_tdo;
+
+static void *grow(void *buf, size_t *cap, size_t needed)
+{
+	if (needed <= *cap)
+		return buf;
+	while (*cap < needed)
+		*cap = *cap ? *cap * 2 : 4096;
+	buf = realloc(buf, *cap);
+	if (!buf) {
+		fprintf(stderr, "mock: out of memory\n");
+		abort();
+	}
+	return buf;
+}
+
+static void device_reply(uint8_t data)
+{
+	in_data = grow(in_data, &in_cap, in_len + 1);
+	in_data[in_len++] = data;
+}
+
+/* Executes the command at parse_pos, if all of it has been received */
+static bool device_execute(void)
+{
+	const uint8_t *cmd = mock.out + parse_pos;
+	size_t avail = mock.out_len - parse_pos;
+
+	if (avail < 1)
+		return false;
+
+	uint8_t op = cmd[0];
+
+	if (op & 0x80) {
+		switch (op) {
+			case 0x80:
+			case 0x82:
+			case 0x86:
+				if (avail < 3)
+					return false;
+				parse_pos += 3;
+				return true;
+			case 0x81:
+				device_reply(mock.gpio_low);
+				break;
+			case 0x83:
+				device_reply(mock.gpio_high);
+				break;
+			case 0x84:
+			case 0x85:
+			case 0x87:
+			case 0x8a:
+			case 0x8b:
+			case 0x96:
+			case 0x97:
+				break;
+			default:
+				fprintf(stderr, "mock: bad command 0x%02x\n", op);
+				mock.protocol_error = true;
+				device_reply(0xfa);
+				device_reply(op);
+				break;
+		}
+		parse_pos += 1;
+		return true;
+	}
+
+	bool write_tdi = op & 0x10;
+	bool read_tdo = op & 0x20;
+
+	if (op & 0x40) {
+		/* TMS shift, TDI is held at bit 7 of the data byte */
+		if (avail < 3)
+			return false;
+		unsigned bits = cmd[1] + 1;
+		if (read_tdo)
+			device_reply(cmd[2] & 0x80 ? (0xff << (8 - bits)) & 0xff : 0x00);
+		parse_pos += 3;
+		return true;
+	}
+
+	if (op & 0x02) {
+		/* Bit mode. TDO is shifted in from the top, so the first bit ends up at 8 - bits. */
+		if (avail < 2u + write_tdi)
+			return false;
+		unsigned bits = cmd[1] + 1;
+		if (read_tdo)
+			device_reply(write_tdi ? (cmd[2] << (8 - bits)) & 0xff
+					: (next_tdo++ << (8 - bits)) & 0xff);
+		parse_pos += 2 + write_tdi;
+		return true;
+	}
+
+	/* Byte mode */
+	if (avail < 3)
+		return false;
+	size_t bytes = (cmd[1] | cmd[2] << 8) + 1;
+	if (write_tdi && avail < 3 + bytes)
+		return false;
+	if (read_tdo)
+		for (size_t i = 0; i < bytes; i++)
+			device_reply(write_tdi ? cmd[3 + i] : next_tdo++);
+	parse_pos += 3 + (write_tdi ? bytes : 0);
+	return true;
+}
+
+static void complete(unsigned index, enum libusb_transfer_status status, int actual_length)
+{
+	struct libusb_transfer *transfer = pending[index].transfer;
+
+	memmove(&pending[index], &pending[index + 1], (num_pending - index - 1) * sizeof(pending[0]));
+	num_pending--;
+
+	transfer->status = status;
+	transfer->actual_length = actual_length;
+	transfer->callback(transfer);
+}
+
+static void complete_write(unsigned index)
+{
+	struct libusb_transfer *transfer = pending[index].transfer;
+
+	if (mock.fail_next_write) {
+		mock.fail_next_write = false;
+		complete(index, LIBUSB_TRANSFER_ERROR, 0);
+		return;
+	}
+
+	size_t length = transfer->length;
+	if (mock.short_write && mock.short_write < length)
+		length = mock.short_write;
+	mock.short_write = 0;
+
+	mock.out = grow(mock.out, &mock.out_cap, mock.out_len + length);
+	memcpy(mock.out + mock.out_len, transfer->buffer, length);
+	mock.out_len += length;
+	while (device_execute())
+		;
+
+	mock.write_transfers++;
+	complete(index, LIBUSB_TRANSFER_COMPLETED, length);
+}
+
+static void complete_read(unsigned index)
+{
+	struct libusb_transfer *transfer = pending[index].transfer;
+	size_t limit = transfer->length;
+	size_t pos = 0;
+
+	if (mock.read_limit && mock.read_limit < limit)
+		limit = mock.read_limit;
+
+	/* A packet shorter than the maximum ends the transfer */
+	while (in_head < in_len && pos + 2 < limit) {
+		size_t size = MOCK_PACKET_SIZE - 2;
+		if (size > in_len - in_head)
+			size = in_len - in_head;
+		if (size > limit - pos - 2)
+			size = limit - pos - 2;
+		transfer->buffer[pos++] = 0x32;
+		transfer->buffer[pos++] = 0x60;
+		memcpy(transfer->buffer + pos, in_data + in_head, size);
+		in_head += size;
+		pos += size;
+		if (size < MOCK_PACKET_SIZE - 2)
+			break;
+	}
+
+	mock.read_transfers++;
+	complete(index, LIBUSB_TRANSFER_COMPLETED, pos);
+}
+
+void mock_reset(void)
+{
+	free(mock.out);
+	memset(&mock, 0, sizeof(mock));
+	mock.gpio_low = 0xa5;
+	mock.gpio_high = 0x3c;
+	parse_pos = 0;
+	in_head = 0;
+	in_len = 0;
+	next_tdo = 0;
+}
+
+int libusb_init(libusb_context **ctx)
+{
+	*ctx = &usb_ctx;
+	return LIBUSB_SUCCESS;
+}
+
+void libusb_exit(libusb_context *ctx)
+{
+}
+
+const char *libusb_error_name(int errcode)
+{
+	static char name[32];
+	snprintf(name, sizeof(name), "LIBUSB_ERROR(%d)", errcode);
+	return name;
+}
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+	static libusb_device *devices[] = { &usb_dev, NULL };
+	*list = devices;
+	return 1;
+}
+
+void libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+}
+
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->idVendor = 0x0403;
+	desc->idProduct = 0x6010;
+	desc->bcdDevice = 0x0700;
+	desc->iProduct = 2;
+	desc->iSerialNumber = 3;
+	desc->bNumConfigurations = 1;
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_get_config_descriptor(libusb_device *dev, uint8_t config_index,
+	struct libusb_config_descriptor **config_out)
+{
+	*config_out = &config;
+	return LIBUSB_SUCCESS;
+}
+
+void libusb_free_config_descriptor(struct libusb_config_descriptor *config_in)
+{
+}
+
+libusb_device *libusb_get_device(libusb_device_handle *dev_handle)
+{
+	return dev_handle->dev;
+}
+
+uint8_t libusb_get_bus_number(libusb_device *dev)
+{
+	return 1;
+}
+
+int libusb_get_port_numbers(libusb_device *dev, uint8_t *port_numbers, int port_numbers_len)
+{
+	port_numbers[0] = 1;
+	return 1;
+}
+
+int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle)
+{
+	*dev_handle = &usb_handle;
+	return LIBUSB_SUCCESS;
+}
+
+void libusb_close(libusb_device_handle *dev_handle)
+{
+}
+
+int libusb_get_configuration(libusb_device_handle *dev, int *cfg)
+{
+	*cfg = 1;
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_set_configuration(libusb_device_handle *dev, int configuration)
+{
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_claim_interface(libusb_device_handle *dev, int interface_number)
+{
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_detach_kernel_driver(libusb_device_handle *dev, int interface_number)
+{
+	return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int libusb_get_string_descriptor_ascii(libusb_device_handle *dev, uint8_t desc_index,
+	unsigned char *data, int length)
+{
+	const char *str = desc_index == 2 ? "Dual RS232-HS" : "FT000001";
+	snprintf((char *)data, length, "%s", str);
+	return strlen((char *)data);
+}
+
+int libusb_control_transfer(libusb_device_handle *dev_handle, uint8_t request_type,
+	uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data,
+	uint16_t wLength, unsigned int timeout)
+{
+	mock.control_transfers++;
+
+	/* SIO_RESET_REQUEST drops whatever the device holds in either direction */
+	if (bRequest == 0) {
+		parse_pos = mock.out_len;
+		in_head = in_len;
+	}
+	return 0;
+}
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets)
+{
+	return calloc(1, sizeof(struct libusb_transfer));
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer)
+{
+	free(transfer);
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	if (num_pending == MAX_PENDING)
+		return LIBUSB_ERROR_BUSY;
+
+	pending[num_pending].transfer = transfer;
+	pending[num_pending].cancelled = false;
+	num_pending++;
+
+	unsigned writes = 0;
+	for (unsigned i = 0; i < num_pending; i++)
+		if (!(pending[i].transfer->endpoint & 0x80))
+			writes++;
+	if (writes > mock.max_writes_queued)
+		mock.max_writes_queued = writes;
+
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+	for (unsigned i = 0; i < num_pending; i++) {
+		if (pending[i].transfer == transfer) {
+			pending[i].cancelled = true;
+			return LIBUSB_SUCCESS;
+		}
+	}
+	return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv,
+	int *completed)
+{
+	for (unsigned i = 0; i < num_pending; i++) {
+		if (pending[i].cancelled) {
+			complete(i, LIBUSB_TRANSFER_CANCELLED, 0);
+			return LIBUSB_SUCCESS;
+		}
+	}
+
+	for (unsigned i = 0; i < num_pending; i++) {
+		if (!(pending[i].transfer->endpoint & 0x80)) {
+			complete_write(i);
+			return LIBUSB_SUCCESS;
+		}
+	}
+
+	for (unsigned i = 0; i < num_pending; i++) {
+		if (in_head < in_len) {
+			complete_read(i);
+			return LIBUSB_SUCCESS;
+		}
+	}
+
+	/* A real device would keep returning status-only packets here, so the host would wait
+	 * forever for data that was never requested */
+	fprintf(stderr, "mock: no transfer can make progress\n");
+	return LIBUSB_ERROR_TIMEOUT;
+}
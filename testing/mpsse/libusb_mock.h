@@ -0,0 +1,54 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TESTING_MPSSE_LIBUSB_MOCK_H
+#define OPENOCD_TESTING_MPSSE_LIBUSB_MOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Max packet size of the emulated IN endpoint. Every packet starts with two modem status bytes. */
+#define MOCK_PACKET_SIZE 64
+
+/* The emulated device runs in loopback mode: TDO follows TDI. Shifts that only read return
+ * consecutive byte values, starting at 0 after mock_reset(), bit mode keeping the low bits,
+ * and the GPIO read commands return gpio_low/gpio_high. */
+struct mock_state {
+	/* Knobs set by the test */
+	unsigned short_write;	/* accept only this many bytes of the next write, 0 to accept all */
+	bool fail_next_write;	/* complete the next write with an error, without consuming it */
+	unsigned read_limit;	/* most bytes returned by one read transfer, 0 for the transfer length */
+	uint8_t gpio_low;
+	uint8_t gpio_high;
+
+	/* Observations */
+	uint8_t *out;		/* every byte accepted on the OUT endpoint, in order */
+	size_t out_len;
+	size_t out_cap;
+	unsigned write_transfers;	/* completed write transfers */
+	unsigned read_transfers;	/* completed read transfers */
+	unsigned max_writes_queued;	/* most write transfers submitted at the same time */
+	unsigned control_transfers;
+	bool protocol_error;	/* an unknown MPSSE command was seen */
+};
+
+extern struct mock_state mock;
+
+/* Forget everything observed so far and restore the default knobs. Data the emulated device
+ * still holds for the host is dropped, as a purge would. */
+void mock_reset(void);
+
+#endif /* OPENOCD_TESTING_MPSSE_LIBUSB_MOCK_H */
@@ -0,0 +1,246 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/* Runs the MPSSE command queue against libusb_mock.c and checks the command stream the device
+ * receives and the data read back through the ring of command buffers. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "jtag/drivers/mpsse.h"
+#include "helper/log.h"
+#include "libusb_mock.h"
+
+static int failures;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static bool out_equals(const uint8_t *expected, size_t len)
+{
+	return mock.out_len == len && memcmp(mock.out, expected, len) == 0;
+}
+
+static bool bit_at(const uint8_t *buf, unsigned bit)
+{
+	return buf[bit / 8] & (1 << (bit % 8));
+}
+
+static void fill_pattern(uint8_t *buf, size_t len, uint32_t seed)
+{
+	for (size_t i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+/* Commands without read data go out as they are, without SEND_IMMEDIATE */
+static void test_command_stream(struct mpsse_ctx *ctx)
+{
+	static const uint8_t expected[] = { 0x80, 0x08, 0x0b, 0x86, 0x05, 0x00, 0x84 };
+
+	mock_reset();
+	mpsse_set_data_bits_low_byte(ctx, 0x08, 0x0b);
+	mpsse_set_divisor(ctx, 5);
+	mpsse_loopback_config(ctx, true);
+	CHECK(mpsse_flush(ctx) == ERROR_OK);
+
+	CHECK(out_equals(expected, sizeof(expected)));
+	CHECK(mock.write_transfers == 1);
+	CHECK(mock.read_transfers == 0);
+}
+
+/* A scan that is not a multiple of 8 bits is split into a byte and a bit mode command */
+static void test_short_scan(struct mpsse_ctx *ctx)
+{
+	static const uint8_t out[5] = { 0x5a, 0xc3, 0x96, 0x0f, 0x15 };
+	static const uint8_t expected[] = {
+		0x39, 0x03, 0x00, 0x5a, 0xc3, 0x96, 0x0f,
+		0x3b, 0x04, 0x15,
+		0x87,
+	};
+	uint8_t in[5] = { 0 };
+
+	mock_reset();
+	mpsse_clock_data(ctx, out, 0, in, 0, 37, LSB_FIRST | NEG_EDGE_OUT);
+	CHECK(mpsse_flush(ctx) == ERROR_OK);
+
+	CHECK(mock.out_len == sizeof(expected));
+	CHECK(memcmp(mock.out, expected, 9) == 0);
+	CHECK((mock.out[9] & 0x1f) == expected[9] && mock.out[10] == expected[10]);
+	CHECK(memcmp(in, out, 4) == 0 && in[4] == (out[4] & 0x1f));
+}
+
+/* A long scan fills several command buffers, keeps more than one of them in flight and has its
+ * read data spread over read transfers that do not line up with the buffers */
+static void test_long_scan(struct mpsse_ctx *ctx)
+{
+	const unsigned bits = 8 * 200000 + 5;
+	const unsigned out_offset = 5;
+	const unsigned in_offset = 3;
+	uint8_t *out = malloc(DIV_ROUND_UP(bits + out_offset, 8));
+	uint8_t *in = calloc(1, DIV_ROUND_UP(bits + in_offset, 8));
+
+	fill_pattern(out, DIV_ROUND_UP(bits + out_offset, 8), 1);
+	in[0] = 0x07;
+
+	mock_reset();
+	mock.read_limit = 1000;
+	mpsse_clock_data(ctx, out, out_offset, in, in_offset, bits, LSB_FIRST | NEG_EDGE_OUT);
+	CHECK(mpsse_flush(ctx) == ERROR_OK);
+
+	CHECK(!mock.protocol_error);
+	CHECK(mock.write_transfers > 4);
+	CHECK(mock.max_writes_queued > 1);
+	CHECK((in[0] & 0x07) == 0x07);
+
+	unsigned mismatches = 0;
+	for (unsigned i = 0; i < bits; i++)
+		if (bit_at(in, in_offset + i) != bit_at(out, out_offset + i))
+			mismatches++;
+	CHECK(mismatches == 0);
+
+	free(out);
+	free(in);
+}
+
+/* Many small reads of different kinds, enough to span several buffers */
+static void test_mixed_reads(struct mpsse_ctx *ctx)
+{
+	const unsigned count = 5000;
+	static const uint8_t tms = 0x0a;
+	uint8_t *gpio = calloc(count, 1);
+	uint8_t *data = calloc(count, 2);
+	uint8_t *tdo = calloc(count, 1);
+
+	mock_reset();
+	mock.read_limit = 300;
+	for (unsigned i = 0; i < count; i++) {
+		mpsse_read_data_bits_low_byte(ctx, &gpio[i]);
+		mpsse_clock_data_in(ctx, &data[2 * i], 0, 11, LSB_FIRST | POS_EDGE_IN);
+		mpsse_clock_tms_cs(ctx, &tms, 0, &tdo[i], 0, 5, true, NEG_EDGE_OUT);
+	}
+	CHECK(mpsse_flush(ctx) == ERROR_OK);
+
+	CHECK(!mock.protocol_error);
+	CHECK(mock.write_transfers > 1);
+
+	unsigned mismatches = 0;
+	for (unsigned i = 0; i < count; i++) {
+		uint8_t first = 2 * i;
+		uint32_t expected = first | ((first + 1) & 0x07) << 8;
+		if (gpio[i] != 0xa5 || buf_get_u32(&data[2 * i], 0, 11) != expected || tdo[i] != 0x1f)
+			mismatches++;
+	}
+	CHECK(mismatches == 0);
+
+	free(gpio);
+	free(data);
+	free(tdo);
+}
+
+/* The remainder of a short write is sent again, in order */
+static void test_short_write(struct mpsse_ctx *ctx)
+{
+	static const uint8_t expected[] = { 0x80, 0x01, 0x02, 0x82, 0x03, 0x04, 0x80, 0x05, 0x06 };
+
+	mock_reset();
+	mock.short_write = 4;
+	mpsse_set_data_bits_low_byte(ctx, 0x01, 0x02);
+	mpsse_set_data_bits_high_byte(ctx, 0x03, 0x04);
+	mpsse_set_data_bits_low_byte(ctx, 0x05, 0x06);
+	CHECK(mpsse_flush(ctx) == ERROR_OK);
+
+	CHECK(out_equals(expected, sizeof(expected)));
+	CHECK(mock.write_transfers == 2);
+}
+
+/* The remainder of a short write can not be sent again once newer buffers are queued behind it,
+ * since that would reorder the command stream, so the flush fails instead */
+static void test_short_write_behind(struct mpsse_ctx *ctx)
+{
+	const unsigned bytes = 100000;
+	uint8_t *out = malloc(bytes);
+	uint8_t *in = calloc(1, bytes);
+
+	fill_pattern(out, bytes, 2);
+
+	mock_reset();
+	mock.short_write = 100;
+	debug_level = LOG_LVL_SILENT;
+	mpsse_clock_data(ctx, out, 0, in, 0, bytes * 8, LSB_FIRST | NEG_EDGE_OUT);
+	CHECK(mpsse_flush(ctx) != ERROR_OK);
+	debug_level = LOG_LVL_WARNING;
+	CHECK(!mock.protocol_error);
+
+	free(out);
+	free(in);
+}
+
+/* A failed write fails the flush and leaves the queue usable afterwards */
+static void test_write_error(struct mpsse_ctx *ctx)
+{
+	static const uint8_t out[4] = { 0x12, 0x34, 0x56, 0x78 };
+	uint8_t in[4] = { 0 };
+
+	mock_reset();
+	mock.fail_next_write = true;
+	debug_level = LOG_LVL_SILENT;
+	mpsse_clock_data(ctx, out, 0, in, 0, 32, LSB_FIRST | NEG_EDGE_OUT);
+	CHECK(mpsse_flush(ctx) != ERROR_OK);
+	debug_level = LOG_LVL_WARNING;
+
+	mock_reset();
+	mpsse_clock_data(ctx, out, 0, in, 0, 32, LSB_FIRST | NEG_EDGE_OUT);
+	CHECK(mpsse_flush(ctx) == ERROR_OK);
+	CHECK(memcmp(in, out, sizeof(out)) == 0);
+}
+
+int main(void)
+{
+	const uint16_t vid = 0x0403;
+	const uint16_t pid = 0x6010;
+
+	mock_reset();
+	struct mpsse_ctx *ctx = mpsse_open(&vid, &pid, "Dual RS232-HS", NULL, NULL, 0);
+	if (!ctx) {
+		fprintf(stderr, "mpsse_open() failed\n");
+		return 1;
+	}
+
+	test_command_stream(ctx);
+	test_short_scan(ctx);
+	test_long_scan(ctx);
+	test_mixed_reads(ctx);
+	test_short_write(ctx);
+	test_short_write_behind(ctx);
+	test_write_error(ctx);
+
+	mpsse_close(ctx);
+	mock_reset();
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("mpsse: all tests passed\n");
+	return 0;
+}